@@ -0,0 +1,15 @@
+import os
+import sys
+
+Import("env")
+
+sys.path.insert(0, os.path.join(env.subst("$PROJECT_DIR"), "tools"))
+import ram_report
+
+def report_ram(source, target, env):
+    # Fails the build when a region is over the env's custom_ram_budget
+    budget = env.GetProjectOption("custom_ram_budget", "")
+    ok = ram_report.report(str(target[0]), [budget] if budget else None)
+    return 0 if ok else 1
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", report_ram)
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "codes.h"
+#include "doublebuf.h"
+#include "filter.h"
+#include "platform.h"
+
+#define FAULT_PIN_NONE      0xFF
+#define FAULT_BLINK_HALF_US 125000 // 4 Hz
+
+// Readers of the config, each interruptible by the next
+enum FaultAlarmReader: uint8_t {
+    FAULT_READER_SERVICE = 0,
+    FAULT_READER_CHECK = 1,
+    FAULT_READER_COUNT,
+};
+
+enum FaultAlarmMode: uint8_t {
+    FAULT_MODE_ACTIVE_LOW = 0x01,
+    FAULT_MODE_BLINK = 0x02,
+};
+
+typedef struct {
+    CodeIntervalTable faults;
+    uint32_t holdUs; // 0 = stays on until acknowledged
+    uint8_t pin;
+    uint8_t mode;    // FaultAlarmMode bits
+} FaultAlarmConfig;
+
+// Drives a GPIO (stack light, LED) straight from the capture path as soon
+// as a code in one of the CODE_RULE_FAULT ranges arrives, so it reacts
+// within microseconds of the I2C write - regardless of what core0's queue,
+// serial and display are doing. Turning it off after the hold time,
+// blinking and acknowledging are left to service(), which core1 calls
+// every loop.
+class FaultAlarm {
+public:
+    // core0. The fault ranges come from the shared code rule table.
+    void configure(const CodeRule *rules, uint8_t ruleCount, uint8_t pin, uint8_t mode, uint16_t holdMs) {
+        uint8_t oldPin = configs.current().pin;
+
+        FaultAlarmConfig &config = configs.edit();
+        config.faults.clear();
+        for (uint8_t i = 0; i < ruleCount; i++) {
+            if (rules[i].kind == CODE_RULE_FAULT) {
+                config.faults.add(rules[i].first, rules[i].last, rules[i].flavors);
+            }
+        }
+        config.holdUs = (uint32_t)holdMs * 1000;
+        config.pin = pin;
+        config.mode = mode;
+
+        if (pin != FAULT_PIN_NONE) {
+            pinMode(pin, OUTPUT);
+            platformGpioWrite(pin, mode & FAULT_MODE_ACTIVE_LOW);
+        }
+        configs.publish();
+        if (oldPin != FAULT_PIN_NONE && oldPin != pin) {
+            pinMode(oldPin, INPUT);
+        }
+    }
+
+    // Capture path: called for every code, before the capture filter
+    inline void CAPTURE_FUNC(check)(CodeFlavor flavor, uint64_t code, uint32_t nowUs) {
+        const FaultAlarmConfig &config = configs.acquire(FAULT_READER_CHECK);
+        if (config.pin == FAULT_PIN_NONE || !config.faults.contains(flavorBit(flavor), code)) {
+            configs.release(FAULT_READER_CHECK);
+            return;
+        }
+        platformGpioWrite(config.pin, !(config.mode & FAULT_MODE_ACTIVE_LOW));
+        configs.release(FAULT_READER_CHECK);
+        tripUs = nowUs;
+        lastFlavor = flavor;
+        lastCode = code;
+        trips = trips + 1;
+        raised = true;
+    }
+
+    // core1 (or whatever runs loop1())
+    void service(uint32_t nowUs) {
+        if (ackSeen != ackRequests) {
+            ackSeen = ackRequests;
+            raised = false;
+        }
+        if (testSeen != testRequests) {
+            testSeen = testRequests;
+            tripUs = nowUs;
+            raised = true;
+            heldOut = false;
+        }
+
+        const FaultAlarmConfig &config = configs.acquire(FAULT_READER_SERVICE);
+        // Once the hold is over the trip is done with, so the 32-bit time
+        // since it can't wrap around and light it again. `trips` is read
+        // before `tripUs`: a trip landing in between looks recent, not old.
+        if (config.holdUs > 0 && raised && !isHeldOut()) {
+            uint32_t trip = trips;
+            if (nowUs - tripUs >= config.holdUs) {
+                heldOutTrip = trip;
+                heldOut = true;
+            }
+        }
+        if (config.pin != FAULT_PIN_NONE) {
+            platformGpioWrite(config.pin, isLit(config, nowUs) != (bool)(config.mode & FAULT_MODE_ACTIVE_LOW));
+        }
+        configs.release(FAULT_READER_SERVICE);
+    }
+
+    // core0: requests for core1, picked up by its next service()
+    void acknowledge() { ackRequests = ackRequests + 1; }
+    void test() { testRequests = testRequests + 1; }
+
+    bool isRaised() const { return raised && !isHeldOut(); }
+    // core0, the thread that calls configure()
+    bool isLit(uint32_t nowUs) const { return isLit(configs.current(), nowUs); }
+    uint32_t getTrips() const { return trips; }
+    CodeFlavor getLastFlavor() const { return lastFlavor; }
+    uint64_t getLastCode() const { return lastCode; }
+
+private:
+    DoubleBuffer<FaultAlarmConfig, FAULT_READER_COUNT> configs{FaultAlarmConfig{ {}, 0, FAULT_PIN_NONE, 0 }};
+
+    // Written from the capture path
+    volatile uint32_t tripUs = 0;
+    volatile uint32_t trips = 0;
+    volatile uint64_t lastCode = 0;
+    volatile CodeFlavor lastFlavor = (CodeFlavor)0;
+    volatile bool raised = false; // tripped and not acknowledged yet
+
+    // Single-writer request counters, core0 -> core1
+    volatile uint8_t ackRequests = 0;
+    volatile uint8_t testRequests = 0;
+    uint8_t ackSeen = 0;
+    uint8_t testSeen = 0;
+
+    // service() only: the trip whose hold ran out. Kept apart from `raised`,
+    // which the capture path sets, so a trip arriving meanwhile isn't lost.
+    volatile uint32_t heldOutTrip = 0;
+    volatile bool heldOut = false;
+
+    bool isHeldOut() const { return heldOut && heldOutTrip == trips; }
+
+    bool isLit(const FaultAlarmConfig &config, uint32_t nowUs) const {
+        uint32_t sinceUs = nowUs - tripUs;
+        if (!raised || isHeldOut() || (config.holdUs > 0 && sinceUs >= config.holdUs)) {
+            return false;
+        }
+        return !(config.mode & FAULT_MODE_BLINK) || ((sinceUs / FAULT_BLINK_HALF_US) & 1) == 0;
+    }
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "platform.h"
+
+// Compile-time traits of the board being built for. platform.h says how
+// each framework does things; this says what the board has, so buffer sizes
+// and implementations are chosen by the compiler instead of branched on at
+// runtime. Preprocessor code uses the BOARD_ macros, everything else the
+// Board constants.
+//
+// Build flags (platformio.ini):
+// - BOARD_HEADLESS=1: the board has no OLED. U8g2 and the drawing code are
+//   left out of the build, and Display turns into a class that does nothing.
+
+#ifndef BOARD_HEADLESS
+#define BOARD_HEADLESS 0
+#endif
+#define BOARD_HAS_DISPLAY (!BOARD_HEADLESS)
+
+// Capture queues and history buffers grow with the RAM: 1x below 256 KB,
+// 2x below 512 KB, 4x from there
+#define BOARD_BUFFER_SCALE (PLATFORM_RAM_KB >= 512 ? 4 : PLATFORM_RAM_KB >= 256 ? 2 : 1)
+
+struct Board {
+    static constexpr uint8_t coreCount = PLATFORM_CORE_COUNT;
+    static constexpr bool hasFpu = PLATFORM_HAS_FPU;
+    static constexpr uint16_t ramKb = PLATFORM_RAM_KB;
+    static constexpr bool canRemapI2c = PLATFORM_CAN_REMAP_I2C;
+    static constexpr bool hasDisplay = BOARD_HAS_DISPLAY;
+    static constexpr bool hasSampler = PLATFORM_HAS_SAMPLER;
+    static constexpr uint8_t bufferScale = BOARD_BUFFER_SCALE;
+};
+
+static_assert((Board::bufferScale & (Board::bufferScale - 1)) == 0, "Buffer sizes must stay powers of two");
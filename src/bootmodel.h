@@ -0,0 +1,447 @@
+#pragma once
+
+#include <Arduino.h>
+#include "board.h"
+#include "codes.h"
+
+#define BOOT_MODEL_VERSION         2
+#define BOOT_MODEL_MAX_CHECKPOINTS 32
+#define BOOT_MODEL_INDEX_SLOTS     64 // power of two, > BOOT_MODEL_MAX_CHECKPOINTS
+#define BOOT_MODEL_MIN_CODES       4  // shorter boots aren't learned from
+#define BOOT_MODEL_STALL_FACTOR    3  // a step taking this many times longer than expected is a stall
+#define BOOT_MODEL_MIN_STALL_MS    3000
+#define BOOT_MODEL_CONSOLES        4  // consoles a model is kept for
+#define BOOT_MODEL_KEY_CODES       BOOT_MODEL_MIN_CODES // opening codes that tell consoles apart
+#define BOOT_MODEL_SAVE_BOOTS      8  // refined timings are saved once per this many boots
+
+typedef struct {
+    uint64_t code;
+    uint32_t offsetMs; // from boot start
+    CodeFlavor flavor;
+} BootCheckpoint;
+
+typedef struct {
+    uint8_t percent;
+    uint32_t etaMs;
+    bool stalled;
+    bool done;
+} BootEstimate;
+
+// Checkpoints in the order they were first reached, with a small hash
+// index so looking a code up is O(1).
+class CheckpointList {
+public:
+    void clear() {
+        count = 0;
+        memset(index, 0xFF, sizeof(index));
+    }
+
+    int8_t find(CodeFlavor flavor, uint64_t code) const {
+        uint8_t slot = hash(flavor, code);
+        while (index[slot] != 0xFF) {
+            const BootCheckpoint &cp = items[index[slot]];
+            if (cp.code == code && cp.flavor == flavor) {
+                return index[slot];
+            }
+            slot = (slot + 1) & (BOOT_MODEL_INDEX_SLOTS - 1);
+        }
+        return -1;
+    }
+
+    // Appends a checkpoint unless it's already there (or the list is full)
+    bool add(CodeFlavor flavor, uint64_t code, uint32_t offsetMs) {
+        if (count == BOOT_MODEL_MAX_CHECKPOINTS || find(flavor, code) >= 0) {
+            return false;
+        }
+        uint8_t slot = hash(flavor, code);
+        while (index[slot] != 0xFF) {
+            slot = (slot + 1) & (BOOT_MODEL_INDEX_SLOTS - 1);
+        }
+        index[slot] = count;
+        items[count++] = BootCheckpoint{ code, offsetMs, flavor };
+        return true;
+    }
+
+    uint8_t size() const { return count; }
+    const BootCheckpoint &operator[](uint8_t i) const { return items[i]; }
+    BootCheckpoint &operator[](uint8_t i) { return items[i]; }
+    uint32_t lastOffsetMs() const { return count ? items[count - 1].offsetMs : 0; }
+
+private:
+    BootCheckpoint items[BOOT_MODEL_MAX_CHECKPOINTS];
+    uint8_t index[BOOT_MODEL_INDEX_SLOTS];
+    uint8_t count = 0;
+
+    static uint8_t hash(CodeFlavor flavor, uint64_t code) {
+        uint32_t h = (uint32_t)code ^ (uint32_t)(code >> 32) ^ ((uint32_t)flavor << 24);
+        return (uint8_t)((h * 2654435761u) >> 24) & (BOOT_MODEL_INDEX_SLOTS - 1);
+    }
+};
+
+// What has been learned about one console
+typedef struct {
+    uint32_t key;          // hash of its opening codes, 0 = slot unused
+    CheckpointList checkpoints;
+    uint16_t learnedBoots;
+    uint32_t lastUsed;     // for replacing the least recently seen console
+} ConsoleModel;
+
+// Learned models of a console's boot: the codes it passes through, in
+// order, and the typical time from boot start to each. A reader on a bench
+// gets moved between consoles, so a model is kept per console, told apart
+// by the first BOOT_MODEL_KEY_CODES codes of its boot (which differ between
+// console revisions and firmware). Until those have come in, a boot has no
+// model to be compared against.
+//
+// Every boot that gets as far as its model's last checkpoint pulls the
+// model's timings towards its own (EWMA, 1/4 weight). A boot that runs
+// clearly further than the model replaces it, so a model learned from a
+// failing first boot doesn't stick. A new or replaced model is saved
+// straight away; refined timings only every BOOT_MODEL_SAVE_BOOTS boots,
+// so a bench cycling consoles doesn't write a journal page per boot.
+//
+// While a boot is running, the furthest checkpoint reached gives progress
+// and an ETA, scaled by how fast this boot has been so far.
+class BootModel {
+public:
+    BootModel() {
+        clear();
+        trace.clear();
+    }
+
+    void clear() {
+        for (ConsoleModel &console : consoles) {
+            console.key = 0;
+            console.checkpoints.clear();
+            console.learnedBoots = 0;
+            console.lastUsed = 0;
+        }
+        active = -1;
+        current = -1;
+        unsavedBoots = 0;
+    }
+
+    const ConsoleModel &console(uint8_t i) const { return consoles[i]; }
+    // The console the running boot was recognised as, -1 if none (yet)
+    int8_t activeConsole() const { return active; }
+
+    void beginBoot(uint64_t startUs) {
+        bootStartUs = startUs;
+        reachedUs = startUs;
+        current = -1;
+        active = -1;
+        bootKey = 0;
+        inBoot = true;
+        trace.clear();
+    }
+
+    // O(1): two hash lookups, plus one pass over the opening codes when
+    // they identify the console
+    void onCode(const SegmentData &seg) {
+        if (!inBoot) {
+            beginBoot(seg.timestamp);
+        }
+        uint32_t offsetMs = (uint32_t)((seg.timestamp - bootStartUs) / 1000);
+        bool added = trace.add(seg.flavor, seg.code, offsetMs);
+
+        if (bootKey == 0) {
+            if (added && trace.size() == BOOT_MODEL_KEY_CODES) {
+                identify();
+            }
+            return;
+        }
+        if (active < 0) {
+            return;
+        }
+        int8_t idx = consoles[active].checkpoints.find(seg.flavor, seg.code);
+        if (idx > current) {
+            current = idx;
+            reachedUs = seg.timestamp;
+        }
+    }
+
+    // Learns from the boot that just ended. Returns true if the models
+    // should be saved now.
+    bool endBoot() {
+        if (!inBoot) {
+            return false;
+        }
+        inBoot = false;
+        if (bootKey == 0 || trace.size() < BOOT_MODEL_MIN_CODES) {
+            return false;
+        }
+
+        if (active < 0) {
+            active = leastRecentlyUsed();
+            consoles[active].key = bootKey;
+            consoles[active].checkpoints.clear();
+        }
+        ConsoleModel &console = consoles[active];
+        console.lastUsed = ++useClock;
+        CheckpointList &model = console.checkpoints;
+
+        bool hasModel = model.size() > 0;
+        bool reachedEnd = hasModel && trace.find(model[model.size() - 1].flavor, model[model.size() - 1].code) >= 0;
+        bool ranFurther = trace.size() > model.size() && trace.lastOffsetMs() > model.lastOffsetMs() + model.lastOffsetMs() / 2;
+        if (!hasModel || (!reachedEnd && ranFurther)) {
+            model = trace;
+            console.learnedBoots = 1;
+            unsavedBoots = 0;
+            return true;
+        }
+        if (!reachedEnd) {
+            return false;
+        }
+
+        for (uint8_t i = 0; i < model.size(); i++) {
+            int8_t j = trace.find(model[i].flavor, model[i].code);
+            if (j >= 0) {
+                model[i].offsetMs = (uint32_t)(((uint64_t)model[i].offsetMs * 3 + trace[j].offsetMs) / 4);
+            }
+        }
+        if (console.learnedBoots < UINT16_MAX) {
+            console.learnedBoots++;
+        }
+        if (++unsavedBoots < BOOT_MODEL_SAVE_BOOTS) {
+            return false;
+        }
+        unsavedBoots = 0;
+        return true;
+    }
+
+    bool estimate(uint64_t nowUs, BootEstimate *out) const {
+        if (!inBoot || active < 0) {
+            return false;
+        }
+        const CheckpointList &model = consoles[active].checkpoints;
+        if (model.lastOffsetMs() == 0) {
+            return false;
+        }
+
+        uint32_t totalMs = model.lastOffsetMs();
+        uint32_t expectedMs = current >= 0 ? model[current].offsetMs : 0;
+        uint32_t actualMs = (uint32_t)((reachedUs - bootStartUs) / 1000);
+        uint32_t sinceMs = (uint32_t)((nowUs - reachedUs) / 1000);
+
+        out->done = (current == model.size() - 1);
+        uint32_t percent = (uint32_t)((uint64_t)expectedMs * 100 / totalMs);
+        out->percent = (out->done || percent > 100) ? 100 : percent;
+
+        // The rest of the model and its next step, stretched by this boot's
+        // pace relative to the model (within reason). Boards without an FPU
+        // keep the pace in 1/1024ths instead of going through soft-float.
+        uint32_t remainingMs = totalMs - expectedMs;
+        uint32_t stepMs = out->done ? 0 : model[current + 1].offsetMs - expectedMs;
+        if (Board::hasFpu) {
+            float pace = expectedMs > 0 ? (float)actualMs / expectedMs : 1.0f;
+            pace = pace < 0.5f ? 0.5f : (pace > 4.0f ? 4.0f : pace);
+            remainingMs = (uint32_t)(remainingMs * pace);
+            stepMs = (uint32_t)(stepMs * pace);
+        } else {
+            uint32_t pace = expectedMs > 0 ? (uint32_t)(((uint64_t)actualMs << 10) / expectedMs) : 1024;
+            pace = pace < 512 ? 512 : (pace > 4096 ? 4096 : pace);
+            remainingMs = (uint32_t)(((uint64_t)remainingMs * pace) >> 10);
+            stepMs = (uint32_t)(((uint64_t)stepMs * pace) >> 10);
+        }
+        out->etaMs = remainingMs > sinceMs ? remainingMs - sinceMs : 0;
+
+        uint32_t limitMs = stepMs * BOOT_MODEL_STALL_FACTOR;
+        out->stalled = !out->done && sinceMs > (limitMs > BOOT_MODEL_MIN_STALL_MS ? limitMs : BOOT_MODEL_MIN_STALL_MS);
+        return true;
+    }
+
+    // Checkpoint the running boot is waiting for, if any
+    const BootCheckpoint *nextCheckpoint() const {
+        if (!inBoot || active < 0) {
+            return NULL;
+        }
+        const CheckpointList &model = consoles[active].checkpoints;
+        return current + 1 < model.size() ? &model[current + 1] : NULL;
+    }
+
+    // Compact encoding for flash, all consoles in one record: count u8, then
+    // per console its key u32, learned boots u16 and checkpoint count u8,
+    // then per checkpoint the flavor byte, the code and the offset delta to
+    // the previous checkpoint as LEB128 varints. Consoles share the space
+    // evenly; one that doesn't fit its share keeps every other checkpoint
+    // (every third, ...) and always its last, so the whole boot stays
+    // covered, just more coarsely.
+    uint8_t encode(uint8_t *out, uint8_t maxLen) const {
+        uint8_t used = 0;
+        for (const ConsoleModel &console : consoles) {
+            used += console.checkpoints.size() > 0;
+        }
+        uint8_t len = 1;
+        out[0] = 0;
+        if (used == 0) {
+            return len;
+        }
+
+        uint8_t share = (maxLen - 1) / used;
+        for (const ConsoleModel &console : consoles) {
+            if (console.checkpoints.size() == 0) {
+                continue;
+            }
+            for (uint8_t stride = 1; stride <= BOOT_MODEL_MAX_CHECKPOINTS; stride++) {
+                uint8_t n = encodeConsole(console, stride, out + len, share);
+                if (n > 0) {
+                    len += n;
+                    out[0]++;
+                    break;
+                }
+            }
+        }
+        return len;
+    }
+
+    bool decode(const uint8_t *in, uint8_t len) {
+        clear();
+        if (len < 1 || in[0] > BOOT_MODEL_CONSOLES) {
+            return false;
+        }
+        uint8_t pos = 1;
+        for (uint8_t c = 0; c < in[0]; c++) {
+            if (pos + 7 > len) {
+                clear();
+                return false;
+            }
+            ConsoleModel &console = consoles[c];
+            console.key = in[pos] | ((uint32_t)in[pos + 1] << 8) | ((uint32_t)in[pos + 2] << 16) | ((uint32_t)in[pos + 3] << 24);
+            console.learnedBoots = in[pos + 4] | ((uint16_t)in[pos + 5] << 8);
+            uint8_t count = in[pos + 6];
+            pos += 7;
+
+            uint32_t offsetMs = 0;
+            for (uint8_t i = 0; i < count; i++) {
+                if (pos >= len) {
+                    clear();
+                    return false;
+                }
+                CodeFlavor flavor = (CodeFlavor)in[pos++];
+                uint64_t code = 0;
+                uint64_t delta = 0;
+                if (!getVarint(in, len, &pos, &code) || !getVarint(in, len, &pos, &delta)) {
+                    clear();
+                    return false;
+                }
+                offsetMs += (uint32_t)delta;
+                console.checkpoints.add(flavor, code, offsetMs);
+            }
+        }
+        return true;
+    }
+
+private:
+    ConsoleModel consoles[BOOT_MODEL_CONSOLES];
+    CheckpointList trace; // first-reached codes of the running boot
+    uint32_t useClock = 0;
+    uint8_t unsavedBoots = 0; // refinements, across all consoles, not saved yet
+
+    bool inBoot = false;
+    uint64_t bootStartUs = 0;
+    uint64_t reachedUs = 0;
+    uint32_t bootKey = 0; // 0 until the opening codes are in
+    int8_t active = -1;
+    int8_t current = -1; // furthest model checkpoint reached
+
+    // Runs once per boot, when the opening codes are in
+    void identify() {
+        uint32_t h = 2166136261u; // FNV-1a
+        for (uint8_t i = 0; i < BOOT_MODEL_KEY_CODES; i++) {
+            uint64_t code = trace[i].code;
+            for (uint8_t b = 0; b < 8; b++) {
+                h = (h ^ (uint8_t)(code >> (8 * b))) * 16777619u;
+            }
+            h = (h ^ trace[i].flavor) * 16777619u;
+        }
+        bootKey = h ? h : 1;
+
+        for (uint8_t c = 0; c < BOOT_MODEL_CONSOLES; c++) {
+            if (consoles[c].key == bootKey) {
+                active = c;
+            }
+        }
+        if (active < 0) {
+            return;
+        }
+        const CheckpointList &model = consoles[active].checkpoints;
+        for (uint8_t i = 0; i < trace.size(); i++) {
+            int8_t idx = model.find(trace[i].flavor, trace[i].code);
+            if (idx > current) {
+                current = idx;
+                reachedUs = bootStartUs + (uint64_t)trace[i].offsetMs * 1000;
+            }
+        }
+    }
+
+    int8_t leastRecentlyUsed() const {
+        int8_t oldest = 0;
+        for (uint8_t c = 0; c < BOOT_MODEL_CONSOLES; c++) {
+            if (consoles[c].key == 0) {
+                return c;
+            }
+            if (consoles[c].lastUsed < consoles[oldest].lastUsed) {
+                oldest = c;
+            }
+        }
+        return oldest;
+    }
+
+    // Every `stride`-th checkpoint and the last; 0 if that needs more than maxLen
+    static uint8_t encodeConsole(const ConsoleModel &console, uint8_t stride, uint8_t *out, uint8_t maxLen) {
+        if (maxLen < 7) {
+            return 0;
+        }
+        const CheckpointList &model = console.checkpoints;
+        out[0] = (uint8_t)console.key;
+        out[1] = (uint8_t)(console.key >> 8);
+        out[2] = (uint8_t)(console.key >> 16);
+        out[3] = (uint8_t)(console.key >> 24);
+        out[4] = (uint8_t)console.learnedBoots;
+        out[5] = (uint8_t)(console.learnedBoots >> 8);
+        uint8_t len = 7;
+        uint8_t stored = 0;
+        uint32_t prevMs = 0;
+        for (uint8_t i = 0; i < model.size(); i++) {
+            if (i % stride != 0 && i != model.size() - 1) {
+                continue;
+            }
+            uint8_t entry[1 + 10 + 5];
+            uint8_t n = 0;
+            uint32_t offsetMs = model[i].offsetMs > prevMs ? model[i].offsetMs : prevMs;
+            entry[n++] = model[i].flavor;
+            n += putVarint(entry + n, model[i].code);
+            n += putVarint(entry + n, offsetMs - prevMs);
+            if (len + n > maxLen) {
+                return 0;
+            }
+            memcpy(out + len, entry, n);
+            len += n;
+            prevMs = offsetMs;
+            stored++;
+        }
+        out[6] = stored;
+        return len;
+    }
+
+    static uint8_t putVarint(uint8_t *out, uint64_t v) {
+        uint8_t n = 0;
+        do {
+            out[n++] = (uint8_t)(v & 0x7F) | (v > 0x7F ? 0x80 : 0);
+            v >>= 7;
+        } while (v);
+        return n;
+    }
+
+    static bool getVarint(const uint8_t *in, uint8_t len, uint8_t *pos, uint64_t *out) {
+        *out = 0;
+        for (uint8_t shift = 0; shift < 64 && *pos < len; shift += 7) {
+            uint8_t b = in[(*pos)++];
+            *out |= (uint64_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
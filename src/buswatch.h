@@ -0,0 +1,195 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "platform.h"
+#include "ringbuffer.h"
+
+// A bus held this long (a line stuck low, or a transaction that never saw
+// its STOP) is stalled. A packet takes well under a millisecond.
+#define BUS_HELD_MS 50
+// A bus still held after a recovery is retried with a doubling wait, up to this
+#define BUS_HELD_MAX_MS 5000
+// Code pace for the lost-codes estimate is measured over windows this long
+#define BUS_PACE_WINDOW_MS 1000
+#define BUS_RECOVERY_LOG_SIZE 8
+
+enum BusStallCause: uint8_t {
+    BUS_STALL_HELD = 1,   // SDA or SCL held low, or the peripheral stuck mid-transaction
+    BUS_STALL_SILENT = 2, // traffic stopped in the middle of a boot and came back; reported, no restart
+    BUS_STALL_FORCED = 3, // `bus recover`
+};
+
+typedef struct {
+    uint64_t atUs;       // when recovery finished, or the traffic came back
+    uint32_t stalledUs;  // from the first sign of the stall to recovery finishing
+    uint32_t recoveryUs; // Wire teardown, clock pulses and restart; 0 for a silence
+    uint32_t codesLost;  // estimate, at the pace before the stall; 0 for a silence
+    uint8_t cause;       // BusStallCause
+} BusRecovery;
+
+// Watches the Xbox bus from core1 and decides when the Wire slave needs
+// restarting; main.cpp does the restart. Only a bus held for BUS_HELD_MS
+// is a stall (platformI2cBusHeld(): line levels, or the peripheral's
+// bus-busy flag where the pins can't be read while Wire has them).
+//
+// A quiet bus is left alone: the console may just be busy, and a boot
+// always ends in silence. A gap in the traffic that ends while core0 still
+// has the boot session open is only reported, once the traffic is back.
+//
+// Recoveries and silences are queued for core0 to report; the totals are
+// readable from core0 at any time.
+class BusWatchdog {
+public:
+    // core0: a gap of at least minMs, and shorter than maxMs (the gap that
+    // ends a boot), is reported as a silence. 0, 0 while no boot is running.
+    inline void setSilenceWindow(uint16_t minMs, uint16_t maxMs) {
+        silenceWindow.store((uint32_t)maxMs << 16 | minMs, std::memory_order_relaxed);
+    }
+
+    // core1, every loop: whether the Wire slave needs restarting
+    BusStallCause poll(bool held, uint32_t receiveCount, uint32_t capturedCodes) {
+        uint32_t nowMs = millis();
+
+        if (receiveCount != lastReceiveCount) {
+            uint32_t window = silenceWindow.load(std::memory_order_relaxed);
+            uint32_t gapMs = nowMs - lastTrafficMs;
+            if (gapMs >= (window & 0xFFFF) && gapMs < (window >> 16)) {
+                silent(gapMs);
+            }
+            lastReceiveCount = receiveCount;
+            lastTrafficMs = nowMs;
+            heldRetryMs = BUS_HELD_MS;
+        }
+        if (!held) {
+            heldSinceMs = nowMs;
+            stalled = false;
+        }
+
+        // The pace is the one before the stall: a window starts over while
+        // the bus is held, and a window without codes makes it 0
+        if (stalled || nowMs - heldSinceMs >= BUS_HELD_MS) {
+            paceStartMs = nowMs;
+            paceStartCodes = capturedCodes;
+        } else if (nowMs - paceStartMs >= BUS_PACE_WINDOW_MS) {
+            uint32_t codes = capturedCodes - paceStartCodes;
+            codesPerSec = (uint32_t)((uint64_t)codes * 1000 / (nowMs - paceStartMs));
+            paceStartMs = nowMs;
+            paceStartCodes = capturedCodes;
+        }
+
+        if (nowMs - heldSinceMs >= heldRetryMs) {
+            stallStartMs = heldSinceMs;
+            stalled = true;
+            return BUS_STALL_HELD;
+        }
+        return (BusStallCause)0;
+    }
+
+    // core1, once the Wire slave is running again
+    void recovered(BusStallCause cause, uint32_t recoveryUs) {
+        uint32_t nowMs = millis();
+        uint32_t stalledMs = cause == BUS_STALL_FORCED ? 0 : nowMs - stallStartMs;
+
+        BusRecovery record;
+        record.atUs = now_us64();
+        record.stalledUs = stalledMs * 1000 + recoveryUs;
+        record.recoveryUs = recoveryUs;
+        record.codesLost = (uint32_t)((uint64_t)codesPerSec * record.stalledUs / 1000000);
+        record.cause = cause;
+        log.push(record);
+
+        recoveries = recoveries + 1;
+        codesLost = codesLost + record.codesLost;
+        if (recoveryUs > worstRecoveryUs) {
+            worstRecoveryUs = recoveryUs;
+        }
+        if (cause == BUS_STALL_HELD) {
+            heldRetryMs = heldRetryMs * 2 < BUS_HELD_MAX_MS ? heldRetryMs * 2 : BUS_HELD_MAX_MS;
+        }
+        heldSinceMs = nowMs;
+        // The gap the stall left has been reported already
+        lastTrafficMs = nowMs;
+    }
+
+    // core1, when the Wire slave is back after this reader was a bus
+    // master (replay, savetest send). poll() wasn't called meanwhile, so
+    // the hold, the last traffic and the pace window all start over; the
+    // pace from before doesn't apply either.
+    void resume(uint32_t receiveCount, uint32_t capturedCodes) {
+        uint32_t nowMs = millis();
+        lastReceiveCount = receiveCount;
+        lastTrafficMs = nowMs;
+        heldSinceMs = nowMs;
+        stalled = false;
+        paceStartMs = nowMs;
+        paceStartCodes = capturedCodes;
+        codesPerSec = 0;
+    }
+
+    // core0
+    inline bool popRecovery(BusRecovery &out) { return log.pop(out); }
+    inline uint32_t getRecoveries() const { return recoveries; }
+    inline uint32_t getSilences() const { return silences; }
+    inline uint32_t getCodesLost() const { return codesLost; }
+    inline uint32_t getWorstRecoveryUs() const { return worstRecoveryUs; }
+
+    // Frees a device stuck mid-byte on SDA: clocks until it lets go (nine at
+    // most, a byte and its ACK), then a STOP. Wire must be stopped. Open
+    // drain by hand, a line is either driven low or left to the pull-up.
+    static void pulseClock(uint8_t sda, uint8_t scl) {
+        pinMode(sda, INPUT_PULLUP);
+        pinMode(scl, INPUT_PULLUP);
+        for (uint8_t i = 0; i < 9 && !digitalRead(sda); i++) {
+            driveLow(scl);
+            delayMicroseconds(5);
+            release(scl);
+            delayMicroseconds(5);
+        }
+        driveLow(scl);
+        driveLow(sda);
+        delayMicroseconds(5);
+        release(scl);
+        delayMicroseconds(5);
+        release(sda);
+        delayMicroseconds(5);
+    }
+
+private:
+    void silent(uint32_t gapMs) {
+        BusRecovery record;
+        record.atUs = now_us64();
+        record.stalledUs = gapMs * 1000;
+        record.recoveryUs = 0;
+        record.codesLost = 0;
+        record.cause = BUS_STALL_SILENT;
+        log.push(record);
+        silences = silences + 1;
+    }
+
+    static inline void driveLow(uint8_t pin) {
+        digitalWrite(pin, LOW);
+        pinMode(pin, OUTPUT);
+    }
+    static inline void release(uint8_t pin) { pinMode(pin, INPUT_PULLUP); }
+
+    std::atomic<uint32_t> silenceWindow{0}; // max << 16 | min
+
+    // core1 only
+    uint32_t lastReceiveCount = 0;
+    uint32_t lastTrafficMs = 0;
+    uint32_t heldSinceMs = 0;
+    uint16_t heldRetryMs = BUS_HELD_MS;
+    uint32_t stallStartMs = 0;
+    bool stalled = false;
+    uint32_t paceStartMs = 0;
+    uint32_t paceStartCodes = 0;
+    uint32_t codesPerSec = 0;
+
+    // Written by core1, read by core0
+    volatile uint32_t recoveries = 0;
+    volatile uint32_t silences = 0;
+    volatile uint32_t codesLost = 0;
+    volatile uint32_t worstRecoveryUs = 0;
+    SpscRing<BusRecovery, BUS_RECOVERY_LOG_SIZE> log;
+};
@@ -0,0 +1,366 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "alarm.h"
+#include "board.h"
+#include "codes.h"
+#include "doublebuf.h"
+#include "filter.h"
+#include "platform.h"
+#include "regshadow.h"
+#include "ringbuffer.h"
+
+/* MAX6958 emulation */
+#define MAX6958_ADDRESS 0x38
+#define MAX6958_REGISTER_SIZE 0x25
+
+static_assert(REG_SHADOW_SIZE == MAX6958_REGISTER_SIZE, "The register shadow must cover every MAX6958 register");
+
+/* POST Code storage */
+// One queue per flavor, so a storm of one flavor only ever drops codes of
+// that flavor. Each queue allocates exactly its own size, and none is
+// smaller than the single shared queue they replaced (POST_QUEUE_MIN_SIZE).
+// The queues scale with the board's RAM; -D POST_QUEUE_SCALE (a power of
+// two) overrides that, -D POST_QUEUE_SIZE_<flavor> one queue, and
+// tools/ram_report.py shows what it costs.
+#ifndef POST_QUEUE_SCALE
+#define POST_QUEUE_SCALE (2 * BOARD_BUFFER_SCALE)
+#endif
+#define POST_QUEUE_MIN_SIZE (32 * POST_QUEUE_SCALE)
+#ifndef POST_QUEUE_SIZE_CPU
+#define POST_QUEUE_SIZE_CPU POST_QUEUE_MIN_SIZE
+#endif
+#ifndef POST_QUEUE_SIZE_SP
+#define POST_QUEUE_SIZE_SP  POST_QUEUE_MIN_SIZE
+#endif
+#ifndef POST_QUEUE_SIZE_SMC
+#define POST_QUEUE_SIZE_SMC POST_QUEUE_MIN_SIZE
+#endif
+#ifndef POST_QUEUE_SIZE_OS
+#define POST_QUEUE_SIZE_OS  POST_QUEUE_MIN_SIZE
+#endif
+// A queue this full is drained ahead of timestamp order
+#define POST_QUEUE_PRESSURE_PCT 75
+
+static_assert(POST_QUEUE_SIZE_CPU >= POST_QUEUE_MIN_SIZE && POST_QUEUE_SIZE_SP >= POST_QUEUE_MIN_SIZE
+    && POST_QUEUE_SIZE_SMC >= POST_QUEUE_MIN_SIZE && POST_QUEUE_SIZE_OS >= POST_QUEUE_MIN_SIZE,
+    "A flavor's queue can't be smaller than the shared queue it replaced");
+
+enum MAX6958Registers {
+    NoOp = 0x00,
+    DecodeMode = 0x01,
+    Intensity = 0x02,
+    ScanLimit = 0x03,
+    Configuration = 0x04,
+    FactoryReserved = 0x05,
+    GpIo = 0x06,
+    DisplayTest = 0x07,
+    ReadKeyDebounced = 0x08,
+    ReadKeyPressed = 0x0C,
+    Digit0 = 0x20,
+    Digit1 = 0x21,
+    Digit2 = 0x22,
+    Digit3 = 0x23,
+    Segments = 0x24,
+};
+
+static const char *getNameForMAX6958Register(uint8_t reg) {
+    switch(reg) {
+        case NoOp:
+            return "NoOp";
+        case DecodeMode:
+            return "DecodeMode";
+        case Intensity:
+            return "Intensity";
+        case ScanLimit:
+            return "ScanLimit";
+        case Configuration:
+            return "Configuration";
+        case FactoryReserved:
+            return "FactoryReserved";
+        case GpIo:
+            return "GpIo";
+        case DisplayTest:
+            return "DisplayTest";
+        case ReadKeyDebounced:
+            return "ReadKeyDebounced";
+        case ReadKeyPressed:
+            return "ReadKeyPressed";
+        case Digit0:
+            return "Digit0";
+        case Digit1:
+            return "Digit1";
+        case Digit2:
+            return "Digit2";
+        case Digit3:
+            return "Digit3";
+        case Segments:
+            return "Segments";
+        default:
+            return "<UNKNOWN>";
+    }
+}
+
+// One digit-group write as the console sends it: register address Digit0,
+// then Digit0..Digit3 (one nibble each, auto-incremented) and the Segments
+// byte carrying flavor + segment index.
+#define MAX6958_CODE_PACKET_SIZE 6
+
+static inline void encodeCodePacket(uint8_t out[MAX6958_CODE_PACKET_SIZE], CodeFlavor flavor, uint8_t segIndex, uint16_t codeWord) {
+    out[0] = Digit0;
+    for (int i = 0; i < 4; i++) {
+        out[1 + i] = (codeWord >> (4 * i)) & 0x0F;
+    }
+    out[5] = (uint8_t)flavor | (segIndex & SEGMENT_INDEX_MASK);
+}
+
+// Byte source over a plain buffer, interchangeable with Wire in
+// Capture::receive(). Used to push synthetic packets through the real
+// decode path.
+class BufferSource {
+public:
+    BufferSource(const uint8_t *buf, size_t len) : buf(buf), len(len) {}
+    inline int CAPTURE_FUNC(available)() { return (int)(len - pos); }
+    inline int CAPTURE_FUNC(read)() { return pos < len ? buf[pos++] : -1; }
+private:
+    const uint8_t *buf;
+    size_t len;
+    size_t pos = 0;
+};
+
+// Everything the I2C receive callback touches. Written from core1 (or the
+// Wire ISR), drained from core0 through the SPSC queue.
+//
+// Every method on the receive path is CAPTURE_FUNC-placed, so it runs from
+// SRAM on RP2040 (IRAM on ESP32) and can't be stalled by an XIP cache miss.
+class Capture {
+public:
+    // Decodes one I2C write transaction from `src` (Wire, or a BufferSource).
+    template <typename Source>
+    void CAPTURE_FUNC(receive)(Source &src) {
+        uint32_t startTicks = now_ticks();
+        uint8_t recvd_byte = 0;
+        int reg = -1;
+
+        uint16_t codeWord = 0;
+        registers.beginWrite();
+        while (src.available()) {
+            recvd_byte = src.read();
+            if (reg == -1 || reg == FactoryReserved || reg == MAX6958_REGISTER_SIZE) {
+                // First byte of a packet is the CMD / target register address
+                // NOTE: Register Configuration (0x04) is always sent alone
+                // If we are at Register FactoryReserved (0x05), we read the register/command again, as it will be the start of a new packet
+                // If Register is > MAX6958_REGISTER_SIZE, also expect a new packet following
+                reg = recvd_byte;
+            } else {
+                setRegister(reg, recvd_byte);
+                if (reg >= Digit0 && reg <= Digit3) {
+                    // Shift lower nibble (4 bits) of digit to position in u16 value
+                    codeWord |= (uint16_t)(recvd_byte & 0x0F) << (4 * (reg - Digit0));
+                } else if (reg == Segments) {
+                    setSegmentCode(recvd_byte, codeWord);
+                    codeWord = 0;
+                }
+                // After each byte the target register address is automatically incremented
+                // This allow communication to be more dense
+                // See: MAX6958 Datasheet, page 9 -> Command Address Autoincrementing
+                reg++;
+            }
+        }
+        registers.endWrite();
+
+        // Add the assembled code
+        if (isCodeReady()) {
+            enqueueCode();
+        }
+
+        uint32_t elapsedTicks = now_ticks() - startTicks;
+        if (elapsedTicks > maxReceiveTicks) {
+            maxReceiveTicks = elapsedTicks;
+        }
+        receiveCount = receiveCount + 1;
+    }
+
+    inline void CAPTURE_FUNC(setRegister)(uint8_t reg, uint8_t value) { registers.write(reg, value); }
+    inline const RegisterShadow &getRegisters() const { return registers; }
+
+    inline void CAPTURE_FUNC(setSegmentCode)(uint8_t segmentByte, uint16_t codeWord) {
+        // Exactly one of the index bits (1, 2, 4, 8) is set; its position is
+        // the digit-group slot. Computed rather than switch()ed, since a
+        // switch can compile to a table lookup helper that lives in flash.
+        uint8_t segIndex = segmentByte & SEGMENT_INDEX_MASK;
+        if (segIndex == 0 || (segIndex & (segIndex - 1)) != 0) {
+            return;
+        }
+        uint8_t code_idx = (segIndex >= 4 ? 2 : 0) + ((segIndex & 0x0A) ? 1 : 0);
+
+        codeWords[code_idx] = codeWord;
+        currSegment = SegmentByte(segmentByte);
+    }
+
+    inline bool CAPTURE_FUNC(isCodeReady)() {
+        // Codes come in MSB-first (index order: 8, 4, 2, 1)
+        // When index is 1, full code was transmitted from console
+        return currSegment.index() == 1;
+    }
+
+    inline void CAPTURE_FUNC(enqueueCode)() {
+        SegmentData segData = {
+            .code = assembleCode(codeWords),
+            .flavor = currSegment.flavor(),
+            .timestamp = now_us64(),
+        };
+        capturedCodes = capturedCodes + 1;
+        // The fault alarm and last-codes cache still see filtered codes
+        faultAlarm.check(segData.flavor, segData.code, (uint32_t)segData.timestamp);
+        putCodeCache(segData.flavor, segData.code);
+        bool accepted = filters.acquire(0).accepts(segData.flavor, segData.code);
+        filters.release(0);
+        if (accepted) {
+            pushPostCode(segData);
+        } else {
+            filteredCodes = filteredCodes + 1;
+        }
+        resetSegment();
+    }
+
+    // Swaps in a new filter (core0). The capture side switches over at its
+    // next code; back-to-back changes wait for it to finish with the old copy.
+    void setFilter(const CaptureFilter &filter) {
+        filters.edit() = filter;
+        filters.publish();
+    }
+
+    // Drops a partially assembled code (e.g. on a monitor restart).
+    inline void CAPTURE_FUNC(resetSegment)() {
+        resetCodeWords();
+        currSegment = SegmentByte(0);
+    }
+
+    // Consumer side (core0)
+
+    // Codes come out in timestamp order across all flavors - unless a queue
+    // is close to overflowing, in which case it's drained first, the
+    // highest priority flavor (SMC, SP, CPU, OS) first.
+    bool popPostCode(SegmentData *segDataOut) {
+        static const CodeIndex PRIORITY[CODE_IDX_MAX] = { CODE_IDX_SMC, CODE_IDX_SP, CODE_IDX_CPU, CODE_IDX_OS };
+
+        int8_t next = -1;
+        for (CodeIndex idx : PRIORITY) {
+            PostCodeQueue &queue = *_postCodeQueues[idx];
+            if (queue.count() * 100 >= queue.capacity() * POST_QUEUE_PRESSURE_PCT) {
+                next = idx;
+                break;
+            }
+        }
+
+        if (next < 0) {
+            uint64_t oldest = UINT64_MAX;
+            for (uint8_t idx = 0; idx < CODE_IDX_MAX; idx++) {
+                const SegmentData *head = _postCodeQueues[idx]->peek();
+                if (head != NULL && head->timestamp <= oldest) {
+                    oldest = head->timestamp;
+                    next = idx;
+                }
+            }
+        }
+
+        return next >= 0 && _postCodeQueues[next]->pop(*segDataOut);
+    }
+
+    inline void discardPostCodes() {
+        for (PostCodeQueue *queue : _postCodeQueues) {
+            queue->discard();
+        }
+    }
+    inline uint16_t getQueueDepth() {
+        uint16_t depth = 0;
+        for (PostCodeQueue *queue : _postCodeQueues) {
+            depth += queue->count();
+        }
+        return depth;
+    }
+    inline uint16_t getQueueDepth(CodeIndex index) { return _postCodeQueues[index]->count(); }
+    inline uint16_t getQueueCapacity(CodeIndex index) { return _postCodeQueues[index]->capacity(); }
+
+    inline FaultAlarm *alarm() { return &faultAlarm; }
+
+    inline uint64_t getCachedCode(CodeIndex index) {
+        if (index >= CODE_IDX_MAX) {
+            return 0;
+        }
+
+        return codeCache[index];
+    }
+
+    // Counters; only ever written from the capture side.
+    inline uint32_t getDroppedCodes() {
+        uint32_t total = 0;
+        for (uint8_t idx = 0; idx < CODE_IDX_MAX; idx++) {
+            total += droppedCodes[idx];
+        }
+        return total;
+    }
+    inline uint32_t getDroppedCodes(CodeIndex index) { return droppedCodes[index]; }
+    inline uint32_t getFilteredCodes() { return filteredCodes; }
+    inline uint32_t getCapturedCodes() { return capturedCodes; } // before filtering
+    inline uint32_t getReceiveCount() { return receiveCount; }
+    inline uint32_t getMaxReceiveTicks() { return maxReceiveTicks; } // now_ticks() of the capture core
+    inline void resetMaxReceiveTicks() { maxReceiveTicks = 0; }
+
+private:
+    SegmentByte currSegment = SegmentByte(0);
+
+    uint16_t codeWords[POST_CODE_WORD_COUNT] = {0};
+    uint64_t codeCache[CODE_IDX_MAX] = {0};
+    RegisterShadow registers;
+
+    volatile uint32_t droppedCodes[CODE_IDX_MAX] = {0};
+    volatile uint32_t filteredCodes = 0;
+    volatile uint32_t capturedCodes = 0;
+    volatile uint32_t receiveCount = 0;
+    volatile uint32_t maxReceiveTicks = 0;
+
+    typedef SpscQueue<SegmentData> PostCodeQueue;
+    SpscRing<SegmentData, POST_QUEUE_SIZE_CPU> cpuQueue;
+    SpscRing<SegmentData, POST_QUEUE_SIZE_SP> spQueue;
+    SpscRing<SegmentData, POST_QUEUE_SIZE_SMC> smcQueue;
+    SpscRing<SegmentData, POST_QUEUE_SIZE_OS> osQueue;
+    PostCodeQueue *const _postCodeQueues[CODE_IDX_MAX] = { &cpuQueue, &spQueue, &smcQueue, &osQueue };
+
+    DoubleBuffer<CaptureFilter, 1> filters{CaptureFilter()};
+
+    FaultAlarm faultAlarm;
+
+    // Codes of unknown flavor share the lowest priority queue
+    static inline uint8_t CAPTURE_FUNC(queueIndexForFlavor)(CodeFlavor flavor) {
+        return flavor == CODE_FLAVOR_SMC ? CODE_IDX_SMC
+            : flavor == CODE_FLAVOR_SP ? CODE_IDX_SP
+            : flavor == CODE_FLAVOR_CPU ? CODE_IDX_CPU
+            : CODE_IDX_OS;
+    }
+
+    inline void CAPTURE_FUNC(pushPostCode)(const SegmentData &segData) {
+        uint8_t idx = queueIndexForFlavor(segData.flavor);
+        if (!_postCodeQueues[idx]->push(segData)) {
+            droppedCodes[idx] = droppedCodes[idx] + 1;
+        }
+    }
+
+    inline bool CAPTURE_FUNC(putCodeCache)(CodeFlavor flavor, uint64_t code) {
+        uint8_t index = getCodeIndexForFlavor(flavor);
+        if (index == CODE_IDX_INVALID) {
+            return false;
+        }
+        codeCache[index] = code;
+        return true;
+    }
+
+    inline void CAPTURE_FUNC(resetCodeWords)() {
+        codeWords[0] = 0;
+        codeWords[1] = 0;
+        codeWords[2] = 0;
+        codeWords[3] = 0;
+    }
+};
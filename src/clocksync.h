@@ -0,0 +1,47 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Maps device time (now_us64()) onto the host's clock, so codes can be
+// lined up with logs recorded on the host.
+//
+// The host does the estimating: it times RPC_OP_TIME round trips, fits
+// offset and drift, and hands the result over with RPC_OP_TIME_SET - again
+// every so often, since the fit only holds for a while. Between syncs the
+// bound grows by the drift uncertainty for every microsecond since the
+// reference point.
+
+typedef struct {
+    uint64_t deviceUs;          // reference point on the device clock...
+    uint64_t hostUs;            // ...and where it falls on the host clock (us since the Unix epoch)
+    int32_t driftPpb;           // host rate relative to the device's, minus one
+    uint32_t uncertaintyUs;     // bound on the error at the reference point
+    uint32_t driftUncertaintyPpb;
+} ClockSyncFit;
+
+class ClockSync {
+public:
+    void set(const ClockSyncFit &fit) {
+        this->fit = fit;
+        valid = true;
+    }
+    void clear() { valid = false; }
+    bool isValid() const { return valid; }
+    const ClockSyncFit &getFit() const { return fit; }
+
+    uint64_t toHostUs(uint64_t deviceUs) const {
+        int64_t sinceRef = (int64_t)(deviceUs - fit.deviceUs);
+        return fit.hostUs + sinceRef + sinceRef * fit.driftPpb / 1000000000;
+    }
+
+    uint32_t uncertaintyUs(uint64_t deviceUs) const {
+        int64_t sinceRef = (int64_t)(deviceUs - fit.deviceUs);
+        uint64_t age = sinceRef < 0 ? -sinceRef : sinceRef;
+        uint64_t bound = fit.uncertaintyUs + age * fit.driftUncertaintyPpb / 1000000000;
+        return bound > UINT32_MAX ? UINT32_MAX : (uint32_t)bound;
+    }
+
+private:
+    ClockSyncFit fit = {};
+    bool valid = false;
+};
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <Arduino.h>
+#include "codes.h"
+
+// Longest repeating cycle of codes that gets detected, e.g. a console
+// retrying a 3-step init sequence forever.
+#define COALESCE_MAX_PERIOD 4
+#define COALESCE_HISTORY    (2 * COALESCE_MAX_PERIOD)
+
+// One summary line: `count` more complete instances of `cycle` were seen
+// between firstUs and lastUs. `ongoing` is set for periodic summaries of a
+// run that's still repeating. A run that ends partway through the cycle
+// hands the codes of that last, unfinished instance out in `tail`.
+typedef struct {
+    uint8_t period;
+    SegmentData cycle[COALESCE_MAX_PERIOD];
+    uint32_t count;
+    uint64_t firstUs;
+    uint64_t lastUs;
+    bool ongoing;
+    uint8_t tailLen;
+    SegmentData tail[COALESCE_MAX_PERIOD];
+} CoalesceSummary;
+
+// Collapses repeats of a code, or of a short cycle of codes, that come out
+// of the capture queue. A run is recognised once the cycle has been seen
+// twice in a row; from then on instances are counted instead of printed,
+// and summarised every `interval` and when the run ends.
+class Coalescer {
+public:
+    void setIntervalMs(uint16_t ms) { intervalUs = (uint64_t)ms * 1000; }
+
+    void reset() {
+        historyLen = 0;
+        period = 0;
+        phase = 0;
+        count = 0;
+    }
+
+    // Returns true if `seg` should be printed. If it ends a run, the run's
+    // final summary is stored in `summary` (count or tailLen > 0), to be
+    // printed first.
+    bool feed(const SegmentData &seg, CoalesceSummary *summary) {
+        summary->count = 0;
+        summary->tailLen = 0;
+
+        if (period > 0) {
+            if (sameCode(seg, history[phase])) {
+                tail[phase] = seg;
+                phase = (phase + 1) % period;
+                if (phase == 0) {
+                    if (count == 0) {
+                        windowStartUs = tail[0].timestamp;
+                    }
+                    count++;
+                    lastUs = seg.timestamp;
+                }
+                return false;
+            }
+
+            fillSummary(summary, false);
+            reset();
+        }
+
+        push(seg);
+        detectCycle();
+        return true;
+    }
+
+    // Hands out a summary of an ongoing run once `interval` has passed
+    // since the first instance it covers. Call regularly, also when no
+    // codes arrive.
+    bool poll(uint64_t nowUs, CoalesceSummary *summary) {
+        if (period == 0 || count == 0 || nowUs - windowStartUs < intervalUs) {
+            return false;
+        }
+        fillSummary(summary, true);
+        return true;
+    }
+
+    // Summary of whatever is pending, e.g. before switching coalescing off
+    bool flush(CoalesceSummary *summary) {
+        if (period == 0 || (count == 0 && phase == 0)) {
+            return false;
+        }
+        fillSummary(summary, false);
+        reset();
+        return true;
+    }
+
+private:
+    // While idle: the most recent codes, oldest first.
+    // While in a run: history[0..period) is the cycle, in the order it repeats.
+    SegmentData history[COALESCE_HISTORY];
+    uint8_t historyLen = 0;
+    uint8_t period = 0;  // 0 = not in a run
+    uint8_t phase = 0;   // next expected cycle entry
+    uint32_t count = 0;  // complete instances since the last summary
+    SegmentData tail[COALESCE_MAX_PERIOD]; // the instance in progress, up to `phase`
+    uint64_t windowStartUs = 0;
+    uint64_t lastUs = 0;
+    uint64_t intervalUs = 1000000;
+
+    static bool sameCode(const SegmentData &a, const SegmentData &b) {
+        return a.code == b.code && a.flavor == b.flavor;
+    }
+
+    void push(const SegmentData &seg) {
+        if (historyLen == COALESCE_HISTORY) {
+            memmove(&history[0], &history[1], sizeof(history[0]) * (COALESCE_HISTORY - 1));
+            historyLen--;
+        }
+        history[historyLen++] = seg;
+    }
+
+    // Looks for the shortest cycle that the newest entries repeat twice
+    void detectCycle() {
+        for (uint8_t p = 1; p <= COALESCE_MAX_PERIOD && 2 * p <= historyLen; p++) {
+            bool repeats = true;
+            for (uint8_t i = historyLen - p; i < historyLen; i++) {
+                if (!sameCode(history[i], history[i - p])) {
+                    repeats = false;
+                    break;
+                }
+            }
+            if (repeats) {
+                lastUs = history[historyLen - 1].timestamp;
+                memmove(&history[0], &history[historyLen - p], sizeof(history[0]) * p);
+                historyLen = p;
+                period = p;
+                phase = 0;
+                count = 0;
+                return;
+            }
+        }
+    }
+
+    void fillSummary(CoalesceSummary *summary, bool ongoing) {
+        summary->period = period;
+        memcpy(summary->cycle, history, sizeof(history[0]) * period);
+        summary->count = count;
+        summary->firstUs = windowStartUs;
+        summary->lastUs = lastUs;
+        summary->ongoing = ongoing;
+        summary->tailLen = ongoing ? 0 : phase;
+        memcpy(summary->tail, tail, sizeof(tail[0]) * summary->tailLen);
+        count = 0;
+    }
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <Arduino.h>
+#include "platform.h"
 
 #define SEGMENT_FLAVOR_MASK 0xF0
 #define SEGMENT_INDEX_MASK  0x0F
@@ -60,6 +61,13 @@ static inline CodeIndex getCodeIndexForFlavor(CodeFlavor flavor) {
     }
 }
 
+static const CodeFlavor CODE_FLAVOR_FOR_INDEX[CODE_IDX_MAX] = {
+    CODE_FLAVOR_CPU,
+    CODE_FLAVOR_SP,
+    CODE_FLAVOR_SMC,
+    CODE_FLAVOR_OS,
+};
+
 static inline const char* getStringForCodeFlavor(CodeFlavor flavor) {
     switch (flavor) {
         case CODE_FLAVOR_CPU:
@@ -78,10 +86,11 @@ static inline const char* getStringForCodeFlavor(CodeFlavor flavor) {
 #define POST_CODE_WORD_COUNT 4
 
 // Merges up to 4x 16-bit digit-group values into one 64-bit code.
-static inline uint64_t assembleCode(const uint16_t words[POST_CODE_WORD_COUNT]) {
-    uint64_t code = 0;
-    for (int idx = 0; idx < POST_CODE_WORD_COUNT; idx++) {
-        code |= (uint64_t)words[idx] << (16 * idx);
-    }
-    return code;
+// Constant shifts only: a variable 64-bit shift is a libgcc call on
+// Cortex-M0+, and libgcc lives in flash.
+static inline uint64_t CAPTURE_FUNC(assembleCode)(const uint16_t words[POST_CODE_WORD_COUNT]) {
+    return (uint64_t)words[0]
+        | ((uint64_t)words[1] << 16)
+        | ((uint64_t)words[2] << 32)
+        | ((uint64_t)words[3] << 48);
 }
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <Arduino.h>
+#include "board.h"
+#include "codes.h"
+
+#define CODE_STATS_CAPACITY (128 * BOARD_BUFFER_SCALE) // power of two
+#define CODE_STATS_TOP_MAX  32
+
+typedef struct {
+    uint64_t code;
+    uint64_t firstUs;
+    uint64_t lastUs;
+    uint32_t hits;      // 0 = free slot
+    uint32_t minGapUs;  // between consecutive hits, saturating
+    uint32_t maxGapUs;
+    CodeFlavor flavor;
+} CodeStatsEntry;
+
+// Hit counts per (flavor, code), kept on core0 as codes are drained.
+// Open addressing with linear probing in a fixed table; once it's full,
+// hits on codes not in it yet are only counted in total.
+class CodeStats {
+    static_assert((CODE_STATS_CAPACITY & (CODE_STATS_CAPACITY - 1)) == 0, "CODE_STATS_CAPACITY must be a power of two");
+public:
+    void reset() {
+        memset(entries, 0, sizeof(entries));
+        used = 0;
+        untrackedHits = 0;
+    }
+
+    void record(const SegmentData &seg) {
+        uint16_t slot = hash(seg.flavor, seg.code);
+        for (uint16_t probe = 0; probe < CODE_STATS_CAPACITY; probe++) {
+            CodeStatsEntry &entry = entries[slot];
+            if (entry.hits == 0) {
+                entry.code = seg.code;
+                entry.flavor = seg.flavor;
+                entry.hits = 1;
+                entry.firstUs = seg.timestamp;
+                entry.lastUs = seg.timestamp;
+                entry.minGapUs = UINT32_MAX;
+                entry.maxGapUs = 0;
+                used++;
+                return;
+            }
+            if (entry.code == seg.code && entry.flavor == seg.flavor) {
+                uint64_t gap = seg.timestamp - entry.lastUs;
+                uint32_t gapUs = gap > UINT32_MAX ? UINT32_MAX : (uint32_t)gap;
+                if (gapUs < entry.minGapUs) {
+                    entry.minGapUs = gapUs;
+                }
+                if (gapUs > entry.maxGapUs) {
+                    entry.maxGapUs = gapUs;
+                }
+                entry.lastUs = seg.timestamp;
+                if (entry.hits < UINT32_MAX) {
+                    entry.hits++;
+                }
+                return;
+            }
+            slot = (slot + 1) & (CODE_STATS_CAPACITY - 1);
+        }
+        untrackedHits++;
+    }
+
+    // Fills `out` with the slots of the (up to) `n` most frequent codes,
+    // most frequent first. Returns how many were found.
+    uint8_t top(uint16_t *out, uint8_t n) const {
+        uint8_t found = 0;
+        for (uint16_t slot = 0; slot < CODE_STATS_CAPACITY; slot++) {
+            uint32_t hits = entries[slot].hits;
+            if (hits == 0 || (found == n && hits <= entries[out[n - 1]].hits)) {
+                continue;
+            }
+            uint8_t pos = (found < n) ? found++ : n - 1;
+            while (pos > 0 && entries[out[pos - 1]].hits < hits) {
+                out[pos] = out[pos - 1];
+                pos--;
+            }
+            out[pos] = slot;
+        }
+        return found;
+    }
+
+    const CodeStatsEntry &entry(uint16_t slot) const { return entries[slot]; }
+    uint16_t getUsed() const { return used; }
+    uint32_t getUntrackedHits() const { return untrackedHits; }
+
+private:
+    CodeStatsEntry entries[CODE_STATS_CAPACITY] = {};
+    uint16_t used = 0;
+    uint32_t untrackedHits = 0;
+
+    static uint16_t hash(CodeFlavor flavor, uint64_t code) {
+        uint32_t h = (uint32_t)code ^ (uint32_t)(code >> 32) ^ ((uint32_t)flavor << 24);
+        return (uint16_t)((h * 2654435761u) >> 16) & (CODE_STATS_CAPACITY - 1);
+    }
+};
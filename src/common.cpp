@@ -1,13 +1,11 @@
 #include "common.h"
 
-RuntimeState::RuntimeState(Display display) :
-    _postCodeQueue(sizeof(SegmentData), POST_MAX_QUEUE_SIZE, FIFO),
+RuntimeState::RuntimeState(Display &display) :
     _display(display)
 {}
 
 bool RuntimeState::begin() {
-    _display.begin();
     initialized = true;
 
-    return true;
+    return _display.begin();
 }
\ No newline at end of file
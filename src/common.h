@@ -2,7 +2,7 @@
 
 #include <Arduino.h>
 #include <Wire.h>
-#include <cppQueue.h>
+#include "capture.h"
 #include "codes.h"
 #include "display.h"
 #include "platform.h"
@@ -10,13 +10,6 @@
 /* DISPLAY */
 #define SSD1306_DISP_ADDRESS 0x3C
 
-/* MAX6958 emulation */
-#define MAX6958_ADDRESS 0x38
-#define MAX6958_REGISTER_SIZE 0x25
-
-/* POST Code storage */
-#define POST_MAX_QUEUE_SIZE 30
-
 #define CTRL_C 3
 
 #if DEBUG
@@ -41,6 +34,33 @@ enum State {
     STATE_PRINT_HELP,
     STATE_BOOTSEL,
     STATE_SET_I2C0_PINS,
+    STATE_LATENCY_TEST,
+    STATE_SAVE_TEST,
+    STATE_TOGGLE_EXACT,
+    STATE_SET_COALESCE_INTERVAL,
+    STATE_FILTER_SHOW,
+    STATE_FILTER_FLAVOR,
+    STATE_FILTER_INCLUDE,
+    STATE_FILTER_EXCLUDE,
+    STATE_SHOW_QUEUES,
+    STATE_TOP_CODES,
+    STATE_RESET_STATS,
+    STATE_PROFILE_SHOW,
+    STATE_SET_MILESTONE,
+    STATE_SET_IDLE_GAP,
+    STATE_SET_RESET_CODE,
+    STATE_BOOT_MODEL,
+    STATE_TOGGLE_SPLIT_FALL,
+    STATE_ADD_FAULT,
+    STATE_ALARM,
+    STATE_SINK,
+    STATE_SET_UART_BAUD,
+    STATE_REPLAY,
+    STATE_REPLAY_SETTINGS,
+    STATE_PROFILER,
+    STATE_DISPLAY_BENCH,
+    STATE_REGISTERS,
+    STATE_BUS_WATCHDOG,
 };
 
 // For communication between core0/1
@@ -48,78 +68,44 @@ enum CrossThreadMsg: uint32_t {
     INVALID = 0,
     RESET_TIMESTAMP = 1,
     SET_I2C0_PINS = 2, // low byte = this code, byte 1 = SDA pin, byte 2 = SCL pin
+    LATENCY_TEST = 3,
+    SYNTHETIC_LOAD = 4, // low byte = this code, bytes 1-3 = period in us (0 = stop)
+    SAMPLER = 5,        // low byte = this code, bytes 1-2 = sampling rate in Hz (0 = stop)
+    BUS_RECOVER = 6,
+    SYNTHETIC_SEND = 7, // as SYNTHETIC_LOAD, but sent onto the Xbox bus as I2C master
 };
 
 static inline uint32_t packSetI2C0PinsMsg(uint8_t sda, uint8_t scl) {
     return (uint32_t)SET_I2C0_PINS | ((uint32_t)sda << 8) | ((uint32_t)scl << 16);
 }
 
-enum MAX6958Registers {
-    NoOp = 0x00,
-    DecodeMode = 0x01,
-    Intensity = 0x02,
-    ScanLimit = 0x03,
-    Configuration = 0x04,
-    FactoryReserved = 0x05,
-    GpIo = 0x06,
-    DisplayTest = 0x07,
-    ReadKeyDebounced = 0x08,
-    ReadKeyPressed = 0x0C,
-    Digit0 = 0x20,
-    Digit1 = 0x21,
-    Digit2 = 0x22,
-    Digit3 = 0x23,
-    Segments = 0x24,
-};
+static inline uint32_t packSyntheticLoadMsg(uint32_t periodUs) {
+    return (uint32_t)SYNTHETIC_LOAD | (periodUs << 8);
+}
 
-static const char *getNameForMAX6958Register(uint8_t reg) {
-    switch(reg) {
-        case NoOp:
-            return "NoOp";
-        case DecodeMode:
-            return "DecodeMode";
-        case Intensity:
-            return "Intensity";
-        case ScanLimit:
-            return "ScanLimit";
-        case Configuration:
-            return "Configuration";
-        case FactoryReserved:
-            return "FactoryReserved";
-        case GpIo:
-            return "GpIo";
-        case DisplayTest:
-            return "DisplayTest";
-        case ReadKeyDebounced:
-            return "ReadKeyDebounced";
-        case ReadKeyPressed:
-            return "ReadKeyPressed";
-        case Digit0:
-            return "Digit0";
-        case Digit1:
-            return "Digit1";
-        case Digit2:
-            return "Digit2";
-        case Digit3:
-            return "Digit3";
-        case Segments:
-            return "Segments";
-        default:
-            return "<UNKNOWN>";
-    }
+static inline uint32_t packSyntheticSendMsg(uint32_t periodUs) {
+    return (uint32_t)SYNTHETIC_SEND | (periodUs << 8);
 }
 
 class RuntimeState {
 public:
-    RuntimeState(Display display);
+    RuntimeState(Display &display);
 
     bool begin();
 
     inline void setCurrentState(State state) { currentState = state; }
     inline State getCurrentState() { return currentState; }
 
-    inline void setRegister(uint8_t reg, uint8_t value) { registers[reg] = value; }
-    inline uint8_t getRegister(uint8_t reg) { return registers[reg]; }
+    // Runs the command `state`, issued from `origin` (the REPL, or POST
+    // monitoring for ':'-prefixed commands).
+    inline void beginCommand(State state, State origin) {
+        commandOrigin = origin;
+        currentState = state;
+    }
+    // Returns to wherever the running command was issued from
+    inline void finishCommand() {
+        currentState = (commandOrigin == STATE_POST_MONITOR) ? STATE_POST_MONITOR : STATE_RETURN_TO_REPL;
+    }
 
     inline void resetTimestamp() { prevPrintedTimestamp = 0; }
     inline uint64_t nextPrintedTimestampDelta(uint64_t ts) {
@@ -129,107 +115,35 @@ public:
     }
 
     inline Display *display() { return &_display; }
+    inline Capture *capture() { return &_capture; }
+
+    // Bus activity, as seen from core0: any receive callback since the
+    // previous call counts. Only needs calling often enough to be accurate
+    // to the precision the caller cares about.
+    inline uint32_t getBusIdleMs(uint32_t nowMs) {
+        uint32_t count = _capture.getReceiveCount();
+        if (count != lastReceiveCount) {
+            lastReceiveCount = count;
+            lastBusActivityMs = nowMs;
+        }
+        return nowMs - lastBusActivityMs;
+    }
 
     inline uint8_t getXboxSdaPin() { return xboxSdaPin; }
     inline uint8_t getXboxSclPin() { return xboxSclPin; }
     inline void setXboxI2CPins(uint8_t sda, uint8_t scl) { xboxSdaPin = sda; xboxSclPin = scl; }
 
-    inline bool isPostCodeQueueFull() { return _postCodeQueue.isFull(); }
-    inline bool isPostCodeQueueEmpty() { return _postCodeQueue.isEmpty(); }
-
-    inline bool popPostCode(SegmentData *segDataOut) {
-        if (_postCodeQueue.getCount() > 0) {
-            return _postCodeQueue.pop((SegmentData*)segDataOut);
-        }
-        return false;
-    }
-    inline void clearPostCodeQueue() { _postCodeQueue.clean(); }
-
-    inline void setSegmentCode(uint8_t segmentByte, uint16_t codeWord) {
-        uint8_t code_idx = 0;
-        switch (segmentByte & SEGMENT_INDEX_MASK) {
-            case 1:
-                code_idx = 0;
-                break;
-            case 2:
-                code_idx = 1;
-                break;
-            case 4:
-                code_idx = 2;
-                break;
-            case 8:
-                code_idx = 3;
-                break;
-            default:
-                return;
-        }
-
-        codeWords[code_idx] = codeWord;
-        currSegment = SegmentByte(segmentByte);
-    }
-
-    inline bool isCodeReady() {
-        // Codes come in MSB-first (index order: 8, 4, 2, 1)
-        // When index is 1, full code was transmitted from console
-        return currSegment.index() == 1;
-    }
-
-    inline void enqueueCode() {
-        SegmentData segData = {
-            .code = assembleCode(codeWords),
-            .flavor = currSegment.flavor(),
-            .timestamp = now_us64(),
-        };
-        pushPostCode(&segData);
-        putCodeCache(segData.flavor, segData.code);
-        resetCodeWords();
-        currSegment = SegmentByte(0);
-    }
-
-    inline uint64_t getCachedCode(CodeIndex index) {
-        if (index >= CODE_IDX_MAX) {
-            return 0;
-        }
-
-        return codeCache[index];
-    }
 private:
     uint64_t prevPrintedTimestamp = 0;
-
-    SegmentByte currSegment = SegmentByte(0);
-
-    uint16_t codeWords[POST_CODE_WORD_COUNT] = {0};
-    uint64_t codeCache[CODE_IDX_MAX] = {0};
+    uint32_t lastReceiveCount = 0;
+    uint32_t lastBusActivityMs = 0;
 
     State currentState = STATE_POST_MONITOR;
-    uint8_t registers[MAX6958_REGISTER_SIZE];
+    State commandOrigin = STATE_REPL;
     bool initialized = false;
     uint8_t xboxSdaPin = PIN_SDA_XBOX;
     uint8_t xboxSclPin = PIN_SCL_XBOX;
 
-    Display  _display;
-    // Create a queue for POST codes
-    cppQueue _postCodeQueue;
-
-    inline void pushPostCode(SegmentData* segData) {
-        if (!isPostCodeQueueFull()) {
-            _postCodeQueue.push(segData);
-        }
-    }
-    
-    inline bool putCodeCache(CodeFlavor flavor, uint64_t code) {
-        uint8_t index = getCodeIndexForFlavor(flavor);
-        if (index == CODE_IDX_INVALID) {
-            return false;
-        }
-        codeCache[index] = code;
-        return true;
-    }
-
-    inline void resetCodeWords() {
-        codeWords[0] = 0;
-        codeWords[1] = 0;
-        codeWords[2] = 0;
-        codeWords[3] = 0;
-    }
+    Display &_display;
+    Capture  _capture;
 };
\ No newline at end of file
@@ -1,13 +1,31 @@
 #pragma once
 
 #include <Arduino.h>
-#include <EEPROM.h>
 #include <CRC.h>
+#include "alarm.h"
+#include "filter.h"
+#include "journal.h"
+#include "profile.h"
+#include "sink.h"
 
-#define CFG_VERSION  2
-#define CONFIG_ADDR  0x0
-#define EEPROM_SIZE  256
+// v1/v2: single ConfigHeader + ConfigData struct at the start of EEPROM
+// v3:    TLV records in the append-only ConfigJournal
+#define CFG_VERSION  3
+
+// Save policy: saves are deferred until the Xbox bus has been quiet for
+// CFG_COMMIT_IDLE_MS, and several saves in quick succession only commit
+// once. On RP2040 a page program is short enough to happen anyway after
+// CFG_COMMIT_MAX_DEFER_MS; ESP32 and Teensy pay far more per page (see
+// JournalStorage) and are only spared by how rarely a save is that overdue.
+// Compacting a full journal always waits for idle.
+#define CFG_COMMIT_DEBOUNCE_MS  500
+#define CFG_COMMIT_IDLE_MS      250
+#define CFG_COMMIT_MAX_DEFER_MS 10000
+
+/* Pre-journal (v1/v2) layout, only read for migration */
 #define CONFIG_MAGIC 0x30474643 // CFG0
+#define LEGACY_V1_DATA_SIZE 4
+#define LEGACY_V2_DATA_SIZE 6
 
 typedef struct {
     uint32_t magic;                  /* 0x00 */
@@ -23,11 +41,30 @@ typedef struct {
     uint8_t  post_print_timestamps;  /* 0x03 */
     uint8_t  xbox_sda_pin;           /* 0x04 */
     uint8_t  xbox_scl_pin;           /* 0x05 */
-} ConfigData, *PConfigData;          /* Total len: 0x06 */
+    uint16_t coalesce_interval_ms;   /* 0x06 */
+    uint8_t  post_exact;             /* 0x08 */
+    uint8_t  filter_flavors;         /* 0x09 */
+    CodeRule filter_rules[CODE_FILTER_MAX_RULES]; /* 0x10 */
+    uint16_t session_idle_ms;        /* 0x70 */
+    uint8_t  session_reset_flavors;  /* 0x72 */
+    uint8_t  milestone_flavors[PROFILE_MAX_MILESTONES]; /* 0x73 */
+    uint8_t  session_split_fall;     /* 0x77 */
+    uint64_t session_reset_code;     /* 0x78 */
+    uint64_t milestone_codes[PROFILE_MAX_MILESTONES];   /* 0x80 */
+    uint8_t  fault_pin;              /* 0xA0 */
+    uint8_t  fault_mode;             /* 0xA1 */
+    uint16_t fault_hold_ms;          /* 0xA2 */
+    uint8_t  sink_usb_format;        /* 0xA4 */
+    uint8_t  sink_uart_format;       /* 0xA5 */
+    uint8_t  sink_null_format;       /* 0xA6 */
+    uint32_t sink_uart_baud;         /* 0xA8 */
+} ConfigData, *PConfigData;          /* Total len: 0xB0 (incl. padding) */
 
 const uint8_t CFG_HEADER_SIZE = sizeof(ConfigHeader);
 const uint8_t CFG_DATA_SIZE = sizeof(ConfigData);
 
+// Doubles as the TLV tag each field is stored under. Tags are never reused
+// or renumbered; new fields get new tags.
 enum ConfigValues {
     CFG_DISPLAY_MIRRORED = 0,
     CFG_ROTATION_PORTRAIT = 1,
@@ -35,6 +72,23 @@ enum ConfigValues {
     CFG_PRINT_TIMESTAMPS = 3,
     CFG_XBOX_SDA_PIN = 4,
     CFG_XBOX_SCL_PIN = 5,
+    CFG_COALESCE_INTERVAL_MS = 6,
+    CFG_POST_EXACT = 7,
+    CFG_FILTER_FLAVORS = 8,
+    CFG_FILTER_RULES = 9,
+    CFG_SESSION_IDLE_MS = 10,
+    CFG_SESSION_RESET_FLAVORS = 11,
+    CFG_SESSION_RESET_CODE = 12,
+    CFG_MILESTONE_FLAVORS = 13,
+    CFG_MILESTONE_CODES = 14,
+    CFG_SESSION_SPLIT_FALL = 15,
+    CFG_FAULT_PIN = 16,
+    CFG_FAULT_MODE = 17,
+    CFG_FAULT_HOLD_MS = 18,
+    CFG_SINK_USB_FORMAT = 19,
+    CFG_SINK_UART_FORMAT = 20,
+    CFG_SINK_NULL_FORMAT = 21,
+    CFG_SINK_UART_BAUD = 22,
 };
 
 // Default configuration values
@@ -45,83 +99,213 @@ const ConfigData DEFAULT_CONFIG = {
     .post_print_timestamps = 1,
     .xbox_sda_pin = PIN_SDA_XBOX,
     .xbox_scl_pin = PIN_SCL_XBOX,
+    .coalesce_interval_ms = 1000,
+    .post_exact = 1,
+    .filter_flavors = FLAVOR_MASK_ALL,
+    .filter_rules = {},
+    .session_idle_ms = 5000,
+    .session_reset_flavors = 0,
+    .milestone_flavors = {},
+    .session_split_fall = 1,
+    .session_reset_code = 0,
+    .milestone_codes = {},
+    .fault_pin = FAULT_PIN_NONE,
+    .fault_mode = 0,
+    .fault_hold_ms = 2000,
+    .sink_usb_format = SINK_FORMAT_TEXT,
+    .sink_uart_format = SINK_FORMAT_OFF,
+    .sink_null_format = SINK_FORMAT_OFF,
+    .sink_uart_baud = SINK_UART_DEFAULT_BAUD,
 };
 
-// RP2040/ESP32 emulate EEPROM in flash and need an explicit begin(size) /
-// commit() / end(); Teensy's EEPROM is written through directly, no buffering.
-#if defined(ARDUINO_ARCH_RP2040) || defined(ARDUINO_ARCH_ESP32)
-#define EEPROM_NEEDS_COMMIT 1
-#else
-#define EEPROM_NEEDS_COMMIT 0
-#endif
+typedef struct {
+    uint8_t tag;
+    uint8_t offset;
+    uint8_t size;
+    const char *name; // as exposed over the RPC interface
+} ConfigField;
 
-class Config {
-    public:
-        ~Config() {
-#if EEPROM_NEEDS_COMMIT
-            EEPROM.end();
-#endif
+#define CFG_FIELD(tag, member) { tag, offsetof(ConfigData, member), sizeof(((ConfigData *)0)->member), #member }
+
+// Every persisted field, in TLV order
+static const ConfigField CONFIG_FIELDS[] = {
+    CFG_FIELD(CFG_DISPLAY_MIRRORED, disp_mirrored),
+    CFG_FIELD(CFG_ROTATION_PORTRAIT, disp_rotation_portrait),
+    CFG_FIELD(CFG_PRINT_COLORS, serial_print_colors),
+    CFG_FIELD(CFG_PRINT_TIMESTAMPS, post_print_timestamps),
+    CFG_FIELD(CFG_XBOX_SDA_PIN, xbox_sda_pin),
+    CFG_FIELD(CFG_XBOX_SCL_PIN, xbox_scl_pin),
+    CFG_FIELD(CFG_COALESCE_INTERVAL_MS, coalesce_interval_ms),
+    CFG_FIELD(CFG_POST_EXACT, post_exact),
+    CFG_FIELD(CFG_FILTER_FLAVORS, filter_flavors),
+    CFG_FIELD(CFG_FILTER_RULES, filter_rules),
+    CFG_FIELD(CFG_SESSION_IDLE_MS, session_idle_ms),
+    CFG_FIELD(CFG_SESSION_RESET_FLAVORS, session_reset_flavors),
+    CFG_FIELD(CFG_SESSION_RESET_CODE, session_reset_code),
+    CFG_FIELD(CFG_MILESTONE_FLAVORS, milestone_flavors),
+    CFG_FIELD(CFG_MILESTONE_CODES, milestone_codes),
+    CFG_FIELD(CFG_SESSION_SPLIT_FALL, session_split_fall),
+    CFG_FIELD(CFG_FAULT_PIN, fault_pin),
+    CFG_FIELD(CFG_FAULT_MODE, fault_mode),
+    CFG_FIELD(CFG_FAULT_HOLD_MS, fault_hold_ms),
+    CFG_FIELD(CFG_SINK_USB_FORMAT, sink_usb_format),
+    CFG_FIELD(CFG_SINK_UART_FORMAT, sink_uart_format),
+    CFG_FIELD(CFG_SINK_NULL_FORMAT, sink_null_format),
+    CFG_FIELD(CFG_SINK_UART_BAUD, sink_uart_baud),
+};
+const uint8_t CFG_FIELD_COUNT = sizeof(CONFIG_FIELDS) / sizeof(CONFIG_FIELDS[0]);
+static_assert(2 * CFG_FIELD_COUNT + CFG_DATA_SIZE <= JOURNAL_MAX_PAYLOAD, "Config TLV record must fit a journal page");
+
+static inline const ConfigField *findConfigField(uint8_t tag) {
+    for (uint8_t i = 0; i < CFG_FIELD_COUNT; i++) {
+        if (CONFIG_FIELDS[i].tag == tag) {
+            return &CONFIG_FIELDS[i];
         }
+    }
+    return NULL;
+}
+
+// Schema migrations, applied in order from the version a config was
+// written with up to CFG_VERSION. Fields a record doesn't carry are already
+// at their DEFAULT_CONFIG value by then, so a step is only needed when the
+// meaning of an existing field changes.
+typedef struct {
+    uint8_t fromVersion;
+    void (*apply)(ConfigData &data);
+} ConfigMigration;
+
+static void migrateConfigV1(ConfigData &data) {
+    // v1 had no xbox_sda_pin/xbox_scl_pin yet
+    data.xbox_sda_pin = DEFAULT_CONFIG.xbox_sda_pin;
+    data.xbox_scl_pin = DEFAULT_CONFIG.xbox_scl_pin;
+}
+
+static const ConfigMigration CONFIG_MIGRATIONS[] = {
+    { 1, migrateConfigV1 },
+    // v2 -> v3 only changed the storage format
+};
 
+enum ConfigCommitResult {
+    CFG_COMMIT_NONE = 0,
+    CFG_COMMIT_DONE,
+    CFG_COMMIT_FAILED,
+};
+
+class Config {
+    public:
         bool begin() {
-#if EEPROM_NEEDS_COMMIT
-            EEPROM.begin(EEPROM_SIZE);
-#endif
-            ConfigHeader tmpHeader = {0};
-            EEPROM.get(CONFIG_ADDR, tmpHeader);
-
-            if (tmpHeader.magic != CONFIG_MAGIC) {
-                // Invalid config, initialize with defaults
-                initDefaultConfig();
-                return true;
+            data = DEFAULT_CONFIG;
+            initialized = true;
+
+            if (!journal.begin()) {
+                return false;
             }
 
-            if (tmpHeader.version < CFG_VERSION) {
-                // upgradeConfig() reads the old (smaller) data itself, since
-                // its on-disk layout/size differs from the current one, then
-                // saves it back out in the current layout.
-                if (!upgradeConfig(tmpHeader)) {
-                    initDefaultConfig();
-                }
+            uint8_t payload[JOURNAL_MAX_PAYLOAD];
+            uint8_t length = 0;
+            uint8_t version = 0;
+            if (journal.readNewest(JOURNAL_RECORD_CONFIG, payload, &length, &version)) {
+                decodeTlv(payload, length);
+                migrate(version);
                 return true;
             }
 
-            if (tmpHeader.data_length != CFG_DATA_SIZE) {
-                // Invalid config, initialize with defaults
-                initDefaultConfig();
-                return true;
+            // No journal record yet, carry over a pre-journal config if
+            // there is one and write it back out in the current format.
+            if (loadLegacy()) {
+                save();
             }
+            return true;
+        }
 
-            // Read data
-            EEPROM.get(CONFIG_ADDR + CFG_HEADER_SIZE, data);
+        // Marks the config for saving. The write itself happens from
+        // service() once the bus is idle (or commitNow()).
+        bool save() {
+            if (!initialized) return false;
 
-            // Verify checksum
-            uint16_t calcChecksum = calcCRC16((uint8_t*)&data, CFG_DATA_SIZE);
-            if (calcChecksum != tmpHeader.checksum) {
-                // Checksum mismatch, initialize with defaults
-                initDefaultConfig();
-                return true;
-            }
+            markPending();
+            dirty = true;
+            return true;
+        }
 
-            header = tmpHeader;
-            initialized = true;
+        // The learned boot model (see BootModel) is stored as its own
+        // journal record, saved by the same policy as the config.
+        bool loadBootModel(uint8_t *payload, uint8_t *length, uint8_t *version) {
+            return initialized && journal.readNewest(JOURNAL_RECORD_BOOT_MODEL, payload, length, version);
+        }
+
+        bool saveBootModel(uint8_t version, const uint8_t *payload, uint8_t length) {
+            if (!initialized || length > JOURNAL_MAX_PAYLOAD) return false;
+
+            memcpy(modelPayload, payload, length);
+            modelLength = length;
+            modelVersion = version;
+            markPending();
+            modelDirty = true;
             return true;
         }
 
-        bool save() {
+        bool isSavePending() const { return dirty || modelDirty; }
+        uint16_t freeJournalPages() const { return journal.freePages(); }
+
+        // Commits a pending save according to the save policy above. Meant
+        // to be called every loop() iteration. Boot model saves alone
+        // report CFG_COMMIT_NONE: a new or replaced model is saved as soon
+        // as it's learned, refined timings once every BOOT_MODEL_SAVE_BOOTS
+        // boots, so they'd be noise.
+        ConfigCommitResult service(uint32_t nowMs, uint32_t busIdleMs) {
+            if (!isSavePending() || nowMs - lastSaveRequestMs < CFG_COMMIT_DEBOUNCE_MS) {
+                return CFG_COMMIT_NONE;
+            }
+
+            bool busIdle = busIdleMs >= CFG_COMMIT_IDLE_MS;
+            bool overdue = nowMs - dirtySinceMs >= CFG_COMMIT_MAX_DEFER_MS;
+            if (!busIdle && (journal.isFull() || !overdue)) {
+                return CFG_COMMIT_NONE;
+            }
+
+            bool wasConfig = dirty;
+            if (!commitPending(busIdle)) {
+                return CFG_COMMIT_FAILED;
+            }
+            return wasConfig ? CFG_COMMIT_DONE : CFG_COMMIT_NONE;
+        }
+
+        // Writes the config (and a pending boot model) immediately. A full
+        // journal is only compacted if `allowErase` is set; otherwise this
+        // fails and the save stays pending.
+        bool commitNow(bool allowErase) {
             if (!initialized) return false;
-            
-            // Calculate new checksum
-            header.checksum = calcCRC16((uint8_t*)&data, CFG_DATA_SIZE);
-            
-            // Write header and data
-            EEPROM.put(CONFIG_ADDR, header);
-            EEPROM.put(CONFIG_ADDR + CFG_HEADER_SIZE, data);
-#if EEPROM_NEEDS_COMMIT
-            return EEPROM.commit();
-#else
+
+            dirty = true;
+            return commitPending(allowErase);
+        }
+
+        // Compacts the journal down to the newest record of each type and
+        // writes out a pending save, so the next saves have as many pages
+        // available as possible.
+        bool compact() {
+            return journal.compact() && commitPending(false);
+        }
+
+        // Raw field access by TLV tag, for the RPC interface
+        bool getField(uint8_t tag, uint8_t *out, uint8_t *size) const {
+            const ConfigField *field = findConfigField(tag);
+            if (field == NULL) {
+                return false;
+            }
+            memcpy(out, (const uint8_t *)&data + field->offset, field->size);
+            *size = field->size;
+            return true;
+        }
+
+        bool setField(uint8_t tag, const uint8_t *in, uint8_t size) {
+            const ConfigField *field = findConfigField(tag);
+            if (field == NULL || field->size != size) {
+                return false;
+            }
+            memcpy((uint8_t *)&data + field->offset, in, size);
             return true;
-#endif
         }
 
         // Getters
@@ -131,6 +315,24 @@ class Config {
         bool isPostPrintTimestamps() const { return data.post_print_timestamps; }
         uint8_t getXboxSdaPin() const { return data.xbox_sda_pin; }
         uint8_t getXboxSclPin() const { return data.xbox_scl_pin; }
+        uint16_t getCoalesceIntervalMs() const { return data.coalesce_interval_ms; }
+        bool isPostExact() const { return data.post_exact; }
+        uint8_t getFilterFlavors() const { return data.filter_flavors; }
+        const CodeRule *getFilterRules() const { return data.filter_rules; }
+        uint16_t getSessionIdleMs() const { return data.session_idle_ms; }
+        uint8_t getSessionResetFlavors() const { return data.session_reset_flavors; }
+        uint64_t getSessionResetCode() const { return data.session_reset_code; }
+        bool isSessionSplitFall() const { return data.session_split_fall; }
+        uint8_t getFaultPin() const { return data.fault_pin; }
+        uint8_t getFaultMode() const { return data.fault_mode; }
+        uint16_t getFaultHoldMs() const { return data.fault_hold_ms; }
+        SinkFormat getSinkFormat(SinkId id) const {
+            const uint8_t formats[SINK_COUNT] = { data.sink_usb_format, data.sink_uart_format, data.sink_null_format };
+            return (SinkFormat)formats[id];
+        }
+        uint32_t getSinkUartBaud() const { return data.sink_uart_baud; }
+        const uint8_t *getMilestoneFlavors() const { return data.milestone_flavors; }
+        const uint64_t *getMilestoneCodes() const { return data.milestone_codes; }
 
         // Setters
         void setDisplayMirrored(bool value) { data.disp_mirrored = value; }
@@ -138,58 +340,189 @@ class Config {
         void setSerialPrintColors(bool value) { data.serial_print_colors = value; }
         void setPostPrintTimestamps(bool value) { data.post_print_timestamps = value; }
         void setXboxI2CPins(uint8_t sda, uint8_t scl) { data.xbox_sda_pin = sda; data.xbox_scl_pin = scl; }
+        void setCoalesceIntervalMs(uint16_t ms) { data.coalesce_interval_ms = ms; }
+        void setFilterFlavors(uint8_t flavors) { data.filter_flavors = flavors & FLAVOR_MASK_ALL; }
+        // Stores a filter or fault rule in a free slot, returns false if there is none
+        bool addCodeRule(const CodeRule &rule) {
+            for (CodeRule &slot : data.filter_rules) {
+                if (slot.kind == CODE_RULE_UNUSED) {
+                    slot = rule;
+                    return true;
+                }
+            }
+            return false;
+        }
+        void setSessionIdleMs(uint16_t ms) { data.session_idle_ms = ms; }
+        void setFaultPin(uint8_t pin) { data.fault_pin = pin; }
+        void setFaultMode(uint8_t mode) { data.fault_mode = mode; }
+        void setFaultHoldMs(uint16_t ms) { data.fault_hold_ms = ms; }
+        void setSinkFormat(SinkId id, SinkFormat format) {
+            uint8_t *formats[SINK_COUNT] = { &data.sink_usb_format, &data.sink_uart_format, &data.sink_null_format };
+            *formats[id] = format;
+        }
+        void setSinkUartBaud(uint32_t baud) { data.sink_uart_baud = baud; }
+        void setSessionResetCode(uint8_t flavors, uint64_t code) {
+            data.session_reset_flavors = flavors & FLAVOR_MASK_ALL;
+            data.session_reset_code = code;
+        }
+        // Stores a milestone in a free slot, returns false if there is none
+        bool addMilestone(CodeFlavor flavor, uint64_t code) {
+            for (uint8_t i = 0; i < PROFILE_MAX_MILESTONES; i++) {
+                if (data.milestone_flavors[i] == 0) {
+                    data.milestone_flavors[i] = flavor;
+                    data.milestone_codes[i] = code;
+                    return true;
+                }
+            }
+            return false;
+        }
+        void clearMilestones() {
+            memset(data.milestone_flavors, 0, sizeof(data.milestone_flavors));
+            memset(data.milestone_codes, 0, sizeof(data.milestone_codes));
+        }
+        void clearFilter() {
+            data.filter_flavors = FLAVOR_MASK_ALL;
+            clearCodeRules(CODE_RULE_INCLUDE);
+            clearCodeRules(CODE_RULE_EXCLUDE);
+        }
+        void clearFaultRules() { clearCodeRules(CODE_RULE_FAULT); }
 
         // Togglers
         void toggleDisplayMirrored() { data.disp_mirrored = !data.disp_mirrored; }
         void toggleRotationPortrait() { data.disp_rotation_portrait = !data.disp_rotation_portrait; }
         void toggleSerialPrintColors() { data.serial_print_colors = !data.serial_print_colors; }
         void togglePostPrintTimestamps() { data.post_print_timestamps = !data.post_print_timestamps; }
+        void togglePostExact() { data.post_exact = !data.post_exact; }
+        void toggleSessionSplitFall() { data.session_split_fall = !data.session_split_fall; }
 
     private:
         bool initialized = false;
-        ConfigHeader header = {0};
+        bool dirty = false;
+        bool modelDirty = false;
+        uint32_t dirtySinceMs = 0;
+        uint32_t lastSaveRequestMs = 0;
         ConfigData data = {0};
+        ConfigJournal journal;
 
-        void initDefaultConfig() {
-            header.magic = CONFIG_MAGIC;
-            header.version = CFG_VERSION;
-            header.data_length = CFG_DATA_SIZE;
-            data = DEFAULT_CONFIG;
-            initialized = true;
+        uint8_t modelPayload[JOURNAL_MAX_PAYLOAD];
+        uint8_t modelLength = 0;
+        uint8_t modelVersion = 0;
+
+        void clearCodeRules(CodeRuleKind kind) {
+            for (CodeRule &rule : data.filter_rules) {
+                if (rule.kind == kind) {
+                    memset(&rule, 0, sizeof(rule));
+                }
+            }
+        }
+
+        void markPending() {
+            uint32_t now = millis();
+            if (!isSavePending()) {
+                dirtySinceMs = now;
+            }
+            lastSaveRequestMs = now;
+        }
+
+        bool appendRecord(JournalRecordType type, uint8_t version, const uint8_t *payload, uint8_t length, bool allowErase) {
+            if (journal.isFull()) {
+                return allowErase && journal.compactAndAppend(type, version, payload, length);
+            }
+            return journal.append(type, version, payload, length);
         }
 
-        bool upgradeConfig(ConfigHeader& oldHeader) {
-            // Perform version-specific upgrades
-            switch (oldHeader.version) {
-                case 1: {
-                    // v1's ConfigData was 4 bytes (no xbox_sda_pin/xbox_scl_pin
-                    // yet). Read exactly that many bytes so we don't pull in
-                    // unrelated flash contents past the old struct's length.
-                    struct {
-                        uint8_t disp_mirrored;
-                        uint8_t disp_rotation_portrait;
-                        uint8_t serial_print_colors;
-                        uint8_t post_print_timestamps;
-                    } oldData;
-                    EEPROM.get(CONFIG_ADDR + CFG_HEADER_SIZE, oldData);
-                    data.disp_mirrored = oldData.disp_mirrored;
-                    data.disp_rotation_portrait = oldData.disp_rotation_portrait;
-                    data.serial_print_colors = oldData.serial_print_colors;
-                    data.post_print_timestamps = oldData.post_print_timestamps;
-                    data.xbox_sda_pin = DEFAULT_CONFIG.xbox_sda_pin;
-                    data.xbox_scl_pin = DEFAULT_CONFIG.xbox_scl_pin;
+        bool commitPending(bool allowErase) {
+            if (dirty) {
+                uint8_t payload[JOURNAL_MAX_PAYLOAD];
+                uint8_t length = encodeTlv(payload);
+                if (!appendRecord(JOURNAL_RECORD_CONFIG, CFG_VERSION, payload, length, allowErase)) {
+                    return false;
+                }
+                dirty = false;
+            }
+            if (modelDirty) {
+                if (!appendRecord(JOURNAL_RECORD_BOOT_MODEL, modelVersion, modelPayload, modelLength, allowErase)) {
+                    return false;
+                }
+                modelDirty = false;
+            }
+            return true;
+        }
+
+        uint8_t encodeTlv(uint8_t *out) {
+            uint8_t len = 0;
+            for (uint8_t i = 0; i < CFG_FIELD_COUNT; i++) {
+                const ConfigField &field = CONFIG_FIELDS[i];
+                out[len++] = field.tag;
+                out[len++] = field.size;
+                memcpy(out + len, (uint8_t *)&data + field.offset, field.size);
+                len += field.size;
+            }
+            return len;
+        }
+
+        void decodeTlv(const uint8_t *in, uint8_t length) {
+            uint8_t pos = 0;
+            while (pos + 2 <= length) {
+                uint8_t tag = in[pos];
+                uint8_t size = in[pos + 1];
+                pos += 2;
+                if (pos + size > length) {
                     break;
                 }
 
+                // Unknown tags (written by a newer firmware) are skipped,
+                // size mismatches keep the default.
+                const ConfigField *field = findConfigField(tag);
+                if (field != NULL && field->size == size) {
+                    memcpy((uint8_t *)&data + field->offset, in + pos, size);
+                }
+                pos += size;
+            }
+        }
+
+        void migrate(uint8_t fromVersion) {
+            for (const ConfigMigration &step : CONFIG_MIGRATIONS) {
+                if (step.fromVersion >= fromVersion) {
+                    step.apply(data);
+                }
+            }
+        }
+
+        bool loadLegacy() {
+            ConfigHeader legacyHeader = {0};
+            journal.readRaw(0, &legacyHeader, CFG_HEADER_SIZE);
+            if (legacyHeader.magic != CONFIG_MAGIC) {
+                return false;
+            }
+
+            uint8_t legacy[LEGACY_V2_DATA_SIZE];
+            switch (legacyHeader.version) {
+                case 1:
+                    // Read exactly v1's 4 bytes so we don't pull in unrelated
+                    // flash contents past the old struct's length.
+                    journal.readRaw(CFG_HEADER_SIZE, legacy, LEGACY_V1_DATA_SIZE);
+                    break;
+                case 2:
+                    if (legacyHeader.data_length != LEGACY_V2_DATA_SIZE) {
+                        return false;
+                    }
+                    journal.readRaw(CFG_HEADER_SIZE, legacy, LEGACY_V2_DATA_SIZE);
+                    if (calcCRC16(legacy, LEGACY_V2_DATA_SIZE) != legacyHeader.checksum) {
+                        return false;
+                    }
+                    data.xbox_sda_pin = legacy[4];
+                    data.xbox_scl_pin = legacy[5];
+                    break;
                 default:
                     return false; // Unknown version
             }
 
-            // Update version number and length
-            oldHeader.version = CFG_VERSION;
-            oldHeader.data_length = CFG_DATA_SIZE;
-            header = oldHeader;
-            initialized = true;
-            return save();
+            data.disp_mirrored = legacy[0];
+            data.disp_rotation_portrait = legacy[1];
+            data.serial_print_colors = legacy[2];
+            data.post_print_timestamps = legacy[3];
+            migrate(legacyHeader.version);
+            return true;
         }
 };
@@ -1,8 +1,13 @@
 
 #include "display.h"
 
+#if BOARD_HAS_DISPLAY
+
 #define FONT_SMALL u8g2_font_6x10_tf
 #define FONT_LARGE u8g2_font_profont22_tr
+#define FONT_HISTORY u8g2_font_5x8_tf // fits a page
+
+static const char HEX_DIGITS[] = "0123456789ABCDEF";
 
 bool Display::begin() {
     // U8g2's "2ND_HW_I2C" HAL is hardwired to talk to Wire1 and only ever
@@ -20,10 +25,10 @@ bool Display::begin() {
 
     display.setI2CAddress(address << 1);
     display.begin();
-
-    setRotation(currentRotation);
+    hasHistoryView = display.getBufferTileHeight() == HISTORY_ROWS;
 
     initialized = true;
+    setRotation(currentRotation);
     return true;
 }
 
@@ -59,11 +64,16 @@ void Display::printCenteredH(const char *text, int16_t y) {
     display.drawStr((display.getDisplayWidth() - w) / 2, y, text);
 }
 
-void Display::printCode(uint64_t code, const char *flavor) {
+void Display::printCode(uint64_t code, CodeFlavor flavor) {
     if (!initialized) {
         return;
     }
 
+    if (isHistoryView()) {
+        pushHistory(code, flavor);
+        return;
+    }
+
     if (isDisplayPortrait() && cursorY >= display.getDisplayWidth()) {
         clear();
     }
@@ -72,16 +82,16 @@ void Display::printCode(uint64_t code, const char *flavor) {
         clear();
     }
 
-    snprintf(codeBuf, CODEBUF_SZ, "%04llX", (unsigned long long)code);
-
     if (isDisplayLandscape()) {
-        display.setFont(FONT_LARGE);
-        printCenteredH(codeBuf, display.getDisplayHeight() - 4);
-
-        // Print Code flavor in the top-left corner
-        display.setFont(FONT_SMALL);
-        display.drawStr(0, 8, flavor);
+        CodeIndex index = getCodeIndexForFlavor(flavor);
+        if (glyphCacheValid && index != CODE_IDX_INVALID) {
+            drawCodeCached(code, index);
+        } else {
+            drawCodeText(code, flavor);
+        }
+        drawStatus();
     } else {
+        formatCode(code);
         display.setFont(FONT_SMALL);
         cursorY += display.getMaxCharHeight() + 1;
         display.drawStr(0, cursorY, codeBuf);
@@ -89,3 +99,261 @@ void Display::printCode(uint64_t code, const char *flavor) {
 
     display.sendBuffer();
 }
+
+void Display::pushHistory(uint64_t code, CodeFlavor flavor) {
+    formatCode(code);
+    char *text = history[historyNext];
+    snprintf(text, HISTORY_TEXT_SZ, "%s %s", getStringForCodeFlavor(flavor), codeBuf);
+    historyNext = (historyNext + 1) % HISTORY_ROWS;
+    if (historyCount < HISTORY_ROWS) {
+        historyCount++;
+    }
+
+    if (historyStale) {
+        redrawHistory();
+        return;
+    }
+
+    // The page in the top row holds the oldest code. It gets the new one,
+    // then moving the start line by a row turns it into the bottom row.
+    // Mirrored, the rows run through the RAM the other way round.
+    uint8_t page = mirrored ? (startPage + HISTORY_ROWS - 1) % HISTORY_ROWS : startPage;
+    drawHistoryRow(page, text);
+    display.updateDisplayArea(0, page, display.getBufferTileWidth(), 1);
+    setStartPage(mirrored ? page : (startPage + 1) % HISTORY_ROWS);
+}
+
+void Display::redrawHistory() {
+    display.clearBuffer();
+    setStartPage(0);
+    for (uint8_t i = 0; i < historyCount; i++) {
+        uint8_t row = HISTORY_ROWS - historyCount + i; // oldest first, the newest at the bottom
+        uint8_t slot = (historyNext + HISTORY_ROWS - historyCount + i) % HISTORY_ROWS;
+        drawHistoryRow(mirrored ? HISTORY_ROWS - 1 - row : row, history[slot]);
+    }
+    display.sendBuffer();
+    historyStale = false;
+}
+
+// U8g2 draws in logical coordinates, which mirroring turns upside down
+void Display::drawHistoryRow(uint8_t page, const char *text) {
+    uint16_t stride = display.getBufferTileWidth() * 8;
+    memset(display.getBufferPtr() + page * stride, 0, stride);
+    display.setFont(FONT_HISTORY);
+    display.setFontPosTop();
+    display.drawStr(0, (mirrored ? HISTORY_ROWS - 1 - page : page) * 8, text);
+    display.setFontPosBaseline();
+}
+
+void Display::setStartPage(uint8_t page) {
+    if (!hasHistoryView || page == startPage) {
+        return;
+    }
+    startPage = page;
+
+    // Set Display Start Line, the same command on SSD1306 and SH1106
+    u8x8_t *u8x8 = display.getU8x8();
+    u8x8_cad_StartTransfer(u8x8);
+    u8x8_cad_SendCmd(u8x8, 0x40 | (page * 8));
+    u8x8_cad_EndTransfer(u8x8);
+}
+
+void Display::formatCode(uint64_t code) {
+    snprintf(codeBuf, CODEBUF_SZ, "%04llX", (unsigned long long)code);
+}
+
+// The landscape code view through U8g2: the code centered in the large
+// font, its flavor in the top-left corner
+void Display::drawCodeText(uint64_t code, CodeFlavor flavor) {
+    formatCode(code);
+    display.setFont(FONT_LARGE);
+    printCenteredH(codeBuf, display.getDisplayHeight() - 4);
+
+    display.setFont(FONT_SMALL);
+    display.drawStr(0, 8, getStringForCodeFlavor(flavor));
+}
+
+// Same picture as drawCodeText(), from the glyph cache
+void Display::drawCodeCached(uint64_t code, CodeIndex index) {
+    uint8_t digits = 4;
+    while (digits < 16 && (code >> (4 * digits)) != 0) {
+        digits++;
+    }
+    int16_t x = codeX[digits - 1];
+    for (int8_t shift = 4 * (digits - 1); shift >= 0; shift -= 4, x += digitAdvance) {
+        blit(digitGlyphs[(code >> shift) & 0xF], x);
+    }
+    blit(labelGlyphs[index], 0);
+}
+
+// Rasterises the digits and labels for the current rotation, unless they
+// already are. Portrait mode draws a list in the small font and keeps
+// using U8g2 for it.
+void Display::buildGlyphCache() {
+    // Mirroring turns the picture by 180 degrees, and with it the
+    // direction logical x runs in the buffer
+    int8_t direction = mirrored ? -1 : 1;
+    if (!isDisplayLandscape() || (glyphCacheValid && direction == glyphDirection)) {
+        return;
+    }
+
+    glyphCacheValid = false;
+    glyphDirection = direction;
+    bufferStride = display.getBufferTileWidth() * 8;
+
+    int16_t y = display.getDisplayHeight() - 4;
+    char digit[2] = {0};
+    for (uint8_t i = 0; i < 16; i++) {
+        digit[0] = HEX_DIGITS[i];
+        if (!rasterise(digitGlyphs[i], FONT_LARGE, digit, y)) {
+            return;
+        }
+    }
+    for (uint8_t i = 0; i < CODE_IDX_MAX; i++) {
+        if (!rasterise(labelGlyphs[i], FONT_SMALL, getStringForCodeFlavor(CODE_FLAVOR_FOR_INDEX[i]), 8)) {
+            return;
+        }
+    }
+
+    // The large font is monospaced, so a code's width only depends on its
+    // digit count
+    char text[17];
+    memset(text, '0', sizeof(text));
+    display.setFont(FONT_LARGE);
+    text[1] = '\0';
+    int16_t one = display.getStrWidth(text);
+    text[1] = '0';
+    text[2] = '\0';
+    digitAdvance = display.getStrWidth(text) - one;
+    for (uint8_t n = 1; n <= 16; n++) {
+        text[n] = '\0';
+        codeX[n - 1] = (display.getDisplayWidth() - display.getStrWidth(text)) / 2;
+        text[n] = '0';
+    }
+    glyphCacheValid = true;
+}
+
+// Draws `text` into a blank buffer and keeps the part of it that was
+// drawn on. False if that doesn't fit the strip.
+template <uint8_t W, uint8_t P>
+bool Display::rasterise(GlyphStrip<W, P> &strip, const uint8_t *font, const char *text, int16_t y) {
+    display.clearBuffer();
+    display.setFont(font);
+    display.drawStr(0, y, text);
+
+    const uint8_t *buf = display.getBufferPtr();
+    uint8_t pageCount = display.getBufferTileHeight();
+    int16_t firstX = bufferStride, lastX = -1;
+    int16_t firstPage = pageCount, lastPage = -1;
+    for (int16_t page = 0; page < pageCount; page++) {
+        for (int16_t x = 0; x < bufferStride; x++) {
+            if (buf[page * bufferStride + x]) {
+                firstX = x < firstX ? x : firstX;
+                lastX = x > lastX ? x : lastX;
+                firstPage = page < firstPage ? page : firstPage;
+                lastPage = page;
+            }
+        }
+    }
+
+    strip.x = 0;
+    strip.page = 0;
+    strip.pages = 0;
+    strip.width = 0;
+    if (lastX < 0) {
+        return true; // nothing drawn
+    }
+    if (lastX - firstX + 1 > W || lastPage - firstPage + 1 > P) {
+        return false;
+    }
+    strip.x = firstX;
+    strip.page = firstPage;
+    strip.pages = lastPage - firstPage + 1;
+    strip.width = lastX - firstX + 1;
+    for (uint8_t page = 0; page < strip.pages; page++) {
+        memcpy(strip.bits[page], buf + (firstPage + page) * bufferStride + firstX, strip.width);
+    }
+    return true;
+}
+
+// ORs a strip into the buffer, shifted by `dx` logical columns and clipped
+// to the screen
+template <uint8_t W, uint8_t P>
+void Display::blit(const GlyphStrip<W, P> &strip, int16_t dx) {
+    int16_t x = strip.x + glyphDirection * dx;
+    int16_t first = x < 0 ? -x : 0;
+    int16_t last = x + strip.width > bufferStride ? bufferStride - x : strip.width;
+    if (first >= last) {
+        return;
+    }
+
+    uint8_t *buf = display.getBufferPtr();
+    for (uint8_t page = 0; page < strip.pages; page++) {
+        uint8_t *dst = buf + (strip.page + page) * bufferStride;
+        const uint8_t *src = strip.bits[page];
+        for (int16_t col = first; col < last; col++) {
+            dst[x + col] |= src[col];
+        }
+    }
+}
+
+bool Display::benchmark(uint16_t count, uint32_t *textUs, uint32_t *cachedUs, uint32_t *sendUs) {
+    if (!initialized || !glyphCacheValid || count == 0) {
+        return false;
+    }
+
+    // Codes of every length, from a fixed LCG so both runs draw the same
+    uint64_t seed = 0x9E3779B97F4A7C15ull;
+    uint32_t start = now_us32();
+    for (uint16_t i = 0; i < count; i++) {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        display.clearBuffer();
+        drawCodeText(seed >> (4 * (i & 0xF)), CODE_FLAVOR_FOR_INDEX[i & 3]);
+    }
+    *textUs = (now_us32() - start) / count;
+
+    seed = 0x9E3779B97F4A7C15ull;
+    start = now_us32();
+    for (uint16_t i = 0; i < count; i++) {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        display.clearBuffer();
+        drawCodeCached(seed >> (4 * (i & 0xF)), (CodeIndex)(i & 3));
+    }
+    *cachedUs = (now_us32() - start) / count;
+
+    start = now_us32();
+    display.sendBuffer();
+    *sendUs = now_us32() - start;
+
+    clear();
+    display.sendBuffer();
+    return true;
+}
+
+void Display::setStatus(const char *text) {
+    if (strncmp(statusBuf, text, STATUSBUF_SZ - 1) == 0) {
+        return;
+    }
+    strncpy(statusBuf, text, STATUSBUF_SZ - 1);
+    statusBuf[STATUSBUF_SZ - 1] = '\0';
+
+    if (!initialized || !isDisplayLandscape() || isHistoryView()) {
+        return;
+    }
+    drawStatus();
+    display.sendBuffer();
+}
+
+void Display::drawStatus() {
+    // Blank the corner first, the previous status may have been longer
+    int16_t width = display.getDisplayWidth() / 2;
+    display.setFont(FONT_SMALL);
+    display.setDrawColor(0);
+    display.drawBox(display.getDisplayWidth() - width, 0, width, 10);
+    display.setDrawColor(1);
+
+    int16_t w = display.getStrWidth(statusBuf);
+    display.drawStr(display.getDisplayWidth() - w, 8, statusBuf);
+}
+
+#endif
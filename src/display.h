@@ -1,15 +1,37 @@
 #pragma once
 
-#include <Wire.h>
-#include <U8g2lib.h>
+#include "board.h"
+#include "codes.h"
 
-#define CODEBUF_SZ 18
+#define CODEBUF_SZ 18 // up to 16 hex digits (uint64_t) + newline + NUL
+#define STATUSBUF_SZ 12
 
 enum DisplayRotation {
     DISPLAY_LANDSCAPE = 0,
     DISPLAY_PORTRAIT = 1,
 };
 
+#if BOARD_HAS_DISPLAY
+
+#include <Wire.h>
+#include <U8g2lib.h>
+
+// The panel, chosen with -D DISPLAY_PANEL=DISPLAY_PANEL_... in
+// platformio.ini. Panels with 64 rows show a scrolling history of codes in
+// landscape instead of a single large one.
+#define DISPLAY_PANEL_SSD1306_128X32 0
+#define DISPLAY_PANEL_SSD1306_128X64 1
+#define DISPLAY_PANEL_SH1106_128X64  2
+#ifndef DISPLAY_PANEL
+#define DISPLAY_PANEL DISPLAY_PANEL_SSD1306_128X32
+#endif
+
+// The controller's display start line wraps around its 64 rows of RAM, so
+// the history view needs a panel that shows all of them: 8 pages, one row
+// of text each
+#define HISTORY_ROWS 8
+#define HISTORY_TEXT_SZ (4 + CODEBUF_SZ) // flavor, space, digits
+
 // Internal enum only used in `getInternalRotation` / `Display::setRotation` !
 enum INTERNAL_DisplayRotation {
     INTERNAL_DISP_ROTATION_LANDSCAPE = 0,
@@ -28,22 +50,34 @@ static inline const u8g2_cb_t *getInternalRotation(DisplayRotation rotation, boo
     return U8G2_R0;
 }
 
+// Text rasterised into the frame buffer's native layout (SSD1306: pages of
+// 8 rows, one byte per column and page), as it came out when drawn at a
+// logical x of 0: `pages` pages from `page`, `width` columns from native
+// column `x`
+template <uint8_t W, uint8_t P>
+struct GlyphStrip {
+    int16_t x;
+    uint8_t page;
+    uint8_t pages;
+    uint8_t width;
+    uint8_t bits[P][W];
+};
+
+#define GLYPH_DIGIT_MAX_WIDTH 16
+#define GLYPH_DIGIT_MAX_PAGES 4
+#define GLYPH_LABEL_MAX_WIDTH 24
+#define GLYPH_LABEL_MAX_PAGES 2
+
 class Display {
 public:
-    Display(uint8_t i2cAddress, uint8_t sdaPin, uint8_t sclPin, U8G2 displayInstance)
+    // `displayInstance` is used in place, so it has to outlive the Display
+    Display(uint8_t i2cAddress, uint8_t sdaPin, uint8_t sclPin, U8G2 &displayInstance) :
+        display(displayInstance)
     {
         _sdaPin = sdaPin;
         _sclPin = sclPin;
-        display = displayInstance;
         address = i2cAddress;
         currentRotation = DISPLAY_LANDSCAPE;
-        // Up to 16 hex digits (uint64_t) + newline + NUL
-        codeBuf = (char *) calloc(1, CODEBUF_SZ);
-    }
-    ~Display() {
-        if (codeBuf != NULL) {
-            free(codeBuf);
-        }
     }
     bool begin();
 
@@ -65,10 +99,12 @@ public:
         }
 
         display.setDisplayRotation(getInternalRotation(rotation, mirrored));
+        currentRotation = rotation;
+        buildGlyphCache();
         display.clearBuffer();
         cursorY = 0;
-
-        currentRotation = rotation;
+        setStartPage(0);
+        historyStale = true;
     }
 
     void toggleRotation() {
@@ -95,19 +131,89 @@ public:
 
         display.clearBuffer();
         cursorY = 0;
+        historyStale = true;
     }
 
     void printMessage(const char *header, const char *text, int durationMs = 1000);
     void printCenteredH(const char *text, int16_t y);
-    void printCode(uint64_t code, const char *flavor);
+    void printCode(uint64_t code, CodeFlavor flavor);
+    // Short status (e.g. boot progress) in the top-right corner of the
+    // landscape code view. Only redraws when the text changes.
+    void setStatus(const char *text);
+    // Average time to draw a code in the landscape view, through U8g2's
+    // text rendering and through the glyph cache, and to send a frame.
+    // False if there's no display or no cache for the current rotation.
+    bool benchmark(uint16_t count, uint32_t *textUs, uint32_t *cachedUs, uint32_t *sendUs);
 private:
     uint8_t address;
     uint8_t _sdaPin;
     uint8_t _sclPin;
     DisplayRotation currentRotation;
-    U8G2 display;
+    U8G2 &display;
     bool mirrored = false;
     bool initialized = false;
     int16_t cursorY = 0;
-    char *codeBuf = NULL;
+    char codeBuf[CODEBUF_SZ] = {0};
+    char statusBuf[STATUSBUF_SZ] = {0};
+
+    // The landscape code view's large hex digits and flavor labels, built
+    // whenever the rotation changes, so drawing a code doesn't have to
+    // decode glyphs from the compressed font or measure the text
+    GlyphStrip<GLYPH_DIGIT_MAX_WIDTH, GLYPH_DIGIT_MAX_PAGES> digitGlyphs[16];
+    GlyphStrip<GLYPH_LABEL_MAX_WIDTH, GLYPH_LABEL_MAX_PAGES> labelGlyphs[CODE_IDX_MAX];
+    int16_t codeX[16];             // where a code of n + 1 digits starts
+    int16_t digitAdvance = 0;
+    int8_t glyphDirection = 1;     // native columns per logical column
+    uint16_t bufferStride = 0;     // bytes per page
+    bool glyphCacheValid = false;
+
+    // The history view: one row of text per code, the newest at the bottom.
+    // A new code only sends its own page and moves the controller's display
+    // start line by a row, instead of sending the whole frame.
+    char history[HISTORY_ROWS][HISTORY_TEXT_SZ] = {};
+    uint8_t historyNext = 0;  // ring slot for the next code
+    uint8_t historyCount = 0;
+    bool hasHistoryView = false;
+    uint8_t startPage = 0;    // display start line / 8
+    bool historyStale = true; // the screen shows something else, redraw all of it
+
+    bool isHistoryView() { return hasHistoryView && isDisplayLandscape(); }
+    void pushHistory(uint64_t code, CodeFlavor flavor);
+    void redrawHistory();
+    void drawHistoryRow(uint8_t page, const char *text);
+    void setStartPage(uint8_t page);
+
+    void drawStatus();
+    void formatCode(uint64_t code);
+    void drawCodeText(uint64_t code, CodeFlavor flavor);
+    void drawCodeCached(uint64_t code, CodeIndex index);
+    void buildGlyphCache();
+    template <uint8_t W, uint8_t P>
+    bool rasterise(GlyphStrip<W, P> &strip, const uint8_t *font, const char *text, int16_t y);
+    template <uint8_t W, uint8_t P>
+    void blit(const GlyphStrip<W, P> &strip, int16_t dx);
+};
+
+#else
+
+// Headless build: the same interface, with nothing behind it, so every call
+// compiles away
+class Display {
+public:
+    bool begin() { return false; }
+    DisplayRotation getCurrentRotation() { return DISPLAY_LANDSCAPE; }
+    bool isDisplayLandscape() { return true; }
+    bool isDisplayPortrait() { return false; }
+    void setRotation(DisplayRotation) {}
+    void toggleRotation() {}
+    void setMirroring(bool) {}
+    void toggleMirroring() {}
+    void clear() {}
+    void printMessage(const char *, const char *, int = 1000) {}
+    void printCenteredH(const char *, int16_t) {}
+    void printCode(uint64_t, CodeFlavor) {}
+    void setStatus(const char *) {}
+    bool benchmark(uint16_t, uint32_t *, uint32_t *, uint32_t *) { return false; }
 };
+
+#endif
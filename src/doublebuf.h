@@ -0,0 +1,59 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "platform.h"
+
+// Two copies of something core0 reconfigures and the capture side reads on
+// every code: readers use the live copy while core0 rewrites the other one,
+// then publish() swaps them. Nothing is ever locked on the capture side.
+//
+// Each reader marks the copy it is on in its own slot (a reader that can
+// be interrupted by another needs a slot of its own). Before core0 rewrites
+// a copy, edit() waits for any reader that picked it up before the last
+// publish() to let go, which takes at most one reader's pass. A reader that
+// marks a copy just as it stops being live sees the swap when it re-checks
+// and moves on to the new one, so it never reads a copy under rewrite.
+template <typename T, uint8_t READERS>
+class DoubleBuffer {
+    static constexpr uint8_t IDLE = 0xFF;
+public:
+    explicit DoubleBuffer(const T &initial) : copies{initial, initial} {
+        for (std::atomic<uint8_t> &slot : reading) {
+            slot.store(IDLE, std::memory_order_relaxed);
+        }
+    }
+
+    // Reader side, around every use of the copy
+    inline const T &CAPTURE_FUNC(acquire)(uint8_t reader) {
+        uint8_t idx = live.load(std::memory_order_seq_cst);
+        while (true) {
+            reading[reader].store(idx, std::memory_order_seq_cst);
+            uint8_t now = live.load(std::memory_order_seq_cst);
+            if (now == idx) {
+                return copies[idx];
+            }
+            idx = now;
+        }
+    }
+    inline void CAPTURE_FUNC(release)(uint8_t reader) { reading[reader].store(IDLE, std::memory_order_release); }
+
+    // core0: the copy to fill in, once no reader is on it any more
+    T &edit() {
+        uint8_t next = live.load(std::memory_order_relaxed) ^ 1;
+        for (const std::atomic<uint8_t> &slot : reading) {
+            while (slot.load(std::memory_order_seq_cst) == next) {
+            }
+        }
+        return copies[next];
+    }
+    // core0: makes the copy edit() returned live
+    inline void publish() { live.store(live.load(std::memory_order_relaxed) ^ 1, std::memory_order_seq_cst); }
+    // core0: the live copy, only from the thread that calls edit()
+    inline const T &current() const { return copies[live.load(std::memory_order_relaxed)]; }
+
+private:
+    T copies[2];
+    std::atomic<uint8_t> live{0};
+    std::atomic<uint8_t> reading[READERS];
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <Arduino.h>
+#include "codes.h"
+#include "platform.h"
+
+#define CODE_FILTER_MAX_RULES 4
+
+// One bit per CodeIndex
+#define FLAVOR_BIT(idx) (1 << (idx))
+#define FLAVOR_MASK_ALL (FLAVOR_BIT(CODE_IDX_CPU) | FLAVOR_BIT(CODE_IDX_SP) | FLAVOR_BIT(CODE_IDX_SMC) | FLAVOR_BIT(CODE_IDX_OS))
+
+// Flavor -> FLAVOR_BIT, 0 for anything unknown. Branches instead of a
+// switch, which may become a flash-resident table lookup.
+static inline uint8_t CAPTURE_FUNC(flavorBit)(CodeFlavor flavor) {
+    return flavor == CODE_FLAVOR_CPU ? FLAVOR_BIT(CODE_IDX_CPU)
+        : flavor == CODE_FLAVOR_SP ? FLAVOR_BIT(CODE_IDX_SP)
+        : flavor == CODE_FLAVOR_SMC ? FLAVOR_BIT(CODE_IDX_SMC)
+        : flavor == CODE_FLAVOR_OS ? FLAVOR_BIT(CODE_IDX_OS)
+        : 0;
+}
+
+enum CodeRuleKind: uint8_t {
+    CODE_RULE_UNUSED = 0,
+    CODE_RULE_INCLUDE = 1,
+    CODE_RULE_EXCLUDE = 2,
+    CODE_RULE_FAULT = 3,   // not a filter rule, see FaultAlarm
+};
+
+// A code range rule as configured and persisted. Filter and fault ranges
+// share one table.
+typedef struct {
+    uint64_t first;
+    uint64_t last;
+    uint8_t flavors;     // FLAVOR_BITs the rule applies to
+    uint8_t kind;        // CodeRuleKind
+    uint8_t reserved[6];
+} CodeRule;              /* Total len: 0x18 */
+
+typedef struct {
+    uint64_t first;
+    uint64_t last;
+    uint8_t flavors;
+} CodeInterval;
+
+// Code ranges sorted by their first code, with overlapping ranges for the
+// same flavors merged, so a lookup can stop at the first range starting
+// past the code.
+class CodeIntervalTable {
+public:
+    void clear() { count = 0; }
+
+    void add(uint64_t first, uint64_t last, uint8_t flavors) {
+        if (first > last || count == CODE_FILTER_MAX_RULES) {
+            return;
+        }
+
+        uint8_t pos = count;
+        while (pos > 0 && intervals[pos - 1].first > first) {
+            intervals[pos] = intervals[pos - 1];
+            pos--;
+        }
+        intervals[pos] = CodeInterval{ first, last, flavors };
+        count++;
+        merge();
+    }
+
+    inline bool CAPTURE_FUNC(contains)(uint8_t flavorBit, uint64_t code) const {
+        for (uint8_t i = 0; i < count; i++) {
+            if (code < intervals[i].first) {
+                break;
+            }
+            if (code <= intervals[i].last && (intervals[i].flavors & flavorBit)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    uint8_t size() const { return count; }
+
+private:
+    CodeInterval intervals[CODE_FILTER_MAX_RULES];
+    uint8_t count = 0;
+
+    void merge() {
+        uint8_t out = 0;
+        for (uint8_t i = 1; i < count; i++) {
+            CodeInterval &prev = intervals[out];
+            if (intervals[i].flavors == prev.flavors && intervals[i].first <= prev.last + 1 && prev.last != UINT64_MAX) {
+                if (intervals[i].last > prev.last) {
+                    prev.last = intervals[i].last;
+                }
+            } else {
+                intervals[++out] = intervals[i];
+            }
+        }
+        count = count ? out + 1 : 0;
+    }
+};
+
+// Capture-time filter. A code passes if its flavor is enabled, no exclude
+// range matches, and - if its flavor has any include ranges - one of those
+// matches. Codes of unknown flavor aren't filtered.
+class CaptureFilter {
+public:
+    void compile(uint8_t enabledFlavors, const CodeRule *rules, uint8_t ruleCount) {
+        enabled = enabledFlavors;
+        included = 0;
+        include.clear();
+        exclude.clear();
+        for (uint8_t i = 0; i < ruleCount; i++) {
+            const CodeRule &rule = rules[i];
+            if (rule.kind == CODE_RULE_INCLUDE) {
+                include.add(rule.first, rule.last, rule.flavors);
+                included |= rule.flavors;
+            } else if (rule.kind == CODE_RULE_EXCLUDE) {
+                exclude.add(rule.first, rule.last, rule.flavors);
+            }
+        }
+    }
+
+    inline bool CAPTURE_FUNC(accepts)(CodeFlavor flavor, uint64_t code) const {
+        uint8_t bit = flavorBit(flavor);
+        if (bit == 0) {
+            return true;
+        }
+        if (!(enabled & bit) || exclude.contains(bit, code)) {
+            return false;
+        }
+        return !(included & bit) || include.contains(bit, code);
+    }
+
+private:
+    uint8_t enabled = FLAVOR_MASK_ALL;
+    uint8_t included = 0; // flavors with at least one include range
+    CodeIntervalTable include;
+    CodeIntervalTable exclude;
+};
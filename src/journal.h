@@ -0,0 +1,423 @@
+#pragma once
+
+#include <Arduino.h>
+#include <CRC.h>
+
+// Append-only record journal for the config.
+//
+// The store is two erase blocks (banks) split into pages. Every commit
+// programs one fresh page of the live bank and the newest record with a
+// valid checksum wins on load, so a save costs a single page program
+// instead of the erase + rewrite EEPROM.commit() does every time.
+//
+// Once the live bank is full, compaction copies the newest record of each
+// type into the other bank, reads them back, and only then erases the old
+// one. A power loss at any point leaves a complete copy in one bank or the
+// other; the bank with the highest sequence number is the live one.
+//
+// Records come in types, told apart by their magic; the newest record of
+// each type is kept independently.
+
+#define JOURNAL_MAGIC 0x314A4643            // CFJ1
+#define JOURNAL_MAGIC_BOOT_MODEL 0x314D5442 // BTM1
+
+enum JournalRecordType: uint8_t {
+    JOURNAL_RECORD_CONFIG = 0,
+    JOURNAL_RECORD_BOOT_MODEL,
+    JOURNAL_RECORD_TYPES,
+};
+
+static const uint32_t JOURNAL_RECORD_MAGIC[JOURNAL_RECORD_TYPES] = {
+    JOURNAL_MAGIC,
+    JOURNAL_MAGIC_BOOT_MODEL,
+};
+
+typedef struct {
+    uint32_t magic;                  /* 0x00 */
+    uint32_t sequence;               /* 0x04 */
+    uint8_t  version;                /* 0x08 */
+    uint8_t  length;                 /* 0x09 */
+    uint16_t checksum;               /* 0x0A */
+} JournalRecordHeader;               /* Total len: 0x0C */
+
+// JOURNAL_PAGE_SIZE and JOURNAL_BANK_PAGES come from the storage back-end
+#define JOURNAL_BANKS      2
+#define JOURNAL_PAGE_COUNT (JOURNAL_BANKS * JOURNAL_BANK_PAGES)
+
+#if defined(ARDUINO_ARCH_RP2040)
+
+#include <hardware/flash.h>
+
+// arduino-pico's linker script reserves one flash sector for EEPROM
+// emulation, and the filesystem area right below it (one sector, see
+// board_build.filesystem_size in platformio.ini). The journal takes both
+// over, the EEPROM sector as bank 0, which also leaves any pre-journal
+// config where Config::begin() can find and migrate it.
+extern "C" uint8_t _EEPROM_start;
+extern "C" uint8_t _FS_start;
+extern "C" uint8_t _FS_end;
+
+#define JOURNAL_PAGE_SIZE  FLASH_PAGE_SIZE
+#define JOURNAL_BANK_PAGES (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+
+class JournalStorage {
+public:
+    // Without a filesystem sector there is nowhere to compact to
+    bool begin() { return &_FS_end - &_FS_start >= FLASH_SECTOR_SIZE; }
+    void end() {}
+
+    void read(uint16_t page, uint16_t offset, void *out, size_t len) {
+        memcpy(out, pageStart(page) + offset, len);
+    }
+
+    // XIP is unavailable while flash is written, so core1 gets parked in
+    // RAM and interrupts go off - the same thing EEPROM.commit() does, just
+    // for one page instead of a whole sector.
+    bool program(uint16_t page, const uint8_t *data) {
+        noInterrupts();
+        rp2040.idleOtherCore();
+        flash_range_program(flashOffset(pageStart(page)), data, JOURNAL_PAGE_SIZE);
+        rp2040.resumeOtherCore();
+        interrupts();
+        return true;
+    }
+
+    bool erase(uint8_t bank) {
+        noInterrupts();
+        rp2040.idleOtherCore();
+        flash_range_erase(flashOffset(bankStart(bank)), FLASH_SECTOR_SIZE);
+        rp2040.resumeOtherCore();
+        interrupts();
+        return true;
+    }
+
+private:
+    static uint8_t *bankStart(uint8_t bank) { return bank == 0 ? &_EEPROM_start : &_FS_end - FLASH_SECTOR_SIZE; }
+    static uint8_t *pageStart(uint16_t page) {
+        return bankStart(page / JOURNAL_BANK_PAGES) + (page % JOURNAL_BANK_PAGES) * JOURNAL_PAGE_SIZE;
+    }
+    static uint32_t flashOffset(const uint8_t *addr) { return (uint32_t)((uintptr_t)addr - XIP_BASE); }
+};
+
+#else
+
+#include <EEPROM.h>
+
+// ESP32 and Teensy don't expose raw flash pages, so journal pages are
+// carved out of EEPROM instead, the two banks being its two halves. The
+// format stays the same everywhere, but a page program costs a lot more
+// than on RP2040:
+//  - ESP32 keeps EEPROM in RAM and every commit() writes the whole area
+//    (2 KB) out as one NVS blob, with the flash cache off on both cores.
+//  - Teensy writes through its EEPROM emulation one byte at a time, every
+//    changed byte its own flash write, plus a sector erase whenever the
+//    emulation's log fills up. Its 1080 bytes of EEPROM only fit two pages
+//    per bank.
+#define JOURNAL_PAGE_SIZE  256
+#if defined(ARDUINO_ARCH_ESP32)
+#define JOURNAL_BANK_PAGES 4
+#else
+#define JOURNAL_BANK_PAGES 2
+#endif
+
+// ESP32 emulates EEPROM in RAM and needs an explicit begin(size) /
+// commit() / end(); Teensy's EEPROM is written through directly.
+#if defined(ARDUINO_ARCH_ESP32)
+#define EEPROM_NEEDS_COMMIT 1
+#else
+#define EEPROM_NEEDS_COMMIT 0
+#endif
+
+class JournalStorage {
+public:
+    bool begin() {
+#if EEPROM_NEEDS_COMMIT
+        return EEPROM.begin(JOURNAL_PAGE_SIZE * JOURNAL_PAGE_COUNT);
+#else
+        return true;
+#endif
+    }
+
+    void end() {
+#if EEPROM_NEEDS_COMMIT
+        EEPROM.end();
+#endif
+    }
+
+    void read(uint16_t page, uint16_t offset, void *out, size_t len) {
+        uint8_t *dst = (uint8_t *)out;
+        for (size_t i = 0; i < len; i++) {
+            dst[i] = EEPROM.read(page * JOURNAL_PAGE_SIZE + offset + i);
+        }
+    }
+
+    bool program(uint16_t page, const uint8_t *data) {
+        for (size_t i = 0; i < JOURNAL_PAGE_SIZE; i++) {
+            EEPROM.write(page * JOURNAL_PAGE_SIZE + i, data[i]);
+        }
+        return commit();
+    }
+
+    bool erase(uint8_t bank) {
+        for (size_t i = 0; i < JOURNAL_PAGE_SIZE * JOURNAL_BANK_PAGES; i++) {
+            EEPROM.write(bank * JOURNAL_PAGE_SIZE * JOURNAL_BANK_PAGES + i, 0xFF);
+        }
+        return commit();
+    }
+
+private:
+    bool commit() {
+#if EEPROM_NEEDS_COMMIT
+        return EEPROM.commit();
+#else
+        return true;
+#endif
+    }
+};
+
+#endif
+
+#define JOURNAL_MAX_PAYLOAD (JOURNAL_PAGE_SIZE - sizeof(JournalRecordHeader))
+
+class ConfigJournal {
+public:
+    ~ConfigJournal() {
+        storage.end();
+    }
+
+    // Scans both banks for the newest valid record of each type, the live
+    // bank and its first free page. If a compaction was cut short, finishes
+    // it, so the other bank is erased and ready for the next one.
+    bool begin() {
+        if (!storage.begin()) {
+            return false;
+        }
+
+        for (int16_t &page : newestPage) {
+            page = -1;
+        }
+        uint16_t usedPages[JOURNAL_BANKS] = { 0 };
+        liveBank = 0;
+        for (uint16_t page = 0; page < JOURNAL_PAGE_COUNT; page++) {
+            JournalRecordHeader hdr;
+            storage.read(page, 0, &hdr, sizeof(hdr));
+            if (hdr.magic == 0xFFFFFFFF) {
+                // Erased. Pages fill strictly in order, but keep scanning in
+                // case an earlier write was interrupted.
+                continue;
+            }
+
+            uint8_t bank = page / JOURNAL_BANK_PAGES;
+            usedPages[bank] = page % JOURNAL_BANK_PAGES + 1;
+            int8_t type = typeForMagic(hdr.magic);
+            if (type < 0 || !isValidRecord(page, hdr)) {
+                continue;
+            }
+            if (newestPage[type] < 0 || hdr.sequence > newestSequence[type]) {
+                newestPage[type] = page;
+                newestSequence[type] = hdr.sequence;
+            }
+            if (hdr.sequence > lastSequence) {
+                lastSequence = hdr.sequence;
+                liveBank = bank;
+            }
+        }
+        nextFreePage = usedPages[liveBank];
+
+        uint8_t otherBank = 1 - liveBank;
+        if (!isBankErased(otherBank)) {
+            retireBank(otherBank);
+        }
+        return true;
+    }
+
+    bool hasRecord(JournalRecordType type) const { return newestPage[type] >= 0; }
+    bool isFull() const { return nextFreePage >= JOURNAL_BANK_PAGES; }
+    uint16_t freePages() const { return JOURNAL_BANK_PAGES - nextFreePage; }
+
+    // Copies out the newest record's payload (up to JOURNAL_MAX_PAYLOAD bytes).
+    bool readNewest(JournalRecordType type, uint8_t *payload, uint8_t *length, uint8_t *version) {
+        if (!hasRecord(type)) {
+            return false;
+        }
+
+        JournalRecordHeader hdr;
+        storage.read(newestPage[type], 0, &hdr, sizeof(hdr));
+        storage.read(newestPage[type], sizeof(hdr), payload, hdr.length);
+        *length = hdr.length;
+        *version = hdr.version;
+        return true;
+    }
+
+    // Raw access to the first page of bank 0, for reading pre-journal data.
+    void readRaw(uint16_t offset, void *out, size_t len) {
+        storage.read(0, offset, out, len);
+    }
+
+    // Programs the next free page of the live bank. Fails when the bank is
+    // full; compact() first in that case.
+    bool append(JournalRecordType type, uint8_t version, const uint8_t *payload, uint8_t length) {
+        if (isFull() || length > JOURNAL_MAX_PAYLOAD) {
+            return false;
+        }
+
+        uint8_t page[JOURNAL_PAGE_SIZE];
+        memset(page, 0xFF, sizeof(page));
+
+        JournalRecordHeader hdr = {
+            .magic = JOURNAL_RECORD_MAGIC[type],
+            .sequence = lastSequence + 1,
+            .version = version,
+            .length = length,
+            .checksum = 0,
+        };
+        memcpy(page, &hdr, sizeof(hdr));
+        memcpy(page + sizeof(hdr), payload, length);
+        hdr.checksum = calcCRC16(page, sizeof(hdr) + length);
+        memcpy(page, &hdr, sizeof(hdr));
+
+        uint16_t target = liveBank * JOURNAL_BANK_PAGES + nextFreePage;
+        if (!storage.program(target, page)) {
+            return false;
+        }
+
+        // Read back, so a failed program doesn't get mistaken for the newest record
+        JournalRecordHeader check;
+        storage.read(target, 0, &check, sizeof(check));
+        if (!isValidRecord(target, check)) {
+            nextFreePage++;
+            return false;
+        }
+
+        newestPage[type] = target;
+        newestSequence[type] = hdr.sequence;
+        lastSequence = hdr.sequence;
+        nextFreePage++;
+        return true;
+    }
+
+    // Copies the newest record of every type into the other bank, which
+    // becomes the live one, and erases the old bank once they all read back
+    // valid, so only superseded records are lost. The sequence number
+    // carries on. Leaves JOURNAL_BANK_PAGES minus one page per type free.
+    bool compact() {
+        return compactWith(JOURNAL_RECORD_TYPES, 0, NULL, 0);
+    }
+
+    // compact() and append() in one, the new record standing in for the
+    // newest of its type, so a bank with no more than a page per type (as
+    // on Teensy) still takes it.
+    bool compactAndAppend(JournalRecordType type, uint8_t version, const uint8_t *payload, uint8_t length) {
+        return compactWith(type, version, payload, length);
+    }
+
+private:
+    JournalStorage storage;
+    int16_t newestPage[JOURNAL_RECORD_TYPES] = { -1, -1 };
+    uint32_t newestSequence[JOURNAL_RECORD_TYPES] = { 0 };
+    uint32_t lastSequence = 0;
+    uint8_t liveBank = 0;
+    uint16_t nextFreePage = 0; // within the live bank
+
+    bool compactWith(uint8_t replaced, uint8_t version, const uint8_t *payload, uint8_t length) {
+        uint8_t payloads[JOURNAL_RECORD_TYPES][JOURNAL_MAX_PAYLOAD];
+        uint8_t lengths[JOURNAL_RECORD_TYPES];
+        uint8_t versions[JOURNAL_RECORD_TYPES];
+        bool present[JOURNAL_RECORD_TYPES];
+        uint8_t oldBank = liveBank;
+        uint8_t newBank = 1 - liveBank;
+        for (uint8_t type = 0; type < JOURNAL_RECORD_TYPES; type++) {
+            present[type] = type != replaced &&
+                readNewest((JournalRecordType)type, payloads[type], &lengths[type], &versions[type]);
+        }
+
+        // The new bank is normally erased already. It only holds a newest
+        // record when begin() couldn't retire it (a pre-bank journal filling
+        // both halves), and then that record is unprotected until rewritten.
+        if (!isBankErased(newBank) && !storage.erase(newBank)) {
+            return false;
+        }
+
+        int16_t oldNewestPage[JOURNAL_RECORD_TYPES];
+        uint32_t oldNewestSequence[JOURNAL_RECORD_TYPES];
+        memcpy(oldNewestPage, newestPage, sizeof(newestPage));
+        memcpy(oldNewestSequence, newestSequence, sizeof(newestSequence));
+        uint16_t oldNextFreePage = nextFreePage;
+        liveBank = newBank;
+        nextFreePage = 0;
+        bool written = true;
+        for (uint8_t type = 0; type < JOURNAL_RECORD_TYPES && written; type++) {
+            if (present[type]) {
+                written = append((JournalRecordType)type, versions[type], payloads[type], lengths[type]);
+            }
+        }
+        if (written && replaced < JOURNAL_RECORD_TYPES) {
+            written = append((JournalRecordType)replaced, version, payload, length);
+        }
+        if (!written) {
+            // The old bank is untouched, keep using it
+            liveBank = oldBank;
+            nextFreePage = oldNextFreePage;
+            memcpy(newestPage, oldNewestPage, sizeof(newestPage));
+            memcpy(newestSequence, oldNewestSequence, sizeof(newestSequence));
+            return false;
+        }
+
+        return storage.erase(oldBank);
+    }
+
+    static uint8_t bankOf(uint16_t page) { return page / JOURNAL_BANK_PAGES; }
+
+    static int8_t typeForMagic(uint32_t magic) {
+        for (uint8_t type = 0; type < JOURNAL_RECORD_TYPES; type++) {
+            if (JOURNAL_RECORD_MAGIC[type] == magic) {
+                return type;
+            }
+        }
+        return -1;
+    }
+
+    bool isValidRecord(uint16_t page, JournalRecordHeader hdr) {
+        if (typeForMagic(hdr.magic) < 0 || hdr.length > JOURNAL_MAX_PAYLOAD) {
+            return false;
+        }
+
+        uint8_t buf[JOURNAL_PAGE_SIZE];
+        uint16_t expected = hdr.checksum;
+        hdr.checksum = 0;
+        memcpy(buf, &hdr, sizeof(hdr));
+        storage.read(page, sizeof(hdr), buf + sizeof(hdr), hdr.length);
+        return calcCRC16(buf, sizeof(hdr) + hdr.length) == expected;
+    }
+
+    bool isBankErased(uint8_t bank) {
+        uint8_t buf[JOURNAL_PAGE_SIZE];
+        for (uint16_t page = 0; page < JOURNAL_BANK_PAGES; page++) {
+            storage.read(bank * JOURNAL_BANK_PAGES + page, 0, buf, sizeof(buf));
+            for (uint8_t b : buf) {
+                if (b != 0xFF) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Moves the newest records the live bank lacks over from `bank`, left
+    // behind by a compaction that was cut short, then erases it. Leaves
+    // `bank` alone if they don't fit.
+    bool retireBank(uint8_t bank) {
+        uint8_t payload[JOURNAL_MAX_PAYLOAD];
+        uint8_t length, version;
+        for (uint8_t type = 0; type < JOURNAL_RECORD_TYPES; type++) {
+            if (!hasRecord((JournalRecordType)type) || bankOf(newestPage[type]) != bank) {
+                continue;
+            }
+            readNewest((JournalRecordType)type, payload, &length, &version);
+            if (!append((JournalRecordType)type, version, payload, length)) {
+                return false;
+            }
+        }
+        return storage.erase(bank);
+    }
+};
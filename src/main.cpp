@@ -1,12 +1,23 @@
 #include <atomic>
 
-#include "U8g2lib.h"
-#include "clib/u8x8.h"
+#include "board.h"
+#include "bootmodel.h"
+#include "buswatch.h"
+#include "clocksync.h"
+#include "coalesce.h"
+#include "codestats.h"
 #include "common.h"
 #include "colors.h"
 #include "codes.h"
 #include "config.h"
 #include "platform.h"
+#include "profile.h"
+#include "repl.h"
+#include "replay.h"
+#include "rpc.h"
+#include "sampler.h"
+#include "session.h"
+#include "sink.h"
 
 #ifndef __FW_VERSION__
 #define FW_VERSION "unknown version"
@@ -21,12 +32,12 @@
 #endif
 
 
-#define PRINT_COLOR(c, x) \
+#define LINE_COLOR(line, c, x) \
     if (cfg.isSerialPrintColors()) \
-        Serial.print(c); \
+        line.print(c); \
     x; \
     if (cfg.isSerialPrintColors()) \
-        Serial.print(COLOR_RESET);
+        line.print(COLOR_RESET);
 
 
 // Message from core0->core1
@@ -34,29 +45,180 @@ std::atomic<uint32_t> msg_core0{INVALID};
 
 SegmentData currentSegData = {0};
 bool postMonitorRunning = false;
+bool latencyTestRunning = false;
+bool saveTestRunning = false;
 
-String inputBuffer = "";
-uint8_t pendingI2C0Sda = 0;
-uint8_t pendingI2C0Scl = 0;
+LineEditor lineEditor;
+ReplArgs commandArgs = {0};
+bool monitorCommandLine = false;
+RpcParser rpcParser;
+uint64_t rpcReceivedUs = 0; // when the request being handled came in
+ClockSync clockSync;
+Coalescer coalescer;
+CodeStats codeStats;
+SessionDetector sessionDetector;
+BootProfiler bootProfiler;
+BootModel bootModel;
 
-// NOTE: Replace with your specific display if needed
-U8G2 displayInstance = U8G2_SSD1306_128X32_UNIVISION_F_2ND_HW_I2C(U8G2_R0, U8X8_PIN_NONE);
+// Code stream output, owned by core0
+OutputSinks sinks;
+uint8_t sinkUartBuffer[SINK_UART_BUFFER_SIZE];
+uint32_t sinkUartBaud = 0; // 0 = UART not started
+uint8_t eventSeq = 0;
+
+// Converts now_ticks() intervals, calibrated in setup()
+TickScale tickScale;
+
+// Boot progress reporting, owned by core0
+#define PROGRESS_UPDATE_MS 250
+uint32_t progressUpdateMs = 0;
+uint8_t progressDecile = 0xFF;
+bool progressStalled = false;
+
+// Register watch, owned by core0
+#define REGS_WATCH_DEFAULT_MS 250
+// Digit0..Digit3 and Segments carry the codes themselves, so aren't watched
+#define REGS_CODE_BITS (0x1FULL << Digit0)
+uint16_t regsWatchMs = 0; // 0 = off
+uint32_t regsWatchLastMs = 0;
+RegisterSnapshot regsWatched; // as last streamed
+uint32_t regsShownSeq = 0;    // `regs` marks what changed since it last ran
+
+// The panel is picked with DISPLAY_PANEL, see display.h
+#if BOARD_HAS_DISPLAY
+#if DISPLAY_PANEL == DISPLAY_PANEL_SSD1306_128X64
+U8G2_SSD1306_128X64_NONAME_F_2ND_HW_I2C displayInstance(U8G2_R0, U8X8_PIN_NONE);
+#elif DISPLAY_PANEL == DISPLAY_PANEL_SH1106_128X64
+U8G2_SH1106_128X64_NONAME_F_2ND_HW_I2C displayInstance(U8G2_R0, U8X8_PIN_NONE);
+#else
+U8G2_SSD1306_128X32_UNIVISION_F_2ND_HW_I2C displayInstance(U8G2_R0, U8X8_PIN_NONE);
+#endif
 Display display(SSD1306_DISP_ADDRESS, PIN_SDA_DISP, PIN_SCL_DISP, displayInstance);
+#else
+Display display;
+#endif
 
 Config cfg;
 RuntimeState runtimeState(display);
 
+constexpr ReplCommand<State> REPL_COMMANDS[] = {
+    REPL_CMD("post", STATE_POST_MONITOR),
+    REPL_CMD("rotate", STATE_DISPLAY_ROTATE),
+    REPL_CMD("mirror", STATE_DISPLAY_MIRROR),
+    REPL_CMD("colors", STATE_TOGGLE_COLORS),
+    REPL_CMD("ts", STATE_TOGGLE_TIMESTAMP),
+    REPL_CMD("exact", STATE_TOGGLE_EXACT),
+    REPL_CMD_ARGS("coalesce", STATE_SET_COALESCE_INTERVAL, 1, 1, "coalesce <interval_ms>", ARG_U16),
+    REPL_CMD("config", STATE_CONFIG_SHOW),
+    REPL_CMD("save", STATE_CONFIG_SAVE),
+    REPL_CMD("version", STATE_PRINT_VERSION),
+    REPL_CMD("help", STATE_PRINT_HELP),
+    REPL_CMD("bootsel", STATE_BOOTSEL),
+    REPL_CMD("latency", STATE_LATENCY_TEST),
+    REPL_CMD_ARGS("savetest", STATE_SAVE_TEST, 0, 1, "savetest [bus|send|stop]", ARG_WORD),
+    REPL_CMD("queues", STATE_SHOW_QUEUES),
+    REPL_CMD_ARGS("top", STATE_TOP_CODES, 0, 1, "top [count]", ARG_U8),
+    REPL_CMD_ARGS("reset", STATE_RESET_STATS, 1, 1, "reset <stats|profile>", ARG_WORD),
+    REPL_CMD_ARGS("profile", STATE_PROFILE_SHOW, 0, 1, "profile [count]", ARG_U8),
+    REPL_CMD_ARGS("milestone", STATE_SET_MILESTONE, 1, 2, "milestone <cpu|sp|smc|os> <code> | milestone clear", ARG_WORD, ARG_HEX),
+    REPL_CMD("fallsplit", STATE_TOGGLE_SPLIT_FALL),
+    REPL_CMD_ARGS("idlegap", STATE_SET_IDLE_GAP, 1, 1, "idlegap <ms>", ARG_U16),
+    REPL_CMD_ARGS("model", STATE_BOOT_MODEL, 0, 1, "model [clear]", ARG_WORD),
+    REPL_CMD_ARGS("resetcode", STATE_SET_RESET_CODE, 1, 2, "resetcode <cpu|sp|smc|os|all> <code> | resetcode off", ARG_WORD, ARG_HEX),
+    REPL_CMD_ARGS("i2c0", STATE_SET_I2C0_PINS, 2, 2, "i2c0 <sda_pin> <scl_pin>", ARG_U8, ARG_U8),
+    REPL_CMD_ARGS("bus", STATE_BUS_WATCHDOG, 0, 1, "bus [recover]", ARG_WORD),
+    REPL_CMD_ARGS("filter", STATE_FILTER_SHOW, 0, 1, "filter [clear]", ARG_WORD),
+    REPL_CMD_ARGS("flavor", STATE_FILTER_FLAVOR, 2, 2, "flavor <cpu|sp|smc|os|all> <on|off>", ARG_WORD, ARG_WORD),
+    REPL_CMD_ARGS("include", STATE_FILTER_INCLUDE, 1, 3, "include <first> [last] [cpu|sp|smc|os]", ARG_HEX, ARG_HEX, ARG_WORD),
+    REPL_CMD_ARGS("exclude", STATE_FILTER_EXCLUDE, 1, 3, "exclude <first> [last] [cpu|sp|smc|os]", ARG_HEX, ARG_HEX, ARG_WORD),
+    REPL_CMD_ARGS("fault", STATE_ADD_FAULT, 1, 3, "fault <first> [last] [cpu|sp|smc|os]", ARG_HEX, ARG_HEX, ARG_WORD),
+    REPL_CMD_ARGS("sink", STATE_SINK, 0, 2, "sink [reset] | sink <usb|uart|null> <off|text|binary>", ARG_WORD, ARG_WORD),
+    REPL_CMD_ARGS("uartbaud", STATE_SET_UART_BAUD, 1, 1, "uartbaud <baud>", ARG_U32),
+    REPL_CMD_ARGS("replay", STATE_REPLAY, 0, 2, "replay [bus|loop [passes] | stop | clear]", ARG_WORD, ARG_U16),
+    REPL_CMD_ARGS("replayset", STATE_REPLAY_SETTINGS, 4, 4, "replayset <clock_khz> <gap_us> <burst> <speedup>", ARG_U16, ARG_U16, ARG_U8, ARG_U8),
+    REPL_CMD_ARGS("prof", STATE_PROFILER, 0, 2, "prof [start [hz] | stop | dump]", ARG_WORD, ARG_U16),
+    REPL_CMD_ARGS("dispbench", STATE_DISPLAY_BENCH, 0, 1, "dispbench [count]", ARG_U16),
+    REPL_CMD_ARGS("regs", STATE_REGISTERS, 0, 2, "regs [watch [ms] | stop]", ARG_WORD, ARG_U16),
+    REPL_CMD_ARGS("alarm", STATE_ALARM, 0, 2, "alarm [ack|test|clear|off|low|high|blink|steady] | alarm pin|hold <n>", ARG_WORD, ARG_U16),
+};
+static_assert(replHashesUnique(REPL_COMMANDS), "REPL command names must hash uniquely");
+const ReplIndex<State, sizeof(REPL_COMMANDS) / sizeof(REPL_COMMANDS[0])> replIndex(REPL_COMMANDS);
+
+/* Latency / save tests */
+#define LATENCY_TEST_PACKETS 2000
+#define SAVE_TEST_PERIOD_US  250  // 4000 codes/s, far more than a console sends
+#define SAVE_TEST_BUS_PERIOD_US 1000 // a packet takes ~650 us at 100 kHz
+#define SAVE_TEST_BUS_CLOCK_HZ 100000
+#define SAVE_TEST_COMMITS    8
+#define SAVE_TEST_INTERVAL_MS 250
+
+// Only fed by the latency and save tests, so synthetic codes never reach
+// the real queue or code cache, and never race the real receive callback.
+Capture benchCapture;
+std::atomic<bool> latencyTestDone{false};
+
+// Synthetic load generator state, owned by core1
+uint32_t synthPeriodUs = 0;
+uint32_t synthStartUs = 0;
+uint32_t synthSent = 0;
+bool synthOnBus = false; // I2C master on the Xbox bus instead of feeding benchCapture
+std::atomic<uint32_t> synthGenerated{0};
+
+// Restarts the Wire slave when the Xbox bus stalls, see buswatch.h
+BusWatchdog busWatchdog;
+
+// Capture replay. Codes are loaded (core0) while it's stopped; core1 plays
+// them back onto the Xbox bus or into benchCapture.
+Replayer replayer;
+ReplaySettings replaySettings = { REPLAY_TARGET_BUS, 1, 400, 0, 1, 1 };
+bool replayRunning = false; // core0's view, for the end-of-run report
+uint32_t replayReceived = 0;
+uint32_t replayStartDropped = 0;
+
+// Sampling profiler; core0 drains every core's samples
+Sampler sampler;
+uint16_t samplerHz = 0; // 0 = stopped
+
+// Save test state, owned by core0
+bool saveTestOnBus = false;   // load from another reader's `savetest send`
+bool saveTestSending = false; // this reader is that other reader
+uint32_t saveTestStartDropped = 0;
+uint32_t saveTestReceived = 0;
+uint32_t saveTestLost = 0;    // gaps in the sequence sent over the bus
+int32_t saveTestLastSeq = -1;
+uint32_t saveTestTarget = 0;      // commits to make, at most SAVE_TEST_COMMITS
+uint32_t saveTestCommits = 0;
+uint32_t saveTestFailedCommits = 0;
+uint32_t saveTestMaxCommitUs = 0;
+uint32_t saveTestLastCommitMs = 0;
+
 void print(const char* header, const char *text, int durationMs = 0) {
     Serial.printf("%s: %s\r\n", header, text);
     runtimeState.display()->printMessage(header, text, durationMs);
 }
 
+// Counts what arrived for the save test. Codes sent over the bus are
+// numbered, so a gap in the numbers is codes lost before they were queued.
+void drainSaveTest(Capture *capture) {
+    SegmentData segData;
+    while (capture->popPostCode(&segData)) {
+        saveTestReceived++;
+        if (!saveTestOnBus || segData.flavor != CODE_FLAVOR_SMC) {
+            continue;
+        }
+        uint16_t seq = (uint16_t)segData.code;
+        if (saveTestLastSeq >= 0 && seq != 0) {
+            saveTestLost += (uint16_t)(seq - (uint16_t)saveTestLastSeq - 1);
+        }
+        saveTestLastSeq = seq; // 0 = the sender (re)started
+    }
+}
+
 void printFwVersion(bool startup = false) {
-    char *fwString = (char *)calloc(1, 255);
-    snprintf(fwString, 255, "%s %lu", FW_VERSION, BUILD_DATE);
+    char fwString[sizeof(FW_VERSION) + 11]; // space + up to 10 digits
+    snprintf(fwString, sizeof(fwString), "%s %lu", FW_VERSION, (unsigned long)BUILD_DATE);
     // Only delay the print on startup
     print("FW", fwString, startup ? 2000 : 0);
-    free(fwString);
     if (startup) {
         runtimeState.display()->printMessage("Presented by", "xboxresearch.com");
     }
@@ -74,15 +236,69 @@ void printHelp() {
     Serial.println("\r\nPOST modifiers:");
     Serial.println("  ts      - Toggle showing timestamps");
     Serial.println("  colors  - Print colors over serial");
-    Serial.println("  rotate  - Rotate display");
-    Serial.println("  mirror  - Mirror display");
+    Serial.println("  exact   - Toggle exact mode (the default): every code printed, repeats not summarised");
+    Serial.println("  coalesce <ms> - Interval between summaries of a repeating code");
+    if (Board::hasDisplay) {
+        Serial.println("  rotate  - Rotate display");
+        Serial.println("  mirror  - Mirror display");
+    }
     Serial.println("\r\nConfig:");
     Serial.println("  config  - Show config");
-    Serial.println("  save    - Save config");
+    Serial.println("  save    - Save config (written once the Xbox bus is idle)");
     Serial.println("\r\nI2C:");
     Serial.println("  i2c0 <sda> <scl> - Change I2C0 (Xbox bus) pins (use 'save' to persist)");
+    Serial.println("  bus [recover]    - Show bus stall recoveries and silences (or restart the I2C slave now)");
+    Serial.println("\r\nCapture filter (use 'save' to persist):");
+    Serial.println("  filter [clear]   - Show (or reset) the capture filter");
+    Serial.println("  flavor <cpu|sp|smc|os|all> <on|off> - Capture codes of a flavor or not");
+    Serial.println("  include <first> [last] [flavor] - Only capture codes in this hex range");
+    Serial.println("  exclude <first> [last] [flavor] - Never capture codes in this hex range");
+    Serial.println("\r\nOutput sinks (use 'save' to persist):");
+    Serial.println("  sink [reset]     - Show (or reset) per-sink records, bytes and drops");
+    Serial.println("  sink <usb|uart|null> <off|text|binary> - Format the code stream is sent in");
+    Serial.println("  uartbaud <baud>  - Baud rate of the UART sink");
+    Serial.println("\r\nFault alarm (use 'save' to persist):");
+    Serial.println("  fault <first> [last] [flavor] - Drive the alarm pin on codes in this hex range");
+    Serial.println("  alarm             - Show alarm pin, fault ranges and trips");
+    Serial.println("  alarm pin <gpio>  - Pin to drive ('alarm off' disables)");
+    Serial.println("  alarm hold <ms>   - How long it stays on after a fault (0 = until 'alarm ack')");
+    Serial.println("  alarm low|high    - Active level; alarm blink|steady - Output pattern");
+    Serial.println("  alarm ack|test|clear - Switch it off, try it, or remove all fault ranges");
     Serial.println("\r\nGeneral:");
     Serial.println("  version - Show firmware version");
+    Serial.println("  latency - Measure worst-case capture latency");
+    Serial.println("  savetest - Save under synthetic load fed in-process; core1 is parked while flash is");
+    Serial.println("             written, so this only checks the queues absorb the catch-up burst");
+    Serial.println("  savetest bus - Save while another reader's 'savetest send' drives the Xbox bus,");
+    Serial.println("             counting codes lost on the wire too");
+    Serial.println("  savetest send|stop - Send the bus test's numbered codes as I2C master (or stop)");
+    Serial.println("  queues  - Show per-flavor queue usage and dropped codes");
+    Serial.println("  top [n] - Show the n most frequent codes seen while monitoring");
+    Serial.println("  reset stats - Forget the code frequency statistics");
+    Serial.println("  regs    - Show the MAX6958 registers, * = changed since the last 'regs'");
+    Serial.println("  regs watch [ms] - Stream non-digit register changes while monitoring ('regs stop' ends it)");
+    if (Board::hasDisplay) {
+        Serial.println("  dispbench [n] - Time drawing a code on the display, with and without the glyph cache");
+    }
+    Serial.println("\r\nCapture replay (load a capture with tools/replay.py first):");
+    Serial.println("  replay           - Show the loaded capture and sent/received counts");
+    Serial.println("  replay bus [n]   - Play it n times (0 = until stopped) onto the Xbox bus as I2C master");
+    Serial.println("  replay loop [n]  - Play it through this reader's own decoder, no wiring needed");
+    Serial.println("  replay stop|clear - Stop, or forget the loaded capture");
+    Serial.println("  replayset <clock_khz> <gap_us> <burst> <speedup> - Bus clock, gap after each packet,");
+    Serial.println("                     times each code is sent, time compression (0 = no pauses)");
+    Serial.println("\r\nSampling profiler (tools/sampleprof.py symbolises the samples):");
+    Serial.println("  prof             - Show whether it runs and how many samples are waiting");
+    Serial.println("  prof start [hz]  - Sample both cores (default 1000 Hz), dropping anything not dumped yet");
+    Serial.println("  prof stop|dump   - Stop, or print and drain the samples taken so far");
+    Serial.println("\r\nBoot profiling (use 'save' to persist):");
+    Serial.println("  profile [n] - Show the n slowest code transitions across boots");
+    Serial.println("  reset profile - Forget the boot profile");
+    Serial.println("  milestone <flavor> <code> - Also time the way to this code (or 'milestone clear')");
+    Serial.println("  idlegap <ms> - Silence that ends a boot (0 = never)");
+    Serial.println("  resetcode <flavor> <code> - Code that starts a new boot (or 'resetcode off')");
+    Serial.println("  fallsplit - Toggle starting a new boot when the first boot stage starts over");
+    Serial.println("  model [clear] - Show (or forget) the learned boot models, one per console, used for progress/ETA");
 #if defined(ARDUINO_ARCH_RP2040)
     Serial.println("  bootsel - Reboot into USB bootloader mode (for flashing UF2)");
 #elif defined(ARDUINO_ARCH_ESP32)
@@ -92,185 +308,1346 @@ void printHelp() {
 #endif
     Serial.println("  help    - Show this help message");
     Serial.println("  CTRL+C  - Exit current mode and return to REPL");
+    Serial.println("\r\nWhile monitoring, prefix a command with ':' (e.g. ':config') to run it");
+    Serial.println("without leaving POST monitoring.");
 }
 
-void handleRepl() {
-    if (Serial.available()) {
-        char c = Serial.read();
-        // Letters for command names, digits + space for "i2c0 <sda> <scl>"-style args
-        bool isBufferable = isalnum(c) || c == ' ';
+// FLAVOR_BIT(s) for a flavor name as typed, 0 if unknown
+uint8_t flavorBitsForWord(uint32_t wordHash) {
+    switch (wordHash) {
+        case replHash("cpu"): return FLAVOR_BIT(CODE_IDX_CPU);
+        case replHash("sp"):  return FLAVOR_BIT(CODE_IDX_SP);
+        case replHash("smc"): return FLAVOR_BIT(CODE_IDX_SMC);
+        case replHash("os"):  return FLAVOR_BIT(CODE_IDX_OS);
+        case replHash("all"): return FLAVOR_MASK_ALL;
+        default:              return 0;
+    }
+}
+
+void printTransitionEnd(CodeFlavor flavor, uint64_t code) {
+    if (flavor == 0) {
+        Serial.printf("%-22s", "(boot start)");
+    } else {
+        Serial.printf("%s 0x%-16llx", getStringForCodeFlavor(flavor), (unsigned long long)code);
+    }
+}
+
+void printProfile(uint8_t wanted) {
+    uint8_t slots[PROFILE_MAX_TRANSITIONS];
+    uint8_t found = bootProfiler.slowest(slots, wanted);
+
+    Serial.printf("Boot profile: %lu boots, %u transitions\r\n",
+        (unsigned long)bootProfiler.getBoots(), bootProfiler.getUsed());
+    Serial.println("Kind From                      To                        Count   Min(ms)  Mean(ms)   P95(ms)   Max(ms)");
+    for (uint8_t i = 0; i < found; i++) {
+        const TransitionStats &t = bootProfiler.transition(slots[i]);
+        Serial.print(t.kind == TRANSITION_MILESTONE ? "mile " : "step ");
+        printTransitionEnd(t.fromFlavor, t.fromCode);
+        Serial.print(" -> ");
+        printTransitionEnd(t.toFlavor, t.toCode);
+        Serial.printf(" %6lu %9.3f %9.3f %9.3f %9.3f\r\n", (unsigned long)t.sketch.getCount(),
+            t.sketch.getMinUs() / 1000.0, t.sketch.getMeanUs() / 1000.0,
+            t.sketch.getPercentileUs(95) / 1000.0, t.sketch.getMaxUs() / 1000.0);
+    }
+    if (bootProfiler.getUntracked() > 0) {
+        Serial.printf("%lu samples of transitions that didn't fit the table\r\n", (unsigned long)bootProfiler.getUntracked());
+    }
+}
+
+void saveBootModel() {
+    uint8_t payload[JOURNAL_MAX_PAYLOAD];
+    uint8_t length = bootModel.encode(payload, sizeof(payload));
+    cfg.saveBootModel(BOOT_MODEL_VERSION, payload, length);
+}
+
+void loadBootModel() {
+    uint8_t payload[JOURNAL_MAX_PAYLOAD];
+    uint8_t length = 0;
+    uint8_t version = 0;
+    if (cfg.loadBootModel(payload, &length, &version) && version == BOOT_MODEL_VERSION) {
+        bootModel.decode(payload, length);
+    }
+}
+
+// Ends the previous boot (learning from it) and starts timing a new one
+void startBoot(uint64_t timestamp) {
+    if (bootModel.endBoot()) {
+        saveBootModel();
+    }
+    bootModel.beginBoot(timestamp);
+    progressDecile = 0xFF;
+    progressStalled = false;
+}
+
+// Progress/ETA against the learned model: kept up to date on the display,
+// printed over serial at every 10% step and when a boot stalls.
+void updateBootProgress() {
+    if (millis() - progressUpdateMs < PROGRESS_UPDATE_MS) {
+        return;
+    }
+    progressUpdateMs = millis();
+
+    BootEstimate est;
+    if (!bootModel.estimate(now_us64(), &est)) {
+        runtimeState.display()->setStatus("");
+        return;
+    }
+
+    char text[STATUSBUF_SZ];
+    if (est.done) {
+        snprintf(text, sizeof(text), "DONE");
+    } else if (est.stalled) {
+        snprintf(text, sizeof(text), "STALL %u%%", est.percent);
+    } else {
+        snprintf(text, sizeof(text), "%u%% %lus", est.percent, (unsigned long)((est.etaMs + 999) / 1000));
+    }
+    runtimeState.display()->setStatus(text);
+
+    uint8_t decile = est.percent / 10;
+    if (decile == progressDecile && est.stalled == progressStalled) {
+        return;
+    }
+    progressDecile = decile;
+    progressStalled = est.stalled;
+
+    const BootCheckpoint *next = bootModel.nextCheckpoint();
+    if (est.stalled && next != NULL) {
+        Serial.printf("Progress: STALLED at %u%%, expected %s: 0x%llx by now\r\n", est.percent,
+            getStringForCodeFlavor(next->flavor), (unsigned long long)next->code);
+    } else if (est.done) {
+        Serial.println("Progress: 100%, boot complete");
+    } else {
+        Serial.printf("Progress: %u%% (ETA %.1f s)\r\n", est.percent, est.etaMs / 1000.0);
+    }
+}
+
+void printBootModel() {
+    bool any = false;
+    for (uint8_t c = 0; c < BOOT_MODEL_CONSOLES; c++) {
+        const ConsoleModel &console = bootModel.console(c);
+        const CheckpointList &cps = console.checkpoints;
+        if (cps.size() == 0) {
+            continue;
+        }
+        any = true;
+        Serial.printf("Console %08lx: %u checkpoints, learned from %u boots%s\r\n", (unsigned long)console.key,
+            cps.size(), console.learnedBoots, bootModel.activeConsole() == c ? " (booting now)" : "");
+        for (uint8_t i = 0; i < cps.size(); i++) {
+            Serial.printf("  %s: 0x%-16llx at %9.3f s\r\n", getStringForCodeFlavor(cps[i].flavor),
+                (unsigned long long)cps[i].code, cps[i].offsetMs / 1000.0);
+        }
+    }
+    if (!any) {
+        Serial.println("No boot model learned yet");
+    }
+}
+
+void printFlavorBits(uint8_t flavors) {
+    if (flavors == FLAVOR_MASK_ALL) {
+        Serial.print("all");
+        return;
+    }
+    for (uint8_t i = 0; i < CODE_IDX_MAX; i++) {
+        if (flavors & FLAVOR_BIT(i)) {
+            Serial.printf("%s ", getStringForCodeFlavor(CODE_FLAVOR_FOR_INDEX[i]));
+        }
+    }
+}
+
+void printFilter() {
+    Serial.print("Captured flavors: ");
+    printFlavorBits(cfg.getFilterFlavors());
+    Serial.println();
+
+    const CodeRule *rules = cfg.getFilterRules();
+    for (uint8_t i = 0; i < CODE_FILTER_MAX_RULES; i++) {
+        if (rules[i].kind != CODE_RULE_INCLUDE && rules[i].kind != CODE_RULE_EXCLUDE) {
+            continue;
+        }
+        Serial.printf("%s 0x%llx-0x%llx (", rules[i].kind == CODE_RULE_INCLUDE ? "Include" : "Exclude",
+            (unsigned long long)rules[i].first, (unsigned long long)rules[i].last);
+        printFlavorBits(rules[i].flavors);
+        Serial.println(")");
+    }
+    Serial.printf("Codes filtered since boot: %lu\r\n", (unsigned long)runtimeState.capture()->getFilteredCodes());
+}
+
+void printAlarm() {
+    FaultAlarm *alarm = runtimeState.capture()->alarm();
+    if (cfg.getFaultPin() == FAULT_PIN_NONE) {
+        Serial.println("Alarm pin: off");
+    } else {
+        Serial.printf("Alarm pin: GPIO %u, active %s, %s, ", cfg.getFaultPin(),
+            (cfg.getFaultMode() & FAULT_MODE_ACTIVE_LOW) ? "low" : "high",
+            (cfg.getFaultMode() & FAULT_MODE_BLINK) ? "blinking" : "steady");
+        if (cfg.getFaultHoldMs()) {
+            Serial.printf("held %u ms\r\n", cfg.getFaultHoldMs());
+        } else {
+            Serial.println("held until acknowledged");
+        }
+    }
+
+    const CodeRule *rules = cfg.getFilterRules();
+    for (uint8_t i = 0; i < CODE_FILTER_MAX_RULES; i++) {
+        if (rules[i].kind != CODE_RULE_FAULT) {
+            continue;
+        }
+        Serial.printf("Fault 0x%llx-0x%llx (", (unsigned long long)rules[i].first, (unsigned long long)rules[i].last);
+        printFlavorBits(rules[i].flavors);
+        Serial.println(")");
+    }
+
+    Serial.printf("Tripped %lu times", (unsigned long)alarm->getTrips());
+    if (alarm->getTrips()) {
+        Serial.printf(", last %s: 0x%llx", getStringForCodeFlavor(alarm->getLastFlavor()), (unsigned long long)alarm->getLastCode());
+    }
+    Serial.println(alarm->isLit(now_us32()) ? " (on)" : alarm->isRaised() ? " (not acknowledged)" : "");
+}
+
+void printRegisters() {
+    RegisterSnapshot snap;
+    if (!runtimeState.capture()->getRegisters().snapshot(snap)) {
+        print("Error", "The bus kept writing registers, try again");
+        return;
+    }
+    uint64_t changed = snap.changedSince(regsShownSeq);
+    regsShownSeq = snap.seq;
+
+    Serial.println("Reg  Name             Value     Writes");
+    for (uint8_t reg = 0; reg < MAX6958_REGISTER_SIZE; reg++) {
+        const char *name = getNameForMAX6958Register(reg);
+        bool known = strcmp(name, "<UNKNOWN>") != 0;
+        if (!known && snap.writes[reg] == 0) {
+            continue;
+        }
+        Serial.printf("0x%02X %-16s  0x%02X %10lu%s\r\n", reg, known ? name : "-", snap.values[reg],
+            (unsigned long)snap.writes[reg], (changed >> reg) & 1 ? " *" : "");
+    }
+    Serial.printf("As of transaction %lu\r\n", (unsigned long)(snap.seq / 2));
+}
+
+void emitText(const TextLine &line) {
+    sinks.write(SINK_FORMAT_TEXT, line.data(), line.length());
+}
+
+void emitEvent(RpcEvent &event) {
+    uint16_t length = event.finish();
+    sinks.write(SINK_FORMAT_BINARY, event.data(), length);
+}
+
+// While watching, emits the non-digit registers that changed since the last
+// tick, at most every `regsWatchMs`.
+void streamRegisterChanges() {
+    uint32_t nowMs = millis();
+    if (regsWatchMs == 0 || nowMs - regsWatchLastMs < regsWatchMs) {
+        return;
+    }
+    regsWatchLastMs = nowMs;
+
+    RegisterSnapshot snap;
+    if (!runtimeState.capture()->getRegisters().snapshot(snap)) {
+        return; // Busy bus, next tick
+    }
+    uint64_t changed = snap.changedSince(regsWatched.seq) & ~REGS_CODE_BITS;
+    if (changed == 0) {
+        regsWatched = snap;
+        return;
+    }
+
+    if (sinks.wants(SINK_FORMAT_TEXT)) {
+        for (uint8_t reg = 0; reg < MAX6958_REGISTER_SIZE; reg++) {
+            if (!((changed >> reg) & 1)) {
+                continue;
+            }
+            TextLine line;
+            line.printf("REG 0x%02X %s: 0x%02X -> 0x%02X (%lu writes)\r\n", reg, getNameForMAX6958Register(reg),
+                regsWatched.values[reg], snap.values[reg], (unsigned long)snap.writes[reg]);
+            emitText(line);
+        }
+    }
+    if (sinks.wants(SINK_FORMAT_BINARY)) {
+        RpcEvent event(RPC_EVENT_REGISTERS, eventSeq++);
+        event.put64(now_us64());
+        for (uint8_t reg = 0; reg < MAX6958_REGISTER_SIZE; reg++) {
+            if ((changed >> reg) & 1) {
+                event.put8(reg);
+                event.put8(snap.values[reg]);
+                event.put32(snap.writes[reg]);
+            }
+        }
+        emitEvent(event);
+    }
+    regsWatched = snap;
+}
+
+void printCode(uint64_t code, CodeFlavor flavor, uint64_t timestamp) {
+    const char *flavor_str = getStringForCodeFlavor(flavor);
+    runtimeState.display()->printCode(code, flavor);
+
+    uint32_t startUs = now_us32();
+    uint64_t delta = runtimeState.nextPrintedTimestampDelta(timestamp);
+
+    if (sinks.wants(SINK_FORMAT_TEXT)) {
+        TextLine line;
+        // Color is only printed if `printColors` is set
+        LINE_COLOR(line, COLOR_FLAVOR, line.print(flavor_str))
+        LINE_COLOR(line, COLOR_CODE, line.printf(": 0x%llx", (unsigned long long)code))
+
+        if (cfg.isPostPrintTimestamps()) {
+            line.print(" (");
+            LINE_COLOR(line, COLOR_TIMESTAMP, line.printf("+%.3f", (double)delta / 1000.0))
+            line.printf(" mS @ %.3f s", (double)sessionDetector.rebase(timestamp) / 1000000.0);
+            line.print(")");
+        }
+        line.print("\r\n");
+        emitText(line);
+    }
+
+    if (sinks.wants(SINK_FORMAT_BINARY)) {
+        RpcEvent event(RPC_EVENT_CODE, eventSeq++);
+        event.put8(flavor);
+        event.put64(code);
+        event.put64(timestamp);
+        event.put32(sessionDetector.getCurrent().id);
+        if (clockSync.isValid()) {
+            event.put64(clockSync.toHostUs(timestamp));
+            event.put32(clockSync.uncertaintyUs(timestamp));
+        }
+        emitEvent(event);
+    }
+    sinks.noteEmitUs(now_us32() - startUs);
+}
+
+// "SMC: 0x1234 x57 over 1000 ms", or the whole cycle if several codes repeat.
+// The codes of an unfinished last cycle follow as plain codes.
+void printCoalesceSummary(const CoalesceSummary &summary) {
+    if (summary.count > 0 && sinks.wants(SINK_FORMAT_TEXT)) {
+        TextLine line;
+        for (uint8_t i = 0; i < summary.period; i++) {
+            if (i > 0) {
+                line.print(" > ");
+            }
+            LINE_COLOR(line, COLOR_FLAVOR, line.print(getStringForCodeFlavor(summary.cycle[i].flavor)))
+            LINE_COLOR(line, COLOR_CODE, line.printf(": 0x%llx", (unsigned long long)summary.cycle[i].code))
+        }
+        line.printf(" x%lu over %lu ms%s\r\n",
+            (unsigned long)summary.count,
+            (unsigned long)((summary.lastUs - summary.firstUs) / 1000),
+            summary.ongoing ? " (repeating)" : "");
+        emitText(line);
+    }
+
+    if (summary.count > 0 && sinks.wants(SINK_FORMAT_BINARY)) {
+        RpcEvent event(RPC_EVENT_REPEAT, eventSeq++);
+        event.put32(summary.count);
+        event.put64(summary.firstUs);
+        event.put64(summary.lastUs);
+        event.put8(summary.ongoing);
+        event.put8(summary.period);
+        for (uint8_t i = 0; i < summary.period; i++) {
+            event.put8(summary.cycle[i].flavor);
+            event.put64(summary.cycle[i].code);
+        }
+        emitEvent(event);
+    }
+
+    if (summary.tailLen > 0) {
+        // Deltas count from the last complete cycle, not the tail's own codes
+        runtimeState.nextPrintedTimestampDelta(summary.lastUs);
+        for (uint8_t i = 0; i < summary.tailLen; i++) {
+            printCode(summary.tail[i].code, summary.tail[i].flavor, summary.tail[i].timestamp);
+        }
+    }
+}
+
+const char *getStringForSessionCause(SessionCause cause) {
+    switch (cause) {
+        case SESSION_CAUSE_IDLE:
+            return "after idle gap";
+        case SESSION_CAUSE_RESET_CODE:
+            return "reset code";
+        case SESSION_CAUSE_FALL:
+            return "boot stage restarted";
+        default:
+            return "monitoring started";
+    }
+}
+
+// "--- Session 3 end: 142 codes in 12.345 s, 0 dropped | SMC: 0x1234 SP : - ..."
+void endSession() {
+    CoalesceSummary summary;
+    if (coalescer.flush(&summary)) {
+        printCoalesceSummary(summary);
+    }
+
+    if (bootModel.endBoot()) {
+        saveBootModel();
+    }
+
+    const SessionSummary &session = sessionDetector.close(runtimeState.capture()->getDroppedCodes());
+    busWatchdog.setSilenceWindow(0, 0);
+    if (sinks.wants(SINK_FORMAT_TEXT)) {
+        TextLine line;
+        line.printf("--- Session %lu end: %lu codes in %.3f s, %lu dropped |",
+            (unsigned long)session.id, (unsigned long)session.codes,
+            (double)(session.lastUs - session.startUs) / 1000000.0, (unsigned long)session.dropped);
+        for (uint8_t idx = 0; idx < CODE_IDX_MAX; idx++) {
+            line.printf(" %s: ", getStringForCodeFlavor(CODE_FLAVOR_FOR_INDEX[idx]));
+            if (session.seenFlavors & FLAVOR_BIT(idx)) {
+                line.printf("0x%llx", (unsigned long long)session.lastCode[idx]);
+            } else {
+                line.print("-");
+            }
+        }
+        line.print(" ---\r\n");
+        emitText(line);
+    }
+
+    if (sinks.wants(SINK_FORMAT_BINARY)) {
+        RpcEvent event(RPC_EVENT_SESSION_END, eventSeq++);
+        event.put32(session.id);
+        event.put32(session.codes);
+        event.put32(session.dropped);
+        event.put64(session.startUs);
+        event.put64(session.lastUs);
+        for (uint8_t idx = 0; idx < CODE_IDX_MAX; idx++) {
+            if (session.seenFlavors & FLAVOR_BIT(idx)) {
+                event.put8(CODE_FLAVOR_FOR_INDEX[idx]);
+                event.put64(session.lastCode[idx]);
+            }
+        }
+        emitEvent(event);
+    }
+}
+
+void startSession(const SegmentData &segData) {
+    if (sessionDetector.isOpen()) {
+        endSession();
+    }
+    sessionDetector.begin(segData, runtimeState.capture()->getDroppedCodes());
+    runtimeState.resetTimestamp();
+    const SessionSummary &session = sessionDetector.getCurrent();
+    if (sinks.wants(SINK_FORMAT_TEXT)) {
+        TextLine line;
+        line.printf("--- Session %lu start (%s) ---\r\n", (unsigned long)session.id, getStringForSessionCause(session.cause));
+        emitText(line);
+    }
+    if (sinks.wants(SINK_FORMAT_BINARY)) {
+        RpcEvent event(RPC_EVENT_SESSION_START, eventSeq++);
+        event.put32(session.id);
+        event.put8(session.cause);
+        event.put64(session.startUs);
+        emitEvent(event);
+    }
+    startBoot(segData.timestamp);
+    // Traffic that comes back after half the idle gap, but before the gap
+    // has ended the boot, had stopped in the middle of it
+    busWatchdog.setSilenceWindow(cfg.getSessionIdleMs() / 2, cfg.getSessionIdleMs());
+}
+
+// "--- Bus stall (held): restarted in 0.412 ms, stalled 63 ms, ~12 codes lost ---"
+// "--- Bus silent for 1204 ms mid-boot ---"
+void reportBusRecovery(const BusRecovery &recovery) {
+    if (sinks.wants(SINK_FORMAT_TEXT)) {
+        TextLine line;
+        if (recovery.cause == BUS_STALL_SILENT) {
+            line.printf("--- Bus silent for %lu ms mid-boot ---\r\n", (unsigned long)(recovery.stalledUs / 1000));
+        } else {
+            line.printf("--- Bus stall (%s): restarted in %.3f ms, stalled %lu ms, ~%lu codes lost ---\r\n",
+                recovery.cause == BUS_STALL_HELD ? "held" : "forced",
+                (double)recovery.recoveryUs / 1000.0, (unsigned long)(recovery.stalledUs / 1000),
+                (unsigned long)recovery.codesLost);
+        }
+        emitText(line);
+    }
+    if (sinks.wants(SINK_FORMAT_BINARY)) {
+        RpcEvent event(RPC_EVENT_BUS_RECOVERY, eventSeq++);
+        event.put8(recovery.cause);
+        event.put32(recovery.stalledUs);
+        event.put32(recovery.recoveryUs);
+        event.put32(recovery.codesLost);
+        event.put64(recovery.atUs);
+        emitEvent(event);
+    }
+}
+
+void processCode(const SegmentData &segData) {
+    if (cfg.isPostExact()) {
+        printCode(segData.code, segData.flavor, segData.timestamp);
+        return;
+    }
+
+    CoalesceSummary summary;
+    bool print = coalescer.feed(segData, &summary);
+    if (summary.count > 0 || summary.tailLen > 0) {
+        printCoalesceSummary(summary);
+    }
+    if (print) {
+        printCode(segData.code, segData.flavor, segData.timestamp);
+    } else {
+        // Keeps the delta of the next printed code relative to the last
+        // code seen, not the last one printed
+        runtimeState.nextPrintedTimestampDelta(segData.timestamp);
+    }
+}
+
+/* CORE 1 START */
+
+// Wire's onReceive callback. Runs in interrupt context on RP2040/Teensy,
+// and must not touch flash - see Capture.
+void CAPTURE_FUNC(core1_receiveI2cData)(int howMany) {
+    runtimeState.capture()->receive(Wire);
+}
+
+// Pushes synthetic packets through the same decode path the I2C callback
+// uses, timing each one. Runs while core0 keeps flushing the XIP cache.
+void core1_runLatencyTest() {
+    uint8_t packet[MAX6958_CODE_PACKET_SIZE];
+    SegmentData discard;
+
+    benchCapture.resetMaxReceiveTicks();
+    for (uint32_t i = 0; i < LATENCY_TEST_PACKETS; i++) {
+        encodeCodePacket(packet, CODE_FLAVOR_SMC, 1, (uint16_t)i);
+        BufferSource src(packet, sizeof(packet));
+        benchCapture.receive(src);
+        benchCapture.popPostCode(&discard);
+    }
+    latencyTestDone.store(true, std::memory_order_release);
+}
+
+// Feeds one packet per synthPeriodUs, numbered by the code word. In-process
+// it goes to benchCapture; whenever core1 was held up (e.g. parked during a
+// flash write) it catches up in a burst. On the bus it goes to another
+// reader, whose own flash writes don't hold this one up.
+void core1_pumpSyntheticLoad() {
+    if (synthPeriodUs == 0) {
+        return;
+    }
+
+    uint8_t packet[MAX6958_CODE_PACKET_SIZE];
+    uint32_t due = (now_us32() - synthStartUs) / synthPeriodUs;
+    while (synthSent < due) {
+        encodeCodePacket(packet, CODE_FLAVOR_SMC, 1, (uint16_t)synthSent);
+        if (synthOnBus) {
+            Wire.beginTransmission(MAX6958_ADDRESS);
+            Wire.write(packet, sizeof(packet));
+            Wire.endTransmission();
+        } else {
+            BufferSource src(packet, sizeof(packet));
+            benchCapture.receive(src);
+        }
+        synthSent++;
+    }
+    synthGenerated.store(synthSent, std::memory_order_release);
+}
+
+// I2C master on the Xbox bus pins, for replaying onto another reader
+void initReplayWire(uint8_t sdaPin, uint8_t sclPin, uint32_t clockHz) {
+#if defined(ARDUINO_ARCH_RP2040)
+    Wire.setSDA(sdaPin);
+    Wire.setSCL(sclPin);
+    Wire.begin();
+    Wire.setClock(clockHz);
+#elif defined(ARDUINO_ARCH_ESP32)
+    Wire.begin((int)sdaPin, (int)sclPin, clockHz);
+#elif defined(TEENSYDUINO)
+    Wire.begin(); // pins fixed in hardware
+    Wire.setClock(clockHz);
+#endif
+}
 
-        // Echo character in REPL mode
-        if (runtimeState.getCurrentState() == STATE_REPL && isBufferable) {
-            Serial.write(c);
+void initXboxWire(uint8_t sdaPin, uint8_t sclPin) {
+#if defined(ARDUINO_ARCH_RP2040)
+    Wire.setSDA(sdaPin);
+    Wire.setSCL(sclPin);
+    Wire.begin(MAX6958_ADDRESS);
+#elif defined(ARDUINO_ARCH_ESP32)
+    Wire.begin((uint8_t)MAX6958_ADDRESS, sdaPin, sclPin);
+#elif defined(TEENSYDUINO)
+    Wire.begin(MAX6958_ADDRESS); // pins fixed in hardware, not configurable
+#endif
+    Wire.onReceive(core1_receiveI2cData);
+}
+
+// While replaying onto the bus, Wire is a master and this reader captures
+// nothing; it goes back to being the MAX6958 once the run is over.
+bool replayOnBus = false;
+
+// Stops the Wire slave, clocks out whatever holds SDA and starts it again.
+// A code half-received when the bus stalled is dropped.
+void core1_recoverBus(BusStallCause cause) {
+    uint32_t startUs = now_us32();
+    uint8_t sda = runtimeState.getXboxSdaPin();
+    uint8_t scl = runtimeState.getXboxSclPin();
+    Wire.end();
+    BusWatchdog::pulseClock(sda, scl);
+    runtimeState.capture()->resetSegment();
+    initXboxWire(sda, scl);
+    busWatchdog.recovered(cause, now_us32() - startUs);
+}
+
+void core1_serviceReplay() {
+    if (replayer.poll(now_us32())) {
+        const ReplaySettings &settings = replayer.getSettings();
+        replayOnBus = (settings.target == REPLAY_TARGET_BUS);
+        if (replayOnBus) {
+            Wire.end();
+            initReplayWire(runtimeState.getXboxSdaPin(), runtimeState.getXboxSclPin(), (uint32_t)settings.clockKhz * 1000);
+        }
+    }
+
+    bool active;
+    if (replayOnBus) {
+        active = replayer.service([](const uint8_t *data, uint8_t len) {
+            Wire.beginTransmission(MAX6958_ADDRESS);
+            Wire.write(data, len);
+            return Wire.endTransmission() == 0;
+        });
+    } else {
+        active = replayer.service([](const uint8_t *data, uint8_t len) {
+            BufferSource src(data, len);
+            benchCapture.receive(src);
+            return true;
+        });
+    }
+
+    if (!active && replayOnBus) {
+        Wire.end();
+        initXboxWire(runtimeState.getXboxSdaPin(), runtimeState.getXboxSclPin());
+        busWatchdog.resume(runtimeState.capture()->getReceiveCount(), runtimeState.capture()->getCapturedCodes());
+        replayOnBus = false;
+    }
+}
+
+void setup1() {
+    platformTicksBegin();
+    initXboxWire(runtimeState.getXboxSdaPin(), runtimeState.getXboxSclPin());
+}
+
+void loop1() {
+    runtimeState.capture()->alarm()->service(now_us32());
+
+    // React to message from core0, if any (INVALID = nothing pending)
+    uint32_t msg = msg_core0.exchange(INVALID, std::memory_order_relaxed);
+    uint8_t msgType = msg & 0xFF;
+    switch (msgType) {
+        case RESET_TIMESTAMP:
+            // core0 already dropped what was queued, drop any half-received code too
+            runtimeState.capture()->resetSegment();
+            break;
+        case SET_I2C0_PINS: {
+            // Decode packed pins from message value
+            uint8_t sda = (msg >> 8) & 0xFF;
+            uint8_t scl = (msg >> 16) & 0xFF;
+            // Stop I2C slave handler
+            Wire.end();
+            // Set new pin mapping
+            initXboxWire(sda, scl);
+            // Restart I2C slave handler
+            runtimeState.setXboxI2CPins(sda, scl);
+            break;
+        }
+        case LATENCY_TEST:
+            core1_runLatencyTest();
+            break;
+        case SAMPLER:
+            if (msg >> 8) {
+                sampler.startCore(msg >> 8);
+            } else {
+                sampler.stopCore();
+            }
+            break;
+        case SYNTHETIC_LOAD:
+        case SYNTHETIC_SEND: {
+            bool onBus = msgType == SYNTHETIC_SEND && (msg >> 8) != 0;
+            if (onBus && replayOnBus) {
+                break;
+            }
+            if (onBus != synthOnBus) {
+                Wire.end();
+                if (onBus) {
+                    initReplayWire(runtimeState.getXboxSdaPin(), runtimeState.getXboxSclPin(), SAVE_TEST_BUS_CLOCK_HZ);
+                } else {
+                    initXboxWire(runtimeState.getXboxSdaPin(), runtimeState.getXboxSclPin());
+                    busWatchdog.resume(runtimeState.capture()->getReceiveCount(), runtimeState.capture()->getCapturedCodes());
+                }
+                synthOnBus = onBus;
+            }
+            synthPeriodUs = msg >> 8;
+            synthStartUs = now_us32();
+            synthSent = 0;
+            synthGenerated.store(0, std::memory_order_release);
+            break;
+        }
+        case BUS_RECOVER:
+            if (!replayOnBus && !synthOnBus) {
+                core1_recoverBus(BUS_STALL_FORCED);
+            }
+            break;
+    }
+
+    // The bus is ours to drive while replaying or sending onto it
+    if (!replayOnBus && !synthOnBus) {
+        Capture *capture = runtimeState.capture();
+        bool held = platformI2cBusHeld(runtimeState.getXboxSdaPin(), runtimeState.getXboxSclPin());
+        BusStallCause stall = busWatchdog.poll(held, capture->getReceiveCount(), capture->getCapturedCodes());
+        if (stall) {
+            core1_recoverBus(stall);
+        }
+    }
+
+    core1_pumpSyntheticLoad();
+    core1_serviceReplay();
+}
+
+/* CORE 1 END */
+
+/* CORE 0 START */
+
+inline void sendMessageToCore1(uint32_t msg) {
+    msg_core0.store(msg, std::memory_order_relaxed);
+}
+
+// The queue is single-consumer, so core0 drops its contents itself instead
+// of leaving that to core1.
+void resetPostMonitor() {
+    if (sessionDetector.isOpen()) {
+        endSession();
+    }
+    runtimeState.resetTimestamp();
+    coalescer.reset();
+    sessionDetector.reset();
+    runtimeState.capture()->discardPostCodes();
+    sendMessageToCore1(RESET_TIMESTAMP);
+}
+
+void applyCaptureFilter() {
+    CaptureFilter filter;
+    filter.compile(cfg.getFilterFlavors(), cfg.getFilterRules(), CODE_FILTER_MAX_RULES);
+    runtimeState.capture()->setFilter(filter);
+}
+
+void applyFaultAlarm() {
+    runtimeState.capture()->alarm()->configure(cfg.getFilterRules(), CODE_FILTER_MAX_RULES,
+        cfg.getFaultPin(), cfg.getFaultMode(), cfg.getFaultHoldMs());
+}
+
+// Output-capable, and not one of the I2C pins: the display's, or the Xbox
+// bus's `sda`/`scl` as they'll be once a pending change is applied
+bool isUsableAlarmPin(uint8_t pin, uint8_t sda, uint8_t scl) {
+#if BOARD_HAS_DISPLAY
+    if (pin == PIN_SDA_DISP || pin == PIN_SCL_DISP) {
+        return false;
+    }
+#endif
+    return isValidAlarmPin(pin) && pin != sda && pin != scl
+        && pin != PIN_TX_SINK && pin != PIN_RX_SINK;
+}
+
+// The UART is only started once something is sent to it, and restarted
+// when its baud rate changes
+void applySinkConfig() {
+    for (uint8_t id = 0; id < SINK_COUNT; id++) {
+        if (sinks[(SinkId)id].getFormat() != cfg.getSinkFormat((SinkId)id)) {
+            sinks[(SinkId)id].setFormat(cfg.getSinkFormat((SinkId)id));
+        }
+    }
+    if (cfg.getSinkFormat(SINK_UART) != SINK_FORMAT_OFF && sinkUartBaud != cfg.getSinkUartBaud()) {
+        if (sinkUartBaud != 0) {
+            SINK_UART_PORT.end();
+        }
+        sinkUartBaud = cfg.getSinkUartBaud();
+        platformSinkUartBegin(sinkUartBaud);
+    }
+}
+
+void printSinks() {
+    static const char *NAMES[SINK_COUNT] = { "USB ", "UART", "Null" };
+    for (uint8_t id = 0; id < SINK_COUNT; id++) {
+        OutputSink &sink = sinks[(SinkId)id];
+        Serial.printf("%s: %-6s %8lu records %10lu bytes %6lu dropped", NAMES[id], getStringForSinkFormat(sink.getFormat()),
+            (unsigned long)sink.getRecords(), (unsigned long)sink.getBytes(), (unsigned long)sink.getDropped());
+        if (sink.getBufferSize()) {
+            Serial.printf(", %u/%u buffered", sink.used(), sink.getBufferSize());
+        }
+        if (id == SINK_UART) {
+            Serial.printf(" @ %lu baud", (unsigned long)cfg.getSinkUartBaud());
+        }
+        Serial.println();
+    }
+    Serial.printf("Per code: %lu us mean, %lu us worst over %lu codes\r\n", (unsigned long)sinks.getEmitMeanUs(),
+        (unsigned long)sinks.getEmitMaxUs(), (unsigned long)sinks.getEmitCount());
+}
+
+// Returns an error message, or NULL once the run has been handed to core1
+const char *startReplay(const ReplaySettings &settings) {
+    if (replayer.size() == 0) {
+        return "No capture loaded";
+    }
+    if (replayer.isRunning()) {
+        return "Replay already running";
+    }
+    if (settings.target == REPLAY_TARGET_LOOPBACK && (latencyTestRunning || saveTestRunning)) {
+        return "The latency and save tests use the bench capture";
+    }
+    if (settings.target == REPLAY_TARGET_BUS && saveTestSending) {
+        return "Sending for a save test, 'savetest stop' first";
+    }
+    if (settings.target == REPLAY_TARGET_BUS && saveTestRunning) {
+        return "A save test is running, the bus replay would skew it";
+    }
+    if (settings.target == REPLAY_TARGET_BUS && settings.clockKhz == 0) {
+        return "Bus clock must not be 0";
+    }
+    SegmentData segData;
+    while (benchCapture.popPostCode(&segData)) {}
+    replayReceived = 0;
+    replayStartDropped = benchCapture.getDroppedCodes();
+    replayer.start(settings);
+    replayRunning = true;
+    return NULL;
+}
+
+void printReplay() {
+    const ReplaySettings &settings = replayRunning ? replayer.getSettings() : replaySettings;
+    Serial.printf("Loaded: %u codes (max %u)%s\r\n", replayer.size(), REPLAY_MAX_CODES,
+        replayer.isRunning() ? (settings.target == REPLAY_TARGET_BUS ? ", playing onto the bus" : ", playing in loopback") : "");
+    Serial.printf("Settings: %u kHz, %u us after each packet, burst %u, speedup %u\r\n",
+        settings.clockKhz, settings.packetGapUs, settings.burst, settings.speedup);
+    Serial.printf("Sent: %lu codes in %lu packets (%lu not acknowledged), %u passes\r\n",
+        (unsigned long)replayer.getCodesSent(), (unsigned long)replayer.getPacketsSent(),
+        (unsigned long)replayer.getNacks(), replayer.getPassesDone());
+    if (settings.target == REPLAY_TARGET_LOOPBACK) {
+        Serial.printf("Received: %lu codes, %lu dropped\r\n", (unsigned long)replayReceived,
+            (unsigned long)(benchCapture.getDroppedCodes() - replayStartDropped));
+    }
+}
+
+// core0 side of a replay: counts what comes out of the bench capture in
+// loopback, and reports once core1 is done
+void serviceReplay() {
+    if (!replayRunning) {
+        return;
+    }
+    SegmentData segData;
+    while (benchCapture.popPostCode(&segData)) {
+        replayReceived++;
+    }
+    if (!replayer.isRunning()) {
+        replayRunning = false;
+        print("Notice", "Replay finished");
+        printReplay();
+    }
+}
+
+void stopSampler() {
+    sampler.stopCore();
+    if (Board::coreCount > 1) {
+        sendMessageToCore1(SAMPLER);
+    }
+    samplerHz = 0;
+}
+
+// Returns an error message, or NULL once every core samples
+const char *startSampler(uint16_t hz) {
+    if (!Board::hasSampler) {
+        return "No sampling profiler on this board";
+    }
+    if (hz == 0 || hz > SAMPLER_MAX_HZ) {
+        return "Sampling rate must be 1-20000 Hz";
+    }
+    stopSampler();
+    sampler.reset();
+    samplerHz = hz;
+    sampler.startCore(hz);
+    if (Board::coreCount > 1) {
+        sendMessageToCore1((uint32_t)SAMPLER | ((uint32_t)hz << 8));
+    }
+    return NULL;
+}
+
+void printSampler() {
+    if (samplerHz) {
+        Serial.printf("Sampling at %u Hz", samplerHz);
+    } else {
+        Serial.print("Stopped");
+    }
+    Serial.printf(", %u samples waiting, %lu dropped\r\n", sampler.pending(), (unsigned long)sampler.getDropped());
+}
+
+// "PROF <core> <pc> <lr>" per sample, the format tools/sampleprof.py reads
+void dumpSamples() {
+    SamplerSample sample;
+    for (uint8_t core = 0; core < Board::coreCount; core++) {
+        while (sampler.pop(core, sample)) {
+            Serial.printf("PROF %u %08lx %08lx\r\n", core, (unsigned long)sample.pc, (unsigned long)sample.lr);
+        }
+    }
+    printSampler();
+}
+
+void applySessionConfig() {
+    sessionDetector.configure(cfg.getSessionIdleMs(), cfg.getSessionResetFlavors(), cfg.getSessionResetCode(),
+        cfg.isSessionSplitFall());
+    bootProfiler.setMilestones(cfg.getMilestoneFlavors(), cfg.getMilestoneCodes());
+}
+
+void applyDisplayConfig() {
+    runtimeState.display()->setMirroring(cfg.isDisplayMirrored());
+    runtimeState.display()->setRotation(
+        cfg.isRotationPortrait()
+        ? DISPLAY_PORTRAIT
+        : DISPLAY_LANDSCAPE
+    );
+}
+
+// Applies (tag, size, value) entries all-or-nothing: every entry is checked
+// before the live config changes.
+RpcStatus rpcConfigSet(const RpcRequest &req, uint8_t *badTag) {
+    uint8_t sda = cfg.getXboxSdaPin();
+    uint8_t scl = cfg.getXboxSclPin();
+    uint8_t faultPin = cfg.getFaultPin();
+    bool faultPinChanged = false;
+
+    for (uint8_t pos = 0; pos < req.length; ) {
+        if (pos + 2 > req.length || pos + 2 + req.payload[pos + 1] > req.length) {
+            return RPC_ERR_BAD_PAYLOAD;
+        }
+        uint8_t tag = req.payload[pos];
+        uint8_t size = req.payload[pos + 1];
+        const ConfigField *field = findConfigField(tag);
+        if (field == NULL || field->size != size) {
+            *badTag = tag;
+            return RPC_ERR_BAD_FIELD;
+        }
+        if (tag == CFG_XBOX_SDA_PIN) {
+            sda = req.payload[pos + 2];
+        } else if (tag == CFG_XBOX_SCL_PIN) {
+            scl = req.payload[pos + 2];
+        } else if (tag == CFG_FAULT_PIN) {
+            faultPin = req.payload[pos + 2];
+            faultPinChanged = true;
+        } else if ((tag == CFG_SINK_USB_FORMAT || tag == CFG_SINK_UART_FORMAT || tag == CFG_SINK_NULL_FORMAT)
+            && req.payload[pos + 2] > SINK_FORMAT_BINARY) {
+            *badTag = tag;
+            return RPC_ERR_BAD_VALUE;
+        } else if (tag == CFG_SINK_UART_BAUD && rpcGet32(&req.payload[pos + 2]) == 0) {
+            *badTag = tag;
+            return RPC_ERR_BAD_VALUE;
+        } else if (tag == CFG_COALESCE_INTERVAL_MS && rpcGet16(&req.payload[pos + 2]) == 0) {
+            *badTag = tag;
+            return RPC_ERR_BAD_VALUE;
+        } else if (tag == CFG_FILTER_RULES) {
+            CodeRule rules[CODE_FILTER_MAX_RULES];
+            memcpy(rules, &req.payload[pos + 2], sizeof(rules));
+            for (const CodeRule &rule : rules) {
+                if (rule.kind > CODE_RULE_FAULT || (rule.kind != CODE_RULE_UNUSED && rule.first > rule.last)) {
+                    *badTag = tag;
+                    return RPC_ERR_BAD_VALUE;
+                }
+            }
+        }
+        pos += 2 + size;
+    }
+
+    bool pinsChanged = sda != cfg.getXboxSdaPin() || scl != cfg.getXboxSclPin();
+    if (pinsChanged && (!Board::canRemapI2c || !isValidI2C0Pins(sda, scl))) {
+        *badTag = CFG_XBOX_SDA_PIN;
+        return RPC_ERR_BAD_VALUE;
+    }
+    // Against the pins this request leaves in place, whichever side changed
+    if ((faultPinChanged || pinsChanged) && faultPin != FAULT_PIN_NONE && !isUsableAlarmPin(faultPin, sda, scl)) {
+        *badTag = faultPinChanged ? CFG_FAULT_PIN : (faultPin == sda ? CFG_XBOX_SDA_PIN : CFG_XBOX_SCL_PIN);
+        return RPC_ERR_BAD_VALUE;
+    }
+
+    for (uint8_t pos = 0; pos < req.length; pos += 2 + req.payload[pos + 1]) {
+        cfg.setField(req.payload[pos], &req.payload[pos + 2], req.payload[pos + 1]);
+    }
+
+    applyDisplayConfig();
+    applyCaptureFilter();
+    applyFaultAlarm();
+    applySessionConfig();
+    applySinkConfig();
+    coalescer.setIntervalMs(cfg.getCoalesceIntervalMs());
+    if (pinsChanged) {
+        sendMessageToCore1(packSetI2C0PinsMsg(sda, scl));
+    }
+    return RPC_OK;
+}
+
+// Binary sinks get every sync too, so their logs can be mapped later on
+void applyClockSync(const ClockSyncFit &fit) {
+    clockSync.set(fit);
+    if (sinks.wants(SINK_FORMAT_BINARY)) {
+        RpcEvent event(RPC_EVENT_CLOCK_SYNC, eventSeq++);
+        event.put64(fit.deviceUs);
+        event.put64(fit.hostUs);
+        event.put32((uint32_t)fit.driftPpb);
+        event.put32(fit.uncertaintyUs);
+        event.put32(fit.driftUncertaintyPpb);
+        emitEvent(event);
+    }
+}
+
+void handleRpcRequest(const RpcRequest &req) {
+    RpcResponse resp(req.id);
+    Capture *capture = runtimeState.capture();
+
+    switch (req.op) {
+        case RPC_OP_PING:
+            resp.putBytes(req.payload, req.length);
+            break;
+        case RPC_OP_VERSION:
+            resp.put8(RPC_PROTOCOL_VERSION);
+            resp.put8(CFG_VERSION);
+            resp.put32(BUILD_DATE);
+            resp.putBytes(FW_VERSION, strlen(FW_VERSION));
+            break;
+        case RPC_OP_STATUS:
+            resp.put8(runtimeState.getCurrentState());
+            resp.put16(capture->getQueueDepth());
+            resp.put8(cfg.isSavePending());
+            resp.put8(cfg.freeJournalPages());
+            resp.put32(millis());
+            resp.put32(runtimeState.getBusIdleMs(millis()));
+            break;
+        case RPC_OP_COUNTERS:
+            resp.put32(capture->getReceiveCount());
+            resp.put32(capture->getDroppedCodes());
+            resp.put32(tickScale.toUs(capture->getMaxReceiveTicks()));
+            resp.put32(capture->getFilteredCodes());
+            for (uint8_t idx = 0; idx < CODE_IDX_MAX; idx++) {
+                resp.put32(capture->getDroppedCodes((CodeIndex)idx));
+            }
+            resp.put32(capture->getCapturedCodes());
+            break;
+        case RPC_OP_CODE_STATS: {
+            if (req.length < 3) {
+                resp.setStatus(RPC_ERR_BAD_PAYLOAD);
+                break;
+            }
+            uint16_t start = rpcGet16(req.payload);
+            uint8_t count = req.payload[2] > RPC_CODE_STATS_MAX_SLOTS ? RPC_CODE_STATS_MAX_SLOTS : req.payload[2];
+            uint16_t end = start + count;
+            resp.put16(CODE_STATS_CAPACITY);
+            resp.put16(codeStats.getUsed());
+            resp.put32(codeStats.getUntrackedHits());
+            for (uint16_t slot = start; slot < end && slot < CODE_STATS_CAPACITY; slot++) {
+                const CodeStatsEntry &e = codeStats.entry(slot);
+                if (e.hits == 0) {
+                    continue;
+                }
+                resp.put8(e.flavor);
+                resp.putBytes(&e.code, sizeof(e.code));
+                resp.put32(e.hits);
+                resp.put32((uint32_t)(e.firstUs / 1000));
+                resp.put32((uint32_t)(e.lastUs / 1000));
+                resp.put32(e.minGapUs);
+                resp.put32(e.maxGapUs);
+            }
+            break;
+        }
+        case RPC_OP_TIME:
+            if (req.length != 8) {
+                resp.setStatus(RPC_ERR_BAD_PAYLOAD);
+                break;
+            }
+            resp.putBytes(req.payload, 8);
+            resp.put64(rpcReceivedUs);
+            resp.put64(now_us64());
+            break;
+        case RPC_OP_TIME_SET:
+            if (req.length == 0) {
+                clockSync.clear();
+            } else if (req.length == 28) {
+                applyClockSync(ClockSyncFit{
+                    rpcGet64(req.payload), rpcGet64(req.payload + 8), (int32_t)rpcGet32(req.payload + 16),
+                    rpcGet32(req.payload + 20), rpcGet32(req.payload + 24) });
+            } else {
+                resp.setStatus(RPC_ERR_BAD_PAYLOAD);
+            }
+            break;
+        case RPC_OP_PROF: {
+            uint8_t action = req.length ? req.payload[0] : RPC_PROF_DRAIN;
+            if (action == RPC_PROF_START) {
+                if (req.length < 3) {
+                    resp.setStatus(RPC_ERR_BAD_PAYLOAD);
+                    break;
+                }
+                if (startSampler(rpcGet16(req.payload + 1)) != NULL) {
+                    resp.setStatus(Board::hasSampler ? RPC_ERR_BAD_VALUE : RPC_ERR_FAILED);
+                    break;
+                }
+            } else if (action == RPC_PROF_STOP) {
+                stopSampler();
+            } else if (action != RPC_PROF_DRAIN) {
+                resp.setStatus(RPC_ERR_BAD_VALUE);
+                break;
+            }
+            resp.put16(samplerHz);
+            resp.put32(sampler.getDropped());
+            // Round robin, so no core's ring overflows while another drains
+            SamplerSample sample;
+            uint8_t count = 0;
+            bool more = true;
+            while (more && count < RPC_PROF_MAX_SAMPLES) {
+                more = false;
+                for (uint8_t core = 0; core < Board::coreCount && count < RPC_PROF_MAX_SAMPLES; core++) {
+                    if (sampler.pop(core, sample)) {
+                        resp.put8(core);
+                        resp.put32(sample.pc);
+                        resp.put32(sample.lr);
+                        count++;
+                        more = true;
+                    }
+                }
+            }
+            break;
+        }
+        case RPC_OP_CONFIG_SCHEMA:
+            // The names don't all fit one frame, so the host pages through them
+            for (uint8_t i = req.length ? req.payload[0] : 0; i < CFG_FIELD_COUNT; i++) {
+                const ConfigField &field = CONFIG_FIELDS[i];
+                uint8_t nameLen = strlen(field.name);
+                if (resp.remaining() < 3u + nameLen) {
+                    break;
+                }
+                resp.put8(field.tag);
+                resp.put8(field.size);
+                resp.put8(nameLen);
+                resp.putBytes(field.name, nameLen);
+            }
+            break;
+        case RPC_OP_CONFIG_GET: {
+            static_assert(2 * CFG_FIELD_COUNT + CFG_DATA_SIZE <= RPC_MAX_PAYLOAD, "Every field must fit one reply");
+            // No tags means all of them
+            uint8_t count = req.length ? req.length : CFG_FIELD_COUNT;
+            for (uint8_t i = 0; i < count; i++) {
+                uint8_t tag = req.length ? req.payload[i] : CONFIG_FIELDS[i].tag;
+                uint8_t value[sizeof(ConfigData)];
+                uint8_t size = 0;
+                if (!cfg.getField(tag, value, &size)) {
+                    resp = RpcResponse(req.id, RPC_ERR_BAD_FIELD);
+                    resp.put8(tag);
+                    break;
+                }
+                // A list of tags can ask for more than a frame holds
+                if (resp.remaining() < 2u + size) {
+                    resp = RpcResponse(req.id, RPC_ERR_TOO_LARGE);
+                    resp.put8(tag);
+                    break;
+                }
+                resp.put8(tag);
+                resp.put8(size);
+                resp.putBytes(value, size);
+            }
+            break;
+        }
+        case RPC_OP_CONFIG_SET: {
+            uint8_t badTag = 0;
+            RpcStatus status = rpcConfigSet(req, &badTag);
+            resp.setStatus(status);
+            if (status == RPC_ERR_BAD_FIELD || status == RPC_ERR_BAD_VALUE) {
+                resp.put8(badTag);
+            }
+            break;
         }
-
-        // Handle newline
-        if (c == '\n' || c == '\r') {
-            Serial.println("");
-            if (inputBuffer.length() > 0) {
-                inputBuffer.trim();
-                if (inputBuffer == "post") {
-                    runtimeState.setCurrentState(STATE_POST_MONITOR);
-                } else if (inputBuffer == "rotate") {
-                    runtimeState.setCurrentState(STATE_DISPLAY_ROTATE);
-                } else if (inputBuffer == "mirror") {
-                    runtimeState.setCurrentState(STATE_DISPLAY_MIRROR);
-                } else if (inputBuffer == "colors") {
-                    runtimeState.setCurrentState(STATE_TOGGLE_COLORS);
-                } else if (inputBuffer == "ts") {
-                    runtimeState.setCurrentState(STATE_TOGGLE_TIMESTAMP);
-                } else if (inputBuffer == "config") {
-                    runtimeState.setCurrentState(STATE_CONFIG_SHOW);
-                } else if (inputBuffer == "save") {
-                    runtimeState.setCurrentState(STATE_CONFIG_SAVE);
-                } else if (inputBuffer == "version" ) {
-                    runtimeState.setCurrentState(STATE_PRINT_VERSION);
-                } else if (inputBuffer == "help") {
-                    runtimeState.setCurrentState(STATE_PRINT_HELP);
-                } else if (inputBuffer == "bootsel") {
-                    runtimeState.setCurrentState(STATE_BOOTSEL);
-                } else if (inputBuffer.startsWith("i2c0")) {
-                    String args = inputBuffer.substring(4);
-                    args.trim();
-                    int spaceIdx = args.indexOf(' ');
-                    String sdaStr = spaceIdx > 0 ? args.substring(0, spaceIdx) : "";
-                    String sclStr = spaceIdx > 0 ? args.substring(spaceIdx + 1) : "";
-                    sclStr.trim();
-                    if (sdaStr.length() > 0 && sclStr.length() > 0) {
-                        pendingI2C0Sda = (uint8_t)sdaStr.toInt();
-                        pendingI2C0Scl = (uint8_t)sclStr.toInt();
-                        runtimeState.setCurrentState(STATE_SET_I2C0_PINS);
-                    } else {
-                        Serial.println("Usage: i2c0 <sda_pin> <scl_pin>");
-                    }
-                } else {
-                    Serial.println("Unknown command. Type 'help' for available commands.");
+        case RPC_OP_CONFIG_SAVE:
+            cfg.save();
+            if (req.length >= 1 && (req.payload[0] & 0x01) && !cfg.commitNow(true)) {
+                resp.setStatus(RPC_ERR_FAILED);
+            }
+            break;
+        case RPC_OP_REPLAY_LOAD: {
+            if (req.length < 1 || (req.length - 1) % 13 != 0) {
+                resp.setStatus(RPC_ERR_BAD_PAYLOAD);
+                break;
+            }
+            if (replayer.isRunning()) {
+                resp.setStatus(RPC_ERR_FAILED);
+                break;
+            }
+            if (req.payload[0] & 0x01) {
+                replayer.clear();
+            }
+            for (uint8_t pos = 1; pos < req.length; pos += 13) {
+                uint64_t code = rpcGet32(&req.payload[pos + 1]) | ((uint64_t)rpcGet32(&req.payload[pos + 5]) << 32);
+                if (!replayer.add((CodeFlavor)req.payload[pos], code, rpcGet32(&req.payload[pos + 9]))) {
+                    resp.setStatus(RPC_ERR_FAILED);
+                    break;
                 }
-                inputBuffer = "";
             }
-            if (runtimeState.getCurrentState() == STATE_REPL) {
-                Serial.print(">> ");  // REPL prompt after command
+            resp.put16(replayer.size());
+            break;
+        }
+        case RPC_OP_REPLAY_START: {
+            if (req.length < 9 || req.payload[0] > REPLAY_TARGET_LOOPBACK) {
+                resp.setStatus(req.length < 9 ? RPC_ERR_BAD_PAYLOAD : RPC_ERR_BAD_VALUE);
+                break;
+            }
+            ReplaySettings settings = {
+                (ReplayTarget)req.payload[0],
+                rpcGet16(&req.payload[1]),
+                rpcGet16(&req.payload[3]),
+                rpcGet16(&req.payload[5]),
+                req.payload[7],
+                req.payload[8],
+            };
+            if (startReplay(settings) != NULL) {
+                resp.setStatus(RPC_ERR_FAILED);
             }
-        } else if (isBufferable) {
-            inputBuffer += c;
+            break;
         }
+        case RPC_OP_REPLAY_STOP:
+            replayer.stop();
+            break;
+        case RPC_OP_REPLAY_STATUS:
+            resp.put8(replayer.isRunning());
+            resp.put16(replayer.size());
+            resp.put16(replayer.getPassesDone());
+            resp.put32(replayer.getCodesSent());
+            resp.put32(replayer.getPacketsSent());
+            resp.put32(replayer.getNacks());
+            resp.put32(replayReceived);
+            resp.put32(benchCapture.getDroppedCodes() - replayStartDropped);
+            break;
+        default:
+            resp.setStatus(RPC_ERR_UNKNOWN_OP);
+            break;
     }
-}
 
-void printRegisters() {
-    Serial.println(">> REGISTERS");
-    for (int i = 0; i < MAX6958_REGISTER_SIZE; i++) {
-        int val = runtimeState.getRegister(i);
-        Serial.printf("REG 0x%02X : 0x%02X\r\n", i, val);
-    }
+    resp.send(Serial);
 }
 
-void printCode(uint64_t code, CodeFlavor flavor, uint64_t timestamp) {
-    const char *flavor_str = getStringForCodeFlavor(flavor);
-    runtimeState.display()->printCode(code, flavor_str);
-    
-    // Color is only printed if `printColors` is set
-    PRINT_COLOR(COLOR_FLAVOR, Serial.print(flavor_str))
-    PRINT_COLOR(COLOR_CODE, Serial.printf(": 0x%llx", (unsigned long long)code))
-
-    uint64_t delta = runtimeState.nextPrintedTimestampDelta(timestamp);
-
-    if (cfg.isPostPrintTimestamps()) {
-        Serial.print(" (");
-        PRINT_COLOR(COLOR_TIMESTAMP, Serial.printf("+%.3f", (double)delta / 1000.0))
-        Serial.print(" mS");
-        Serial.print(")");
+// Parses and dispatches one complete input line. Returns true if a command
+// was started.
+bool dispatchLine(char *line, State origin) {
+    const ReplCommand<State> *cmd = NULL;
+    switch (parseReplLine(replIndex, line, &cmd, &commandArgs)) {
+        case REPL_EMPTY:
+            return false;
+        case REPL_UNKNOWN_COMMAND:
+            Serial.println("Unknown command. Type 'help' for available commands.");
+            return false;
+        case REPL_BAD_ARGS:
+            Serial.printf("Usage: %s\r\n", cmd->usage);
+            return false;
+        case REPL_OK:
+            break;
     }
 
-    Serial.println();
+    runtimeState.beginCommand(cmd->state, origin);
+    return true;
 }
 
-/* CORE 1 START */
+// Drains everything the host has sent so far - scripted command sequences
+// arrive in one burst - but stops right after dispatching a command, so it
+// runs before the next line is read.
+//
+// In the REPL every line is a command. Everywhere else single keys act
+// immediately, and while monitoring ':' starts a command line that runs
+// without leaving POST monitoring.
+void handleSerialInput() {
+    State state = runtimeState.getCurrentState();
+    if (state == STATE_RETURN_TO_REPL) {
+        return;
+    }
+    bool inRepl = (state == STATE_REPL);
 
-void core1_receiveI2cData(int howMany) {
-    uint8_t recvd_byte = 0;
-    int reg = -1;
-
-    uint16_t codeWord = 0;
-    while (Wire.available()) {
-        recvd_byte = Wire.read();
-        if (reg == -1 || reg == FactoryReserved || reg == MAX6958_REGISTER_SIZE) {
-            // First byte of a packet is the CMD / target register address
-            // NOTE: Register Configuration (0x04) is always sent alone
-            // If we are at Register FactoryReserved (0x05), we read the register/command again, as it will be the start of a new packet
-            // If Register is > MAX6958_REGISTER_SIZE, also expect a new packet following
-            reg = recvd_byte;
-        } else {
-            runtimeState.setRegister(reg, recvd_byte);
-            // Serial.printf("Register %s (0x%02x): 0x%02x (ts: %llu)\r\n", getNameForMAX6958Register(reg), reg, recvd_byte, now_us64());
-            if (reg >= Digit0 && reg <= Digit3) {
-                // Shift lower nibble (4 bits) of digit to position in u16 value
-                codeWord |= (uint16_t)(recvd_byte & 0x0F) << (4 * (reg - Digit0));
-            } else if (reg == Segments) {
-                runtimeState.setSegmentCode(recvd_byte, codeWord);
-                codeWord = 0;
+    while (Serial.available() > 0) {
+        char c = Serial.read();
+
+        // RPC frames can show up in any state, in between anything else
+        if (rpcParser.isActive() || (uint8_t)c == RPC_SYNC) {
+            switch (rpcParser.feed((uint8_t)c, millis())) {
+                case RPC_FRAME_READY:
+                    rpcReceivedUs = now_us64();
+                    handleRpcRequest(rpcParser.request());
+                    break;
+                case RPC_FRAME_BAD_CRC: {
+                    RpcResponse resp(rpcParser.request().id, RPC_ERR_BAD_CRC);
+                    resp.send(Serial);
+                    break;
+                }
+                case RPC_FRAME_PENDING:
+                    break;
             }
-            // After each byte the target register address is automatically incremented
-            // This allow communication to be more dense
-            // See: MAX6958 Datasheet, page 9 -> Command Address Autoincrementing
-            reg++;
+            continue;
         }
-    }
-
-    // Add the assembled code
-    if (runtimeState.isCodeReady()) {
-        runtimeState.enqueueCode();
-    }
-}
 
-void initXboxWire(uint8_t sdaPin, uint8_t sclPin) {
-#if defined(ARDUINO_ARCH_RP2040)
-    Wire.setSDA(sdaPin);
-    Wire.setSCL(sclPin);
-    Wire.begin(MAX6958_ADDRESS);
-#elif defined(ARDUINO_ARCH_ESP32)
-    Wire.begin((uint8_t)MAX6958_ADDRESS, sdaPin, sclPin);
-#elif defined(TEENSYDUINO)
-    Wire.begin(MAX6958_ADDRESS); // pins fixed in hardware, not configurable
-#endif
-    Wire.onReceive(core1_receiveI2cData);
-}
+        if (!inRepl && !monitorCommandLine) {
+            switch (c) {
+                case CTRL_C:
+                    runtimeState.setCurrentState(STATE_RETURN_TO_REPL);
+                    return;
+                case 'r':
+                    if (state == STATE_POST_MONITOR) {
+                        resetPostMonitor();
+                        Serial.println("Resetting timestamp");
+                    }
+                    break;
+                case 'l':
+                    if (state == STATE_POST_MONITOR) {
+                        runtimeState.beginCommand(STATE_LAST_CODES, state);
+                        return;
+                    }
+                    break;
+                case ':':
+                    if (state == STATE_POST_MONITOR) {
+                        monitorCommandLine = true;
+                        lineEditor.clear();
+                    }
+                    break;
+            }
+            continue;
+        }
 
-void setup1() {
-    initXboxWire(runtimeState.getXboxSdaPin(), runtimeState.getXboxSclPin());
-}
+        if (c == CTRL_C) {
+            lineEditor.clear();
+            if (monitorCommandLine) {
+                monitorCommandLine = false;
+            } else {
+                Serial.print("\r\n>> ");
+            }
+            continue;
+        }
 
-void loop1() {
-    // React to message from core0, if any (INVALID = nothing pending)
-    uint32_t msg = msg_core0.exchange(INVALID, std::memory_order_relaxed);
-    uint8_t msgType = msg & 0xFF;
-    switch (msgType) {
-        case RESET_TIMESTAMP:
-            runtimeState.resetTimestamp();
-            runtimeState.clearPostCodeQueue();
-            break;
-        case SET_I2C0_PINS: {
-            // Decode packed pins from message value
-            uint8_t sda = (msg >> 8) & 0xFF;
-            uint8_t scl = (msg >> 16) & 0xFF;
-            // Stop I2C slave handler
-            Wire.end();
-            // Set new pin mapping
-            initXboxWire(sda, scl);
-            // Restart I2C slave handler
-            runtimeState.setXboxI2CPins(sda, scl);
-            break;
+        // Echo in REPL mode only, codes keep streaming while monitoring
+        if (inRepl) {
+            if (c == '\b' || c == 0x7F) {
+                if (lineEditor.length() > 0) {
+                    Serial.print("\b \b");
+                }
+            } else if (c >= 0x20 && c < 0x7F) {
+                Serial.write(c);
+            }
         }
-    }
-}
 
-/* CORE 1 END */
+        if (!lineEditor.feed(c)) {
+            continue;
+        }
 
-/* CORE 0 START */
+        if (inRepl) {
+            Serial.println("");
+        }
+        bool dispatched = false;
+        if (lineEditor.isOverflowed()) {
+            Serial.printf("Line too long (max %u characters)\r\n", REPL_LINE_MAX);
+        } else {
+            dispatched = dispatchLine(lineEditor.line(), state);
+        }
+        lineEditor.clear();
+        monitorCommandLine = false;
 
-inline void sendMessageToCore1(uint32_t msg) {
-    msg_core0.store(msg, std::memory_order_relaxed);
+        if (runtimeState.getCurrentState() == STATE_REPL) {
+            Serial.print(">> ");  // REPL prompt after command
+        }
+        if (dispatched) {
+            return;
+        }
+    }
 }
 
 void setup() {
@@ -282,9 +1659,20 @@ void setup() {
     }
 #endif
     Serial.begin(SERIAL_BAUD);
+    platformTicksBegin();
+    tickScale.calibrate(platformTickHz());
     if (!cfg.begin()) {
         Serial.println("Failed to load config");
     }
+    sinks[SINK_USB].begin(&Serial);
+    sinks[SINK_UART].begin(&SINK_UART_PORT, sinkUartBuffer, sizeof(sinkUartBuffer));
+    sinks[SINK_NULL].begin(NULL);
+    applySinkConfig();
+    coalescer.setIntervalMs(cfg.getCoalesceIntervalMs());
+    applyCaptureFilter();
+    applyFaultAlarm();
+    applySessionConfig();
+    loadBootModel();
 
     // Restore persisted I2C0 (Xbox bus) pins, if they differ from the
     // compile-time defaults setup1() starts with. Going through the same
@@ -295,14 +1683,8 @@ void setup() {
 
     if (runtimeState.begin()) {
         Serial.println("SSD1306 Display detected :)");
-        // Set display rotation
-        runtimeState.display()->setRotation(
-            cfg.isRotationPortrait()
-            ? DISPLAY_PORTRAIT
-            : DISPLAY_LANDSCAPE
-        );
-        runtimeState.display()->setMirroring(cfg.isDisplayMirrored());
-    } else {
+        applyDisplayConfig();
+    } else if (Board::hasDisplay) {
         Serial.println("No display detected :(");
     }
 
@@ -314,11 +1696,23 @@ void setup() {
 
 void loop() {
     platformPumpCore1();
+    sinks.pump();
+    serviceReplay();
 
     switch (runtimeState.getCurrentState()) {
         case STATE_RETURN_TO_REPL:
             if (postMonitorRunning) {
                 postMonitorRunning = false;
+                if (sessionDetector.isOpen()) {
+                    endSession();
+                }
+            }
+            latencyTestRunning = false;
+            if (saveTestRunning) {
+                saveTestRunning = false;
+                if (!saveTestOnBus) {
+                    sendMessageToCore1(packSyntheticLoadMsg(0));
+                }
             }
 
             runtimeState.setCurrentState(STATE_REPL);
@@ -326,54 +1720,422 @@ void loop() {
             break;
 
         case STATE_REPL:
-            handleRepl();
+            // Input is handled below, for every state
             break;
         
         case STATE_POST_MONITOR:
             if (!postMonitorRunning) {
                 postMonitorRunning = true;
-                sendMessageToCore1(RESET_TIMESTAMP);
+                resetPostMonitor();
                 runtimeState.display()->clear();
                 Serial.println("Entering POST monitoring mode. Press CTRL+C to exit.");
             }
 
             // Process all codes in the queue
-            while (!runtimeState.isPostCodeQueueEmpty()) {
-                if(runtimeState.popPostCode(&currentSegData)) {
-                    printCode(currentSegData.code, currentSegData.flavor, currentSegData.timestamp);
+            while (runtimeState.capture()->popPostCode(&currentSegData)) {
+                codeStats.record(currentSegData);
+                bool newBoot = sessionDetector.isNewSession(currentSegData);
+                if (newBoot) {
+                    startSession(currentSegData);
+                }
+                sessionDetector.record(currentSegData);
+                bootProfiler.record(currentSegData, newBoot);
+                bootModel.onCode(currentSegData);
+                processCode(currentSegData);
+            }
+            {
+                CoalesceSummary summary;
+                if (coalescer.poll(now_us64(), &summary)) {
+                    printCoalesceSummary(summary);
+                }
+            }
+            if (sessionDetector.isIdle(now_us64())) {
+                endSession();
+            }
+            updateBootProgress();
+            streamRegisterChanges();
+            {
+                BusRecovery recovery;
+                while (busWatchdog.popRecovery(recovery)) {
+                    reportBusRecovery(recovery);
+                }
+            }
+            break;
+        case STATE_SHOW_QUEUES: {
+            Capture *capture = runtimeState.capture();
+            for (uint8_t idx = 0; idx < CODE_IDX_MAX; idx++) {
+                Serial.printf("%s: %2u/%2u queued, %lu dropped\r\n", getStringForCodeFlavor(CODE_FLAVOR_FOR_INDEX[idx]),
+                    capture->getQueueDepth((CodeIndex)idx), capture->getQueueCapacity((CodeIndex)idx),
+                    (unsigned long)capture->getDroppedCodes((CodeIndex)idx));
+            }
+            runtimeState.finishCommand();
+            break;
+        }
+        case STATE_TOP_CODES: {
+            uint16_t slots[CODE_STATS_TOP_MAX];
+            uint8_t wanted = commandArgs.count ? commandArgs.value[0] : 10;
+            if (wanted == 0 || wanted > CODE_STATS_TOP_MAX) {
+                wanted = CODE_STATS_TOP_MAX;
+            }
+            uint8_t found = codeStats.top(slots, wanted);
+
+            Serial.println("Flavor Code                    Hits  First(s)   Last(s)  Min gap(ms) Max gap(ms)");
+            for (uint8_t i = 0; i < found; i++) {
+                const CodeStatsEntry &e = codeStats.entry(slots[i]);
+                Serial.printf("%-6s 0x%-16llx %9lu %9.3f %9.3f ", getStringForCodeFlavor(e.flavor),
+                    (unsigned long long)e.code, (unsigned long)e.hits,
+                    (double)e.firstUs / 1000000.0, (double)e.lastUs / 1000000.0);
+                if (e.hits > 1) {
+                    Serial.printf("%11.3f %11.3f\r\n", (double)e.minGapUs / 1000.0, (double)e.maxGapUs / 1000.0);
+                } else {
+                    Serial.println("          -           -");
+                }
+            }
+            Serial.printf("%u distinct codes tracked", codeStats.getUsed());
+            if (codeStats.getUntrackedHits() > 0) {
+                Serial.printf(", %lu hits on codes that didn't fit the table", (unsigned long)codeStats.getUntrackedHits());
+            }
+            Serial.println();
+            runtimeState.finishCommand();
+            break;
+        }
+        case STATE_RESET_STATS:
+            if (commandArgs.value[0] == replHash("stats")) {
+                codeStats.reset();
+                print("Notice", "Code statistics reset");
+            } else if (commandArgs.value[0] == replHash("profile")) {
+                bootProfiler.reset();
+                print("Notice", "Boot profile reset");
+            } else {
+                print("Error", "Usage: reset <stats|profile>");
+            }
+            runtimeState.finishCommand();
+            break;
+        case STATE_PROFILE_SHOW: {
+            uint8_t wanted = commandArgs.count ? commandArgs.value[0] : 10;
+            printProfile(wanted == 0 || wanted > PROFILE_MAX_TRANSITIONS ? PROFILE_MAX_TRANSITIONS : wanted);
+            runtimeState.finishCommand();
+            break;
+        }
+        case STATE_SET_MILESTONE: {
+            uint8_t bits = flavorBitsForWord(commandArgs.value[0]);
+            CodeFlavor flavor = bits ? CODE_FLAVOR_FOR_INDEX[__builtin_ctz(bits)] : CODE_FLAVOR_SMC;
+            uint64_t code = commandArgs.value[1];
+            if (commandArgs.count == 1 && commandArgs.value[0] == replHash("clear")) {
+                cfg.clearMilestones();
+                applySessionConfig();
+                print("Notice", "Milestones cleared");
+            } else if (commandArgs.count != 2 || bits == 0 || bits == FLAVOR_MASK_ALL) {
+                print("Error", "Usage: milestone <cpu|sp|smc|os> <code> | milestone clear");
+            } else if (!cfg.addMilestone(flavor, code)) {
+                print("Error", "No free milestone, use 'milestone clear'");
+            } else {
+                applySessionConfig();
+                // The whole code back, so a 64-bit one can be checked
+                char msg[48];
+                snprintf(msg, sizeof(msg), "Milestone added: %s 0x%llx", getStringForCodeFlavor(flavor), (unsigned long long)code);
+                print("Notice", msg);
+            }
+            runtimeState.finishCommand();
+            break;
+        }
+        case STATE_SET_IDLE_GAP:
+            cfg.setSessionIdleMs(commandArgs.value[0]);
+            applySessionConfig();
+            print("Notice", commandArgs.value[0] ? "Idle gap set" : "Idle gap disabled");
+            runtimeState.finishCommand();
+            break;
+        case STATE_BOOT_MODEL:
+            if (commandArgs.count == 1) {
+                if (commandArgs.value[0] != replHash("clear")) {
+                    print("Error", "Usage: model [clear]");
+                    runtimeState.finishCommand();
+                    break;
                 }
+                bootModel.clear();
+                saveBootModel();
+                print("Notice", "Boot models cleared");
+            }
+            printBootModel();
+            runtimeState.finishCommand();
+            break;
+        case STATE_SET_RESET_CODE: {
+            uint8_t bits = flavorBitsForWord(commandArgs.value[0]);
+            if (commandArgs.count == 1 && commandArgs.value[0] == replHash("off")) {
+                cfg.setSessionResetCode(0, 0);
+                applySessionConfig();
+                print("Notice", "Reset code disabled");
+            } else if (commandArgs.count != 2 || bits == 0) {
+                print("Error", "Usage: resetcode <cpu|sp|smc|os|all> <code> | resetcode off");
+            } else {
+                cfg.setSessionResetCode(bits, commandArgs.value[1]);
+                applySessionConfig();
+                char msg[48];
+                snprintf(msg, sizeof(msg), "Reset code set: 0x%llx", (unsigned long long)cfg.getSessionResetCode());
+                print("Notice", msg);
             }
+            runtimeState.finishCommand();
             break;
+        }
         case STATE_LAST_CODES:
             Serial.println("--- Last codes ---");
-            Serial.printf("CPU: 0x%llx\r\n", runtimeState.getCachedCode(CODE_IDX_CPU));
-            Serial.printf("SP : 0x%llx\r\n", runtimeState.getCachedCode(CODE_IDX_SP));
-            Serial.printf("SMC: 0x%llx\r\n", runtimeState.getCachedCode(CODE_IDX_SMC));
-            Serial.printf("OS : 0x%llx\r\n", runtimeState.getCachedCode(CODE_IDX_OS));
+            Serial.printf("CPU: 0x%llx\r\n", runtimeState.capture()->getCachedCode(CODE_IDX_CPU));
+            Serial.printf("SP : 0x%llx\r\n", runtimeState.capture()->getCachedCode(CODE_IDX_SP));
+            Serial.printf("SMC: 0x%llx\r\n", runtimeState.capture()->getCachedCode(CODE_IDX_SMC));
+            Serial.printf("OS : 0x%llx\r\n", runtimeState.capture()->getCachedCode(CODE_IDX_OS));
             Serial.println("------------------");
-            runtimeState.setCurrentState(STATE_POST_MONITOR);
+            runtimeState.finishCommand();
             break;
         case STATE_DISPLAY_ROTATE:
-            runtimeState.display()->toggleRotation();
-            cfg.toggleRotationPortrait();
-            print("Notice", "Display rotated");
-            runtimeState.setCurrentState(STATE_RETURN_TO_REPL);
+            if (!Board::hasDisplay) {
+                print("Error", "This build has no display");
+            } else {
+                runtimeState.display()->toggleRotation();
+                cfg.toggleRotationPortrait();
+                print("Notice", "Display rotated");
+            }
+            runtimeState.finishCommand();
             break;
         case STATE_DISPLAY_MIRROR:
-            runtimeState.display()->toggleMirroring();
-            cfg.toggleDisplayMirrored();
-            print("Notice", "Display mirrored");
-            runtimeState.setCurrentState(STATE_RETURN_TO_REPL);
+            if (!Board::hasDisplay) {
+                print("Error", "This build has no display");
+            } else {
+                runtimeState.display()->toggleMirroring();
+                cfg.toggleDisplayMirrored();
+                print("Notice", "Display mirrored");
+            }
+            runtimeState.finishCommand();
             break;
         case STATE_TOGGLE_TIMESTAMP:
             cfg.togglePostPrintTimestamps();
             print("Notice", "Toggled timestamps");
-            runtimeState.setCurrentState(STATE_RETURN_TO_REPL);
+            runtimeState.finishCommand();
+            break;
+        case STATE_TOGGLE_SPLIT_FALL:
+            cfg.toggleSessionSplitFall();
+            applySessionConfig();
+            print("Notice", cfg.isSessionSplitFall() ? "Boot stage restarts start a new boot" : "Ignoring boot stage restarts");
+            runtimeState.finishCommand();
+            break;
+        case STATE_TOGGLE_EXACT: {
+            CoalesceSummary summary;
+            if (coalescer.flush(&summary)) {
+                printCoalesceSummary(summary);
+            }
+            cfg.togglePostExact();
+            print("Notice", cfg.isPostExact() ? "Printing every code" : "Summarising repeated codes");
+            runtimeState.finishCommand();
+            break;
+        }
+        case STATE_SET_COALESCE_INTERVAL: {
+            char msg[48];
+            if (commandArgs.value[0] == 0) {
+                print("Error", "Interval must be at least 1 ms");
+            } else {
+                cfg.setCoalesceIntervalMs(commandArgs.value[0]);
+                coalescer.setIntervalMs(cfg.getCoalesceIntervalMs());
+                snprintf(msg, sizeof(msg), "Repeat summaries every %u ms", cfg.getCoalesceIntervalMs());
+                print("Notice", msg);
+            }
+            runtimeState.finishCommand();
+            break;
+        }
+        case STATE_FILTER_SHOW:
+            if (commandArgs.count == 1) {
+                if (commandArgs.value[0] != replHash("clear")) {
+                    print("Error", "Usage: filter [clear]");
+                    runtimeState.finishCommand();
+                    break;
+                }
+                cfg.clearFilter();
+                applyCaptureFilter();
+                print("Notice", "Capture filter cleared");
+            }
+            printFilter();
+            runtimeState.finishCommand();
+            break;
+        case STATE_FILTER_FLAVOR: {
+            uint8_t bits = flavorBitsForWord(commandArgs.value[0]);
+            bool on = commandArgs.value[1] == replHash("on");
+            if (bits == 0 || (!on && commandArgs.value[1] != replHash("off"))) {
+                print("Error", "Usage: flavor <cpu|sp|smc|os|all> <on|off>");
+            } else {
+                cfg.setFilterFlavors(on ? (cfg.getFilterFlavors() | bits) : (cfg.getFilterFlavors() & ~bits));
+                applyCaptureFilter();
+                printFilter();
+            }
+            runtimeState.finishCommand();
+            break;
+        }
+        case STATE_FILTER_INCLUDE:
+        case STATE_FILTER_EXCLUDE:
+        case STATE_ADD_FAULT: {
+            State state = runtimeState.getCurrentState();
+            CodeRule rule = {0};
+            rule.kind = (state == STATE_FILTER_INCLUDE) ? CODE_RULE_INCLUDE
+                : (state == STATE_FILTER_EXCLUDE) ? CODE_RULE_EXCLUDE
+                : CODE_RULE_FAULT;
+            rule.first = commandArgs.value[0];
+            rule.last = commandArgs.count >= 2 ? commandArgs.value[1] : rule.first;
+            rule.flavors = commandArgs.count >= 3 ? flavorBitsForWord(commandArgs.value[2]) : FLAVOR_MASK_ALL;
+
+            if (rule.first > rule.last || rule.flavors == 0) {
+                print("Error", "Usage: include|exclude|fault <first> [last] [cpu|sp|smc|os]");
+            } else if (!cfg.addCodeRule(rule)) {
+                print("Error", "No free code rule, use 'filter clear' or 'alarm clear'");
+            } else if (rule.kind == CODE_RULE_FAULT) {
+                applyFaultAlarm();
+                printAlarm();
+            } else {
+                applyCaptureFilter();
+                printFilter();
+            }
+            runtimeState.finishCommand();
+            break;
+        }
+        case STATE_SINK: {
+            static const char *const SINK_NAMES[SINK_COUNT] = { "usb", "uart", "null" };
+            if (commandArgs.count == 1 && commandArgs.value[0] == replHash("reset")) {
+                sinks.resetCounters();
+            } else if (commandArgs.count == 2) {
+                int8_t id = -1;
+                for (uint8_t i = 0; i < SINK_COUNT; i++) {
+                    if (commandArgs.value[0] == replHash(SINK_NAMES[i])) {
+                        id = i;
+                    }
+                }
+                uint32_t word = commandArgs.value[1];
+                SinkFormat format = word == replHash("text") ? SINK_FORMAT_TEXT
+                    : word == replHash("binary") ? SINK_FORMAT_BINARY
+                    : SINK_FORMAT_OFF;
+                if (id < 0 || (format == SINK_FORMAT_OFF && word != replHash("off"))) {
+                    print("Error", "Usage: sink <usb|uart|null> <off|text|binary>");
+                    runtimeState.finishCommand();
+                    break;
+                }
+                cfg.setSinkFormat((SinkId)id, format);
+                applySinkConfig();
+            } else if (commandArgs.count != 0) {
+                print("Error", "Usage: sink [reset] | sink <usb|uart|null> <off|text|binary>");
+                runtimeState.finishCommand();
+                break;
+            }
+            printSinks();
+            runtimeState.finishCommand();
+            break;
+        }
+        case STATE_REPLAY: {
+            uint32_t word = commandArgs.count ? commandArgs.value[0] : 0;
+            if (word == replHash("bus") || word == replHash("loop")) {
+                replaySettings.target = (word == replHash("bus")) ? REPLAY_TARGET_BUS : REPLAY_TARGET_LOOPBACK;
+                replaySettings.passes = commandArgs.count == 2 ? commandArgs.value[1] : 1;
+                const char *error = startReplay(replaySettings);
+                if (error != NULL) {
+                    print("Error", error);
+                } else {
+                    Serial.printf("Replaying %u codes %s\r\n", replayer.size(),
+                        replaySettings.target == REPLAY_TARGET_BUS ? "onto the Xbox bus" : "in loopback");
+                }
+            } else if (commandArgs.count == 1 && word == replHash("stop")) {
+                replayer.stop();
+            } else if (commandArgs.count == 1 && word == replHash("clear")) {
+                if (replayer.isRunning()) {
+                    print("Error", "Replay running, stop it first");
+                } else {
+                    replayer.clear();
+                }
+            } else if (commandArgs.count != 0) {
+                print("Error", "Usage: replay [bus|loop [passes] | stop | clear]");
+            } else {
+                printReplay();
+            }
+            runtimeState.finishCommand();
+            break;
+        }
+        case STATE_PROFILER: {
+            uint32_t word = commandArgs.count ? commandArgs.value[0] : 0;
+            if (word == replHash("start")) {
+                const char *error = startSampler(commandArgs.count == 2 ? commandArgs.value[1] : SAMPLER_DEFAULT_HZ);
+                if (error != NULL) {
+                    print("Error", error);
+                } else {
+                    printSampler();
+                }
+            } else if (commandArgs.count == 1 && word == replHash("stop")) {
+                stopSampler();
+                printSampler();
+            } else if (commandArgs.count == 1 && word == replHash("dump")) {
+                dumpSamples();
+            } else if (commandArgs.count != 0) {
+                print("Error", "Usage: prof [start [hz] | stop | dump]");
+            } else {
+                printSampler();
+            }
+            runtimeState.finishCommand();
+            break;
+        }
+        case STATE_REPLAY_SETTINGS:
+            if (commandArgs.value[0] == 0) {
+                print("Error", "Bus clock must not be 0");
+            } else {
+                replaySettings.clockKhz = commandArgs.value[0];
+                replaySettings.packetGapUs = commandArgs.value[1];
+                replaySettings.burst = commandArgs.value[2];
+                replaySettings.speedup = commandArgs.value[3];
+                printReplay();
+            }
+            runtimeState.finishCommand();
+            break;
+        case STATE_SET_UART_BAUD:
+            if (commandArgs.value[0] == 0) {
+                print("Error", "Baud rate must not be 0");
+            } else {
+                cfg.setSinkUartBaud(commandArgs.value[0]);
+                applySinkConfig();
+                printSinks();
+            }
+            runtimeState.finishCommand();
+            break;
+        case STATE_ALARM: {
+            FaultAlarm *alarm = runtimeState.capture()->alarm();
+            uint32_t word = commandArgs.count ? commandArgs.value[0] : 0;
+            bool ok = true;
+            if (commandArgs.count == 2 && word == replHash("pin")) {
+                if (!isUsableAlarmPin(commandArgs.value[1], cfg.getXboxSdaPin(), cfg.getXboxSclPin())) {
+                    print("Error", "Not a usable output pin (or one of the I2C pins)");
+                    ok = false;
+                } else {
+                    cfg.setFaultPin(commandArgs.value[1]);
+                }
+            } else if (commandArgs.count == 2 && word == replHash("hold")) {
+                cfg.setFaultHoldMs(commandArgs.value[1]);
+            } else if (commandArgs.count == 1 && word == replHash("off")) {
+                cfg.setFaultPin(FAULT_PIN_NONE);
+            } else if (commandArgs.count == 1 && (word == replHash("low") || word == replHash("high"))) {
+                cfg.setFaultMode(word == replHash("low") ? (cfg.getFaultMode() | FAULT_MODE_ACTIVE_LOW) : (cfg.getFaultMode() & ~FAULT_MODE_ACTIVE_LOW));
+            } else if (commandArgs.count == 1 && (word == replHash("blink") || word == replHash("steady"))) {
+                cfg.setFaultMode(word == replHash("blink") ? (cfg.getFaultMode() | FAULT_MODE_BLINK) : (cfg.getFaultMode() & ~FAULT_MODE_BLINK));
+            } else if (commandArgs.count == 1 && word == replHash("clear")) {
+                cfg.clearFaultRules();
+            } else if (commandArgs.count == 1 && word == replHash("ack")) {
+                alarm->acknowledge();
+            } else if (commandArgs.count == 1 && word == replHash("test")) {
+                alarm->test();
+            } else if (commandArgs.count != 0) {
+                print("Error", "Usage: alarm [ack|test|clear|off|low|high|blink|steady] | alarm pin|hold <n>");
+                ok = false;
+            }
+            if (ok) {
+                applyFaultAlarm();
+                printAlarm();
+            }
+            runtimeState.finishCommand();
             break;
+        }
         case STATE_TOGGLE_COLORS:
             cfg.toggleSerialPrintColors();
             print("Notice", "Toggled printing colors");
-            runtimeState.setCurrentState(STATE_RETURN_TO_REPL);
+            runtimeState.finishCommand();
             break;
         case STATE_CONFIG_SHOW:
             print("Notice", "Showing config");
@@ -382,20 +2144,44 @@ void loop() {
             Serial.printf("Print timestamps:       %s\r\n", cfg.isPostPrintTimestamps() ? "ON" : "OFF");
             Serial.printf("Print colors:           %s\r\n", cfg.isSerialPrintColors() ? "ON" : "OFF");
             Serial.printf("I2C0 pins (Xbox bus):   SDA=%u SCL=%u\r\n", cfg.getXboxSdaPin(), cfg.getXboxSclPin());
-            runtimeState.setCurrentState(STATE_RETURN_TO_REPL);
+            Serial.printf("Exact (no summaries):   %s\r\n", cfg.isPostExact() ? "ON" : "OFF");
+            Serial.printf("Summary interval:       %u ms\r\n", cfg.getCoalesceIntervalMs());
+            Serial.printf("Boot idle gap:          %u ms\r\n", cfg.getSessionIdleMs());
+            Serial.printf("Split on stage restart: %s\r\n", cfg.isSessionSplitFall() ? "ON" : "OFF");
+            Serial.printf("Sinks (USB/UART/null):  %s/%s/%s, UART at %lu baud\r\n",
+                getStringForSinkFormat(cfg.getSinkFormat(SINK_USB)), getStringForSinkFormat(cfg.getSinkFormat(SINK_UART)),
+                getStringForSinkFormat(cfg.getSinkFormat(SINK_NULL)), (unsigned long)cfg.getSinkUartBaud());
+            if (cfg.getFaultPin() == FAULT_PIN_NONE) {
+                Serial.println("Fault alarm pin:        OFF");
+            } else {
+                Serial.printf("Fault alarm pin:        GPIO %u\r\n", cfg.getFaultPin());
+            }
+            if (cfg.getSessionResetFlavors()) {
+                Serial.print("Boot reset code:        ");
+                printFlavorBits(cfg.getSessionResetFlavors());
+                Serial.printf(" 0x%llx\r\n", (unsigned long long)cfg.getSessionResetCode());
+            }
+            for (uint8_t i = 0; i < PROFILE_MAX_MILESTONES; i++) {
+                if (cfg.getMilestoneFlavors()[i]) {
+                    Serial.printf("Milestone:              %s 0x%llx\r\n",
+                        getStringForCodeFlavor((CodeFlavor)cfg.getMilestoneFlavors()[i]),
+                        (unsigned long long)cfg.getMilestoneCodes()[i]);
+                }
+            }
+            runtimeState.finishCommand();
             break;
         case STATE_CONFIG_SAVE:
             cfg.save();
-            print("Notice", "Saved config");
-            runtimeState.setCurrentState(STATE_RETURN_TO_REPL);
+            print("Notice", "Saving config once the bus is idle");
+            runtimeState.finishCommand();
             break;
         case STATE_PRINT_VERSION:
             printFwVersion();
-            runtimeState.setCurrentState(STATE_RETURN_TO_REPL);
+            runtimeState.finishCommand();
             break;
         case STATE_PRINT_HELP:
             printHelp();
-            runtimeState.setCurrentState(STATE_RETURN_TO_REPL);
+            runtimeState.finishCommand();
             break;
         case STATE_BOOTSEL:
             print("Notice", "Rebooting into bootloader mode...");
@@ -403,43 +2189,237 @@ void loop() {
             rebootToBootloader();
             break;
         case STATE_SET_I2C0_PINS: {
+            uint8_t pendingI2C0Sda = commandArgs.value[0];
+            uint8_t pendingI2C0Scl = commandArgs.value[1];
             char msg[64];
-            if (!platformSupportsI2C0PinChange()) {
+            if (!Board::canRemapI2c) {
                 print("Error", "I2C0 pins are fixed in hardware on this platform");
             } else if (!isValidI2C0Pins(pendingI2C0Sda, pendingI2C0Scl)) {
                 snprintf(msg, sizeof(msg), "SDA=%u SCL=%u is not a valid I2C0 pin pair", pendingI2C0Sda, pendingI2C0Scl);
                 print("Error", msg);
+            } else if (cfg.getFaultPin() != FAULT_PIN_NONE
+                && (cfg.getFaultPin() == pendingI2C0Sda || cfg.getFaultPin() == pendingI2C0Scl)) {
+                snprintf(msg, sizeof(msg), "GPIO %u is the fault alarm pin, 'alarm off' first", cfg.getFaultPin());
+                print("Error", msg);
             } else {
                 sendMessageToCore1(packSetI2C0PinsMsg(pendingI2C0Sda, pendingI2C0Scl));
                 cfg.setXboxI2CPins(pendingI2C0Sda, pendingI2C0Scl);
                 snprintf(msg, sizeof(msg), "I2C0 pins set to SDA=%u SCL=%u (type 'save' to persist)", pendingI2C0Sda, pendingI2C0Scl);
                 print("Notice", msg);
             }
-            runtimeState.setCurrentState(STATE_RETURN_TO_REPL);
+            runtimeState.finishCommand();
             break;
         }
-    }
+        case STATE_BUS_WATCHDOG:
+            if (commandArgs.count == 1 && commandArgs.value[0] != replHash("recover")) {
+                print("Error", "Usage: bus [recover]");
+            } else if (commandArgs.count == 1 && replayRunning) {
+                print("Error", "Replay running, stop it first");
+            } else {
+                if (commandArgs.count == 1) {
+                    sendMessageToCore1(BUS_RECOVER);
+                    print("Notice", "Restarting the I2C slave");
+                }
+                Serial.printf("%lu stall recoveries, slowest restart %lu us, ~%lu codes lost\r\n",
+                    (unsigned long)busWatchdog.getRecoveries(), (unsigned long)busWatchdog.getWorstRecoveryUs(),
+                    (unsigned long)busWatchdog.getCodesLost());
+                Serial.printf("%lu silences mid-boot\r\n", (unsigned long)busWatchdog.getSilences());
+                Serial.printf("Bus is %s\r\n",
+                    platformI2cBusHeld(runtimeState.getXboxSdaPin(), runtimeState.getXboxSclPin()) ? "held" : "free");
+            }
+            runtimeState.finishCommand();
+            break;
+        case STATE_REGISTERS: {
+            uint32_t word = commandArgs.count ? commandArgs.value[0] : 0;
+            if (word == replHash("watch")) {
+                regsWatchMs = commandArgs.count == 2 && commandArgs.value[1] ? commandArgs.value[1] : REGS_WATCH_DEFAULT_MS;
+                regsWatchLastMs = millis();
+                // Changes from here on only
+                runtimeState.capture()->getRegisters().snapshot(regsWatched);
+                char msg[80];
+                snprintf(msg, sizeof(msg), "Streaming register changes every %u ms while monitoring", regsWatchMs);
+                print("Notice", msg);
+            } else if (commandArgs.count == 1 && word == replHash("stop")) {
+                regsWatchMs = 0;
+                print("Notice", "Register watch stopped");
+            } else if (commandArgs.count != 0) {
+                print("Error", "Usage: regs [watch [ms] | stop]");
+            } else {
+                printRegisters();
+            }
+            runtimeState.finishCommand();
+            break;
+        }
+        case STATE_DISPLAY_BENCH: {
+            uint16_t count = commandArgs.count ? commandArgs.value[0] : 500;
+            uint32_t textUs, cachedUs, sendUs;
+            if (!runtimeState.display()->benchmark(count, &textUs, &cachedUs, &sendUs)) {
+                print("Error", "Needs a display in landscape mode");
+            } else {
+                Serial.printf("Drawing a code (average of %u): U8g2 text %lu us, glyph cache %lu us\r\n",
+                    count, (unsigned long)textUs, (unsigned long)cachedUs);
+                Serial.printf("Sending the frame: %lu us\r\n", (unsigned long)sendUs);
+            }
+            runtimeState.finishCommand();
+            break;
+        }
+        case STATE_LATENCY_TEST:
+            if (!latencyTestRunning && replayRunning) {
+                print("Error", "Replay running, stop it first");
+                runtimeState.finishCommand();
+                break;
+            }
+            if (!latencyTestRunning) {
+                latencyTestRunning = true;
+                latencyTestDone.store(false, std::memory_order_relaxed);
+                runtimeState.capture()->resetMaxReceiveTicks();
+                Serial.println("Measuring capture latency while flushing the XIP cache...");
+                sendMessageToCore1(LATENCY_TEST);
+            }
 
-    // Check for CTRL+C
-    if (runtimeState.getCurrentState() != STATE_RETURN_TO_REPL
-        && runtimeState.getCurrentState() != STATE_REPL
-        && Serial.available())
-    {
-        int ch = Serial.read();
+            // Keep core1 missing the cache for as long as the test runs
+            for (int i = 0; i < 16; i++) {
+                platformFlushXipCache();
+            }
 
-        switch (ch) {
-            case CTRL_C:
-                runtimeState.setCurrentState(STATE_RETURN_TO_REPL);
+            if (latencyTestDone.load(std::memory_order_acquire)) {
+                latencyTestRunning = false;
+                Serial.printf("Synthetic: %u packets, worst-case receive %.3f us\r\n",
+                    LATENCY_TEST_PACKETS, (double)tickScale.toNs(benchCapture.getMaxReceiveTicks()) / 1000.0);
+                Serial.printf("Live I2C:  %lu callbacks total, worst-case receive %.3f us\r\n",
+                    (unsigned long)runtimeState.capture()->getReceiveCount(),
+                    (double)tickScale.toNs(runtimeState.capture()->getMaxReceiveTicks()) / 1000.0);
+                Serial.printf("(timed in %lu Hz ticks)\r\n", (unsigned long)tickScale.getHz());
+                runtimeState.finishCommand();
+            }
+            break;
+        case STATE_SAVE_TEST: {
+            uint32_t word = commandArgs.count ? commandArgs.value[0] : 0;
+            if (!saveTestRunning && (word == replHash("send") || word == replHash("stop"))) {
+                if (word == replHash("send") && replayRunning) {
+                    print("Error", "Replay running, stop it first");
+                } else {
+                    saveTestSending = (word == replHash("send"));
+                    sendMessageToCore1(packSyntheticSendMsg(saveTestSending ? SAVE_TEST_BUS_PERIOD_US : 0));
+                    print("Notice", saveTestSending ? "Sending numbered codes onto the Xbox bus" : "Stopped sending");
+                }
+                runtimeState.finishCommand();
                 break;
-            case 'r':
-                sendMessageToCore1(RESET_TIMESTAMP);
-                Serial.println("Resetting timestamp");
+            }
+            if (!saveTestRunning && commandArgs.count && word != replHash("bus")) {
+                print("Error", "Usage: savetest [bus|send|stop]");
+                runtimeState.finishCommand();
+                break;
+            }
+            if (!saveTestRunning && (replayRunning || saveTestSending)) {
+                print("Error", replayRunning ? "Replay running, stop it first" : "Sending, 'savetest stop' first");
+                runtimeState.finishCommand();
+                break;
+            }
+            if (!saveTestRunning) {
+                // Make room up front, so no commit during the test has to erase
+                if (cfg.freeJournalPages() < SAVE_TEST_COMMITS && !cfg.compact()) {
+                    print("Error", "Failed to compact config journal");
+                    runtimeState.finishCommand();
+                    break;
+                }
+                // Small journals (EEPROM-backed) can't take all of them
+                saveTestTarget = cfg.freeJournalPages();
+                if (saveTestTarget > SAVE_TEST_COMMITS) {
+                    saveTestTarget = SAVE_TEST_COMMITS;
+                }
+                if (saveTestTarget == 0) {
+                    print("Error", "No free config journal pages to test with");
+                    runtimeState.finishCommand();
+                    break;
+                }
+
+                saveTestRunning = true;
+                saveTestOnBus = (word == replHash("bus"));
+                Capture *capture = saveTestOnBus ? runtimeState.capture() : &benchCapture;
+                capture->discardPostCodes();
+                saveTestStartDropped = capture->getDroppedCodes();
+                saveTestReceived = 0;
+                saveTestLost = 0;
+                saveTestLastSeq = -1;
+                saveTestCommits = 0;
+                saveTestFailedCommits = 0;
+                saveTestMaxCommitUs = 0;
+                saveTestLastCommitMs = millis();
+                if (saveTestOnBus) {
+                    Serial.printf("Saving config %lu times while counting codes from the bus...\r\n", (unsigned long)saveTestTarget);
+                } else {
+                    Serial.printf("Saving config %lu times under %lu codes/s of synthetic load...\r\n",
+                        (unsigned long)saveTestTarget, 1000000UL / SAVE_TEST_PERIOD_US);
+                    sendMessageToCore1(packSyntheticLoadMsg(SAVE_TEST_PERIOD_US));
+                }
+            }
+
+            Capture *capture = saveTestOnBus ? runtimeState.capture() : &benchCapture;
+            drainSaveTest(capture);
+
+            if (saveTestCommits < saveTestTarget) {
+                if (millis() - saveTestLastCommitMs >= SAVE_TEST_INTERVAL_MS) {
+                    uint32_t startUs = now_us32();
+                    if (!cfg.commitNow(false)) {
+                        saveTestFailedCommits++;
+                    }
+                    uint32_t elapsedUs = now_us32() - startUs;
+                    if (elapsedUs > saveTestMaxCommitUs) {
+                        saveTestMaxCommitUs = elapsedUs;
+                    }
+                    saveTestCommits++;
+                    saveTestLastCommitMs = millis();
+                    if (saveTestCommits == saveTestTarget && !saveTestOnBus) {
+                        sendMessageToCore1(packSyntheticLoadMsg(0));
+                    }
+                }
                 break;
-            case 'l':
-                runtimeState.setCurrentState(STATE_LAST_CODES);
+            }
+
+            // Wait for the generator to stop and its last codes to drain
+            if (millis() - saveTestLastCommitMs < SAVE_TEST_INTERVAL_MS) {
                 break;
+            }
+            drainSaveTest(capture);
+
+            uint32_t dropped = capture->getDroppedCodes() - saveTestStartDropped;
+            bool pass;
+            if (saveTestOnBus) {
+                Serial.printf("Received: %lu, lost on the bus: %lu, dropped: %lu\r\n",
+                    (unsigned long)saveTestReceived, (unsigned long)saveTestLost, (unsigned long)dropped);
+                pass = saveTestReceived > 0 && saveTestLost == 0 && dropped == 0 && saveTestFailedCommits == 0;
+                if (saveTestReceived == 0) {
+                    print("Error", "Nothing received, is the other reader running 'savetest send'?");
+                }
+            } else {
+                uint32_t generated = synthGenerated.load(std::memory_order_acquire);
+                Serial.printf("Generated: %lu, received: %lu, dropped: %lu\r\n",
+                    (unsigned long)generated, (unsigned long)saveTestReceived, (unsigned long)dropped);
+                pass = dropped == 0 && generated == saveTestReceived && saveTestFailedCommits == 0;
+            }
+            Serial.printf("Commits: %lu (%lu failed), worst-case commit %lu us\r\n",
+                (unsigned long)saveTestCommits, (unsigned long)saveTestFailedCommits,
+                (unsigned long)saveTestMaxCommitUs);
+            print("Notice", pass ? "savetest PASS" : "savetest FAIL");
+            saveTestRunning = false;
+            runtimeState.finishCommand();
+            break;
         }
     }
+
+    switch (cfg.service(millis(), runtimeState.getBusIdleMs(millis()))) {
+        case CFG_COMMIT_DONE:
+            Serial.println("Notice: Saved config");
+            break;
+        case CFG_COMMIT_FAILED:
+            print("Error", "Failed to save config");
+            break;
+        default:
+            break;
+    }
+
+    handleSerialInput();
 }
 
 /* CORE 0 END */
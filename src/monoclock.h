@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+// Platform-independent half of the clocks in platform.h. Nothing in here
+// touches hardware, so the static_asserts below check it on every build.
+
+// Stretches a free-running 32-bit counter to 64 bits without a lock, so it
+// can be read from interrupts and loop() alike. One word holds the upper
+// 32 bits (31 of them, which outlasts any board) next to the top bit of the
+// newest low word seen. Every reader publishes what it saw with a CAS; one
+// that loses the race still returns a correct time, just doesn't publish.
+//
+// The counter has to be read at least once per half wrap, and after load():
+// a reading older than the state would look like a wrap.
+static constexpr uint32_t wrapAdvance(uint32_t state, uint32_t low) {
+    return (((state >> 1) + ((state & 1) && !(low >> 31) ? 1 : 0)) << 1) | (low >> 31);
+}
+static constexpr uint64_t wrapCombine(uint32_t state, uint32_t low) {
+    return ((uint64_t)(wrapAdvance(state, low) >> 1) << 32) | low;
+}
+
+static_assert(wrapCombine(0, 5) == 5, "No wrap yet");
+static_assert(wrapCombine(wrapAdvance(0, 0x80000000u), 0x7FFFFFFFu) == 0x17FFFFFFFULL, "Wrap after the top half");
+static_assert(wrapCombine(wrapAdvance(0, 0xFFFFFFF0u), 0x10) == 0x100000010ULL, "Wrap across zero");
+static_assert(wrapCombine(wrapAdvance(0, 0x7FFFFFFFu), 0x80000000u) == 0x80000000ULL, "Crossing the half isn't a wrap");
+static_assert(wrapCombine(wrapAdvance(wrapAdvance(0, 0xFFFFFFF0u), 0x10), 0x20) == 0x100000020ULL, "Counted once");
+static_assert(wrapCombine(0xFFFFFFFEu, 0xFFFFFFFFu) == 0x7FFFFFFFFFFFFFFFULL, "Top of the range");
+
+class WrapExtender {
+public:
+    inline uint32_t load() const { return state.load(std::memory_order_acquire); }
+
+    // `low` must have been read after load() returned `seen`
+    inline uint64_t extend(uint32_t seen, uint32_t low) {
+        uint32_t next = wrapAdvance(seen, low);
+        if (next != seen) {
+            state.compare_exchange_strong(seen, next, std::memory_order_release, std::memory_order_relaxed);
+        }
+        return ((uint64_t)(next >> 1) << 32) | low;
+    }
+
+private:
+    std::atomic<uint32_t> state{0};
+};
+
+// Converts now_ticks() intervals, calibrated to the tick rate the board
+// actually runs at (Q16 nanoseconds per tick).
+class TickScale {
+public:
+    void calibrate(uint32_t tickHz) {
+        hz = tickHz;
+        nsPerTickQ16 = (uint32_t)((1000000000ULL << 16) / tickHz);
+    }
+    inline uint32_t getHz() const { return hz; }
+    inline uint32_t toNs(uint32_t ticks) const { return (uint32_t)(((uint64_t)ticks * nsPerTickQ16) >> 16); }
+    inline uint32_t toUs(uint32_t ticks) const { return (uint32_t)((((uint64_t)ticks * nsPerTickQ16) >> 16) / 1000); }
+
+private:
+    uint32_t hz = 1000000;
+    uint32_t nsPerTickQ16 = 1000UL << 16;
+};
@@ -1,22 +1,122 @@
 #pragma once
 
 // Platform differences are isolated here:
-// - 64-bit microsecond clock
+// - 64-bit microsecond clock, monotonic and safe to read from interrupts
+// - now_ticks(): the finest counter the chip has (CPU cycles where there is
+//   one), for timing short stretches of code. 32 bits, wraps within seconds,
+//   and on dual-core chips each core counts its own: only compare readings
+//   taken on the same core. TickScale (monoclock.h) turns them into time.
+// - CAPTURE_FUNC(): placement of the I2C capture path in RAM
 // - reboot into flashing mode
+// - GPIO writes from the capture path (fault alarm)
+// - whether the Xbox bus is held, for the bus watchdog
+// - the hardware UART used as an output sink
+// - the sampling profiler's timer interrupt
+// - what the chip has: PLATFORM_CORE_COUNT, PLATFORM_HAS_FPU,
+//   PLATFORM_RAM_KB (RAM static data can go in), PLATFORM_CAN_REMAP_I2C.
+//   board.h turns these into compile-time traits for the rest of the code.
 // - core1: arduino-pico calls setup1()/loop1() natively. Platforms without a
 //   second physical core (or without one exposed the same way) instead run
 //   loop1() from platformPumpCore1(), called once per core0 loop() iteration.
 
 #include <Arduino.h>
+#include "monoclock.h"
 
 #if defined(ARDUINO_ARCH_RP2040)
 
-static inline uint64_t now_us64() { return time_us_64(); }
+#include <hardware/clocks.h>
+#include <hardware/exception.h>
+#include <hardware/flash.h>
+#include <hardware/gpio.h>
+#include <hardware/structs/systick.h>
+#include <hardware/timer.h>
+#if defined(PICO_RP2350) && !defined(__riscv)
+#include <hardware/structs/m33.h>
+#endif
+
+// Code reachable from the I2C receive callback is kept out of XIP flash: a
+// cache miss costs a full QSPI fetch, and while flash is being written
+// there's no XIP at all.
+#define CAPTURE_FUNC(name) __not_in_flash_func(name)
+
+// Same loop as the SDK's time_us_64(), inlined here so the capture path
+// doesn't call out into flash for a timestamp.
+static inline uint64_t CAPTURE_FUNC(now_us64)() {
+    uint32_t hi = timer_hw->timerawh;
+    uint32_t lo;
+    for (;;) {
+        lo = timer_hw->timerawl;
+        uint32_t nextHi = timer_hw->timerawh;
+        if (hi == nextHi) break;
+        hi = nextHi;
+    }
+    return ((uint64_t)hi << 32) | lo;
+}
+static inline uint32_t CAPTURE_FUNC(now_us32)() { return timer_hw->timerawl; }
+
+#if defined(PICO_RP2350) && !defined(__riscv)
+// The M33's DWT cycle counter. Each core has its own, so each enables it.
+static inline uint32_t CAPTURE_FUNC(now_ticks)() { return m33_hw->dwt_cyccnt; }
+static inline uint32_t platformTickHz() { return clock_get_hz(clk_sys); }
+static inline void platformTicksBegin() {
+    m33_hw->demcr |= M33_DEMCR_TRCENA_BITS;
+    m33_hw->dwt_ctrl |= M33_DWT_CTRL_CYCCNTENA_BITS;
+}
+#else
+// The M0+ has no cycle counter, the 1 MHz timer is the finest there is
+static inline uint32_t CAPTURE_FUNC(now_ticks)() { return timer_hw->timerawl; }
+static inline uint32_t platformTickHz() { return 1000000; }
+static inline void platformTicksBegin() {}
+#endif
+
+// Evicts everything from the XIP cache, so the next flash fetch on either
+// core misses. Only used to provoke worst-case latency in the "latency" test.
+static inline void platformFlushXipCache() { flash_flush_cache(); }
+
+// gpio_put() is an inline SIO register write
+static inline void CAPTURE_FUNC(platformGpioWrite)(uint8_t pin, bool high) { gpio_put(pin, high); }
+static inline bool isValidAlarmPin(uint8_t pin) { return pin < NUM_BANK0_GPIOS; }
+// The pads read back whatever function the pins are set to
+static inline bool platformI2cBusHeld(uint8_t sda, uint8_t scl) { return !gpio_get(sda) || !gpio_get(scl); }
+
+#define SINK_UART_PORT Serial1
+static inline void platformSinkUartBegin(uint32_t baud) {
+    Serial1.setTX(PIN_TX_SINK);
+    Serial1.setRX(PIN_RX_SINK);
+    Serial1.begin(baud);
+}
+
+// Sampling profiler: SysTick is per core, and unused by arduino-pico
+// without FreeRTOS. Each core has to start and stop its own. Both share the
+// vector table, so they share the handler too.
+#define PLATFORM_HAS_SAMPLER 1
+#define PLATFORM_CORE_COUNT 2
+static inline uint8_t CAPTURE_FUNC(platformCoreId)() { return get_core_num(); }
+static inline void platformSamplerStart(void (*handler)(), uint32_t hz) {
+    exception_set_exclusive_handler(SYSTICK_EXCEPTION, handler);
+    systick_hw->csr = 0;
+    systick_hw->rvr = clock_get_hz(clk_sys) / hz - 1;
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0x7; // processor clock, interrupt, enable (same bits on RP2040 and RP2350)
+}
+static inline void platformSamplerStop() { systick_hw->csr = 0; }
+static inline void CAPTURE_FUNC(platformSamplerAck)() {} // SysTick needs none
+
 static inline void rebootToBootloader() { rp2040.rebootToBootloader(); }
 static inline void platformStartCore1() {} // arduino-pico already runs setup1()/loop1()
 static inline void platformPumpCore1() {}
 
-static inline bool platformSupportsI2C0PinChange() { return true; }
+#if defined(PICO_RP2350)
+#define PLATFORM_RAM_KB 520
+#else
+#define PLATFORM_RAM_KB 264
+#endif
+#if defined(__ARM_FP) // the RP2350's M33, not the RP2040's M0+
+#define PLATFORM_HAS_FPU 1
+#else
+#define PLATFORM_HAS_FPU 0
+#endif
+#define PLATFORM_CAN_REMAP_I2C 1
 
 // RP2040/RP2350 GPIO function-select: I2C SDA/SCL alternate with GPIO parity,
 // and I2C0 vs I2C1 alternates every other pair ((gpio/2) % 2). Getting this
@@ -34,10 +134,23 @@ static_assert(!isValidI2C0Pins(1, 0), "SDA/SCL roles are fixed per pin, can't be
 #elif defined(ARDUINO_ARCH_ESP32)
 
 #include <esp_timer.h>
+#include <hal/gpio_ll.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <xtensa/core-macros.h>
+
+// IRAM_ATTR keeps the capture path runnable while the flash cache is
+// disabled for a flash write (esp_timer_get_time() itself is IRAM-resident).
+#define CAPTURE_FUNC(name) IRAM_ATTR name
 
 static inline uint64_t now_us64() { return (uint64_t)esp_timer_get_time(); }
+static inline uint32_t now_us32() { return (uint32_t)esp_timer_get_time(); }
+// CCOUNT, per core. Arduino doesn't scale the CPU clock, so the rate holds.
+static inline uint32_t CAPTURE_FUNC(now_ticks)() { return XTHAL_GET_CCOUNT(); }
+static inline uint32_t platformTickHz() { return getCpuFrequencyMhz() * 1000000UL; }
+static inline void platformTicksBegin() {}
+// Cache control isn't exposed to app code; the latency test runs without it.
+static inline void platformFlushXipCache() {}
 
 // ponytail: classic ESP32 has no UF2/BOOTSEL flow reachable from firmware,
 // flashing goes through esptool's DTR/RTS auto-reset instead. Plain restart
@@ -56,11 +169,21 @@ static void core1_task(void *) {
 }
 
 static inline void platformStartCore1() {
-    xTaskCreatePinnedToCore(core1_task, "core1", 4096, NULL, 1, NULL, 1);
+    // Static stack and TCB, so the task shows up in the RAM report instead
+    // of coming out of the FreeRTOS heap
+    static StackType_t stack[4096];
+    static StaticTask_t tcb;
+    xTaskCreateStaticPinnedToCore(core1_task, "core1", 4096, NULL, 1, stack, &tcb, 1);
 }
 static inline void platformPumpCore1() {}
 
-static inline bool platformSupportsI2C0PinChange() { return true; }
+#if defined(CONFIG_IDF_TARGET_ESP32S3)
+#define PLATFORM_RAM_KB 320 // internal DRAM left for .data/.bss
+#else
+#define PLATFORM_RAM_KB 160
+#endif
+#define PLATFORM_HAS_FPU 1 // single precision
+#define PLATFORM_CAN_REMAP_I2C 1
 
 // ESP32's I2C is routed through the GPIO matrix, so almost any GPIO works
 // for either role - the one hard rule is SDA and SCL can't be the same pin.
@@ -74,6 +197,30 @@ static inline constexpr bool isValidI2C0Pins(uint8_t sda, uint8_t scl) {
     return sda != scl && isValidI2C0Pin(sda) && isValidI2C0Pin(scl);
 }
 
+// digitalWrite() isn't IRAM-resident on every core version; the HAL's
+// register write is inline
+static inline void CAPTURE_FUNC(platformGpioWrite)(uint8_t pin, bool high) {
+    gpio_ll_set_level(&GPIO, (gpio_num_t)pin, high);
+}
+static inline bool isValidAlarmPin(uint8_t pin) { return isValidI2C0Pin(pin); } // same output-capable pins
+// The I2C pins are open drain with input enabled, so GPIO_IN sees the bus
+static inline bool platformI2cBusHeld(uint8_t sda, uint8_t scl) {
+    return !gpio_ll_get_level(&GPIO, (gpio_num_t)sda) || !gpio_ll_get_level(&GPIO, (gpio_num_t)scl);
+}
+
+#define SINK_UART_PORT Serial1
+static inline void platformSinkUartBegin(uint32_t baud) {
+    Serial1.begin(baud, SERIAL_8N1, PIN_RX_SINK, PIN_TX_SINK);
+}
+
+// No sampling profiler: the stacked-frame trick is Cortex-M only
+#define PLATFORM_HAS_SAMPLER 0
+#define PLATFORM_CORE_COUNT 2
+static inline uint8_t platformCoreId() { return xPortGetCoreID(); }
+static inline void platformSamplerStart(void (*)(), uint32_t) {}
+static inline void platformSamplerStop() {}
+static inline void platformSamplerAck() {}
+
 #elif defined(TEENSYDUINO)
 
 // Teensy 4.x (imxrt1062) is single-core with no bundled RTOS: there's no
@@ -81,17 +228,26 @@ static inline constexpr bool isValidI2C0Pins(uint8_t sda, uint8_t scl) {
 // reception itself (core1_receiveI2cData) is still interrupt-driven and
 // runs regardless, so loop1() - which only checks for a cross-thread
 // message - is safe to just call inline from core0's loop().
-static inline uint64_t now_us64() {
-    // micros() is 32-bit and wraps after ~71 minutes; stretch it to 64 bits
-    // by tracking wraparounds. Relies on now_us64() being called more often
-    // than that, which the main loop() easily does.
-    static uint32_t high = 0;
-    static uint32_t lastLow = 0;
-    uint32_t low = micros();
-    if (low < lastLow) high++;
-    lastLow = low;
-    return ((uint64_t)high << 32) | low;
+
+// Teensy 4 links all code into ITCM unless it's explicitly marked FLASHMEM,
+// so the capture path is RAM-resident already. FASTRUN would add noinline.
+#define CAPTURE_FUNC(name) name
+
+// micros() is 32-bit and wraps after ~71 minutes. WrapExtender stretches
+// it to 64 bits, safely against the I2C interrupt calling in mid-update, as
+// long as something reads the clock every half hour; loop() does all the
+// time. Not static, so every translation unit shares the one extender.
+inline uint64_t now_us64() {
+    static WrapExtender extender;
+    uint32_t seen = extender.load();
+    return extender.extend(seen, micros());
 }
+static inline uint32_t now_us32() { return micros(); }
+// The startup code enables the DWT cycle counter for micros() already
+static inline uint32_t now_ticks() { return ARM_DWT_CYCCNT; }
+static inline uint32_t platformTickHz() { return F_CPU_ACTUAL; }
+static inline void platformTicksBegin() {}
+static inline void platformFlushXipCache() {}
 
 // Jumps to the HalfKay bootloader (same mechanism the Teensy Loader uses).
 extern "C" void _reboot_Teensyduino_(void);
@@ -103,11 +259,53 @@ void loop1();
 static inline void platformStartCore1() { setup1(); }
 static inline void platformPumpCore1() { loop1(); }
 
+#define PLATFORM_RAM_KB 512 // RAM1, shared with the code in ITCM
+#define PLATFORM_HAS_FPU 1
 // Wire/Wire1/Wire2 pins are wired to fixed silicon pads on Teensy 4.x, not
 // software-remappable, so there's nothing to validate or change.
-static inline bool platformSupportsI2C0PinChange() { return false; }
+#define PLATFORM_CAN_REMAP_I2C 0
 static inline constexpr bool isValidI2C0Pins(uint8_t, uint8_t) { return false; }
 
+// Everything is in ITCM already, see CAPTURE_FUNC
+static inline void platformGpioWrite(uint8_t pin, bool high) { digitalWrite(pin, high); }
+static inline bool isValidAlarmPin(uint8_t pin) { return pin < CORE_NUM_DIGITAL; }
+// The pads can't be read while LPI2C1 (Wire) has them, but its bus-busy
+// flag stays set from a START until the STOP, which covers a line held low
+// and a transaction cut short alike.
+static inline bool platformI2cBusHeld(uint8_t, uint8_t) { return (LPI2C1_SSR & LPI2C_SSR_BBF) != 0; }
+
+// Serial1's pins are fixed, like Wire's
+#define SINK_UART_PORT Serial1
+static inline void platformSinkUartBegin(uint32_t baud) { Serial1.begin(baud); }
+
+// Sampling profiler: SysTick drives millis() here, so GPT1 (24 MHz
+// peripheral clock) takes the samples instead. Its vector points straight
+// at the handler, which needs the interrupted frame rather than the core's
+// dispatch.
+#define PLATFORM_HAS_SAMPLER 1
+#define PLATFORM_CORE_COUNT 1
+static inline uint8_t platformCoreId() { return 0; }
+static inline void platformSamplerStart(void (*handler)(), uint32_t hz) {
+    CCM_CCGR1 |= CCM_CCGR1_GPT1_BUS(CCM_CCGR_ON) | CCM_CCGR1_GPT1_SERIAL(CCM_CCGR_ON);
+    GPT1_CR = 0;
+    GPT1_PR = 0;
+    GPT1_SR = 0x3F;
+    GPT1_IR = GPT_IR_OF1IE;
+    GPT1_OCR1 = 24000000 / hz - 1;
+    attachInterruptVector(IRQ_GPT1, handler);
+    NVIC_SET_PRIORITY(IRQ_GPT1, 0); // sample inside other interrupts too
+    NVIC_ENABLE_IRQ(IRQ_GPT1);
+    GPT1_CR = GPT_CR_EN | GPT_CR_CLKSRC(1);
+}
+static inline void platformSamplerStop() {
+    NVIC_DISABLE_IRQ(IRQ_GPT1);
+    GPT1_CR = 0;
+}
+static inline void platformSamplerAck() {
+    GPT1_SR = GPT_SR_OF1;
+    asm volatile("dsb");
+}
+
 #else
 #error "Unsupported platform - only RP2040, ESP32 and Teensy 4.x are supported"
 #endif
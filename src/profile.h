@@ -0,0 +1,237 @@
+#pragma once
+
+#include <Arduino.h>
+#include "codes.h"
+
+#define PROFILE_MAX_TRANSITIONS 64 // power of two
+#define PROFILE_MAX_MILESTONES  4
+
+// Log-scale duration buckets, two per power of two, from 64 us up to ~18
+// minutes; everything outside goes into the first/last bucket.
+#define PROFILE_SKETCH_MIN_OCTAVE 6
+#define PROFILE_SKETCH_OCTAVES    24
+#define PROFILE_SKETCH_BUCKETS    (2 * PROFILE_SKETCH_OCTAVES)
+
+// Fixed-size duration distribution: exact count/min/max/mean, plus a
+// bucketed histogram for percentiles (to within a bucket, ~41%). Bucket
+// counts are halved when one saturates, so it keeps adapting to recent
+// boots rather than overflowing.
+class DurationSketch {
+public:
+    void add(uint32_t us) {
+        if (count == 0 || us < minUs) {
+            minUs = us;
+        }
+        if (us > maxUs) {
+            maxUs = us;
+        }
+        sumUs += us;
+        count++;
+
+        uint8_t b = bucket(us);
+        if (buckets[b] == UINT8_MAX) {
+            for (uint8_t &c : buckets) {
+                c >>= 1;
+            }
+        }
+        buckets[b]++;
+    }
+
+    uint32_t getCount() const { return count; }
+    uint32_t getMinUs() const { return minUs; }
+    uint32_t getMaxUs() const { return maxUs; }
+    uint32_t getMeanUs() const { return count ? (uint32_t)(sumUs / count) : 0; }
+
+    // Upper edge of the bucket holding the `pct`th percentile, capped at
+    // the largest value actually seen
+    uint32_t getPercentileUs(uint8_t pct) const {
+        uint32_t total = 0;
+        for (uint8_t c : buckets) {
+            total += c;
+        }
+        uint32_t rank = (total * pct + 99) / 100;
+        uint32_t seen = 0;
+        for (uint8_t b = 0; b < PROFILE_SKETCH_BUCKETS; b++) {
+            seen += buckets[b];
+            if (seen >= rank && seen > 0) {
+                uint32_t edge = bucketUpperUs(b);
+                return edge < maxUs ? edge : maxUs;
+            }
+        }
+        return maxUs;
+    }
+
+private:
+    uint64_t sumUs = 0;
+    uint32_t count = 0;
+    uint32_t minUs = 0;
+    uint32_t maxUs = 0;
+    uint8_t buckets[PROFILE_SKETCH_BUCKETS] = {0};
+
+    static uint8_t octave(uint32_t us) {
+        uint8_t o = 0;
+        while (us >>= 1) {
+            o++;
+        }
+        return o;
+    }
+
+    static uint8_t bucket(uint32_t us) {
+        uint8_t o = octave(us);
+        if (o < PROFILE_SKETCH_MIN_OCTAVE) {
+            return 0;
+        }
+        if (o >= PROFILE_SKETCH_MIN_OCTAVE + PROFILE_SKETCH_OCTAVES) {
+            return PROFILE_SKETCH_BUCKETS - 1;
+        }
+        uint8_t half = (us >> (o - 1)) & 1;
+        return 2 * (o - PROFILE_SKETCH_MIN_OCTAVE) + half;
+    }
+
+    static uint32_t bucketUpperUs(uint8_t b) {
+        uint8_t o = PROFILE_SKETCH_MIN_OCTAVE + b / 2;
+        return (b & 1) ? (2UL << o) - 1 : (3UL << (o - 1)) - 1;
+    }
+};
+
+enum TransitionKind: uint8_t {
+    TRANSITION_STEP = 0,      // one code to the next
+    TRANSITION_MILESTONE = 1, // previous milestone of the same flavor (or boot start) to a milestone
+};
+
+typedef struct {
+    uint64_t fromCode;
+    uint64_t toCode;
+    CodeFlavor fromFlavor; // 0 = start of boot
+    CodeFlavor toFlavor;
+    TransitionKind kind;
+    bool used;
+    DurationSketch sketch;
+} TransitionStats;
+
+// Per-transition boot timing, aggregated across every boot of the session.
+// Fixed table, open addressing; transitions that don't fit are counted only.
+class BootProfiler {
+public:
+    void setMilestones(const uint8_t flavors[PROFILE_MAX_MILESTONES], const uint64_t codes[PROFILE_MAX_MILESTONES]) {
+        memcpy(milestoneFlavors, flavors, sizeof(milestoneFlavors));
+        memcpy(milestoneCodes, codes, sizeof(milestoneCodes));
+    }
+
+    void reset() {
+        for (TransitionStats &t : transitions) {
+            t.used = false;
+            t.sketch = DurationSketch();
+        }
+        used = 0;
+        untracked = 0;
+        boots = 0;
+        inBoot = false;
+    }
+
+    // Feeds one code; `newBoot` marks the first code of a boot
+    void record(const SegmentData &seg, bool newBoot) {
+        if (newBoot || !inBoot) {
+            inBoot = true;
+            boots++;
+            for (uint8_t i = 0; i < CODE_IDX_MAX; i++) {
+                lastMilestone[i].flavor = (CodeFlavor)0;
+                lastMilestone[i].code = 0;
+                lastMilestone[i].timestamp = seg.timestamp;
+            }
+        } else {
+            add(TRANSITION_STEP, prev.flavor, prev.code, seg, seg.timestamp - prev.timestamp);
+        }
+
+        if (isMilestone(seg)) {
+            CodeIndex idx = getCodeIndexForFlavor(seg.flavor);
+            if (idx < CODE_IDX_MAX) {
+                SegmentData &from = lastMilestone[idx];
+                add(TRANSITION_MILESTONE, from.flavor, from.code, seg, seg.timestamp - from.timestamp);
+                from = seg;
+            }
+        }
+        prev = seg;
+    }
+
+    // Fills `out` with the slots of the (up to) `n` transitions with the
+    // highest p95, highest first. Returns how many were found.
+    uint8_t slowest(uint8_t *out, uint8_t n) const {
+        uint8_t found = 0;
+        for (uint8_t slot = 0; slot < PROFILE_MAX_TRANSITIONS; slot++) {
+            if (!transitions[slot].used) {
+                continue;
+            }
+            uint32_t p95 = transitions[slot].sketch.getPercentileUs(95);
+            if (found == n && p95 <= transitions[out[n - 1]].sketch.getPercentileUs(95)) {
+                continue;
+            }
+            uint8_t pos = (found < n) ? found++ : n - 1;
+            while (pos > 0 && transitions[out[pos - 1]].sketch.getPercentileUs(95) < p95) {
+                out[pos] = out[pos - 1];
+                pos--;
+            }
+            out[pos] = slot;
+        }
+        return found;
+    }
+
+    const TransitionStats &transition(uint8_t slot) const { return transitions[slot]; }
+    uint16_t getUsed() const { return used; }
+    uint32_t getUntracked() const { return untracked; }
+    uint32_t getBoots() const { return boots; }
+
+private:
+    TransitionStats transitions[PROFILE_MAX_TRANSITIONS] = {};
+    uint16_t used = 0;
+    uint32_t untracked = 0;
+    uint32_t boots = 0;
+
+    bool inBoot = false;
+    SegmentData prev = {0};
+    SegmentData lastMilestone[CODE_IDX_MAX] = {};
+
+    uint8_t milestoneFlavors[PROFILE_MAX_MILESTONES] = {0};
+    uint64_t milestoneCodes[PROFILE_MAX_MILESTONES] = {0};
+
+    bool isMilestone(const SegmentData &seg) const {
+        for (uint8_t i = 0; i < PROFILE_MAX_MILESTONES; i++) {
+            if (milestoneFlavors[i] == seg.flavor && milestoneCodes[i] == seg.code) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static uint8_t hash(TransitionKind kind, CodeFlavor fromFlavor, uint64_t fromCode, CodeFlavor toFlavor, uint64_t toCode) {
+        uint32_t h = (uint32_t)fromCode * 31 + (uint32_t)(fromCode >> 32);
+        h = h * 31 + (uint32_t)toCode;
+        h = h * 31 + (uint32_t)(toCode >> 32);
+        h ^= ((uint32_t)fromFlavor << 8) | ((uint32_t)toFlavor << 16) | ((uint32_t)kind << 24);
+        return (uint8_t)((h * 2654435761u) >> 24) & (PROFILE_MAX_TRANSITIONS - 1);
+    }
+
+    void add(TransitionKind kind, CodeFlavor fromFlavor, uint64_t fromCode, const SegmentData &to, uint64_t durationUs) {
+        uint32_t us = durationUs > UINT32_MAX ? UINT32_MAX : (uint32_t)durationUs;
+        uint8_t slot = hash(kind, fromFlavor, fromCode, to.flavor, to.code);
+        for (uint8_t probe = 0; probe < PROFILE_MAX_TRANSITIONS; probe++) {
+            TransitionStats &t = transitions[slot];
+            if (!t.used) {
+                t.used = true;
+                t.kind = kind;
+                t.fromFlavor = fromFlavor;
+                t.fromCode = fromCode;
+                t.toFlavor = to.flavor;
+                t.toCode = to.code;
+                used++;
+            }
+            if (t.kind == kind && t.fromFlavor == fromFlavor && t.fromCode == fromCode
+                && t.toFlavor == to.flavor && t.toCode == to.code) {
+                t.sketch.add(us);
+                return;
+            }
+            slot = (slot + 1) & (PROFILE_MAX_TRANSITIONS - 1);
+        }
+        untracked++;
+    }
+};
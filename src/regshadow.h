@@ -0,0 +1,93 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "platform.h"
+
+#define REG_SHADOW_SIZE 0x25 // MAX6958_REGISTER_SIZE
+// Snapshot attempts before giving up on a bus that never goes quiet
+#define REG_SHADOW_MAX_RETRIES 8
+
+static_assert(REG_SHADOW_SIZE <= 64, "Change bitmaps are one u64");
+
+// A consistent copy of the shadow, as of transaction `seq`.
+struct RegisterSnapshot {
+    uint32_t seq = 0;
+    uint8_t values[REG_SHADOW_SIZE] = {0};
+    uint32_t writes[REG_SHADOW_SIZE] = {0};
+    uint32_t changedAt[REG_SHADOW_SIZE] = {0}; // seq of the transaction that last changed the value
+
+    // Registers whose value changed after transaction `since`, bit n = register n
+    uint64_t changedSince(uint32_t since) const {
+        uint64_t bits = 0;
+        for (uint8_t reg = 0; reg < REG_SHADOW_SIZE; reg++) {
+            if ((int32_t)(changedAt[reg] - since) > 0) {
+                bits |= 1ULL << reg;
+            }
+        }
+        return bits;
+    }
+};
+
+// The MAX6958 registers as the console last wrote them, behind a seqlock.
+// The capture side is the only writer and never waits: it bumps `seq` to odd
+// before the first write of a transaction and back to even after the last.
+// Readers copy everything and retry if `seq` was odd or moved meanwhile, so
+// a snapshot never mixes two transactions, even when the writer is the Wire
+// ISR interrupting the reader on the same core.
+//
+// A change bitmap the reader clears would need a second writer. Instead each
+// register remembers the transaction that last changed it, and a reader asks
+// what changed since the snapshot it took before.
+class RegisterShadow {
+public:
+    inline void CAPTURE_FUNC(beginWrite)() {
+        seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    inline void CAPTURE_FUNC(write)(uint8_t reg, uint8_t value) {
+        if (reg >= REG_SHADOW_SIZE) {
+            return;
+        }
+        if (values[reg] != value) {
+            values[reg] = value;
+            changedAt[reg] = seq.load(std::memory_order_relaxed);
+        }
+        writes[reg] = writes[reg] + 1;
+    }
+
+    inline void CAPTURE_FUNC(endWrite)() {
+        seq.store(seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Reader side. False if every attempt raced a write.
+    bool snapshot(RegisterSnapshot &out) const {
+        for (uint8_t attempt = 0; attempt < REG_SHADOW_MAX_RETRIES; attempt++) {
+            uint32_t before = seq.load(std::memory_order_acquire);
+            if (before & 1) {
+                continue;
+            }
+            for (uint8_t reg = 0; reg < REG_SHADOW_SIZE; reg++) {
+                out.values[reg] = values[reg];
+                out.writes[reg] = writes[reg];
+                out.changedAt[reg] = changedAt[reg];
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq.load(std::memory_order_relaxed) == before) {
+                out.seq = before;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Unsynchronized; fine for a single register that is written whole
+    inline uint8_t get(uint8_t reg) const { return reg < REG_SHADOW_SIZE ? values[reg] : 0; }
+
+private:
+    std::atomic<uint32_t> seq{0};
+    volatile uint8_t values[REG_SHADOW_SIZE] = {0};
+    volatile uint32_t writes[REG_SHADOW_SIZE] = {0};
+    volatile uint32_t changedAt[REG_SHADOW_SIZE] = {0};
+};
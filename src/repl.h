@@ -0,0 +1,250 @@
+#pragma once
+
+#include <Arduino.h>
+
+#define REPL_LINE_MAX 64
+#define REPL_MAX_ARGS 4
+
+// FNV-1a. Written recursively so it stays a valid C++11 constexpr (ESP32's
+// Arduino core still builds with -std=gnu++11) and the command table can
+// be hashed at compile time.
+static inline constexpr uint32_t replHashStep(const char *s, size_t len, uint32_t h) {
+    return len == 0 ? h : replHashStep(s + 1, len - 1, (h ^ (uint8_t)*s) * 16777619u);
+}
+static inline constexpr size_t replStrLen(const char *s) {
+    return *s ? 1 + replStrLen(s + 1) : 0;
+}
+static inline constexpr uint32_t replHash(const char *s, size_t len) {
+    return replHashStep(s, len, 2166136261u);
+}
+static inline constexpr uint32_t replHash(const char *s) {
+    return replHash(s, replStrLen(s));
+}
+
+enum ReplArgType: uint8_t {
+    ARG_U8,
+    ARG_U16,
+    ARG_U32,
+    ARG_HEX,  // hex up to 64 bits (POST codes), with or without 0x prefix
+    ARG_WORD, // stored as its replHash(), compare against replHash("literal")
+};
+
+// One REPL command: typing `name` (plus arguments) switches the state
+// machine to `state`, which picks the parsed arguments up from ReplArgs.
+template <typename StateT>
+struct ReplCommand {
+    const char *name;
+    uint32_t hash;
+    StateT state;
+    uint8_t minArgs;
+    uint8_t maxArgs;
+    ReplArgType argTypes[REPL_MAX_ARGS];
+    const char *usage;
+};
+
+#define REPL_CMD(name, state) \
+    { name, replHash(name), state, 0, 0, {}, name }
+#define REPL_CMD_ARGS(name, state, minArgs, maxArgs, usage, ...) \
+    { name, replHash(name), state, minArgs, maxArgs, { __VA_ARGS__ }, usage }
+
+// Compile-time check that no two commands in a table hash the same
+template <typename StateT, size_t N>
+constexpr bool replHashUniqueFrom(const ReplCommand<StateT> (&table)[N], size_t i, size_t j) {
+    return j >= N ? true : (table[i].hash != table[j].hash && replHashUniqueFrom(table, i, j + 1));
+}
+template <typename StateT, size_t N>
+constexpr bool replHashesUnique(const ReplCommand<StateT> (&table)[N], size_t i = 0) {
+    return i >= N ? true : (replHashUniqueFrom(table, i, i + 1) && replHashesUnique(table, i + 1));
+}
+
+typedef struct {
+    uint8_t count;
+    uint64_t value[REPL_MAX_ARGS]; // wide enough for any ARG_HEX code
+} ReplArgs;
+
+enum ReplParseResult {
+    REPL_EMPTY,
+    REPL_UNKNOWN_COMMAND,
+    REPL_BAD_ARGS,
+    REPL_OK,
+};
+
+// Fixed-capacity line buffer, fed one character at a time.
+class LineEditor {
+public:
+    // Returns true once `c` completes a line. A CR LF pair ends one line, not two.
+    bool feed(char c) {
+        bool afterCR = lastWasCR;
+        lastWasCR = (c == '\r');
+        if (c == '\r' || c == '\n') {
+            return !(c == '\n' && afterCR);
+        }
+
+        if (c == '\b' || c == 0x7F) {
+            if (len > 0) {
+                len--;
+            }
+        } else if (c >= 0x20 && c < 0x7F) {
+            if (len < REPL_LINE_MAX) {
+                buf[len++] = c;
+            } else {
+                overflowed = true;
+            }
+        }
+        return false;
+    }
+
+    // NUL-terminates the buffer in place
+    char *line() { buf[len] = '\0'; return buf; }
+    size_t length() const { return len; }
+    bool isOverflowed() const { return overflowed; }
+    void clear() { len = 0; overflowed = false; }
+
+private:
+    char buf[REPL_LINE_MAX + 1];
+    size_t len = 0;
+    bool overflowed = false;
+    bool lastWasCR = false;
+};
+
+// Digits only: no sign or whitespace (strtoul would take "-1" and wrap it),
+// and anything above `max` is rejected rather than clamped.
+static inline bool parseReplNumber(const char *tok, uint8_t base, uint64_t max, uint64_t *out) {
+    if (base == 16 && tok[0] == '0' && (tok[1] == 'x' || tok[1] == 'X')) {
+        tok += 2;
+    }
+    if (*tok == '\0') {
+        return false;
+    }
+
+    uint64_t value = 0;
+    for (; *tok; tok++) {
+        char c = *tok;
+        uint8_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (base == 16 && c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else if (base == 16 && c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        } else {
+            return false;
+        }
+        if (digit > max || value > (max - digit) / base) {
+            return false;
+        }
+        value = value * base + digit;
+    }
+    *out = value;
+    return true;
+}
+
+static inline bool parseReplArg(ReplArgType type, const char *tok, uint64_t *out) {
+    switch (type) {
+        case ARG_U8:
+            return parseReplNumber(tok, 10, 0xFF, out);
+        case ARG_U16:
+            return parseReplNumber(tok, 10, 0xFFFF, out);
+        case ARG_U32:
+            return parseReplNumber(tok, 10, 0xFFFFFFFF, out);
+        case ARG_HEX:
+            return parseReplNumber(tok, 16, UINT64_MAX, out);
+        case ARG_WORD:
+            *out = replHash(tok, strlen(tok));
+            return true;
+    }
+    return false;
+}
+
+static inline constexpr size_t replIndexSlots(size_t n, size_t slots = 1) {
+    return slots >= 2 * n ? slots : replIndexSlots(n, slots * 2);
+}
+
+// Open-addressed hash index over a command table. The hash picks the slot,
+// so a lookup probes one or two slots (the table is at most half full)
+// and confirms with a single strcmp, instead of scanning every command.
+// Built once, into static storage, when the index is constructed.
+template <typename StateT, size_t N>
+class ReplIndex {
+    static constexpr size_t SLOTS = replIndexSlots(N);
+    static constexpr uint8_t EMPTY = 0xFF;
+    static_assert(N < EMPTY, "Command indexes are stored as uint8_t");
+public:
+    explicit ReplIndex(const ReplCommand<StateT> (&table)[N]) : table(table) {
+        memset(slots, EMPTY, sizeof(slots));
+        for (size_t i = 0; i < N; i++) {
+            size_t slot = table[i].hash & (SLOTS - 1);
+            while (slots[slot] != EMPTY) {
+                slot = (slot + 1) & (SLOTS - 1);
+            }
+            slots[slot] = (uint8_t)i;
+        }
+    }
+
+    const ReplCommand<StateT> *find(const char *name) const {
+        uint32_t hash = replHash(name, strlen(name));
+        for (size_t slot = hash & (SLOTS - 1); slots[slot] != EMPTY; slot = (slot + 1) & (SLOTS - 1)) {
+            const ReplCommand<StateT> &cmd = table[slots[slot]];
+            if (cmd.hash == hash) {
+                // Hashes are unique (replHashesUnique), so this is the only candidate
+                return strcmp(cmd.name, name) == 0 ? &cmd : NULL;
+            }
+        }
+        return NULL;
+    }
+
+private:
+    const ReplCommand<StateT> (&table)[N];
+    uint8_t slots[SLOTS];
+};
+
+// Splits `line` on spaces (in place), finds the command and parses its
+// arguments according to the command's argTypes.
+template <typename StateT, size_t N>
+ReplParseResult parseReplLine(const ReplIndex<StateT, N> &index, char *line,
+                              const ReplCommand<StateT> **cmdOut, ReplArgs *args) {
+    char *tokens[REPL_MAX_ARGS + 1];
+    uint8_t tokenCount = 0;
+    bool extraTokens = false;
+
+    char *p = line;
+    while (*p) {
+        while (*p == ' ') {
+            *p++ = '\0';
+        }
+        if (*p == '\0') {
+            break;
+        }
+        if (tokenCount < REPL_MAX_ARGS + 1) {
+            tokens[tokenCount++] = p;
+        } else {
+            extraTokens = true;
+        }
+        while (*p && *p != ' ') {
+            p++;
+        }
+    }
+
+    if (tokenCount == 0) {
+        return REPL_EMPTY;
+    }
+
+    const ReplCommand<StateT> *cmd = index.find(tokens[0]);
+    *cmdOut = cmd;
+    if (cmd == NULL) {
+        return REPL_UNKNOWN_COMMAND;
+    }
+
+    uint8_t argCount = tokenCount - 1;
+    if (extraTokens || argCount < cmd->minArgs || argCount > cmd->maxArgs) {
+        return REPL_BAD_ARGS;
+    }
+
+    args->count = argCount;
+    for (uint8_t i = 0; i < argCount; i++) {
+        if (!parseReplArg(cmd->argTypes[i], tokens[i + 1], &args->value[i])) {
+            return REPL_BAD_ARGS;
+        }
+    }
+    return REPL_OK;
+}
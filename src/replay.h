@@ -0,0 +1,213 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "capture.h"
+#include "codes.h"
+
+// Traffic generator: plays a capture back as MAX6958 writes, so one reader
+// can load-test another on the bench (target bus: I2C master writes to
+// MAX6958_ADDRESS on the Xbox bus pins), or push it through this reader's
+// own decode path without any wiring (target loopback).
+
+#define REPLAY_MAX_CODES 1024
+#define REPLAY_MAX_BURST 16
+#define REPLAY_PACKETS_PER_SERVICE 32 // bounds each service() call, so stop requests get seen
+
+typedef struct {
+    uint64_t code;
+    uint32_t gapUs; // since the previous code of the capture
+    CodeFlavor flavor;
+} ReplayEntry;
+
+enum ReplayTarget: uint8_t {
+    REPLAY_TARGET_BUS = 0,
+    REPLAY_TARGET_LOOPBACK = 1,
+};
+
+typedef struct {
+    ReplayTarget target;
+    uint16_t passes;     // over the whole capture, 0 = until stopped
+    uint16_t clockKhz;   // bus target only
+    uint16_t packetGapUs; // idle time after every packet
+    uint8_t burst;       // every code goes out this many times in a row
+    uint8_t speedup;     // the capture's gaps are divided by this, 0 = no gaps at all
+} ReplaySettings;
+
+// Splits a code into the packets the console would send for it: one per
+// 16-bit digit group up to the highest non-zero one, highest first, so the
+// receiver assembles the code when the group with index 1 arrives. Returns
+// the packet count.
+static inline uint8_t encodeCodePackets(uint8_t out[POST_CODE_WORD_COUNT][MAX6958_CODE_PACKET_SIZE], CodeFlavor flavor, uint64_t code) {
+    uint8_t groups = 1;
+    while (groups < POST_CODE_WORD_COUNT && (code >> (16 * groups)) != 0) {
+        groups++;
+    }
+    for (uint8_t i = 0; i < groups; i++) {
+        uint8_t group = groups - 1 - i;
+        encodeCodePacket(out[i], flavor, 1 << group, (uint16_t)(code >> (16 * group)));
+    }
+    return groups;
+}
+
+class Replayer {
+public:
+    // core0, only while stopped
+    void clear() { count = 0; }
+    bool add(CodeFlavor flavor, uint64_t code, uint32_t gapUs) {
+        if (count == REPLAY_MAX_CODES) {
+            return false;
+        }
+        entries[count++] = ReplayEntry{ code, gapUs, flavor };
+        return true;
+    }
+    uint16_t size() const { return count; }
+
+    // core0: settings are handed over with the start request
+    bool start(const ReplaySettings &settings) {
+        if (isRunning() || count == 0) {
+            return false;
+        }
+        this->settings = settings;
+        if (this->settings.burst == 0) {
+            this->settings.burst = 1;
+        } else if (this->settings.burst > REPLAY_MAX_BURST) {
+            this->settings.burst = REPLAY_MAX_BURST;
+        }
+        startRequests.store(startRequests.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        return true;
+    }
+    // Also cancels a start core1 hasn't picked up yet; a start() after this
+    // still runs.
+    void stop() {
+        stoppedStarts.store(startRequests.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        stopRequests.store(stopRequests.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // A start request core1 hasn't picked up yet counts as running
+    bool isRunning() const {
+        return running.load(std::memory_order_acquire)
+            || startRequests.load(std::memory_order_acquire) != startSeen.load(std::memory_order_acquire);
+    }
+    const ReplaySettings &getSettings() const { return settings; }
+
+    // core1. Picks up start and stop requests; returns true on the call a
+    // run starts, so the caller can set up its target first.
+    bool poll(uint32_t nowUs) {
+        uint8_t stops = stopRequests.load(std::memory_order_acquire);
+        uint8_t starts = startRequests.load(std::memory_order_acquire);
+        if (stops != stopSeen) {
+            stopSeen = stops;
+            running.store(false, std::memory_order_release);
+            // The newest start came before the stop: it never runs
+            if (stoppedStarts.load(std::memory_order_relaxed) == starts) {
+                startSeen.store(starts, std::memory_order_release);
+                return false;
+            }
+        }
+        if (starts == startSeen.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        index = copy = packet = 0;
+        packetCount = 0;
+        dueUs = nowUs;
+        codeStartUs = nowUs;
+        codesSent = packetsSent = nacks = passesDone = 0;
+        running.store(true, std::memory_order_release);
+        startSeen.store(starts, std::memory_order_release);
+        return true;
+    }
+
+    // core1: sends whatever is due through `send(data, len)`, which returns
+    // false if the packet wasn't acknowledged. Returns false once the run
+    // is over (or stopped).
+    template <typename Send>
+    bool service(Send send) {
+        if (!running.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        for (uint8_t n = 0; n < REPLAY_PACKETS_PER_SERVICE; n++) {
+            if ((int32_t)(now_us32() - dueUs) < 0) {
+                break;
+            }
+            const ReplayEntry &entry = entries[index];
+            if (packetCount == 0) {
+                packetCount = encodeCodePackets(packets, entry.flavor, entry.code);
+            }
+            if (!send(packets[packet], MAX6958_CODE_PACKET_SIZE)) {
+                nacks = nacks + 1;
+            }
+            packetsSent = packetsSent + 1;
+            dueUs = now_us32() + settings.packetGapUs;
+
+            if (++packet < packetCount) {
+                continue;
+            }
+            packet = 0;
+            codesSent = codesSent + 1;
+            if (++copy < settings.burst) {
+                continue;
+            }
+            copy = 0;
+            packetCount = 0;
+            if (!nextEntry()) {
+                running.store(false, std::memory_order_release);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    uint32_t getCodesSent() const { return codesSent; }
+    uint32_t getPacketsSent() const { return packetsSent; }
+    uint32_t getNacks() const { return nacks; }
+    uint16_t getPassesDone() const { return passesDone; }
+
+private:
+    ReplayEntry entries[REPLAY_MAX_CODES];
+    uint16_t count = 0;
+    ReplaySettings settings = {};
+
+    std::atomic<uint8_t> startRequests{0};
+    std::atomic<uint8_t> stopRequests{0};
+    std::atomic<uint8_t> stoppedStarts{0}; // startRequests as of the last stop()
+    std::atomic<bool> running{false};
+    std::atomic<uint8_t> startSeen{0}; // written by core1
+
+    // core1 only
+    uint8_t stopSeen = 0;
+    uint16_t index = 0;
+    uint8_t copy = 0;
+    uint8_t packet = 0;
+    uint8_t packetCount = 0;
+    uint8_t packets[POST_CODE_WORD_COUNT][MAX6958_CODE_PACKET_SIZE];
+    uint32_t dueUs = 0;       // next packet
+    uint32_t codeStartUs = 0; // when the current code was due
+
+    // Written by core1, read by core0
+    volatile uint32_t codesSent = 0;
+    volatile uint32_t packetsSent = 0;
+    volatile uint32_t nacks = 0;
+    volatile uint16_t passesDone = 0;
+
+    // Moves on to the next code, keeping the capture's timing (scaled)
+    // relative to when the previous code was due. Returns false when done.
+    bool nextEntry() {
+        if (++index == count) {
+            index = 0;
+            passesDone = passesDone + 1;
+            if (settings.passes != 0 && passesDone >= settings.passes) {
+                return false;
+            }
+        }
+        if (settings.speedup != 0) {
+            uint32_t gapUs = entries[index].gapUs / settings.speedup;
+            uint32_t codeDueUs = codeStartUs + gapUs;
+            if ((int32_t)(codeDueUs - dueUs) > 0) {
+                dueUs = codeDueUs;
+            }
+        }
+        codeStartUs = dueUs;
+        return true;
+    }
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "platform.h"
+
+// Fixed-capacity single-producer/single-consumer ring buffer over storage
+// its owner provides (SpscRing below brings its own), so queues of
+// different sizes can sit side by side behind one type.
+// The producer (core1's I2C receive callback) only ever writes `tail`, the
+// consumer (core0's loop()) only ever writes `head`, so neither side needs a
+// lock.
+template <typename T>
+class SpscQueue {
+public:
+    // `size` must be a power of two
+    SpscQueue(T *slots, uint16_t size) : slots(slots), mask(size - 1) {}
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    inline uint16_t capacity() const { return mask + 1; }
+
+    // Producer side. Returns false (and drops `item`) when full.
+    inline bool CAPTURE_FUNC(push)(const T &item) {
+        uint16_t t = tail.load(std::memory_order_relaxed);
+        if ((uint16_t)(t - head.load(std::memory_order_acquire)) > mask) {
+            return false;
+        }
+        slots[t & mask] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side.
+    inline bool pop(T &out) {
+        uint16_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        out = slots[h & mask];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side: the item pop() would return next, left in place.
+    inline const T *peek() const {
+        uint16_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return NULL;
+        }
+        return &slots[h & mask];
+    }
+
+    // Consumer side: drops everything queued so far.
+    inline void discard() {
+        head.store(tail.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    inline uint16_t count() const {
+        return (uint16_t)(tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire));
+    }
+    inline bool isEmpty() const { return count() == 0; }
+    inline bool isFull() const { return count() > mask; }
+
+private:
+    T *const slots;
+    const uint16_t mask;
+    std::atomic<uint16_t> head{0};
+    std::atomic<uint16_t> tail{0};
+};
+
+// An SpscQueue with its N slots inline, so they live in SRAM along with
+// the owner instead of on the heap.
+template <typename T, uint16_t N>
+class SpscRing : public SpscQueue<T> {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscRing capacity must be a power of two");
+public:
+    SpscRing() : SpscQueue<T>(storage, N) {}
+
+private:
+    T storage[N];
+};
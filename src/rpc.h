@@ -0,0 +1,237 @@
+#pragma once
+
+#include <Arduino.h>
+#include <CRC.h>
+
+// Machine-readable control plane, sharing the serial port with the REPL
+// and the code stream.
+//
+// Request:  SYNC | len | id | op     | payload... | crc8
+// Response: SYNC | len | id | status | payload... | crc8
+//
+// `len` counts id, op/status and payload; crc8 (poly 0x07) covers len and
+// those bytes. SYNC is ASCII "record separator", which never appears in the
+// text output, so hosts can pick responses out of the stream and send any
+// number of requests back to back. Responses come back in request order.
+// Multi-byte values are little-endian.
+//
+// Sinks in binary format (see sink.h) carry the code stream as event
+// frames of the same shape, with their own SYNC so they can't be mistaken
+// for a response:
+//
+// Event:    EVENT_SYNC | len | type | seq | payload... | crc8
+//
+// `seq` counts up by one per event, so a host can tell when a sink dropped
+// some.
+
+#define RPC_PROTOCOL_VERSION 1
+#define RPC_SYNC 0x1E
+#define RPC_EVENT_SYNC 0x1F
+#define RPC_MAX_BODY 255
+#define RPC_MAX_PAYLOAD (RPC_MAX_BODY - 2)
+#define RPC_CODE_STATS_MAX_SLOTS 8 // 29 bytes each, so a full page of slots fits a frame
+#define RPC_PROF_MAX_SAMPLES 27 // 9 bytes each
+#define RPC_FRAME_TIMEOUT_MS 100 // a stalled half-frame is dropped after this
+
+enum RpcOp: uint8_t {
+    RPC_OP_PING = 0x00,          // echoes the payload
+    RPC_OP_VERSION = 0x01,       // -> proto u8, cfg version u8, build date u32, fw version string
+    RPC_OP_STATUS = 0x02,        // -> state u8, queue depth u16, save pending u8, free journal pages u8, uptime ms u32, bus idle ms u32
+    RPC_OP_COUNTERS = 0x03,      // -> receive callbacks u32, dropped codes u32, worst receive us u32, filtered codes u32,
+                                 //    dropped codes per flavor (CPU, SP, SMC, OS) u32 x4, captured codes u32
+    RPC_OP_CODE_STATS = 0x04,    // start slot u16, slot count u8 (max RPC_CODE_STATS_MAX_SLOTS)
+                                 // -> capacity u16, tracked u16, untracked hits u32, then per used slot:
+                                 //    flavor u8, code u64, hits u32, first ms u32, last ms u32, min gap us u32, max gap us u32
+    RPC_OP_TIME = 0x05,          // host time u64 -> host time u64 (echoed), device us at receive u64, device us at reply u64
+    RPC_OP_TIME_SET = 0x06,      // device us u64, host us u64, drift ppb i32, uncertainty us u32, drift uncertainty ppb u32
+                                 // (see clocksync.h); an empty payload forgets the sync
+    RPC_OP_PROF = 0x07,          // action u8 (RpcProfAction, none = drain)[, rate Hz u16 to start]
+                                 // -> rate Hz u16 (0 = stopped), dropped samples u32, then drained samples:
+                                 //    (core u8, pc u32, lr u32)... up to RPC_PROF_MAX_SAMPLES
+
+    RPC_OP_CONFIG_SCHEMA = 0x10, // [first field u8] -> (tag u8, size u8, name len u8, name)... as many as fit;
+                                 //    empty once past the last field
+    RPC_OP_CONFIG_GET = 0x11,    // tag u8... (none = all) -> (tag u8, size u8, value)...;
+                                 //    RPC_ERR_TOO_LARGE and the first tag that didn't fit
+    RPC_OP_CONFIG_SET = 0x12,    // (tag u8, size u8, value)... -> nothing, or the offending tag u8
+    RPC_OP_CONFIG_SAVE = 0x13,   // [flags u8: bit0 = write now instead of when idle]
+
+    RPC_OP_REPLAY_LOAD = 0x20,   // flags u8 (bit0 = clear first), then (flavor u8, code u64, gap us u32)...
+                                 // -> codes loaded u16; RPC_ERR_FAILED if running, or if they didn't all fit
+    RPC_OP_REPLAY_START = 0x21,  // target u8, passes u16, clock kHz u16, packet gap us u16, burst u8, speedup u8
+    RPC_OP_REPLAY_STOP = 0x22,
+    RPC_OP_REPLAY_STATUS = 0x23, // -> running u8, loaded u16, passes done u16, codes sent u32, packets sent u32,
+                                 //    nacks u32, loopback received u32, loopback dropped u32
+};
+
+enum RpcProfAction: uint8_t {
+    RPC_PROF_DRAIN = 0,
+    RPC_PROF_START = 1, // drops samples not drained yet
+    RPC_PROF_STOP = 2,
+};
+
+enum RpcEventType: uint8_t {
+    RPC_EVENT_CODE = 0x01,          // flavor u8, code u64, timestamp us u64, session u32,
+                                    //    then once synced to the host: host us u64, uncertainty us u32
+    RPC_EVENT_REPEAT = 0x02,        // count u32, first us u64, last us u64, ongoing u8, period u8,
+                                    //    then per code of the cycle: flavor u8, code u64. Counts complete
+                                    //    cycles only; a run ending partway through one is followed by
+                                    //    RPC_EVENT_CODE for each of that cycle's codes.
+    RPC_EVENT_SESSION_START = 0x03, // session u32, cause u8, start us u64
+    RPC_EVENT_SESSION_END = 0x04,   // session u32, codes u32, dropped u32, start us u64, last us u64,
+                                    //    then per flavor seen: flavor u8, last code u64
+    RPC_EVENT_CLOCK_SYNC = 0x05,    // as RPC_OP_TIME_SET, on every sync
+    RPC_EVENT_REGISTERS = 0x06,     // timestamp us u64, then per changed register: reg u8, value u8, writes u32
+    RPC_EVENT_BUS_RECOVERY = 0x07,  // cause u8 (BusStallCause), stalled us u32, restart us u32, codes lost u32,
+                                    //    recovered at us u64. A silence (cause 2) wasn't restarted: 0 restart us
+                                    //    and 0 lost, stalled us is the gap.
+};
+
+enum RpcStatus: uint8_t {
+    RPC_OK = 0,
+    RPC_ERR_UNKNOWN_OP = 1,
+    RPC_ERR_BAD_PAYLOAD = 2,
+    RPC_ERR_BAD_FIELD = 3,
+    RPC_ERR_BAD_VALUE = 4,
+    RPC_ERR_FAILED = 5,
+    RPC_ERR_BAD_CRC = 6,
+    RPC_ERR_TOO_LARGE = 7,
+};
+
+enum RpcFeedResult {
+    RPC_FRAME_PENDING,
+    RPC_FRAME_READY,
+    RPC_FRAME_BAD_CRC,
+};
+
+static inline uint8_t rpcCrc8(const uint8_t *data, uint16_t len) {
+    return calcCRC8(data, len, 0x07);
+}
+
+static inline uint16_t rpcGet16(const uint8_t *p) { return p[0] | ((uint16_t)p[1] << 8); }
+static inline uint32_t rpcGet32(const uint8_t *p) { return rpcGet16(p) | ((uint32_t)rpcGet16(p + 2) << 16); }
+static inline uint64_t rpcGet64(const uint8_t *p) { return rpcGet32(p) | ((uint64_t)rpcGet32(p + 4) << 32); }
+
+typedef struct {
+    uint8_t id;
+    uint8_t op;
+    uint8_t length;
+    const uint8_t *payload;
+} RpcRequest;
+
+// Incremental request deframer, fed one byte at a time from the serial input.
+class RpcParser {
+public:
+    // True while a frame is being received, i.e. bytes belong to the RPC
+    // rather than to the REPL.
+    bool isActive() const { return stage != STAGE_SYNC; }
+
+    RpcFeedResult feed(uint8_t b, uint32_t nowMs) {
+        if (isActive() && nowMs - lastByteMs > RPC_FRAME_TIMEOUT_MS) {
+            stage = STAGE_SYNC;
+        }
+        lastByteMs = nowMs;
+
+        switch (stage) {
+            case STAGE_SYNC:
+                if (b == RPC_SYNC) {
+                    stage = STAGE_LENGTH;
+                }
+                break;
+            case STAGE_LENGTH:
+                // A body always holds at least id + op
+                if (b < 2) {
+                    stage = STAGE_SYNC;
+                    break;
+                }
+                frame[0] = b;
+                received = 0;
+                stage = STAGE_BODY;
+                break;
+            case STAGE_BODY:
+                frame[1 + received++] = b;
+                if (received == frame[0]) {
+                    stage = STAGE_CRC;
+                }
+                break;
+            case STAGE_CRC:
+                stage = STAGE_SYNC;
+                return rpcCrc8(frame, 1 + frame[0]) == b ? RPC_FRAME_READY : RPC_FRAME_BAD_CRC;
+        }
+        return RPC_FRAME_PENDING;
+    }
+
+    // Valid after feed() returned RPC_FRAME_READY/RPC_FRAME_BAD_CRC, until the next feed()
+    RpcRequest request() const {
+        return RpcRequest{ frame[1], frame[2], (uint8_t)(frame[0] - 2), &frame[3] };
+    }
+
+private:
+    enum Stage { STAGE_SYNC, STAGE_LENGTH, STAGE_BODY, STAGE_CRC };
+    Stage stage = STAGE_SYNC;
+    uint8_t frame[1 + RPC_MAX_BODY]; // len + body
+    uint16_t received = 0;
+    uint32_t lastByteMs = 0;
+};
+
+// Frame builder. Appends fail (and mark the frame as truncated) rather
+// than overflow.
+class RpcFrame {
+public:
+    RpcFrame(uint8_t sync, uint8_t first, uint8_t second) {
+        frame[0] = sync;
+        frame[2] = first;
+        frame[3] = second;
+    }
+
+    bool put8(uint8_t v) { return putBytes(&v, 1); }
+    bool put16(uint16_t v) {
+        uint8_t b[2] = { (uint8_t)v, (uint8_t)(v >> 8) };
+        return putBytes(b, sizeof(b));
+    }
+    bool put32(uint32_t v) {
+        uint8_t b[4] = { (uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24) };
+        return putBytes(b, sizeof(b));
+    }
+    bool put64(uint64_t v) {
+        return put32((uint32_t)v) && put32((uint32_t)(v >> 32));
+    }
+    bool putBytes(const void *data, size_t len) {
+        if (length + len > RPC_MAX_PAYLOAD) {
+            return false;
+        }
+        memcpy(&frame[4 + length], data, len);
+        length += len;
+        return true;
+    }
+    size_t remaining() const { return RPC_MAX_PAYLOAD - length; }
+
+    // Fills in len and crc8, returns the size of the whole frame
+    uint16_t finish() {
+        frame[1] = 2 + length;
+        frame[4 + length] = rpcCrc8(&frame[1], 1 + frame[1]);
+        return 5 + length;
+    }
+    const uint8_t *data() const { return frame; }
+
+    // Writes the whole frame in one go, so it can't end up split by other output
+    void send(Print &out) {
+        out.write(frame, finish());
+    }
+
+protected:
+    uint8_t frame[1 + 1 + RPC_MAX_BODY + 1]; // sync + len + body + crc
+    uint16_t length = 0;
+};
+
+class RpcResponse : public RpcFrame {
+public:
+    RpcResponse(uint8_t id, uint8_t status = RPC_OK) : RpcFrame(RPC_SYNC, id, status) {}
+
+    void setStatus(uint8_t status) { frame[3] = status; }
+};
+
+class RpcEvent : public RpcFrame {
+public:
+    RpcEvent(RpcEventType type, uint8_t seq) : RpcFrame(RPC_EVENT_SYNC, type, seq) {}
+};
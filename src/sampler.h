@@ -0,0 +1,113 @@
+#pragma once
+
+#include <Arduino.h>
+#include "platform.h"
+#include "ringbuffer.h"
+
+// Sampling profiler. A timer interrupt on every core records where it cut
+// in - PC, and LR as a guess at the caller - into a ring per core; core0
+// drains the rings (`prof dump`, RPC_OP_PROF) and tools/sampleprof.py maps the
+// addresses onto functions in firmware.elf. A sample taken while its ring
+// is full is dropped and counted, so drain often.
+//
+// The interrupt runs at top priority so it also lands inside the I2C and
+// USB interrupts; each sample costs about a microsecond.
+
+#if PLATFORM_HAS_SAMPLER
+#define SAMPLER_RING_SIZE 1024 // per core, power of two
+#else
+#define SAMPLER_RING_SIZE 2
+#endif
+#define SAMPLER_DEFAULT_HZ 1000
+#define SAMPLER_MAX_HZ 20000
+
+typedef struct {
+    uint32_t pc;
+    uint32_t lr;
+} SamplerSample;
+
+class Sampler;
+static Sampler *activeSampler = NULL;
+extern "C" void samplerIsr();
+
+class Sampler {
+public:
+    // Starts/stops the calling core's timer; every core does its own
+    void startCore(uint16_t hz) {
+        activeSampler = this;
+        platformSamplerStart(samplerIsr, hz);
+    }
+    void stopCore() { platformSamplerStop(); }
+
+    // The timer interrupt of core `core`
+    inline void CAPTURE_FUNC(record)(uint8_t core, uint32_t pc, uint32_t lr) {
+        if (!rings[core].push(SamplerSample{ pc, lr })) {
+            dropped[core] = dropped[core] + 1;
+        }
+    }
+
+    // core0, the consumer of every ring
+    bool pop(uint8_t core, SamplerSample &out) { return rings[core].pop(out); }
+    void reset() {
+        for (uint8_t core = 0; core < PLATFORM_CORE_COUNT; core++) {
+            rings[core].discard();
+            dropped[core] = 0;
+        }
+    }
+    uint16_t pending() const {
+        uint16_t n = 0;
+        for (const auto &ring : rings) {
+            n += ring.count();
+        }
+        return n;
+    }
+    uint32_t getDropped() const {
+        uint32_t n = 0;
+        for (uint8_t core = 0; core < PLATFORM_CORE_COUNT; core++) {
+            n += dropped[core];
+        }
+        return n;
+    }
+
+private:
+    SpscRing<SamplerSample, SAMPLER_RING_SIZE> rings[PLATFORM_CORE_COUNT];
+    volatile uint32_t dropped[PLATFORM_CORE_COUNT] = {};
+};
+
+#if PLATFORM_HAS_SAMPLER
+
+extern "C" {
+
+// `frame` is the exception frame the core stacked on entry: r0-r3, r12,
+// lr, pc, xpsr
+__attribute__((used)) void CAPTURE_FUNC(samplerRecord)(const uint32_t *frame) {
+    platformSamplerAck();
+    activeSampler->record(platformCoreId(), frame[6], frame[5]);
+}
+
+// Finds the frame on whichever stack was in use (EXC_RETURN bit 2) and
+// tail-calls samplerRecord() with it. Thumb-1 only, so the M0+ runs it too.
+__attribute__((naked)) void CAPTURE_FUNC(samplerIsr)() {
+    asm volatile(
+        ".syntax unified\n"
+        "movs r0, #4\n"
+        "mov r1, lr\n"
+        "tst r0, r1\n"
+        "bne 1f\n"
+        "mrs r0, msp\n"
+        "b 2f\n"
+        "1:\n"
+        "mrs r0, psp\n"
+        "2:\n"
+        "ldr r1, =samplerRecord\n"
+        "bx r1\n"
+        ".ltorg\n");
+}
+
+}
+
+#else
+
+extern "C" void samplerIsr() {}
+
+#endif
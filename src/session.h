@@ -0,0 +1,155 @@
+#pragma once
+
+#include <Arduino.h>
+#include "codes.h"
+#include "filter.h"
+
+#define BOOT_STAGE_UNKNOWN 0xFF
+
+// Order the flavors show up in while a console boots
+static inline uint8_t bootStage(CodeFlavor flavor) {
+    return flavor == CODE_FLAVOR_SMC ? 0
+        : flavor == CODE_FLAVOR_SP ? 1
+        : flavor == CODE_FLAVOR_CPU ? 2
+        : flavor == CODE_FLAVOR_OS ? 3
+        : BOOT_STAGE_UNKNOWN;
+}
+
+enum SessionCause: uint8_t {
+    SESSION_CAUSE_FIRST = 0,      // first code since monitoring (re)started
+    SESSION_CAUSE_IDLE = 1,       // first code after an idle gap
+    SESSION_CAUSE_RESET_CODE = 2, // the configured reset code
+    SESSION_CAUSE_FALL = 3,       // the first boot stage started over
+};
+
+typedef struct {
+    uint32_t id;
+    uint32_t codes;
+    uint32_t dropped;
+    uint64_t startUs;
+    uint64_t lastUs;
+    uint64_t lastCode[CODE_IDX_MAX];
+    uint8_t seenFlavors; // FLAVOR_BITs with a lastCode
+    SessionCause cause;
+} SessionSummary;
+
+// Splits the code stream into boot sessions. A new session starts with the
+// first code after an idle gap, with a configured reset code, or - if
+// enabled - when the flavor sequence falls back: once the boot has moved on
+// to a later stage, the flavor it started with shows its first code (or a
+// lower one) again. Codes from earlier stages that keep counting up while
+// later ones run don't count as a fall.
+//
+// Session IDs only ever count up while the firmware runs, so sessions stay
+// distinguishable across monitor restarts.
+class SessionDetector {
+public:
+    // idleMs = 0 disables the idle gap, resetFlavors = 0 the reset code
+    void configure(uint16_t idleMs, uint8_t resetFlavors, uint64_t resetCode, bool splitOnFall) {
+        idleUs = (uint64_t)idleMs * 1000;
+        this->resetFlavors = resetFlavors;
+        this->resetCode = resetCode;
+        this->splitOnFall = splitOnFall;
+    }
+
+    // Forgets the running session without summarising it
+    void reset() {
+        started = false;
+        open = false;
+    }
+
+    // Returns true if `seg` is the first code of a new session, see getCause()
+    bool isNewSession(const SegmentData &seg) {
+        uint8_t stage = bootStage(seg.flavor);
+        if (!started) {
+            cause = SESSION_CAUSE_FIRST;
+        } else if (idleUs > 0 && seg.timestamp - lastUs >= idleUs) {
+            cause = SESSION_CAUSE_IDLE;
+        } else if ((flavorBit(seg.flavor) & resetFlavors) && seg.code == resetCode) {
+            cause = SESSION_CAUSE_RESET_CODE;
+        } else if (splitOnFall && open && stage == firstStage && stage < peakStage && seg.code <= firstCode) {
+            cause = SESSION_CAUSE_FALL;
+        } else if (!open) {
+            cause = SESSION_CAUSE_FIRST;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    // Starts a session with `seg`; close() the previous one first
+    void begin(const SegmentData &seg, uint32_t droppedTotal) {
+        memset(&current, 0, sizeof(current));
+        current.id = ++lastId;
+        current.cause = cause;
+        current.startUs = seg.timestamp;
+        droppedAtStart = droppedTotal;
+        firstStage = BOOT_STAGE_UNKNOWN;
+        peakStage = BOOT_STAGE_UNKNOWN;
+        started = true;
+        open = true;
+    }
+
+    void record(const SegmentData &seg) {
+        uint8_t stage = bootStage(seg.flavor);
+        uint8_t bit = flavorBit(seg.flavor);
+        if (stage != BOOT_STAGE_UNKNOWN) {
+            if (firstStage == BOOT_STAGE_UNKNOWN) {
+                firstStage = stage;
+                firstCode = seg.code;
+                peakStage = stage;
+            } else if (stage > peakStage) {
+                peakStage = stage;
+            }
+        }
+
+        CodeIndex idx = getCodeIndexForFlavor(seg.flavor);
+        if (idx < CODE_IDX_MAX) {
+            current.lastCode[idx] = seg.code;
+            current.seenFlavors |= bit;
+        }
+        current.codes++;
+        current.lastUs = seg.timestamp;
+        lastUs = seg.timestamp;
+    }
+
+    // True once the running session has been quiet for the idle gap, so
+    // its summary can go out without waiting for the next boot
+    bool isIdle(uint64_t nowUs) const {
+        return open && idleUs > 0 && nowUs > lastUs && nowUs - lastUs >= idleUs;
+    }
+
+    bool isOpen() const { return open; }
+
+    // Ends the running session, returns its summary
+    const SessionSummary &close(uint32_t droppedTotal) {
+        current.dropped = droppedTotal - droppedAtStart;
+        open = false;
+        return current;
+    }
+
+    const SessionSummary &getCurrent() const { return current; }
+    SessionCause getCause() const { return cause; }
+
+    // Timestamp relative to the start of the running session
+    uint64_t rebase(uint64_t timestamp) const {
+        return timestamp - current.startUs;
+    }
+
+private:
+    uint64_t idleUs = 0;
+    uint64_t resetCode = 0;
+    uint64_t lastUs = 0;
+    uint8_t resetFlavors = 0;
+    bool splitOnFall = false;
+
+    bool started = false; // any code since reset()
+    bool open = false;    // a session is running
+    SessionCause cause = SESSION_CAUSE_FIRST;
+    uint32_t lastId = 0;
+    uint32_t droppedAtStart = 0;
+    uint64_t firstCode = 0;                  // first code of firstStage's flavor
+    uint8_t firstStage = BOOT_STAGE_UNKNOWN; // boot stage this session started in
+    uint8_t peakStage = BOOT_STAGE_UNKNOWN;  // furthest boot stage this session
+    SessionSummary current = {};
+};
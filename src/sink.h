@@ -0,0 +1,206 @@
+#pragma once
+
+#include <Arduino.h>
+#include <stdarg.h>
+#include "board.h"
+
+// Destinations for the code stream (codes, repeat summaries, session
+// lines). Each sink gets the stream in its own format; REPL output and
+// notices keep going to the USB console only.
+
+#define SINK_UART_BUFFER_SIZE (2048 * BOARD_BUFFER_SCALE) // power of two
+#define SINK_UART_DEFAULT_BAUD 3000000
+#define SINK_TEXT_LINE_MAX 192
+
+enum SinkId: uint8_t {
+    SINK_USB = 0,  // the USB CDC console
+    SINK_UART = 1, // hardware UART, e.g. to an RS-485 transceiver
+    SINK_NULL = 2, // discards everything, for measuring the stream's cost
+    SINK_COUNT,
+};
+
+enum SinkFormat: uint8_t {
+    SINK_FORMAT_OFF = 0,
+    SINK_FORMAT_TEXT = 1,   // the monitor's text lines
+    SINK_FORMAT_BINARY = 2, // RPC event frames, see rpc.h
+};
+
+static inline const char *getStringForSinkFormat(SinkFormat format) {
+    switch (format) {
+        case SINK_FORMAT_TEXT:
+            return "text";
+        case SINK_FORMAT_BINARY:
+            return "binary";
+        default:
+            return "off";
+    }
+}
+
+// One sink. With a buffer, records are queued and handed to the port only
+// as fast as it takes them, so a slow link drops whole records instead of
+// stalling the monitor; without one they're written straight through.
+class OutputSink {
+public:
+    // port NULL = null sink
+    void begin(Print *port, uint8_t *buffer = NULL, uint16_t bufferSize = 0) {
+        this->port = port;
+        this->buffer = buffer;
+        this->bufferSize = bufferSize;
+        head = tail = 0;
+    }
+
+    void setFormat(SinkFormat format) {
+        this->format = format;
+        head = tail = 0;
+    }
+    SinkFormat getFormat() const { return format; }
+
+    // Queues (or writes) a whole record, or drops it if it doesn't fit
+    bool write(const uint8_t *data, uint16_t len) {
+        if (port != NULL && bufferSize == 0) {
+            port->write(data, len);
+        } else if (port != NULL) {
+            if (len > bufferSize - used()) {
+                dropped++;
+                return false;
+            }
+            for (uint16_t i = 0; i < len; i++) {
+                buffer[head++ & (bufferSize - 1)] = data[i];
+            }
+            pump();
+        }
+        records++;
+        bytes += len;
+        return true;
+    }
+
+    // Moves queued bytes to the port, as many as it takes without blocking
+    void pump() {
+        while (port != NULL && used() > 0) {
+            int room = port->availableForWrite();
+            if (room <= 0) {
+                break;
+            }
+            uint16_t start = tail & (bufferSize - 1);
+            uint16_t chunk = bufferSize - start; // contiguous part
+            if (chunk > used()) {
+                chunk = used();
+            }
+            if (chunk > room) {
+                chunk = room;
+            }
+            port->write(buffer + start, chunk);
+            tail += chunk;
+        }
+    }
+
+    uint16_t used() const { return (uint16_t)(head - tail); }
+    uint16_t getBufferSize() const { return bufferSize; }
+    uint32_t getRecords() const { return records; }
+    uint32_t getBytes() const { return bytes; }
+    uint32_t getDropped() const { return dropped; }
+    void resetCounters() { records = bytes = dropped = 0; }
+
+private:
+    Print *port = NULL;
+    uint8_t *buffer = NULL;
+    uint16_t bufferSize = 0;
+    uint16_t head = 0; // free-running, masked on access
+    uint16_t tail = 0;
+    SinkFormat format = SINK_FORMAT_OFF;
+
+    uint32_t records = 0;
+    uint32_t bytes = 0;
+    uint32_t dropped = 0;
+};
+
+// Fans every record out to the sinks that take its format
+class OutputSinks {
+public:
+    OutputSink &operator[](SinkId id) { return sinks[id]; }
+
+    bool wants(SinkFormat format) const {
+        for (const OutputSink &sink : sinks) {
+            if (sink.getFormat() == format) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void write(SinkFormat format, const uint8_t *data, uint16_t len) {
+        for (OutputSink &sink : sinks) {
+            if (sink.getFormat() == format) {
+                sink.write(data, len);
+            }
+        }
+    }
+
+    void pump() {
+        for (OutputSink &sink : sinks) {
+            sink.pump();
+        }
+    }
+
+    // Time spent formatting and fanning out one stream event
+    void noteEmitUs(uint32_t us) {
+        emitCount++;
+        emitTotalUs += us;
+        if (us > emitMaxUs) {
+            emitMaxUs = us;
+        }
+    }
+    uint32_t getEmitCount() const { return emitCount; }
+    uint32_t getEmitMeanUs() const { return emitCount ? (uint32_t)(emitTotalUs / emitCount) : 0; }
+    uint32_t getEmitMaxUs() const { return emitMaxUs; }
+    void resetCounters() {
+        for (OutputSink &sink : sinks) {
+            sink.resetCounters();
+        }
+        emitCount = 0;
+        emitTotalUs = 0;
+        emitMaxUs = 0;
+    }
+
+private:
+    OutputSink sinks[SINK_COUNT];
+    uint32_t emitCount = 0;
+    uint64_t emitTotalUs = 0;
+    uint32_t emitMaxUs = 0;
+};
+
+// printf-style line builder for the text format; output past the end is
+// cut off rather than overflowing, and a cut line still ends in "\r\n"
+class TextLine {
+public:
+    void printf(const char *fmt, ...) __attribute__((format(printf, 2, 3))) {
+        if (truncated) {
+            return;
+        }
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(buf + len, sizeof(buf) - len, fmt, args);
+        va_end(args);
+        if (n < 0) {
+            return;
+        }
+        if ((uint16_t)n < sizeof(buf) - len) {
+            len += n;
+            return;
+        }
+        // Too long: cut it short, but still end the line
+        truncated = true;
+        len = sizeof(buf) - 3;
+        memcpy(buf + len, "\r\n", 3);
+        len += 2;
+    }
+    void print(const char *text) { printf("%s", text); }
+
+    const uint8_t *data() const { return (const uint8_t *)buf; }
+    uint16_t length() const { return len; }
+
+private:
+    char buf[SINK_TEXT_LINE_MAX];
+    uint16_t len = 0;
+    bool truncated = false;
+};
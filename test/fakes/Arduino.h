@@ -0,0 +1,55 @@
+#pragma once
+
+// Just enough of an Arduino core to build the hardware-independent parts of
+// src/ on the host (the native env). It stands in for Teensyduino, whose
+// branch of platform.h needs nothing but a few registers from here.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEENSYDUINO 159
+#define F_CPU_ACTUAL 600000000
+#define CORE_NUM_DIGITAL 40
+
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define LOW 0
+#define HIGH 1
+
+// The clock only moves when a test moves it
+inline uint32_t fakeMicros = 0;
+static inline uint32_t micros() { return fakeMicros; }
+static inline uint32_t millis() { return fakeMicros / 1000; }
+static inline void delay(uint32_t) {}
+static inline void delayMicroseconds(uint32_t) {}
+static inline void pinMode(uint8_t, uint8_t) {}
+static inline void digitalWrite(uint8_t, uint8_t) {}
+static inline int digitalRead(uint8_t) { return HIGH; }
+
+class HardwareSerial {
+public:
+    void begin(uint32_t) {}
+};
+inline HardwareSerial Serial1;
+
+// Registers platform.h touches
+inline volatile uint32_t ARM_DWT_CYCCNT = 0;
+inline volatile uint32_t LPI2C1_SSR = 0;
+#define LPI2C_SSR_BBF ((uint32_t)(1 << 25))
+inline volatile uint32_t CCM_CCGR1, GPT1_CR, GPT1_PR, GPT1_SR, GPT1_IR, GPT1_OCR1;
+#define CCM_CCGR1_GPT1_BUS(n) ((uint32_t)(n) << 20)
+#define CCM_CCGR1_GPT1_SERIAL(n) ((uint32_t)(n) << 22)
+#define CCM_CCGR_ON 3
+#define GPT_IR_OF1IE 1
+#define GPT_SR_OF1 1
+#define GPT_CR_EN 1
+#define GPT_CR_CLKSRC(n) ((uint32_t)(n) << 6)
+#define IRQ_GPT1 100
+static inline void attachInterruptVector(int, void (*)()) {}
+#define NVIC_SET_PRIORITY(irq, prio) ((void)(irq))
+#define NVIC_ENABLE_IRQ(irq) ((void)(irq))
+#define NVIC_DISABLE_IRQ(irq) ((void)(irq))
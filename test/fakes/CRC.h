@@ -0,0 +1,16 @@
+#pragma once
+
+// robtillaart/CRC's calcCRC16 with its default parameters
+
+#include <stdint.h>
+
+static inline uint16_t calcCRC16(const uint8_t *array, uint16_t length) {
+    uint16_t crc = 0;
+    for (uint16_t i = 0; i < length; i++) {
+        crc ^= (uint16_t)array[i] << 8;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x8001 : crc << 1;
+        }
+    }
+    return crc;
+}
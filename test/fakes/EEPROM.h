@@ -0,0 +1,28 @@
+#pragma once
+
+// Teensy 4.x's emulated EEPROM as plain memory. A test can cut the power
+// after a number of byte writes; the writes after that are lost.
+
+#include <Arduino.h>
+
+class EEPROMClass {
+public:
+    static constexpr uint16_t SIZE = 1080;
+
+    EEPROMClass() { memset(data, 0xFF, sizeof(data)); }
+
+    uint8_t read(int addr) const { return data[addr]; }
+    void write(int addr, uint8_t value) {
+        if (writesLeft == 0) {
+            return;
+        }
+        if (writesLeft > 0) {
+            writesLeft--;
+        }
+        data[addr] = value;
+    }
+
+    uint8_t data[SIZE];
+    int32_t writesLeft = -1; // -1 = the power stays on
+};
+inline EEPROMClass EEPROM;
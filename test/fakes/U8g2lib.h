@@ -0,0 +1,164 @@
+#pragma once
+
+// A U8g2 full-buffer driver for a fake SSD1306: the frame buffer is laid
+// out like the controller's RAM (pages of 8 rows, one byte per column and
+// page) and the rotations map pixels the way U8g2's do. The controller
+// keeps what was sent to it and its display start line, so a test can look
+// at what the panel shows. Fonts are three bytes,
+// advance, height and ascent, and every glyph is a fixed pattern derived
+// from its character, so two ways of drawing the same text can be compared
+// bit for bit.
+
+#include <Arduino.h>
+
+typedef struct {
+    uint8_t quarterTurns;
+} u8g2_cb_t;
+inline const u8g2_cb_t u8g2_cb_r0 = {0};
+inline const u8g2_cb_t u8g2_cb_r1 = {1};
+inline const u8g2_cb_t u8g2_cb_r2 = {2};
+inline const u8g2_cb_t u8g2_cb_r3 = {3};
+#define U8G2_R0 (&u8g2_cb_r0)
+#define U8G2_R1 (&u8g2_cb_r1)
+#define U8G2_R2 (&u8g2_cb_r2)
+#define U8G2_R3 (&u8g2_cb_r3)
+#define U8X8_PIN_NONE 255
+
+inline const uint8_t u8g2_font_5x8_tf[] = {5, 8, 6};
+inline const uint8_t u8g2_font_6x10_tf[] = {6, 10, 8};
+inline const uint8_t u8g2_font_profont22_tr[] = {12, 15, 15};
+
+// The controller side
+typedef struct {
+    uint8_t ram[128 * 8];
+    uint8_t startLine;
+    uint32_t bytesSent;
+} u8x8_t;
+
+static inline uint8_t u8x8_cad_StartTransfer(u8x8_t *) { return 1; }
+static inline uint8_t u8x8_cad_SendCmd(u8x8_t *u8x8, uint8_t cmd) {
+    // Set Display Start Line is the only command the tests need
+    if ((cmd & 0xC0) == 0x40) {
+        u8x8->startLine = cmd & 0x3F;
+    }
+    u8x8->bytesSent++;
+    return 1;
+}
+static inline uint8_t u8x8_cad_EndTransfer(u8x8_t *) { return 1; }
+
+class U8G2 {
+public:
+    static constexpr uint8_t WIDTH = 128;
+
+    explicit U8G2(uint8_t pageCount) : pages(pageCount) {}
+
+    void setI2CAddress(uint8_t) {}
+    bool begin() { return true; }
+    u8x8_t *getU8x8() { return &u8x8; }
+
+    void setDisplayRotation(const u8g2_cb_t *cb) { quarterTurns = cb->quarterTurns; }
+    uint16_t getDisplayWidth() const { return quarterTurns & 1 ? pages * 8 : WIDTH; }
+    uint16_t getDisplayHeight() const { return quarterTurns & 1 ? WIDTH : pages * 8; }
+
+    uint8_t *getBufferPtr() { return buf; }
+    uint8_t getBufferTileWidth() const { return WIDTH / 8; }
+    uint8_t getBufferTileHeight() const { return pages; }
+    void clearBuffer() { memset(buf, 0, sizeof(buf)); }
+    void sendBuffer() { updateDisplayArea(0, 0, getBufferTileWidth(), pages); }
+    void updateDisplayArea(uint8_t tx, uint8_t ty, uint8_t tw, uint8_t th) {
+        for (uint8_t page = ty; page < ty + th; page++) {
+            memcpy(u8x8.ram + page * WIDTH + tx * 8, buf + page * WIDTH + tx * 8, tw * 8);
+            u8x8.bytesSent += tw * 8;
+        }
+    }
+
+    // Whether the pixel in `row` of the panel is lit: the start line is the
+    // RAM row shown at the top, and the rows wrap around
+    bool isLit(uint8_t x, uint8_t row) const {
+        uint8_t ramRow = (row + u8x8.startLine) % (pages * 8);
+        return (u8x8.ram[(ramRow / 8) * WIDTH + x] >> (ramRow % 8)) & 1;
+    }
+
+    void setFont(const uint8_t *f) { font = f; }
+    void setFontPosTop() { fontPosTop = true; }
+    void setFontPosBaseline() { fontPosTop = false; }
+    int8_t getMaxCharHeight() const { return font[1]; }
+    void setDrawColor(uint8_t color) { drawColor = color; }
+
+    int16_t getStrWidth(const char *text) const {
+        size_t n = strlen(text);
+        return n ? n * font[0] - 1 : 0;
+    }
+
+    uint16_t drawStr(int16_t x, int16_t y, const char *text) {
+        drawStrCalls++;
+        int16_t top = fontPosTop ? y : y - font[2] + 1;
+        for (; *text; text++, x += font[0]) {
+            uint8_t c = *text;
+            for (int16_t dx = 0; dx < font[0] - 1; dx++) {
+                for (int16_t dy = 0; dy < font[1]; dy++) {
+                    if (c != ' ' && (c * 7 + dx * 3 + dy * 5) % 3) {
+                        setPixel(x + dx, top + dy);
+                    }
+                }
+            }
+        }
+        return 0;
+    }
+
+    void drawBox(int16_t x, int16_t y, int16_t w, int16_t h) {
+        for (int16_t i = 0; i < w; i++) {
+            for (int16_t j = 0; j < h; j++) {
+                setPixel(x + i, y + j);
+            }
+        }
+    }
+
+    // How often text went through the font, for telling drawing paths apart
+    uint32_t drawStrCalls = 0;
+
+protected:
+    uint8_t buf[WIDTH * 8] = {};
+    const uint8_t pages;
+    u8x8_t u8x8 = {};
+
+private:
+    const uint8_t *font = u8g2_font_6x10_tf;
+    bool fontPosTop = false;
+    uint8_t drawColor = 1;
+    uint8_t quarterTurns = 0;
+
+    void setPixel(int16_t x, int16_t y) {
+        int16_t rows = pages * 8;
+        int16_t px, py;
+        switch (quarterTurns) {
+            case 1:  px = WIDTH - 1 - y; py = x; break;
+            case 2:  px = WIDTH - 1 - x; py = rows - 1 - y; break;
+            case 3:  px = y; py = rows - 1 - x; break;
+            default: px = x; py = y; break;
+        }
+        if (px < 0 || px >= WIDTH || py < 0 || py >= rows) {
+            return;
+        }
+        uint8_t bit = 1 << (py % 8);
+        if (drawColor) {
+            buf[(py / 8) * WIDTH + px] |= bit;
+        } else {
+            buf[(py / 8) * WIDTH + px] &= ~bit;
+        }
+    }
+};
+
+class U8G2_SSD1306_128X32_UNIVISION_F_2ND_HW_I2C : public U8G2 {
+public:
+    explicit U8G2_SSD1306_128X32_UNIVISION_F_2ND_HW_I2C(const u8g2_cb_t *rotation, uint8_t = U8X8_PIN_NONE) : U8G2(4) {
+        setDisplayRotation(rotation);
+    }
+};
+
+class U8G2_SSD1306_128X64_NONAME_F_2ND_HW_I2C : public U8G2 {
+public:
+    explicit U8G2_SSD1306_128X64_NONAME_F_2ND_HW_I2C(const u8g2_cb_t *rotation, uint8_t = U8X8_PIN_NONE) : U8G2(8) {
+        setDisplayRotation(rotation);
+    }
+};
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <Arduino.h>
+
+class TwoWire {
+public:
+    void begin() {}
+};
+inline TwoWire Wire1;
@@ -0,0 +1,164 @@
+#include <unity.h>
+#include "buswatch.h"
+
+// The watchdog only restarts the Wire slave for a held bus. A gap in the
+// traffic is reported once it ends, if it ended inside the boot, and the
+// end of a boot is no gap at all.
+
+static const uint16_t IDLE_MS = 1000;
+
+// The bus as the watchdog sees it, polled every millisecond like loop1()
+struct FakeBus {
+    BusWatchdog watchdog;
+    uint32_t receives = 0;
+    uint32_t codes = 0;
+    uint32_t restarts = 0;
+
+    // `ms` milliseconds of a code every `codeEveryMs` (0 = silence)
+    void run(uint32_t ms, uint32_t codeEveryMs, bool held = false) {
+        for (uint32_t i = 0; i < ms; i++) {
+            fakeMicros += 1000;
+            if (codeEveryMs && i % codeEveryMs == 0) {
+                receives++;
+                codes++;
+            }
+            BusStallCause stall = watchdog.poll(held, receives, codes);
+            if (stall) {
+                restarts++;
+                watchdog.recovered(stall, 400);
+            }
+        }
+    }
+};
+
+void setUp(void) {
+    fakeMicros = 1000000;
+}
+void tearDown(void) {}
+
+static void test_boot_end_is_no_silence(void) {
+    FakeBus bus;
+    bus.watchdog.setSilenceWindow(IDLE_MS / 2, IDLE_MS);
+    bus.run(3000, 10);
+    // The boot is over; core0 closes the session after the idle gap
+    bus.run(IDLE_MS, 0);
+    bus.watchdog.setSilenceWindow(0, 0);
+    bus.run(5000, 0);
+    bus.run(100, 10);
+
+    BusRecovery record;
+    TEST_ASSERT_FALSE(bus.watchdog.popRecovery(record));
+    TEST_ASSERT_EQUAL_UINT32(0, bus.restarts);
+    TEST_ASSERT_EQUAL_UINT32(0, bus.watchdog.getSilences());
+}
+
+// Core0 may not have closed the session yet when the next boot starts
+static void test_gap_past_idle_is_no_silence(void) {
+    FakeBus bus;
+    bus.watchdog.setSilenceWindow(IDLE_MS / 2, IDLE_MS);
+    bus.run(1000, 10);
+    bus.run(IDLE_MS + 50, 0);
+    bus.run(100, 10);
+
+    BusRecovery record;
+    TEST_ASSERT_FALSE(bus.watchdog.popRecovery(record));
+    TEST_ASSERT_EQUAL_UINT32(0, bus.restarts);
+}
+
+static void test_silence_mid_boot_is_reported(void) {
+    FakeBus bus;
+    bus.watchdog.setSilenceWindow(IDLE_MS / 2, IDLE_MS);
+    bus.run(2000, 10);
+    bus.run(700, 0);
+    TEST_ASSERT_EQUAL_UINT32(0, bus.watchdog.getSilences());
+    bus.run(100, 10);
+
+    BusRecovery record;
+    TEST_ASSERT_TRUE(bus.watchdog.popRecovery(record));
+    TEST_ASSERT_EQUAL_UINT8(BUS_STALL_SILENT, record.cause);
+    TEST_ASSERT_EQUAL_UINT32(710000, record.stalledUs);
+    TEST_ASSERT_EQUAL_UINT32(0, record.recoveryUs);
+    TEST_ASSERT_EQUAL_UINT32(0, record.codesLost);
+    TEST_ASSERT_FALSE(bus.watchdog.popRecovery(record));
+    TEST_ASSERT_EQUAL_UINT32(0, bus.restarts);
+    TEST_ASSERT_EQUAL_UINT32(1, bus.watchdog.getSilences());
+    TEST_ASSERT_EQUAL_UINT32(0, bus.watchdog.getCodesLost());
+}
+
+// Lost codes are estimated at the pace the bus had right before the stall
+static void test_held_stall_counts_lost_codes(void) {
+    FakeBus bus;
+    bus.run(3000, 10); // 100 codes/s
+    bus.run(BUS_HELD_MS, 0, true);
+
+    BusRecovery record;
+    TEST_ASSERT_EQUAL_UINT32(1, bus.restarts);
+    TEST_ASSERT_TRUE(bus.watchdog.popRecovery(record));
+    TEST_ASSERT_EQUAL_UINT8(BUS_STALL_HELD, record.cause);
+    TEST_ASSERT_EQUAL_UINT32(400, record.recoveryUs);
+    TEST_ASSERT_EQUAL_UINT32(BUS_HELD_MS * 1000 + 400, record.stalledUs);
+    TEST_ASSERT_UINT32_WITHIN(1, 5, record.codesLost);
+}
+
+// A bus that went quiet before it got stuck wasn't losing any codes
+static void test_quiet_windows_reset_the_pace(void) {
+    FakeBus bus;
+    bus.run(3000, 10);
+    bus.run(2 * BUS_PACE_WINDOW_MS, 0);
+    bus.run(BUS_HELD_MS, 0, true);
+
+    BusRecovery record;
+    TEST_ASSERT_TRUE(bus.watchdog.popRecovery(record));
+    TEST_ASSERT_EQUAL_UINT8(BUS_STALL_HELD, record.cause);
+    TEST_ASSERT_EQUAL_UINT32(0, record.codesLost);
+}
+
+// Retries on a bus that stays held keep the pace from before the stall
+static void test_retries_keep_the_pace(void) {
+    FakeBus bus;
+    bus.run(3000, 10);
+    bus.run(4000, 0, true);
+
+    TEST_ASSERT_TRUE(bus.restarts > 2);
+    uint32_t stalledMs = 0;
+    BusRecovery record;
+    while (bus.watchdog.popRecovery(record)) {
+        TEST_ASSERT_EQUAL_UINT8(BUS_STALL_HELD, record.cause);
+        stalledMs += record.stalledUs / 1000;
+    }
+    // Every held millisecond booked once, at 100 codes/s
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(4000, stalledMs);
+    TEST_ASSERT_UINT32_WITHIN(stalledMs / 50 + bus.restarts, stalledMs / 10, bus.watchdog.getCodesLost());
+}
+
+// While this reader drives the bus itself (replay, savetest send) nothing
+// polls the watchdog. Back in slave mode, the time away is neither a hold
+// nor a silence, and no codes were lost to it.
+static void test_resume_after_master_mode(void) {
+    FakeBus bus;
+    bus.watchdog.setSilenceWindow(IDLE_MS / 2, IDLE_MS);
+    bus.run(3000, 10);
+    fakeMicros += 5000 * 1000;
+    bus.watchdog.resume(bus.receives, bus.codes);
+    // The bus still looks busy for a moment after the master lets go
+    bus.run(BUS_HELD_MS / 2, 0, true);
+    bus.run(100, 10);
+
+    BusRecovery record;
+    TEST_ASSERT_FALSE(bus.watchdog.popRecovery(record));
+    TEST_ASSERT_EQUAL_UINT32(0, bus.restarts);
+    TEST_ASSERT_EQUAL_UINT32(0, bus.watchdog.getSilences());
+    TEST_ASSERT_EQUAL_UINT32(0, bus.watchdog.getCodesLost());
+}
+
+int main(int, char **) {
+    UNITY_BEGIN();
+    RUN_TEST(test_boot_end_is_no_silence);
+    RUN_TEST(test_gap_past_idle_is_no_silence);
+    RUN_TEST(test_silence_mid_boot_is_reported);
+    RUN_TEST(test_held_stall_counts_lost_codes);
+    RUN_TEST(test_quiet_windows_reset_the_pace);
+    RUN_TEST(test_retries_keep_the_pace);
+    RUN_TEST(test_resume_after_master_mode);
+    return UNITY_END();
+}
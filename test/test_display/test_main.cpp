@@ -0,0 +1,82 @@
+#include <unity.h>
+#include "display.h"
+
+// The landscape code view drawn from the glyph cache has to match what
+// U8g2's text rendering draws for the same code, bit for bit
+
+static const uint32_t CODES_PER_LENGTH = 64;
+
+// What Display::drawCodeText() draws: the code centered in the large font,
+// its flavor in the top-left corner
+static void drawReference(U8G2 &u8g2, uint64_t code, CodeFlavor flavor) {
+    char text[CODEBUF_SZ];
+    snprintf(text, sizeof(text), "%04llX", (unsigned long long)code);
+    u8g2.clearBuffer();
+    u8g2.setFont(u8g2_font_profont22_tr);
+    u8g2.drawStr((u8g2.getDisplayWidth() - u8g2.getStrWidth(text)) / 2, u8g2.getDisplayHeight() - 4, text);
+    u8g2.setFont(u8g2_font_6x10_tf);
+    u8g2.drawStr(0, 8, getStringForCodeFlavor(flavor));
+}
+
+static void checkCodes(bool mirrored) {
+    U8G2_SSD1306_128X32_UNIVISION_F_2ND_HW_I2C u8g2(U8G2_R0);
+    Display display(0x3C, 17, 16, u8g2);
+    TEST_ASSERT_TRUE(display.begin());
+    display.setMirroring(mirrored);
+
+    size_t size = u8g2.getBufferTileWidth() * 8 * u8g2.getBufferTileHeight();
+    static uint8_t drawn[U8G2::WIDTH * 8];
+    uint64_t seed = 0x9E3779B97F4A7C15ull;
+    for (uint8_t digits = 1; digits <= 16; digits++) {
+        for (uint32_t i = 0; i < CODES_PER_LENGTH; i++) {
+            seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+            uint64_t code = digits == 16 ? seed : seed & ((1ull << (4 * digits)) - 1);
+            CodeFlavor flavor = CODE_FLAVOR_FOR_INDEX[i % CODE_IDX_MAX];
+
+            uint32_t calls = u8g2.drawStrCalls;
+            display.printCode(code, flavor);
+            // Only the (empty) status goes through U8g2, the code doesn't
+            TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, u8g2.drawStrCalls - calls, "glyph cache not used");
+            memcpy(drawn, u8g2.getBufferPtr(), size);
+
+            drawReference(u8g2, code, flavor);
+            TEST_ASSERT_EQUAL_MEMORY(u8g2.getBufferPtr(), drawn, size);
+        }
+    }
+}
+
+static void test_cached_codes_match_text(void) {
+    checkCodes(false);
+}
+
+static void test_cached_codes_match_text_mirrored(void) {
+    checkCodes(true);
+}
+
+// The cache is rebuilt for the new direction when mirroring is toggled
+// back and forth, not kept from the first build
+static void test_mirroring_twice(void) {
+    U8G2_SSD1306_128X32_UNIVISION_F_2ND_HW_I2C u8g2(U8G2_R0);
+    Display display(0x3C, 17, 16, u8g2);
+    TEST_ASSERT_TRUE(display.begin());
+    display.toggleMirroring();
+    display.toggleMirroring();
+
+    size_t size = u8g2.getBufferTileWidth() * 8 * u8g2.getBufferTileHeight();
+    static uint8_t drawn[U8G2::WIDTH * 8];
+    display.printCode(0xDEADBEEF, CODE_FLAVOR_SMC);
+    memcpy(drawn, u8g2.getBufferPtr(), size);
+    drawReference(u8g2, 0xDEADBEEF, CODE_FLAVOR_SMC);
+    TEST_ASSERT_EQUAL_MEMORY(u8g2.getBufferPtr(), drawn, size);
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+int main(int, char **) {
+    UNITY_BEGIN();
+    RUN_TEST(test_cached_codes_match_text);
+    RUN_TEST(test_cached_codes_match_text_mirrored);
+    RUN_TEST(test_mirroring_twice);
+    return UNITY_END();
+}
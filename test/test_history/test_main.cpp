@@ -0,0 +1,90 @@
+#include <unity.h>
+#include "display.h"
+
+// On a 128x64 panel the landscape view scrolls a history of codes with the
+// controller's display start line. After every code the panel has to show
+// the same picture a full redraw would, while sending only the new row.
+
+static const uint8_t CODES = 50;
+static const uint8_t MESSAGE_AT = 20;
+static const uint32_t ROW_BYTES = 128;
+
+// The last HISTORY_ROWS codes as text, oldest first, drawn from scratch
+static void drawReference(U8G2 &u8g2, char rows[][HISTORY_TEXT_SZ], uint8_t count) {
+    u8g2.clearBuffer();
+    u8g2.setFont(u8g2_font_5x8_tf);
+    u8g2.setFontPosTop();
+    for (uint8_t i = 0; i < count; i++) {
+        u8g2.drawStr(0, (HISTORY_ROWS - count + i) * 8, rows[i]);
+    }
+    u8g2.setFontPosBaseline();
+    u8g2.sendBuffer();
+}
+
+static void checkHistory(bool mirrored) {
+    U8G2_SSD1306_128X64_NONAME_F_2ND_HW_I2C u8g2(U8G2_R0);
+    U8G2_SSD1306_128X64_NONAME_F_2ND_HW_I2C reference(mirrored ? U8G2_R2 : U8G2_R0);
+    Display display(0x3C, 17, 16, u8g2);
+    TEST_ASSERT_TRUE(display.begin());
+    display.setMirroring(mirrored);
+
+    char rows[HISTORY_ROWS][HISTORY_TEXT_SZ];
+    uint8_t count = 0;
+    bool redrawn = true;
+    uint64_t seed = 99;
+    for (uint8_t i = 0; i < CODES; i++) {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        uint64_t code = seed >> (4 * (i & 0xF));
+        CodeFlavor flavor = CODE_FLAVOR_FOR_INDEX[i % CODE_IDX_MAX];
+
+        if (count == HISTORY_ROWS) {
+            memmove(rows[0], rows[1], sizeof(rows[0]) * (HISTORY_ROWS - 1));
+            count--;
+        }
+        snprintf(rows[count++], HISTORY_TEXT_SZ, "%s %04llX", getStringForCodeFlavor(flavor), (unsigned long long)code);
+
+        uint32_t sent = u8g2.getU8x8()->bytesSent;
+        display.printCode(code, flavor);
+        if (!redrawn) {
+            // One row of pixels, plus the start line command
+            TEST_ASSERT_LESS_OR_EQUAL_UINT32(ROW_BYTES + 1, u8g2.getU8x8()->bytesSent - sent);
+        }
+        redrawn = false;
+
+        drawReference(reference, rows, count);
+        for (uint8_t row = 0; row < HISTORY_ROWS * 8; row++) {
+            for (uint8_t x = 0; x < U8G2::WIDTH; x++) {
+                if (u8g2.isLit(x, row) != reference.isLit(x, row)) {
+                    char msg[64];
+                    snprintf(msg, sizeof(msg), "code %u: pixel %u,%u differs", i, x, row);
+                    TEST_FAIL_MESSAGE(msg);
+                }
+            }
+        }
+
+        if (i == MESSAGE_AT) {
+            // Leaves the start line at 0 and the next code redraws it all
+            display.printMessage("Message", "text", 0);
+            TEST_ASSERT_EQUAL_UINT8(0, u8g2.getU8x8()->startLine);
+            redrawn = true;
+        }
+    }
+}
+
+static void test_history_scrolls(void) {
+    checkHistory(false);
+}
+
+static void test_history_scrolls_mirrored(void) {
+    checkHistory(true);
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+int main(int, char **) {
+    UNITY_BEGIN();
+    RUN_TEST(test_history_scrolls);
+    RUN_TEST(test_history_scrolls_mirrored);
+    return UNITY_END();
+}
@@ -0,0 +1,141 @@
+#include <unity.h>
+#include "journal.h"
+
+// Compaction moves the newest records into the other bank before erasing
+// the old one. Wherever the power goes out, the journal has to come back
+// with the newest record of every type, and keep working from there.
+
+static const uint8_t CONFIG_V = 3;
+static const uint8_t MODEL_V = 1;
+static const uint8_t CONFIG_LEN = 100;
+static const uint8_t MODEL_LEN = 150;
+
+static void fill(uint8_t *payload, uint8_t length, uint8_t seed) {
+    for (uint8_t i = 0; i < length; i++) {
+        payload[i] = seed + i * 7;
+    }
+}
+
+// The seed of the newest record of `type`, 0 if it's missing or corrupt
+static uint8_t newestSeed(ConfigJournal &journal, JournalRecordType type, uint8_t expectLength) {
+    uint8_t payload[JOURNAL_MAX_PAYLOAD];
+    uint8_t expected[JOURNAL_MAX_PAYLOAD];
+    uint8_t length = 0, version = 0;
+    if (!journal.readNewest(type, payload, &length, &version) || length != expectLength ||
+        version != (type == JOURNAL_RECORD_CONFIG ? CONFIG_V : MODEL_V)) {
+        return 0;
+    }
+    fill(expected, length, payload[0]);
+    return memcmp(expected, payload, length) == 0 ? payload[0] : 0;
+}
+
+static bool appendRecord(ConfigJournal &journal, JournalRecordType type, uint8_t seed, bool compacting = false) {
+    uint8_t payload[JOURNAL_MAX_PAYLOAD];
+    uint8_t length = type == JOURNAL_RECORD_CONFIG ? CONFIG_LEN : MODEL_LEN;
+    uint8_t version = type == JOURNAL_RECORD_CONFIG ? CONFIG_V : MODEL_V;
+    fill(payload, length, seed);
+    return compacting ? journal.compactAndAppend(type, version, payload, length)
+                      : journal.append(type, version, payload, length);
+}
+
+// A boot model, then configs up to a full live bank; returns the last seed
+static uint8_t fillJournal(ConfigJournal &journal) {
+    TEST_ASSERT_TRUE(journal.begin());
+    TEST_ASSERT_TRUE(appendRecord(journal, JOURNAL_RECORD_BOOT_MODEL, 1));
+    uint8_t seed = 1;
+    while (!journal.isFull()) {
+        TEST_ASSERT_TRUE(appendRecord(journal, JOURNAL_RECORD_CONFIG, ++seed));
+    }
+    return seed;
+}
+
+void setUp(void) {
+    EEPROM = EEPROMClass();
+}
+void tearDown(void) {}
+
+// Saved the way Config does it, through many bank switches
+static void test_records_survive_compactions(void) {
+    ConfigJournal journal;
+    TEST_ASSERT_TRUE(journal.begin());
+    TEST_ASSERT_EQUAL_UINT32(JOURNAL_BANK_PAGES, journal.freePages());
+    TEST_ASSERT_TRUE(appendRecord(journal, JOURNAL_RECORD_BOOT_MODEL, 1));
+
+    for (uint8_t seed = 10; seed < 30; seed++) {
+        TEST_ASSERT_TRUE(appendRecord(journal, JOURNAL_RECORD_CONFIG, seed, journal.isFull()));
+
+        ConfigJournal reloaded;
+        TEST_ASSERT_TRUE(reloaded.begin());
+        TEST_ASSERT_EQUAL_UINT8(seed, newestSeed(reloaded, JOURNAL_RECORD_CONFIG, CONFIG_LEN));
+        TEST_ASSERT_EQUAL_UINT8(1, newestSeed(reloaded, JOURNAL_RECORD_BOOT_MODEL, MODEL_LEN));
+        TEST_ASSERT_EQUAL_UINT32(journal.freePages(), reloaded.freePages());
+    }
+
+    TEST_ASSERT_TRUE(journal.compact());
+    TEST_ASSERT_EQUAL_UINT32(JOURNAL_BANK_PAGES - JOURNAL_RECORD_TYPES, journal.freePages());
+}
+
+// The power goes out after every possible number of byte writes into a
+// compaction, then the reader boots again and saves some more
+static void checkPowerLoss(bool withNewConfig) {
+    const uint8_t NEW_SEED = 200;
+    uint32_t cut = 0;
+    bool finished = false;
+    while (!finished) {
+        EEPROM = EEPROMClass();
+        uint8_t lastSeed;
+        {
+            ConfigJournal journal;
+            lastSeed = fillJournal(journal);
+            EEPROM.writesLeft = cut;
+            if (withNewConfig) {
+                appendRecord(journal, JOURNAL_RECORD_CONFIG, NEW_SEED, true);
+            } else {
+                journal.compact();
+            }
+            finished = EEPROM.writesLeft > 0;
+            EEPROM.writesLeft = -1;
+        }
+
+        ConfigJournal journal;
+        TEST_ASSERT_TRUE(journal.begin());
+        TEST_ASSERT_EQUAL_UINT8(1, newestSeed(journal, JOURNAL_RECORD_BOOT_MODEL, MODEL_LEN));
+        uint8_t config = newestSeed(journal, JOURNAL_RECORD_CONFIG, CONFIG_LEN);
+        if (config != lastSeed && !(withNewConfig && config == NEW_SEED)) {
+            char msg[64];
+            snprintf(msg, sizeof(msg), "cut after %u writes: config %u", (unsigned)cut, config);
+            TEST_FAIL_MESSAGE(msg);
+        }
+        if (finished) {
+            TEST_ASSERT_EQUAL_UINT8(withNewConfig ? NEW_SEED : lastSeed, config);
+        }
+
+        // And it carries on
+        for (uint8_t seed = 100; seed < 100 + 2 * JOURNAL_BANK_PAGES; seed++) {
+            TEST_ASSERT_TRUE(appendRecord(journal, JOURNAL_RECORD_CONFIG, seed, journal.isFull()));
+        }
+        ConfigJournal reloaded;
+        TEST_ASSERT_TRUE(reloaded.begin());
+        TEST_ASSERT_EQUAL_UINT8(1, newestSeed(reloaded, JOURNAL_RECORD_BOOT_MODEL, MODEL_LEN));
+        TEST_ASSERT_EQUAL_UINT8(100 + 2 * JOURNAL_BANK_PAGES - 1, newestSeed(reloaded, JOURNAL_RECORD_CONFIG, CONFIG_LEN));
+        cut++;
+    }
+    // Pages programmed and a whole bank erased
+    TEST_ASSERT_TRUE(cut > (JOURNAL_RECORD_TYPES + JOURNAL_BANK_PAGES) * JOURNAL_PAGE_SIZE);
+}
+
+static void test_power_loss_during_compact(void) {
+    checkPowerLoss(false);
+}
+
+static void test_power_loss_during_compacting_save(void) {
+    checkPowerLoss(true);
+}
+
+int main(int, char **) {
+    UNITY_BEGIN();
+    RUN_TEST(test_records_survive_compactions);
+    RUN_TEST(test_power_loss_during_compact);
+    RUN_TEST(test_power_loss_during_compacting_save);
+    return UNITY_END();
+}
@@ -0,0 +1,177 @@
+#include <unity.h>
+#include <atomic>
+#include <thread>
+#include "monoclock.h"
+
+// WrapExtender is read from loop() and from interrupts alike, so a reader
+// can hold a `seen` that another reader has already moved past, wrap
+// included. Whatever the interleaving, every read has to come out as the
+// counter's true 64-bit time, and the shared state must never go back.
+
+static const uint64_t HALF_WRAP = 1ull << 31;
+
+// A 32-bit counter and the 64-bit time it stands for
+struct FakeCounter {
+    uint64_t now = 0;
+    uint32_t read() const { return (uint32_t)now; }
+};
+
+static uint64_t seed = 1;
+static uint32_t nextRandom() {
+    seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+    return seed >> 32;
+}
+
+// A read in progress: load() done, then the counter read, then extend()
+struct PendingRead {
+    uint32_t seen;
+    uint64_t lastReadAt; // the newest counter read `seen` can reflect
+    bool hasLow;
+    uint32_t low;
+    uint64_t lowAt;
+};
+
+// The basic case spelled out: a reader is interrupted between load() and
+// reading the counter by one that sees the wrap first and publishes it
+static void test_stale_seen_across_a_wrap(void) {
+    WrapExtender extender;
+    FakeCounter counter;
+    counter.now = 0xFFFFFFF0ull;
+    TEST_ASSERT_EQUAL_UINT64(counter.now, extender.extend(extender.load(), counter.read()));
+
+    uint32_t staleSeen = extender.load();
+    counter.now = 0x100000010ull;
+    // The interrupt
+    TEST_ASSERT_EQUAL_UINT64(counter.now, extender.extend(extender.load(), counter.read()));
+    uint32_t published = extender.load();
+    TEST_ASSERT_TRUE(published != staleSeen);
+
+    // The interrupted reader's CAS fails, its time is still right
+    counter.now = 0x100000020ull;
+    TEST_ASSERT_EQUAL_UINT64(counter.now, extender.extend(staleSeen, counter.read()));
+    TEST_ASSERT_EQUAL_UINT32(published, extender.load());
+}
+
+// Readers interrupt each other up to three deep, each running to completion
+// before the one it interrupted goes on (a nested interrupt), while the
+// counter runs through many wraps. An interrupt can land between any two
+// steps of a read: after load(), and after the counter read, before the
+// CAS. The counter never gets half a wrap ahead of the last read, nor of
+// the state a pending reader loaded, as the extender requires.
+static void test_nested_readers(void) {
+    const uint8_t DEPTH = 3;
+    const uint32_t STEPS = 3000000;
+
+    WrapExtender extender;
+    FakeCounter counter;
+    PendingRead pending[DEPTH];
+    uint8_t depth = 0;
+    uint32_t reads = 0, stale = 0;
+    uint64_t lastReadAt = 0;
+    uint32_t lastState = 0;
+
+    seed = 1;
+    for (uint32_t step = 0; step < STEPS; step++) {
+        uint32_t pick = nextRandom() % 8;
+        if (pick < 3 && depth < DEPTH) {
+            // A new reader interrupts the innermost one
+            PendingRead &read = pending[depth++];
+            read.seen = extender.load();
+            read.lastReadAt = lastReadAt;
+            read.hasLow = false;
+        } else if (pick < 6 && depth > 0) {
+            // The innermost reader takes its next step
+            PendingRead &read = pending[depth - 1];
+            if (!read.hasLow) {
+                read.low = counter.read();
+                read.lowAt = counter.now;
+                read.hasLow = true;
+                lastReadAt = counter.now;
+            } else {
+                if (read.seen != extender.load()) {
+                    stale++;
+                }
+                TEST_ASSERT_EQUAL_UINT64(read.lowAt, extender.extend(read.seen, read.low));
+                depth--;
+                reads++;
+            }
+        } else {
+            uint64_t advance = nextRandom() % (1u << 30);
+            uint64_t oldest = depth > 0 ? pending[0].lastReadAt : lastReadAt;
+            if (counter.now + advance - oldest < HALF_WRAP) {
+                counter.now += advance;
+            }
+        }
+
+        // Every CAS moves the state forward
+        uint32_t state = extender.load();
+        TEST_ASSERT_TRUE(state >= lastState);
+        lastState = state;
+    }
+
+    // The run has to have covered what it is meant to
+    TEST_ASSERT_TRUE(counter.now >> 32 >= 16);
+    TEST_ASSERT_TRUE(reads > STEPS / 8);
+    TEST_ASSERT_TRUE(stale > reads / 10);
+}
+
+// The same on real threads, for the CAS itself. The counter moves with
+// every read, so wraps come quickly. A thread held off for half a wrap
+// between load() and its read breaks the extender's precondition, which an
+// interrupt can't; those reads aren't checked.
+static void test_concurrent_readers(void) {
+    const uint8_t THREADS = 4;
+    const uint32_t READS = 500000;
+    const uint64_t STEP = 1ull << 16;
+
+    WrapExtender extender;
+    std::atomic<uint64_t> counter{0};
+    std::atomic<uint32_t> wrong{0}, backwards{0}, checked{0};
+
+    std::thread threads[THREADS];
+    for (std::thread &thread : threads) {
+        thread = std::thread([&]() {
+            uint64_t last = 0;
+            uint32_t lastSeen = 0;
+            for (uint32_t i = 0; i < READS; i++) {
+                uint64_t before = counter.load();
+                uint32_t seen = extender.load();
+                // A CAS only ever moves the state forward, a store from a
+                // reader that was overtaken would move it back
+                if (seen < lastSeen) {
+                    backwards++;
+                }
+                lastSeen = seen;
+                uint64_t now = counter.fetch_add(STEP) + STEP;
+                uint64_t time = extender.extend(seen, (uint32_t)now);
+                if (now - before >= HALF_WRAP) {
+                    continue;
+                }
+                if (time != now || time < last) {
+                    wrong++;
+                }
+                last = time;
+                checked++;
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(0, wrong.load());
+    TEST_ASSERT_EQUAL_UINT32(0, backwards.load());
+    TEST_ASSERT_TRUE(checked.load() > THREADS * READS / 2);
+    TEST_ASSERT_TRUE(counter.load() >> 32 >= 16);
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+int main(int, char **) {
+    UNITY_BEGIN();
+    RUN_TEST(test_stale_seen_across_a_wrap);
+    RUN_TEST(test_nested_readers);
+    RUN_TEST(test_concurrent_readers);
+    return UNITY_END();
+}
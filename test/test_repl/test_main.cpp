@@ -0,0 +1,58 @@
+#include <unity.h>
+#include "repl.h"
+
+// POST codes are up to 64 bits wide, so a hex argument has to take all of
+// them, and reject anything wider instead of wrapping it.
+
+enum TestState: uint8_t { STATE_INCLUDE, STATE_COUNT };
+
+static const ReplCommand<TestState> COMMANDS[] = {
+    REPL_CMD_ARGS("include", STATE_INCLUDE, 1, 3, "include <first> [last] [cpu|sp|smc|os]", ARG_HEX, ARG_HEX, ARG_WORD),
+    REPL_CMD_ARGS("count", STATE_COUNT, 1, 1, "count <n>", ARG_U32),
+};
+static const ReplIndex<TestState, 2> commandIndex(COMMANDS);
+
+static ReplParseResult parse(const char *text, ReplArgs *args) {
+    char line[REPL_LINE_MAX + 1];
+    strncpy(line, text, sizeof(line));
+    const ReplCommand<TestState> *cmd;
+    return parseReplLine(commandIndex, line, &cmd, args);
+}
+
+static void test_hex_takes_64_bits(void) {
+    ReplArgs args;
+    TEST_ASSERT_EQUAL_UINT8(REPL_OK, parse("include 0x1 ffffffffffffffff smc", &args));
+    TEST_ASSERT_EQUAL_UINT8(3, args.count);
+    TEST_ASSERT_EQUAL_UINT64(1, args.value[0]);
+    TEST_ASSERT_EQUAL_UINT64(UINT64_MAX, args.value[1]);
+    TEST_ASSERT_EQUAL_UINT64(replHash("smc"), args.value[2]);
+
+    TEST_ASSERT_EQUAL_UINT8(REPL_OK, parse("include 0x123456789ABCDEF0", &args));
+    TEST_ASSERT_EQUAL_UINT64(0x123456789ABCDEF0ull, args.value[0]);
+}
+
+static void test_hex_rejects_wider_codes(void) {
+    ReplArgs args;
+    TEST_ASSERT_EQUAL_UINT8(REPL_BAD_ARGS, parse("include 10000000000000000", &args));
+    TEST_ASSERT_EQUAL_UINT8(REPL_BAD_ARGS, parse("include 0x", &args));
+    TEST_ASSERT_EQUAL_UINT8(REPL_BAD_ARGS, parse("include 12g", &args));
+}
+
+static void test_decimal_keeps_its_limit(void) {
+    ReplArgs args;
+    TEST_ASSERT_EQUAL_UINT8(REPL_OK, parse("count 4294967295", &args));
+    TEST_ASSERT_EQUAL_UINT64(0xFFFFFFFF, args.value[0]);
+    TEST_ASSERT_EQUAL_UINT8(REPL_BAD_ARGS, parse("count 4294967296", &args));
+    TEST_ASSERT_EQUAL_UINT8(REPL_BAD_ARGS, parse("count -1", &args));
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+int main(int, char **) {
+    UNITY_BEGIN();
+    RUN_TEST(test_hex_takes_64_bits);
+    RUN_TEST(test_hex_rejects_wider_codes);
+    RUN_TEST(test_decimal_keeps_its_limit);
+    return UNITY_END();
+}
@@ -0,0 +1,107 @@
+#include <unity.h>
+#include <vector>
+#include "replay.h"
+
+// A replay is only a load test if the reader decodes exactly the codes the
+// capture held. Codes of every length (one to four 16-bit digit groups, a
+// packet each) go out at every burst setting through Capture::receive(),
+// the path Wire's callback takes, and have to come back as they went in.
+
+static const uint64_t CODES[] = {
+    0x0, 0x1, 0xFFFF,                             // one group
+    0x10000, 0x1FFFF, 0xABCD1234,                 // two
+    0x100000000ull, 0xFFFF0000FFFFull,            // three
+    0x1000000000000ull, 0x123456789ABCDEF0ull,    // four
+    UINT64_MAX, 0xFFFF000000000000ull,
+};
+static const uint8_t CODE_COUNT = sizeof(CODES) / sizeof(CODES[0]);
+
+static Replayer replayer;
+static Capture capture;
+
+struct Received {
+    CodeFlavor flavor;
+    uint64_t code;
+};
+
+// Sends the whole capture once, decoding every packet as it goes out
+static std::vector<Received> replay(uint8_t burst) {
+    ReplaySettings settings = {};
+    settings.target = REPLAY_TARGET_LOOPBACK;
+    settings.passes = 1;
+    settings.burst = burst;
+    settings.speedup = 0;
+    TEST_ASSERT_TRUE(replayer.start(settings));
+    TEST_ASSERT_TRUE(replayer.poll(micros()));
+
+    std::vector<Received> received;
+    bool running = true;
+    while (running) {
+        running = replayer.service([](const uint8_t *data, size_t len) {
+            // Every packet its own write transaction, a little later than the last
+            fakeMicros += 100;
+            BufferSource src(data, len);
+            capture.receive(src);
+            return true;
+        });
+        SegmentData seg;
+        while (capture.popPostCode(&seg)) {
+            received.push_back({ seg.flavor, seg.code });
+        }
+    }
+    return received;
+}
+
+static void checkBurst(uint8_t burst) {
+    replayer.clear();
+    uint8_t packets = 0;
+    for (uint8_t i = 0; i < CODE_COUNT; i++) {
+        uint8_t encoded[POST_CODE_WORD_COUNT][MAX6958_CODE_PACKET_SIZE];
+        packets += encodeCodePackets(encoded, CODE_FLAVOR_FOR_INDEX[i % CODE_IDX_MAX], CODES[i]);
+        TEST_ASSERT_TRUE(replayer.add(CODE_FLAVOR_FOR_INDEX[i % CODE_IDX_MAX], CODES[i], 1000));
+    }
+
+    std::vector<Received> received = replay(burst);
+    TEST_ASSERT_EQUAL_UINT32(CODE_COUNT * burst, received.size());
+    for (uint32_t n = 0; n < received.size(); n++) {
+        uint8_t i = n / burst;
+        if (received[n].code != CODES[i] || received[n].flavor != CODE_FLAVOR_FOR_INDEX[i % CODE_IDX_MAX]) {
+            char msg[96];
+            snprintf(msg, sizeof(msg), "burst %u, code %u: got 0x%llx flavor 0x%02x", burst, n,
+                (unsigned long long)received[n].code, received[n].flavor);
+            TEST_FAIL_MESSAGE(msg);
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT32(CODE_COUNT * burst, replayer.getCodesSent());
+    TEST_ASSERT_EQUAL_UINT32(packets * burst, replayer.getPacketsSent());
+    TEST_ASSERT_EQUAL_UINT32(0, capture.getDroppedCodes());
+}
+
+static void test_codes_of_every_length(void) {
+    // One packet per digit group, up to the highest non-zero one
+    uint8_t encoded[POST_CODE_WORD_COUNT][MAX6958_CODE_PACKET_SIZE];
+    TEST_ASSERT_EQUAL_UINT8(1, encodeCodePackets(encoded, CODE_FLAVOR_SMC, 0));
+    TEST_ASSERT_EQUAL_UINT8(1, encodeCodePackets(encoded, CODE_FLAVOR_SMC, 0xFFFF));
+    TEST_ASSERT_EQUAL_UINT8(2, encodeCodePackets(encoded, CODE_FLAVOR_SMC, 0x10000));
+    TEST_ASSERT_EQUAL_UINT8(3, encodeCodePackets(encoded, CODE_FLAVOR_SMC, 0x100000000ull));
+    TEST_ASSERT_EQUAL_UINT8(4, encodeCodePackets(encoded, CODE_FLAVOR_SMC, UINT64_MAX));
+    checkBurst(1);
+}
+
+static void test_every_burst_setting(void) {
+    for (uint8_t burst = 1; burst <= REPLAY_MAX_BURST; burst++) {
+        checkBurst(burst);
+    }
+}
+
+void setUp(void) {
+    fakeMicros = 1000000;
+}
+void tearDown(void) {}
+
+int main(int, char **) {
+    UNITY_BEGIN();
+    RUN_TEST(test_codes_of_every_length);
+    RUN_TEST(test_every_burst_setting);
+    return UNITY_END();
+}
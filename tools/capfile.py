@@ -0,0 +1,430 @@
+#!/usr/bin/env python3
+"""Compact, indexed capture files for the code stream, and queries on them.
+
+    capfile.py ingest -o console07.dcap console07.log
+    capfile.py info *.dcap
+    capfile.py boots --code SMC:0xa2 *.dcap
+    capfile.py slice --from 120 --to 135 console07.dcap
+    capfile.py hist --flavor SMC --top 20 *.dcap
+
+ingest takes the reader's text output (as captured from the serial port),
+capture_daemon.py logs or other capture files, one console per file. Times are seconds since
+the start of the capture; `info` shows where that is.
+
+File layout (all little endian):
+
+    header    HEADER, see below
+    blocks    up to BLOCK_ROWS records each, as four separately zlib
+              compressed columns: flavor u8, code id u32 (index into the
+              code dictionary), time delta (zigzag varint, microseconds)
+              and session id u32
+    footer    code dictionary  (flavor u8, code u64, count u32) per code
+              session table    SESSION per session
+              block index      BLOCK per block, then a bitmap of the code
+                               ids present in the block
+
+Queries only decompress the columns they need of the blocks the index
+can't rule out: a code lookup checks each block's bitmap, a time range
+bisects the blocks' start times, and a histogram over a whole file comes
+straight from the dictionary's counts.
+"""
+
+import argparse
+import array
+import bisect
+import mmap
+import os
+import struct
+import sys
+import zlib
+
+import durango_rpc as rpc
+from capture_daemon import ANSI_ESCAPE, CODE_LINE, SESSION_START_LINE
+
+MAGIC = b"DCAP"
+VERSION = 1
+BLOCK_ROWS = 4096
+
+# magic, version, rows, blocks, codes, sessions, t_base_us, footer offset, console
+HEADER = struct.Struct("<4sHxxQIIIQQ24s")
+CODE = struct.Struct("<BQI")
+# id, cause, first/last time, codes, first/last block
+SESSION = struct.Struct("<IBQQIII")
+# offset, rows, first/last time, compressed column sizes, flavors present
+BLOCK = struct.Struct("<QIQQ4IB")
+
+COL_FLAVOR, COL_CODE, COL_TIME, COL_SESSION = range(4)
+CAUSES = {"monitoring started": 0, "after idle gap": 1, "reset code": 2, "boot stage restarted": 3}
+FLAVOR_BY_NAME = {name: flavor for flavor, name in rpc.FLAVOR_NAMES.items()}
+FLAVOR_BITS = {0x10: 0, 0x30: 1, 0x70: 2, 0xF0: 3}  # in a block's "flavors present" byte
+
+
+def flavor_name(flavor):
+    return rpc.FLAVOR_NAMES.get(flavor, "0x%02x" % flavor)
+
+
+def flavor_by_name(name):
+    if name.startswith("0x"):
+        return int(name, 16)
+    return FLAVOR_BY_NAME.get(name.strip(), 0)
+
+
+def put_varint(out, value):
+    value = (value << 1) ^ (value >> 63)  # zigzag
+    while value > 0x7F:
+        out.append((value & 0x7F) | 0x80)
+        value >>= 7
+    out.append(value)
+
+
+def get_varints(data, count):
+    values = []
+    value = shift = 0
+    for b in data:
+        value |= (b & 0x7F) << shift
+        if b & 0x80:
+            shift += 7
+            continue
+        values.append((value >> 1) ^ -(value & 1))
+        value = shift = 0
+    if len(values) != count:
+        raise ValueError("corrupt time column")
+    return values
+
+
+def u32_bytes(values):
+    a = array.array("I", values)
+    if sys.byteorder != "little":
+        a.byteswap()
+    return a.tobytes()
+
+
+def u32_array(data):
+    a = array.array("I")
+    a.frombytes(data)
+    if sys.byteorder != "little":
+        a.byteswap()
+    return a
+
+
+class Writer:
+    def __init__(self, path, console):
+        self.f = open(path, "wb")
+        self.f.write(bytes(HEADER.size))
+        self.console = console
+        self.codes = {}      # (flavor, code) -> id
+        self.counts = []
+        self.sessions = {}   # id -> [cause, first_t, last_t, codes, first_block, last_block]
+        self.blocks = []     # (BLOCK fields, set of code ids)
+        self.rows = 0
+        self.t_base = None
+        self.last_t = 0
+        self.pending = ([], [], [], [])
+
+    def add(self, flavor, code, t_us, session, cause=0):
+        if self.t_base is None:
+            self.t_base = t_us
+        t = max(t_us - self.t_base, self.last_t)  # keep time monotonic
+        code_id = self.codes.setdefault((flavor, code), len(self.codes))
+        if code_id == len(self.counts):
+            self.counts.append(0)
+        self.counts[code_id] += 1
+
+        info = self.sessions.get(session)
+        if info is None:
+            info = self.sessions[session] = [cause, t, t, 0, len(self.blocks), len(self.blocks)]
+        info[2] = t
+        info[3] += 1
+        info[5] = len(self.blocks)
+
+        flavors, ids, times, sessions = self.pending
+        flavors.append(flavor)
+        ids.append(code_id)
+        times.append(t)
+        sessions.append(session)
+        self.last_t = t
+        self.rows += 1
+        if len(flavors) == BLOCK_ROWS:
+            self.flush_block()
+
+    def flush_block(self):
+        flavors, ids, times, sessions = self.pending
+        if not flavors:
+            return
+        deltas = bytearray()
+        prev = times[0]
+        for t in times:
+            put_varint(deltas, t - prev)
+            prev = t
+        columns = [zlib.compress(bytes(flavors)), zlib.compress(u32_bytes(ids)),
+                   zlib.compress(bytes(deltas)), zlib.compress(u32_bytes(sessions))]
+        present = 0
+        for flavor in set(flavors):
+            present |= 1 << FLAVOR_BITS.get(flavor, 7)
+        self.blocks.append(((self.f.tell(), len(flavors), times[0], times[-1], *map(len, columns), present), set(ids)))
+        for column in columns:
+            self.f.write(column)
+        self.pending = ([], [], [], [])
+
+    def close(self):
+        self.flush_block()
+        footer = self.f.tell()
+        for (flavor, code), count in zip(self.codes, self.counts):
+            self.f.write(CODE.pack(flavor, code, count))
+        for session, info in sorted(self.sessions.items()):
+            self.f.write(SESSION.pack(session, *info))
+        bitmap_size = (len(self.codes) + 7) // 8
+        for fields, ids in self.blocks:
+            bitmap = bytearray(bitmap_size)
+            for code_id in ids:
+                bitmap[code_id >> 3] |= 1 << (code_id & 7)
+            self.f.write(BLOCK.pack(*fields) + bitmap)
+        self.f.seek(0)
+        self.f.write(HEADER.pack(MAGIC, VERSION, self.rows, len(self.blocks), len(self.codes), len(self.sessions),
+                                 self.t_base or 0, footer, self.console.encode()[:24]))
+        self.f.close()
+
+
+class CaptureFile:
+    def __init__(self, path):
+        self.path = path
+        with open(path, "rb") as f:
+            self.map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        (magic, version, self.rows, block_count, code_count, session_count, self.t_base,
+         footer, console) = HEADER.unpack_from(self.map, 0)
+        if magic != MAGIC or version != VERSION:
+            raise ValueError("%s: not a version %d capture file" % (path, VERSION))
+        self.console = console.rstrip(b"\0").decode("utf-8", "replace")
+
+        pos = footer
+        self.codes = []
+        for _ in range(code_count):
+            self.codes.append(CODE.unpack_from(self.map, pos))
+            pos += CODE.size
+        self.code_ids = {(flavor, code): i for i, (flavor, code, _) in enumerate(self.codes)}
+
+        self.sessions = {}
+        for _ in range(session_count):
+            fields = SESSION.unpack_from(self.map, pos)
+            self.sessions[fields[0]] = fields[1:]
+            pos += SESSION.size
+
+        self.bitmap_size = (code_count + 7) // 8
+        self.blocks = []
+        for _ in range(block_count):
+            self.blocks.append(BLOCK.unpack_from(self.map, pos))
+            self.blocks[-1] += (pos + BLOCK.size,)  # where its bitmap is
+            pos += BLOCK.size + self.bitmap_size
+        self.block_starts = [b[2] for b in self.blocks]
+        self.blocks_read = 0
+
+    def close(self):
+        self.map.close()
+
+    def has_code(self, block, code_id):
+        bitmap = self.blocks[block][-1]
+        return bool(self.map[bitmap + (code_id >> 3)] & (1 << (code_id & 7)))
+
+    def has_flavor(self, block, flavor):
+        return bool(self.blocks[block][8] & (1 << FLAVOR_BITS.get(flavor, 7)))
+
+    def blocks_between(self, t0, t1):
+        """Indexes of the blocks that may hold records in [t0, t1]"""
+        first = max(bisect.bisect_right(self.block_starts, t0) - 1, 0)
+        last = bisect.bisect_right(self.block_starts, t1)
+        return range(first, last)
+
+    def column(self, block, col):
+        offset, rows = self.blocks[block][0:2]
+        sizes = self.blocks[block][4:8]
+        start = offset + sum(sizes[:col])
+        data = zlib.decompress(self.map[start:start + sizes[col]])
+        if col == COL_FLAVOR:
+            return data
+        if col == COL_TIME:
+            times = []
+            t = self.blocks[block][2]
+            for delta in get_varints(data, rows):
+                t += delta
+                times.append(t)
+            return times
+        return u32_array(data)
+
+    def records(self):
+        """Every record as (flavor, code, time us, session, cause)"""
+        for block in range(len(self.blocks)):
+            flavors, ids, times, sessions = self.read(block, COL_FLAVOR, COL_CODE, COL_TIME, COL_SESSION)
+            for flavor, code_id, t, session in zip(flavors, ids, times, sessions):
+                yield flavor, self.codes[code_id][1], self.t_base + t, session, self.sessions[session][0]
+
+    def read(self, block, *cols):
+        self.blocks_read += 1
+        return [self.column(block, col) for col in cols]
+
+
+def read_codes(paths):
+    """Codes from capture files, text output or daemon logs, in order.
+
+    Yields (flavor, code, time us, session, cause). Raw text only has time
+    since session start, so its sessions are laid end to end.
+    """
+    for path in paths:
+        if path.endswith(".dcap"):
+            capture = CaptureFile(path)
+            try:
+                yield from capture.records()
+            finally:
+                capture.close()
+            continue
+
+        session, cause = 0, 0
+        session_base = last_t = 0
+        with open(path, "rb") as f:
+            for line in f:
+                line = line.rstrip(b"\r\n")
+                if b"\x1b" in line:
+                    line = ANSI_ESCAPE.sub(b"", line)
+                fields = line.split(b"\t")
+                if len(fields) == 5:
+                    # capture_daemon.py log
+                    rx, device, sess, kind, detail = fields
+                    if kind == b"session_start":
+                        cause = CAUSES.get(detail.decode(), 0)
+                    elif kind == b"code":
+                        flavor, code = detail.split(b" ")
+                        yield (flavor_by_name(flavor.decode()), int(code, 16), int(float(device or rx) * 1e6),
+                               int(sess or 0), cause)
+                    continue
+
+                m = SESSION_START_LINE.match(line)
+                if m:
+                    session = int(m.group(1))
+                    cause = CAUSES.get(m.group(2).decode(), 0)
+                    session_base = last_t
+                    continue
+                m = CODE_LINE.match(line)
+                if m:
+                    last_t = session_base + (int(float(m.group(4)) * 1e6) if m.group(4) else 0)
+                    yield flavor_by_name(m.group(1).decode()), int(m.group(2), 16), last_t, session, cause
+
+
+def ingest(args):
+    console = args.console or os.path.splitext(os.path.basename(args.output))[0]
+    writer = Writer(args.output, console)
+    for record in read_codes(args.inputs):
+        writer.add(*record)
+    writer.close()
+    print("%s: %d codes, %d distinct, %d sessions, %d blocks, %d bytes" % (
+        args.output, writer.rows, len(writer.codes), len(writer.sessions), len(writer.blocks),
+        os.path.getsize(args.output)))
+
+
+def parse_code(text):
+    name, _, code = text.partition(":")
+    if name.upper() not in FLAVOR_BY_NAME or not code:
+        raise argparse.ArgumentTypeError("expected FLAVOR:CODE, e.g. SMC:0xa2")
+    return FLAVOR_BY_NAME[name.upper()], int(code, 0)
+
+
+def seconds(t_us):
+    return "%.3f" % (t_us / 1e6)
+
+
+def cmd_info(capture, args):
+    print("%s: console %s, %d codes (%d distinct), %d sessions, %d blocks, time base %.6f" % (
+        capture.path, capture.console, capture.rows, len(capture.codes), len(capture.sessions),
+        len(capture.blocks), capture.t_base / 1e6))
+
+
+def cmd_boots(capture, args):
+    code_id = capture.code_ids.get(args.code)
+    if code_id is None:
+        return
+    found = set()
+    for block in range(len(capture.blocks)):
+        if capture.has_code(block, code_id):
+            ids, sessions = capture.read(block, COL_CODE, COL_SESSION)
+            found.update(s for i, s in zip(ids, sessions) if i == code_id)
+    for session in sorted(found):
+        cause, first, last, codes = capture.sessions[session][:4]
+        print("%s\t%s\tsession %d\tat %s s\t%s s\t%d codes" % (
+            capture.path, capture.console, session, seconds(first), seconds(last - first), codes))
+
+
+def cmd_slice(capture, args):
+    t0 = int(args.start * 1e6)
+    t1 = int(args.end * 1e6) if args.end is not None else 1 << 62
+    for block in capture.blocks_between(t0, t1):
+        flavors, ids, times, sessions = capture.read(block, COL_FLAVOR, COL_CODE, COL_TIME, COL_SESSION)
+        for flavor, code_id, t, session in zip(flavors, ids, times, sessions):
+            if t0 <= t <= t1 and (args.session is None or session == args.session):
+                print("%s\t%d\t%s\t0x%x" % (seconds(t), session, flavor_name(flavor), capture.codes[code_id][1]))
+
+
+def cmd_hist(capture, args):
+    counts = {}
+    if args.start is None and args.end is None:
+        for i, (flavor, code, count) in enumerate(capture.codes):
+            counts[i] = count
+    else:
+        t0 = int((args.start or 0) * 1e6)
+        t1 = int(args.end * 1e6) if args.end is not None else 1 << 62
+        for block in capture.blocks_between(t0, t1):
+            if args.flavor is not None and not capture.has_flavor(block, args.flavor):
+                continue
+            ids, times = capture.read(block, COL_CODE, COL_TIME)
+            for code_id, t in zip(ids, times):
+                if t0 <= t <= t1:
+                    counts[code_id] = counts.get(code_id, 0) + 1
+    rows = [(count, capture.codes[i][0], capture.codes[i][1]) for i, count in counts.items()
+            if args.flavor is None or capture.codes[i][0] == args.flavor]
+    rows.sort(reverse=True)
+    for count, flavor, code in rows[:args.top]:
+        print("%s\t%s\t0x%x\t%d" % (capture.path, flavor_name(flavor), code, count))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    p = commands.add_parser("ingest", help="build a capture file from text output or daemon logs")
+    p.add_argument("-o", "--output", required=True)
+    p.add_argument("--console", help="console name, defaults to the output's file name")
+    p.add_argument("inputs", nargs="+")
+
+    def query(name, help, func):
+        p = commands.add_parser(name, help=help)
+        p.add_argument("-v", "--verbose", action="store_true", help="report how many blocks were read")
+        p.add_argument("files", nargs="+")
+        p.set_defaults(func=func)
+        return p
+
+    query("info", "summarise capture files", cmd_info)
+    p = query("boots", "sessions in which a code showed up", cmd_boots)
+    p.add_argument("--code", type=parse_code, required=True, help="FLAVOR:CODE, e.g. SMC:0xa2")
+    p = query("slice", "codes in a time range", cmd_slice)
+    p.add_argument("--from", dest="start", type=float, default=0.0, help="seconds since capture start")
+    p.add_argument("--to", dest="end", type=float)
+    p.add_argument("--session", type=int)
+    p = query("hist", "how often each code showed up", cmd_hist)
+    p.add_argument("--from", dest="start", type=float)
+    p.add_argument("--to", dest="end", type=float)
+    p.add_argument("--flavor", type=lambda s: FLAVOR_BY_NAME[s.upper()])
+    p.add_argument("--top", type=int, default=50)
+
+    args = parser.parse_args()
+    if args.command == "ingest":
+        ingest(args)
+        return
+    for path in args.files:
+        capture = CaptureFile(path)
+        try:
+            args.func(capture, args)
+            if args.verbose:
+                print("%s: read %d of %d blocks" % (path, capture.blocks_read, len(capture.blocks)), file=sys.stderr)
+        finally:
+            capture.close()
+
+
+if __name__ == "__main__":
+    main()
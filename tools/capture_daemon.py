@@ -0,0 +1,725 @@
+#!/usr/bin/env python3
+"""Headless capture daemon for a rack of readers.
+
+Follows the code stream of any number of readers at once - one epoll loop,
+no threads - in the text or the binary event format, and writes a log per
+console. Every record carries the host time it arrived and the device's
+own timestamp mapped onto the host clock, so logs of different consoles
+line up.
+
+    capture_daemon.py -o logs /dev/ttyACM0 /dev/ttyACM1=console02
+    capture_daemon.py -o logs --sync 5 /dev/ttyACM0
+    capture_daemon.py -o /tmp/sim --simulate 40 --duration 10
+
+A port can be given a name with path=name; its log is <name>.log, and
+defaults to the device's file name. Log lines are tab separated:
+
+    rx_time  device_time  session  kind  details
+
+rx_time is the host wall clock when the record arrived, device_time the
+device timestamp mapped onto the host wall clock (empty if the record has
+none). kind is code, repeat, session_start, session_end, clock or text
+(anything else the reader printed).
+
+Every --sync seconds the daemon times a round of RPC_OP_TIME exchanges with
+each reader, fits offset and drift of its clock (durango_rpc.ClockFit) and
+hands the fit back to the reader, which from then on stamps binary code
+events with host time too. Each sync is logged as a clock record with the
+fit's uncertainty. Binary records are mapped with the fit once there is
+one; text records only carry time since session start and keep being
+mapped by arrival time.
+
+Every --stats seconds, and on exit, a line per port goes to stderr with
+its throughput, parse errors and records lost (gaps in the binary
+format's sequence numbers).
+
+--simulate N runs against N pty-backed fake readers instead of real
+ports, half in text and half in binary, with a corrupt record mixed in
+every so often. It exits non-zero unless every record was accounted for.
+"""
+
+import argparse
+import os
+import random
+import re
+import select
+import signal
+import struct
+import sys
+import time
+import tty
+
+import durango_rpc as rpc
+
+READ_SIZE = 65536
+MAX_LINE = 4096      # longer lines are dropped as parse errors
+DRIFT_PPM = 100      # how fast the clock offset may creep up, see ClockMap
+SYNC_EXCHANGES = 8   # RPC_OP_TIME round trips per sync round
+SYNC_MAX_MISSES = 3  # unanswered rounds in a row before a port isn't synced any more
+FLUSH_INTERVAL = 1.0
+
+ANSI_ESCAPE = re.compile(rb"\x1b\[[0-9;]*m")
+CODE_LINE = re.compile(rb"(CPU|SP |SMC|OS |\?\?): 0x([0-9a-f]+)(?: \(\+([0-9.]+) mS @ ([0-9.]+) s\))?$")
+REPEAT_LINE = re.compile(rb"(.+: 0x[0-9a-f]+) x(\d+) over (\d+) ms( \(repeating\))?$")
+SESSION_START_LINE = re.compile(rb"--- Session (\d+) start \((.*)\) ---$")
+SESSION_END_LINE = re.compile(rb"--- Session (\d+) end: (\d+) codes in ([0-9.]+) s, (\d+) dropped \|(.*) ---$")
+CODE_PREFIXES = (b"CPU", b"SP ", b"SMC", b"OS ", b"??:")
+SESSION_PREFIX = b"--- Session"
+SESSION_CAUSES = {0: "monitoring started", 1: "after idle gap", 2: "reset code", 3: "boot stage restarted"}
+BUS_STALL_CAUSES = {1: "held", 2: "silent", 3: "forced"}
+
+
+def flavor_name(flavor):
+    return rpc.FLAVOR_NAMES.get(flavor, "0x%02x" % flavor)
+
+
+class HostClock:
+    """Monotonic microseconds, convertible to wall clock seconds."""
+
+    def __init__(self):
+        self.wall_minus_mono = time.time() - time.monotonic()
+
+    @staticmethod
+    def now_us():
+        return time.monotonic_ns() // 1000
+
+    def wall(self, mono_us):
+        return mono_us / 1e6 + self.wall_minus_mono
+
+    def mono(self, wall_us):
+        return int(wall_us - self.wall_minus_mono * 1e6)
+
+
+class ClockMap:
+    """Maps device microseconds onto the host's.
+
+    The offset is the smallest host - device difference seen, i.e. from the
+    record that got through with the least delay. It creeps up by DRIFT_PPM
+    of the elapsed time so it keeps following a device clock that runs
+    slow. A device timestamp going backwards means the device clock
+    restarted, and the estimate starts over.
+    """
+
+    def __init__(self):
+        self.reset()
+
+    def reset(self):
+        self.offset = None
+        self.last_dev = 0
+        self.last_host = 0
+
+    def map(self, host_us, dev_us):
+        sample = host_us - dev_us
+        if self.offset is None or dev_us < self.last_dev:
+            self.offset = sample
+        else:
+            self.offset = min(self.offset + (host_us - self.last_host) * DRIFT_PPM // 1000000, sample)
+        self.last_dev = dev_us
+        self.last_host = host_us
+        return dev_us + self.offset
+
+
+class Port:
+    """One reader: reads into a fixed buffer and parses records in place."""
+
+    def __init__(self, path, name, log_dir, clock, baud):
+        self.path = path
+        self.name = name
+        self.clock = clock
+        self.fd = rpc.open_port(path, baud)
+        self.buf = bytearray(READ_SIZE + MAX_LINE)
+        self.view = memoryview(self.buf)
+        self.fill = 0
+        self.log = open(os.path.join(log_dir, name + ".log"), "a", buffering=1 << 16)
+
+        self.device_clock = ClockMap()  # binary: absolute device time
+        self.session_clock = ClockMap() # text: time since session start
+        self.session = ""
+        self.next_seq = None
+        self.rx_us = 0
+
+        self.sync = rpc.ClockFit()
+        self.sync_left = 0   # exchanges still to go in this round
+        self.sync_misses = 0
+        self.req_id = 0
+
+        self.bytes = self.lines = self.codes = self.repeats = 0
+        self.sessions = self.events = self.errors = self.lost = 0
+        self.last_report = (0, 0, 0)  # bytes, lines + events, codes
+
+    def close(self):
+        self.log.close()
+        os.close(self.fd)
+
+    def read(self):
+        """Reads whatever is there. Returns False once the port is gone."""
+        while True:
+            try:
+                n = os.readv(self.fd, [self.view[self.fill:self.fill + READ_SIZE]])
+            except BlockingIOError:
+                return True
+            except OSError:
+                return False
+            if n == 0:
+                return True
+            self.rx_us = HostClock.now_us()
+            self.bytes += n
+            self.fill += n
+            self.scan()
+
+    def scan(self):
+        buf, view, end = self.buf, self.view, self.fill
+        pos = 0
+        while pos < end:
+            nl = buf.find(b"\n", pos, end)
+            stop = nl if nl >= 0 else end
+            sync = self.find_sync(pos, stop)
+            if sync < 0 and nl < 0:
+                break
+            if sync < 0:
+                self.on_line(pos, nl)
+                pos = nl + 1
+                continue
+
+            if sync > pos:
+                self.on_line(pos, sync)
+            pos = sync
+            if end - sync < 2 or end - sync < 3 + buf[sync + 1]:
+                break  # frame not complete yet
+            length = buf[sync + 1]
+            if length < 2 or rpc.crc8(view[sync + 1:sync + 2 + length]) != buf[sync + 2 + length]:
+                # Resync at the next frame or line
+                self.errors += 1
+                nl = buf.find(b"\n", sync + 1, end)
+                resync = self.find_sync(sync + 1, nl if nl >= 0 else end)
+                pos = resync if resync >= 0 else (nl + 1 if nl >= 0 else end)
+                continue
+            if buf[sync] == rpc.EVENT_SYNC:
+                self.on_event(buf[sync + 2], buf[sync + 3], view[sync + 4:sync + 2 + length])
+            else:
+                self.on_response(buf[sync + 3], view[sync + 4:sync + 2 + length])
+            pos = sync + 3 + length
+
+        left = end - pos
+        if left > MAX_LINE:
+            self.errors += 1
+            left = 0
+        elif left:
+            buf[:left] = view[pos:end]
+        self.fill = left
+
+    def find_sync(self, start, stop):
+        sync = self.buf.find(b"\x1e", start, stop)
+        event = self.buf.find(b"\x1f", start, stop if sync < 0 else sync)
+        return event if event >= 0 else sync
+
+    def request(self, op, payload):
+        self.req_id = (self.req_id + 1) & 0xFF
+        try:
+            os.write(self.fd, rpc.encode_request(self.req_id, op, payload))
+        except (BlockingIOError, OSError):
+            pass  # the exchange just goes unanswered
+
+    def start_sync(self):
+        """Starts a round of time exchanges, one at a time so none of them
+        waits behind another"""
+        if self.sync_misses >= SYNC_MAX_MISSES:
+            return
+        if self.sync_left:
+            self.sync_misses += 1
+            self.sync.end_round()  # whatever made it back
+        self.sync_left = SYNC_EXCHANGES
+        self.request(rpc.OP_TIME, HostClock.now_us().to_bytes(8, "little"))
+
+    def on_response(self, status, payload):
+        if status == rpc.STATUS_UNKNOWN_OP:
+            self.sync_misses = SYNC_MAX_MISSES  # firmware without clock sync
+            self.sync_left = 0
+            return
+        if status != 0 or len(payload) != 24 or not self.sync_left:
+            return
+        t1, t2, t3 = rpc.u64(payload, 0), rpc.u64(payload, 8), rpc.u64(payload, 16)
+        self.sync.add(t1, t2, t3, self.rx_us)
+        self.sync_left -= 1
+        if self.sync_left:
+            self.request(rpc.OP_TIME, HostClock.now_us().to_bytes(8, "little"))
+            return
+
+        self.sync_misses = 0
+        self.sync.end_round()
+        device_us, host_us, drift_ppb, uncertainty_us, drift_uncertainty_ppb = self.sync.fit()
+        host_wall_us = int(self.clock.wall(host_us) * 1e6)
+        self.request(rpc.OP_TIME_SET, struct.pack(rpc.CLOCK_SYNC_FORMAT, device_us, host_wall_us, drift_ppb,
+                                                  uncertainty_us, drift_uncertainty_ppb))
+        self.write(host_us, "clock", "drift=%+dppb uncertainty=%dus drift_uncertainty=%dppb rounds=%d" % (
+            drift_ppb, uncertainty_us, drift_uncertainty_ppb, len(self.sync.rounds)))
+
+    def device_time(self, device_us):
+        """Device timestamp -> host monotonic us"""
+        if self.sync.fit() is not None:
+            return self.sync.to_host(device_us)
+        return self.device_clock.map(self.rx_us, device_us)
+
+    def write(self, device_us, kind, detail):
+        device = "%.6f" % self.clock.wall(device_us) if device_us is not None else ""
+        self.log.write("%.6f\t%s\t%s\t%s\t%s\n" % (self.clock.wall(self.rx_us), device, self.session, kind, detail))
+
+    def on_line(self, start, stop):
+        if stop > start and self.buf[stop - 1] == 0x0D:
+            stop -= 1
+        if stop == start:
+            return
+        line = self.view[start:stop]
+        if self.buf.find(b"\x1b", start, stop) >= 0:
+            line = ANSI_ESCAPE.sub(b"", line)
+        self.lines += 1
+
+        head = bytes(line[:3])
+        if head in CODE_PREFIXES:
+            m = CODE_LINE.match(line)
+            if m:
+                self.codes += 1
+                device_us = None
+                if m.group(4) is not None:
+                    device_us = self.session_clock.map(self.rx_us, int(float(m.group(4)) * 1e6))
+                self.write(device_us, "code", "%s 0x%s" % (m.group(1).strip().decode(), m.group(2).decode()))
+                return
+            m = REPEAT_LINE.match(line)
+            if m:
+                self.repeats += 1
+                detail = "%s x%s over %s ms%s" % (m.group(1).decode(), m.group(2).decode(), m.group(3).decode(),
+                                                  " (repeating)" if m.group(4) else "")
+                self.write(None, "repeat", detail)
+                return
+            self.errors += 1
+            return
+
+        if head == b"---" and bytes(line[:len(SESSION_PREFIX)]) == SESSION_PREFIX:
+            m = SESSION_START_LINE.match(line)
+            if m:
+                self.sessions += 1
+                self.session = m.group(1).decode()
+                self.session_clock.reset()
+                self.write(self.session_clock.map(self.rx_us, 0), "session_start", m.group(2).decode())
+                return
+            m = SESSION_END_LINE.match(line)
+            if m:
+                detail = "codes=%s dropped=%s duration=%ss last=%s" % (
+                    m.group(2).decode(), m.group(4).decode(), m.group(3).decode(),
+                    " ".join(m.group(5).decode().split()))
+                self.write(None, "session_end", detail)
+                return
+            self.errors += 1
+            return
+
+        self.write(None, "text", bytes(line).decode("utf-8", "replace"))
+
+    def on_event(self, event_type, seq, payload):
+        self.events += 1
+        if self.next_seq is not None and seq != self.next_seq:
+            self.lost += (seq - self.next_seq) & 0xFF
+        self.next_seq = (seq + 1) & 0xFF
+
+        event = rpc.parse_event(event_type, payload)
+        if event is None:
+            self.errors += 1
+            return
+        if event_type == rpc.EVENT_CODE:
+            self.codes += 1
+            self.session = str(event["session"])
+            if "host_us" in event:
+                device_us = self.clock.mono(event["host_us"])
+            else:
+                device_us = self.device_time(event["timestamp_us"])
+            self.write(device_us, "code", "%s 0x%x" % (flavor_name(event["flavor"]), event["code"]))
+        elif event_type == rpc.EVENT_REPEAT:
+            self.repeats += 1
+            cycle = " > ".join("%s: 0x%x" % (flavor_name(f), c) for f, c in event["cycle"])
+            self.write(self.device_time(event["last_us"]), "repeat", "%s x%d over %d ms%s" % (
+                cycle, event["count"], (event["last_us"] - event["first_us"]) // 1000,
+                " (repeating)" if event["ongoing"] else ""))
+        elif event_type == rpc.EVENT_SESSION_START:
+            self.sessions += 1
+            self.session = str(event["session"])
+            self.write(self.device_time(event["start_us"]), "session_start",
+                       SESSION_CAUSES.get(event["cause"], str(event["cause"])))
+        elif event_type == rpc.EVENT_SESSION_END:
+            last = " ".join("%s: 0x%x" % (flavor_name(f), c) for f, c in event["last_codes"])
+            self.write(self.device_time(event["last_us"]), "session_end",
+                       "codes=%d dropped=%d duration=%.3fs last=%s" % (
+                           event["codes"], event["dropped"], (event["last_us"] - event["start_us"]) / 1e6, last))
+        elif event_type == rpc.EVENT_CLOCK_SYNC:
+            pass  # the daemon sent it, and already logged it
+        elif event_type == rpc.EVENT_REGISTERS:
+            self.write(self.device_time(event["timestamp_us"]), "registers", " ".join(
+                "0x%02x=0x%02x/%d" % change for change in event["changes"]))
+        elif event_type == rpc.EVENT_BUS_RECOVERY:
+            self.write(self.device_time(event["timestamp_us"]), "bus_recovery", "cause=%s stalled=%.3fs restart=%dus lost=%d" % (
+                BUS_STALL_CAUSES.get(event["cause"], str(event["cause"])), event["stalled_us"] / 1e6,
+                event["restart_us"], event["codes_lost"]))
+
+    def report(self, elapsed):
+        """One line for the stats table, rates since the previous call"""
+        records = self.lines + self.events
+        last_bytes, last_records, last_codes = self.last_report
+        self.last_report = (self.bytes, records, self.codes)
+        return "%-16s %9.1f %9.0f %9.0f %8d %8d %8d" % (
+            self.name, (self.bytes - last_bytes) / 1024 / elapsed, (records - last_records) / elapsed,
+            (self.codes - last_codes) / elapsed, self.sessions, self.errors, self.lost)
+
+
+REPORT_HEADER = "%-16s %9s %9s %9s %8s %8s %8s" % ("port", "KiB/s", "records/s", "codes/s", "sessions", "errors", "lost")
+
+
+class SimReader:
+    """Fake reader on a pty that boots a console over and over.
+
+    Sessions of a few hundred codes walk through SMC, SP, CPU and OS, with
+    the odd repeat summary in between. Every `corrupt_every`th code goes
+    out mangled: a malformed text line, or a binary frame with a bad CRC.
+    Its clock runs off by up to 50 ppm, and it answers clock syncs the way
+    the firmware does.
+    """
+
+    FLAVORS = (0x70, 0x30, 0x10, 0xF0)  # SMC, SP, CPU, OS
+
+    def __init__(self, index, rate, binary, corrupt_every):
+        self.master, self.slave = os.openpty()
+        tty.setraw(self.slave)  # before the daemon opens it, so nothing gets translated
+        os.set_blocking(self.master, False)
+        self.path = os.ttyname(self.slave)
+        self.name = "sim%02d" % index
+        self.rate = rate
+        self.binary = binary
+        self.corrupt_every = corrupt_every
+        self.rng = random.Random(index)
+        self.device_base_us = self.rng.randrange(1 << 40)
+        self.skew_ppb = self.rng.randrange(-50000, 50000)
+        self.splitter = rpc.StreamSplitter()
+        self.sync = None  # the fit handed over with RPC_OP_TIME_SET
+        self.syncs = 0
+        self.pending = bytearray()
+        self.carry = 0.0
+        self.seq = 0
+
+        self.session = 0
+        self.session_left = 0
+        self.session_start_us = 0
+        self.last_us = 0
+        self.stage = 0
+        self.code = 0
+        self.codes_in_session = 0
+
+        self.finished = False
+        self.sent_codes = 0
+        self.sent_sessions = 0
+        self.corrupted = 0
+
+    def close(self):
+        os.close(self.master)
+        os.close(self.slave)
+
+    def device_us(self, host_us):
+        return self.device_base_us + host_us + host_us * self.skew_ppb // 1000000000
+
+    def tick(self, now_us, elapsed):
+        self.serve()
+        self.carry += self.rate * elapsed
+        count = int(self.carry)
+        self.carry -= count
+        device_us = self.device_us(now_us)
+        for _ in range(count):
+            self.next_code(device_us)
+        self.flush()
+
+    def next_code(self, device_us):
+        if self.session_left == 0:
+            if self.session:
+                self.end_session()
+            self.start_session(device_us)
+        self.session_left -= 1
+
+        if self.rng.random() < 0.1:
+            self.stage = min(self.stage + 1, len(self.FLAVORS) - 1)
+            self.code = self.rng.randrange(0x10)
+        self.code += 1
+        flavor = self.FLAVORS[self.stage]
+        corrupt = self.corrupt_every and (self.sent_codes + self.corrupted + 1) % self.corrupt_every == 0
+        if self.binary:
+            payload = bytes([flavor]) + self.code.to_bytes(8, "little") + device_us.to_bytes(8, "little") \
+                + self.session.to_bytes(4, "little")
+            if self.sync is not None:
+                dev_ref, host_ref, drift_ppb, uncertainty_us, _ = self.sync
+                since = device_us - dev_ref
+                payload += struct.pack("<QI", host_ref + since + since * drift_ppb // 1000000000, uncertainty_us)
+            frame = self.event(rpc.EVENT_CODE, payload)
+            # Only mangle frames the daemon can resync after in one step
+            mangled = frame[:-1] + bytes([frame[-1] ^ 0xFF])
+            if corrupt and not any(b in mangled[1:] for b in (0x0A, rpc.SYNC, rpc.EVENT_SYNC)):
+                self.pending += mangled
+                self.corrupted += 1
+                return
+            self.pending += frame
+        else:
+            rel_us = device_us - self.session_start_us
+            delta_us = device_us - self.last_us
+            name = rpc.FLAVOR_NAMES[flavor].ljust(3).encode()
+            if corrupt:
+                self.pending += name + b": 0x%xg (+%.3f mS\r\n" % (self.code, delta_us / 1000)
+                self.corrupted += 1
+                return
+            self.pending += name + b": 0x%x (+%.3f mS @ %.3f s)\r\n" % (self.code, delta_us / 1000, rel_us / 1e6)
+        self.sent_codes += 1
+        self.codes_in_session += 1
+        self.last_us = device_us
+
+        if self.rng.random() < 0.01:
+            self.repeat(flavor, device_us)
+
+    def serve(self):
+        """Answers the daemon's requests"""
+        try:
+            data = os.read(self.master, 4096)
+        except BlockingIOError:
+            return
+        for kind, item in self.splitter.feed(data):
+            if kind != "frame":
+                continue
+            req_id, op, payload = item
+            status, reply = 0, b""
+            if op == rpc.OP_TIME and len(payload) == 8:
+                device_us = self.device_us(HostClock.now_us())
+                reply = payload + struct.pack("<QQ", device_us, device_us)
+            elif op == rpc.OP_TIME_SET and len(payload) == 28:
+                self.sync = struct.unpack(rpc.CLOCK_SYNC_FORMAT, payload)
+                self.syncs += 1
+                if self.binary:
+                    self.pending += self.event(rpc.EVENT_CLOCK_SYNC, payload)
+            else:
+                status = rpc.STATUS_UNKNOWN_OP
+            # A response is shaped like a request, with the status for the op
+            self.pending += rpc.encode_request(req_id, status, reply)
+
+    def event(self, event_type, payload):
+        frame = rpc.encode_event(event_type, self.seq, payload)
+        self.seq = (self.seq + 1) & 0xFF
+        return frame
+
+    def repeat(self, flavor, device_us):
+        count = self.rng.randrange(2, 100)
+        if self.binary:
+            payload = count.to_bytes(4, "little") + (device_us - 1000 * count).to_bytes(8, "little") \
+                + device_us.to_bytes(8, "little") + bytes([0, 1, flavor]) + self.code.to_bytes(8, "little")
+            self.pending += self.event(rpc.EVENT_REPEAT, payload)
+        else:
+            self.pending += b"%s: 0x%x x%d over %d ms\r\n" % (
+                rpc.FLAVOR_NAMES[flavor].ljust(3).encode(), self.code, count, count)
+
+    def start_session(self, device_us):
+        self.session += 1
+        self.sent_sessions += 1
+        self.session_left = self.rng.randrange(100, 400)
+        self.session_start_us = self.last_us = device_us
+        self.stage = 0
+        self.code = 0
+        self.codes_in_session = 0
+        cause = 0 if self.session == 1 else 1
+        if self.binary:
+            payload = self.session.to_bytes(4, "little") + bytes([cause]) + device_us.to_bytes(8, "little")
+            self.pending += self.event(rpc.EVENT_SESSION_START, payload)
+        else:
+            self.pending += b"--- Session %d start (%s) ---\r\n" % (self.session, SESSION_CAUSES[cause].encode())
+
+    def end_session(self):
+        if self.binary:
+            payload = self.session.to_bytes(4, "little") + self.codes_in_session.to_bytes(4, "little") \
+                + bytes(4) + self.session_start_us.to_bytes(8, "little") + self.last_us.to_bytes(8, "little") \
+                + bytes([self.FLAVORS[self.stage]]) + self.code.to_bytes(8, "little")
+            self.pending += self.event(rpc.EVENT_SESSION_END, payload)
+        else:
+            self.pending += b"--- Session %d end: %d codes in %.3f s, 0 dropped | %s: 0x%x ---\r\n" % (
+                self.session, self.codes_in_session, (self.last_us - self.session_start_us) / 1e6,
+                rpc.FLAVOR_NAMES[self.FLAVORS[self.stage]].ljust(3).encode(), self.code)
+
+    def finish(self):
+        """Ends the running session and sends what's left"""
+        if self.session and not self.finished:
+            self.end_session()
+            self.finished = True
+        self.flush()
+
+    def flush(self):
+        while self.pending:
+            try:
+                n = os.write(self.master, self.pending)
+            except BlockingIOError:
+                return
+            del self.pending[:n]
+
+    def check(self, port, sync_expected):
+        """-> list of mismatches between what was sent and what `port` saw"""
+        problems = []
+        for what, sent, seen in (("codes", self.sent_codes, port.codes),
+                                 ("sessions", self.sent_sessions, port.sessions),
+                                 ("parse errors", self.corrupted, port.errors),
+                                 ("lost", self.corrupted if self.binary else 0, port.lost)):
+            if sent != seen:
+                problems.append("%s: sent %d, daemon saw %d" % (what, sent, seen))
+
+        if sync_expected and port.sync.fit() is None:
+            problems.append("clock: never synced")
+        elif port.sync.fit() is not None:
+            # The daemon's idea of the device clock has to be within its own bound
+            now_us = HostClock.now_us()
+            device_us = self.device_us(now_us)
+            dev_ref, _, _, uncertainty_us, drift_uncertainty_ppb = port.sync.fit()
+            error = port.sync.to_host(device_us) - now_us
+            bound = uncertainty_us + abs(device_us - dev_ref) * drift_uncertainty_ppb / 1e9
+            if abs(error) > bound:
+                problems.append("clock: off by %d us, bound %d us" % (error, bound))
+        return problems
+
+
+class Daemon:
+    def __init__(self, log_dir, stats_interval, sync_interval):
+        self.log_dir = log_dir
+        self.stats_interval = stats_interval
+        self.sync_interval = sync_interval
+        self.clock = HostClock()
+        self.epoll = select.epoll()
+        self.ports = {}  # fd -> Port
+        self.last_stats = (time.monotonic(), time.process_time())
+
+    def add(self, path, name, baud):
+        port = Port(path, name, self.log_dir, self.clock, baud)
+        self.ports[port.fd] = port
+        self.epoll.register(port.fd, select.EPOLLIN)
+        return port
+
+    def remove(self, port):
+        print("%s: port went away" % port.name, file=sys.stderr)
+        self.epoll.unregister(port.fd)
+        del self.ports[port.fd]
+        port.close()
+
+    def run(self, until=None, tick=None, tick_interval=0.01):
+        """Polls until `until()` says stop. `tick(now_us, elapsed)` is
+        called every tick_interval seconds if given."""
+        now = time.monotonic()
+        next_stats = now + self.stats_interval if self.stats_interval else None
+        next_flush = now + FLUSH_INTERVAL
+        next_sync = now if self.sync_interval else None
+        next_tick = now
+        last_tick = now
+
+        while self.ports and (until is None or not until()):
+            deadline = min(t for t in (next_stats, next_flush, next_sync, next_tick if tick else None) if t is not None)
+            for fd, _ in self.epoll.poll(max(0.0, deadline - time.monotonic())):
+                port = self.ports.get(fd)
+                if port is not None and not port.read():
+                    self.remove(port)
+
+            now = time.monotonic()
+            if tick and now >= next_tick:
+                tick(HostClock.now_us(), now - last_tick)
+                last_tick = now
+                next_tick = now + tick_interval
+            if next_sync is not None and now >= next_sync:
+                for port in self.ports.values():
+                    port.start_sync()
+                next_sync = now + self.sync_interval
+            if now >= next_flush:
+                for port in self.ports.values():
+                    port.log.flush()
+                next_flush = now + FLUSH_INTERVAL
+            if next_stats is not None and now >= next_stats:
+                self.report()
+                next_stats = now + self.stats_interval
+
+    def report(self):
+        now, cpu = time.monotonic(), time.process_time()
+        elapsed = max(now - self.last_stats[0], 1e-6)
+        print(REPORT_HEADER, file=sys.stderr)
+        for port in self.ports.values():
+            print(port.report(elapsed), file=sys.stderr)
+        print("cpu %.1f%%" % (100 * (cpu - self.last_stats[1]) / elapsed), file=sys.stderr)
+        self.last_stats = (now, cpu)
+
+    def close(self):
+        for port in self.ports.values():
+            port.close()
+        self.epoll.close()
+
+
+def simulate(daemon, args):
+    sims = [SimReader(i, args.rate, i % 2 == 1, args.corrupt_every) for i in range(args.simulate)]
+    ports = [(sim, daemon.add(sim.path, sim.name, args.baud)) for sim in sims]
+
+    def tick(now_us, elapsed):
+        for sim in sims:
+            if now_us < stop_us:
+                sim.tick(now_us, elapsed)
+            else:
+                sim.finish()
+
+    stop_us = HostClock.now_us() + int(args.duration * 1e6)
+    daemon.run(until=lambda: HostClock.now_us() >= stop_us, tick=tick)
+
+    # Let the daemon catch up with whatever is still queued
+    def drained():
+        if any(sim.pending for sim in sims):
+            return False
+        quiet = time.monotonic() - max(port.rx_us for _, port in ports) / 1e6
+        return quiet > 0.5
+
+    daemon.run(until=drained, tick=tick)
+    daemon.report()
+
+    failed = False
+    for sim, port in ports:
+        problems = sim.check(port, args.sync > 0)
+        for problem in problems:
+            print("%s: %s" % (sim.name, problem))
+        failed |= bool(problems)
+        sim.close()
+    print("%d simulated readers: %s" % (len(sims), "FAILED" if failed else "ok"))
+    return not failed
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("ports", nargs="*", help="serial device, optionally path=name")
+    parser.add_argument("-o", "--log-dir", default=".", help="where the per-console logs go")
+    parser.add_argument("-b", "--baud", type=int, default=115200, help="for hardware UARTs, ignored by USB")
+    parser.add_argument("-s", "--stats", type=float, default=10.0, help="seconds between reports, 0 = only on exit")
+    parser.add_argument("--sync", type=float, default=30.0, help="seconds between clock syncs, 0 = don't sync")
+    sim = parser.add_argument_group("simulation")
+    sim.add_argument("--simulate", type=int, metavar="N", help="run against N pty-backed fake readers")
+    sim.add_argument("--duration", type=float, default=10.0, help="seconds to simulate")
+    sim.add_argument("--rate", type=float, default=500.0, help="codes per second per fake reader")
+    sim.add_argument("--corrupt-every", type=int, default=1000, help="mangle every Nth code, 0 = never")
+    args = parser.parse_args()
+    if not args.ports and not args.simulate:
+        parser.error("no ports given")
+
+    os.makedirs(args.log_dir, exist_ok=True)
+    signal.signal(signal.SIGTERM, signal.default_int_handler)
+    daemon = Daemon(args.log_dir, args.stats, args.sync)
+    ok = True
+    try:
+        if args.simulate:
+            ok = simulate(daemon, args)
+        else:
+            for spec in args.ports:
+                path, _, name = spec.partition("=")
+                daemon.add(path, name or os.path.basename(path), args.baud)
+            daemon.run()
+    except KeyboardInterrupt:
+        daemon.report()
+    finally:
+        daemon.close()
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,324 @@
+"""Host side of the reader's serial RPC protocol (see src/rpc.h).
+
+Only uses the standard library, so it runs anywhere Python 3 does without
+pulling in pyserial.
+"""
+
+import os
+import struct
+import termios
+
+SYNC = 0x1E
+EVENT_SYNC = 0x1F
+
+OP_PING = 0x00
+OP_VERSION = 0x01
+OP_STATUS = 0x02
+OP_COUNTERS = 0x03
+OP_CODE_STATS = 0x04
+OP_TIME = 0x05
+OP_TIME_SET = 0x06
+OP_CONFIG_SCHEMA = 0x10
+OP_CONFIG_GET = 0x11
+OP_CONFIG_SET = 0x12
+OP_CONFIG_SAVE = 0x13
+OP_REPLAY_LOAD = 0x20
+OP_REPLAY_START = 0x21
+OP_REPLAY_STOP = 0x22
+OP_REPLAY_STATUS = 0x23
+
+EVENT_CODE = 0x01
+EVENT_REPEAT = 0x02
+EVENT_SESSION_START = 0x03
+EVENT_SESSION_END = 0x04
+EVENT_CLOCK_SYNC = 0x05
+EVENT_REGISTERS = 0x06
+EVENT_BUS_RECOVERY = 0x07
+
+STATUS_UNKNOWN_OP = 1
+STATUS_NAMES = {
+    0: "ok",
+    1: "unknown op",
+    2: "bad payload",
+    3: "bad field",
+    4: "bad value",
+    5: "failed",
+    6: "bad crc",
+    7: "too large",
+}
+MAX_PAYLOAD = 253
+
+
+def _crc8_table():
+    table = []
+    for i in range(256):
+        crc = i
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+        table.append(crc)
+    return bytes(table)
+
+
+_CRC8_TABLE = _crc8_table()
+
+
+def crc8(data):
+    crc = 0
+    for b in data:
+        crc = _CRC8_TABLE[crc ^ b]
+    return crc
+
+
+def encode_request(req_id, op, payload=b""):
+    body = bytes([2 + len(payload), req_id & 0xFF, op]) + bytes(payload)
+    if len(body) - 1 > 255:
+        raise ValueError("RPC payload too large")
+    return bytes([SYNC]) + body + bytes([crc8(body)])
+
+
+def encode_event(event_type, seq, payload=b""):
+    """Builds a code stream event frame the way the reader sends it."""
+    body = bytes([2 + len(payload), event_type & 0xFF, seq & 0xFF]) + bytes(payload)
+    if len(body) - 1 > 255:
+        raise ValueError("event payload too large")
+    return bytes([EVENT_SYNC]) + body + bytes([crc8(body)])
+
+
+def _find_sync(buf):
+    """Offset of the first SYNC or EVENT_SYNC byte, -1 if there is none."""
+    sync = buf.find(SYNC)
+    event = buf.find(EVENT_SYNC)
+    if sync < 0 or (0 <= event < sync):
+        return event
+    return sync
+
+
+class StreamSplitter:
+    """Separates the reader's output into text, RPC response frames and
+    code stream event frames.
+
+    feed() takes raw bytes as they arrive and returns a list of
+    ("text", bytes), ("frame", (req_id, status, payload)) and
+    ("event", (type, seq, payload)) items. A SYNC byte that doesn't start a
+    valid frame is passed through as text.
+    """
+
+    def __init__(self):
+        self.buf = bytearray()
+
+    def feed(self, data):
+        self.buf += data
+        out = []
+        while self.buf:
+            sync = _find_sync(self.buf)
+            if sync < 0:
+                out.append(("text", bytes(self.buf)))
+                self.buf.clear()
+                break
+            if sync > 0:
+                out.append(("text", bytes(self.buf[:sync])))
+                del self.buf[:sync]
+                continue
+
+            # buf[0] is SYNC or EVENT_SYNC
+            if len(self.buf) < 2:
+                break
+            length = self.buf[1]
+            if len(self.buf) < 3 + length:
+                break
+            body = self.buf[1:2 + length]
+            if length < 2 or crc8(body) != self.buf[2 + length]:
+                out.append(("text", bytes(self.buf[:1])))
+                del self.buf[:1]
+                continue
+            kind = "frame" if self.buf[0] == SYNC else "event"
+            out.append((kind, (body[1], body[2], bytes(body[3:]))))
+            del self.buf[:3 + length]
+        return out
+
+
+def open_port(path, baud=115200):
+    """Opens a serial device (or pty) raw and non-blocking, returns the fd."""
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY | os.O_NONBLOCK)
+    attrs = termios.tcgetattr(fd)
+    attrs[0] = 0                                    # iflag
+    attrs[1] = 0                                    # oflag
+    attrs[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+    attrs[3] = 0                                    # lflag
+    speed = getattr(termios, "B%d" % baud, termios.B115200)
+    attrs[4] = speed
+    attrs[5] = speed
+    attrs[6][termios.VMIN] = 0
+    attrs[6][termios.VTIME] = 0
+    termios.tcsetattr(fd, termios.TCSANOW, attrs)
+    return fd
+
+
+def u16(b, off=0):
+    return b[off] | (b[off + 1] << 8)
+
+
+def u32(b, off=0):
+    return u16(b, off) | (u16(b, off + 2) << 16)
+
+
+CODE_STATS_MAX_SLOTS = 8
+FLAVOR_NAMES = {0x10: "CPU", 0x30: "SP", 0x70: "SMC", 0xF0: "OS"}
+
+
+def parse_code_stats(payload):
+    """-> (capacity, tracked, untracked hits, [entry dict])"""
+    capacity, tracked, untracked = u16(payload, 0), u16(payload, 2), u32(payload, 4)
+    entries = []
+    pos = 8
+    while pos + 29 <= len(payload):
+        entries.append({
+            "flavor": FLAVOR_NAMES.get(payload[pos], "0x%02x" % payload[pos]),
+            "code": int.from_bytes(payload[pos + 1:pos + 9], "little"),
+            "hits": u32(payload, pos + 9),
+            "first_ms": u32(payload, pos + 13),
+            "last_ms": u32(payload, pos + 17),
+            "min_gap_us": u32(payload, pos + 21),
+            "max_gap_us": u32(payload, pos + 25),
+        })
+        pos += 29
+    return capacity, tracked, untracked, entries
+
+
+def parse_schema(payload):
+    """-> {name: (tag, size)}"""
+    fields = {}
+    pos = 0
+    while pos + 3 <= len(payload):
+        tag, size, name_len = payload[pos], payload[pos + 1], payload[pos + 2]
+        name = payload[pos + 3:pos + 3 + name_len].decode("ascii", "replace")
+        fields[name] = (tag, size)
+        pos += 3 + name_len
+    return fields
+
+
+def parse_tlv(payload):
+    """-> {tag: int value}"""
+    values = {}
+    pos = 0
+    while pos + 2 <= len(payload):
+        tag, size = payload[pos], payload[pos + 1]
+        values[tag] = int.from_bytes(payload[pos + 2:pos + 2 + size], "little")
+        pos += 2 + size
+    return values
+
+
+def encode_tlv(entries):
+    """entries: [(tag, size, int value)]"""
+    out = bytearray()
+    for tag, size, value in entries:
+        out += bytes([tag, size]) + int(value).to_bytes(size, "little")
+    return bytes(out)
+
+
+def u64(b, off=0):
+    return u32(b, off) | (u32(b, off + 4) << 32)
+
+
+def parse_event(event_type, payload):
+    """Decodes a code stream event's payload -> dict, None if unknown."""
+    if event_type == EVENT_CODE and len(payload) >= 21:
+        event = {"flavor": payload[0], "code": u64(payload, 1),
+                 "timestamp_us": u64(payload, 9), "session": u32(payload, 17)}
+        if len(payload) >= 33:  # synced to the host
+            event.update(host_us=u64(payload, 21), uncertainty_us=u32(payload, 29))
+        return event
+    if event_type == EVENT_REPEAT and len(payload) >= 22:
+        period = payload[21]
+        cycle = [(payload[22 + 9 * i], u64(payload, 23 + 9 * i)) for i in range(period)
+                 if 31 + 9 * i <= len(payload)]
+        return {"count": u32(payload, 0), "first_us": u64(payload, 4), "last_us": u64(payload, 12),
+                "ongoing": bool(payload[20]), "cycle": cycle}
+    if event_type == EVENT_SESSION_START and len(payload) >= 13:
+        return {"session": u32(payload, 0), "cause": payload[4], "start_us": u64(payload, 5)}
+    if event_type == EVENT_SESSION_END and len(payload) >= 28:
+        last = [(payload[pos], u64(payload, pos + 1)) for pos in range(28, len(payload) - 8, 9)]
+        return {"session": u32(payload, 0), "codes": u32(payload, 4), "dropped": u32(payload, 8),
+                "start_us": u64(payload, 12), "last_us": u64(payload, 20), "last_codes": last}
+    if event_type == EVENT_CLOCK_SYNC and len(payload) >= 28:
+        return dict(zip(CLOCK_SYNC_FIELDS, struct.unpack_from(CLOCK_SYNC_FORMAT, payload)))
+    if event_type == EVENT_REGISTERS and len(payload) >= 8:
+        changes = [(payload[pos], payload[pos + 1], u32(payload, pos + 2)) for pos in range(8, len(payload) - 5, 6)]
+        return {"timestamp_us": u64(payload, 0), "changes": changes}
+    if event_type == EVENT_BUS_RECOVERY and len(payload) >= 21:
+        return {"cause": payload[0], "stalled_us": u32(payload, 1), "restart_us": u32(payload, 5),
+                "codes_lost": u32(payload, 9), "timestamp_us": u64(payload, 13)}
+    return None
+
+
+# RPC_OP_TIME_SET payload and EVENT_CLOCK_SYNC, see src/clocksync.h
+CLOCK_SYNC_FORMAT = "<QQiII"
+CLOCK_SYNC_FIELDS = ("device_us", "host_us", "drift_ppb", "uncertainty_us", "drift_uncertainty_ppb")
+SYNC_WINDOW = 16             # rounds a fit spans
+SYNC_MIN_SPAN_US = 10000000  # rounds closer together than this don't give a drift yet
+SYNC_DEFAULT_DRIFT_PPB = 100000  # crystal tolerance, assumed until there is a drift
+
+
+class ClockFit:
+    """Offset and drift of a reader's clock against the host's, NTP style.
+
+    Every RPC_OP_TIME exchange (host send t1, device receive t2, device
+    reply t3, host receive t4) pins the offset down to within half its
+    round trip. Of each round of exchanges only the quickest counts; a
+    least squares line through the last SYNC_WINDOW rounds gives the drift.
+    Host times are whatever clock the caller measures t1/t4 with.
+    """
+
+    def __init__(self):
+        self.rounds = []  # (device us, host - device us, error us)
+        self.best = None
+        self.current = None  # fit() as of the latest round
+
+    def add(self, t1, t2, t3, t4):
+        if self.rounds and t2 < self.rounds[-1][0]:
+            self.rounds.clear()  # the device restarted
+            self.current = None
+        delay = max((t4 - t1) - (t3 - t2), 0)
+        sample = ((t2 + t3) // 2, ((t1 - t2) + (t4 - t3)) / 2, delay / 2)
+        if self.best is None or sample[2] < self.best[2]:
+            self.best = sample
+
+    def end_round(self):
+        """Keeps the round's quickest exchange. False if it had none."""
+        if self.best is None:
+            return False
+        self.rounds.append(self.best)
+        del self.rounds[:-SYNC_WINDOW]
+        self.best = None
+        self.current = self._fit()
+        return True
+
+    def fit(self):
+        """-> (device us, host us, drift ppb, uncertainty us, drift uncertainty
+        ppb) at the latest round, as for RPC_OP_TIME_SET; None before the
+        first round"""
+        return self.current
+
+    def _fit(self):
+        dev_ref, off_ref, err_ref = self.rounds[-1]
+        dev_first, off_first, err_first = self.rounds[0]
+        span = dev_ref - dev_first
+        if span < SYNC_MIN_SPAN_US:
+            return dev_ref, dev_ref + round(off_ref), 0, int(err_ref + 1), SYNC_DEFAULT_DRIFT_PPB
+
+        xs = [d - dev_ref for d, _, _ in self.rounds]
+        ys = [o for _, o, _ in self.rounds]
+        mx, my = sum(xs) / len(xs), sum(ys) / len(ys)
+        slope = sum((x - mx) * (y - my) for x, y in zip(xs, ys)) / sum((x - mx) ** 2 for x in xs)
+        offset = my - slope * mx
+        # The true offsets at the first and latest round are within their
+        # exchanges' error, which bounds both the line's value and its slope
+        uncertainty = err_ref + abs(offset - off_ref)
+        chord = (off_ref - off_first) / span
+        drift_uncertainty = (err_first + err_ref) / span + abs(slope - chord)
+        return (dev_ref, dev_ref + round(offset), round(slope * 1e9), int(uncertainty + 1),
+                int(drift_uncertainty * 1e9 + 1))
+
+    def to_host(self, device_us):
+        dev_ref, host_ref, drift_ppb, _, _ = self.current
+        return host_ref + (device_us - dev_ref) + (device_us - dev_ref) * drift_ppb // 1000000000
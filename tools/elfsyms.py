@@ -0,0 +1,53 @@
+"""Sections and symbols of a 32-bit little endian ELF, such as the
+firmware.elf PlatformIO builds. Standard library only, so no toolchain
+needs to be on PATH.
+"""
+
+import struct
+
+EM_ARM = 40
+EM_XTENSA = 94
+
+SHT_SYMTAB = 2
+SHT_NOBITS = 8
+SHF_WRITE = 0x1
+SHF_ALLOC = 0x2
+SHF_EXECINSTR = 0x4
+STT_OBJECT = 1
+STT_FUNC = 2
+
+
+class Elf:
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            data = f.read()
+        if data[:4] != b"\x7fELF" or data[4] != 1 or data[5] != 1:
+            raise ValueError("%s: not a 32-bit little endian ELF" % path)
+        self.machine, = struct.unpack_from("<H", data, 0x12)
+        shoff, = struct.unpack_from("<I", data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", data, 0x2E)
+        headers = [struct.unpack_from("<10I", data, shoff + i * shentsize) for i in range(shnum)]
+        names_offset = headers[shstrndx][4]
+
+        # (name, type, flags, address, size)
+        self.sections = [(_string(data, names_offset + h[0]), h[1], h[2], h[3], h[5]) for h in headers]
+
+        # (name, value, size, type, section index)
+        self.symbols = []
+        for _, sh_type, _, _, offset, size, link, _, _, entsize in headers:
+            if sh_type != SHT_SYMTAB:
+                continue
+            strtab_offset = headers[link][4]
+            for pos in range(offset, offset + size, entsize):
+                name, value, sym_size, info, _, shndx = struct.unpack_from("<IIIBBH", data, pos)
+                if shndx == 0 or shndx >= len(headers):
+                    continue
+                self.symbols.append((_string(data, strtab_offset + name), value, sym_size, info & 0xF, shndx))
+
+    def alloc_sections(self):
+        """Indices of the sections the image occupies memory with, code included"""
+        return [i for i, (_, _, flags, _, size) in enumerate(self.sections) if flags & SHF_ALLOC and size]
+
+
+def _string(data, offset):
+    return data[offset:data.index(b"\0", offset)].decode("ascii", "replace")
@@ -0,0 +1,217 @@
+#!/usr/bin/env python3
+"""Static RAM use of a firmware build, per memory region and per subsystem.
+
+    ram_report.py .pio/build/pico/firmware.elf
+    ram_report.py .pio/build/pico/firmware.elf --budget 200000
+    ram_report.py .pio/build/teensy41/firmware.elf --budget RAM1:256000 --budget RAM2:400000
+
+The firmware doesn't allocate at runtime, so everything it needs is in
+the ELF's allocated sections that land in RAM. That is .data and .bss,
+but also code a core runs from RAM: Teensy 4 ITCM, ESP32 IRAM, RP2040
+.time_critical. Each chip's RAM is split into regions that fill up
+independently, and the report gives each its own total:
+
+- rp2:     SRAM
+- esp32:   DRAM and IRAM
+- esp32s3: SRAM (DRAM and IRAM are the same memory there)
+- teensy4: RAM1 (ITCM, rounded up to the 32 KB banks FlexRAM hands out,
+           plus DTCM), RAM2 (OCRAM, DMAMEM) and EXTMEM
+
+Everything is then split by the globals it holds: the capture queues, the
+output sinks, the REPL/RPC parsers and so on. RAM that no firmware global
+accounts for - the framework's and the libraries' own state, stacks the
+linker script reserves, padding - ends up under "framework/other".
+
+A --budget is bytes for one region, NAME:bytes, or plain bytes for the
+chip's first region. The report fails (exit status 1) when a region uses
+more than its budget. The PlatformIO hook in hooks/ram_report.py runs
+this after every build with the env's custom_ram_budget, which takes the
+same form, space separated.
+"""
+
+import argparse
+import collections
+import re
+import sys
+
+import elfsyms
+
+OTHER = "framework/other"
+CODE = "code run from RAM"
+
+# The firmware's globals by subsystem, matched against the symbol name.
+# Statics inside functions and classes are mangled, hence search().
+SUBSYSTEMS = [
+    ("capture", r"^(runtimeState|benchCapture|currentSegData)$"),
+    ("sinks", r"^(sinks|sinkUart\w*)$"),
+    ("repl/rpc", r"^(lineEditor|commandArgs|rpcParser|rpcReceivedUs|clockSync)$"),
+    ("sessions/stats", r"^(coalescer|codeStats|sessionDetector|bootProfiler|bootModel)$"),
+    ("replay", r"^(replayer|replaySettings)$"),
+    ("profiler", r"^(sampler|activeSampler)$"),
+    ("config", r"^cfg$"),
+    ("display", r"^(display|displayInstance)$|u8g2|u8x8"),
+    ("core1 stack", r"platformStartCore1"),
+]
+
+
+# Per chip: region -> [(part, start, end)]. Parts of one region share its
+# memory; the order is the report's, and the first region is the one a
+# plain budget applies to.
+MEMORY_MAPS = {
+    "rp2": [
+        ("SRAM", [("SRAM", 0x20000000, 0x20082000)]),
+    ],
+    "esp32": [
+        ("DRAM", [("DRAM", 0x3FFAE000, 0x40000000)]),
+        ("IRAM", [("IRAM", 0x40070000, 0x400A0000)]),
+        ("RTC", [("RTC fast", 0x3FF80000, 0x3FF82000), ("RTC slow", 0x50000000, 0x50002000)]),
+    ],
+    "esp32s3": [
+        ("SRAM", [("DRAM", 0x3FC88000, 0x3FD00000), ("IRAM", 0x40370000, 0x403E0000)]),
+        ("RTC", [("RTC fast", 0x600FE000, 0x60100000), ("RTC slow", 0x50000000, 0x50002000)]),
+    ],
+    "teensy4": [
+        ("RAM1", [("ITCM", 0x00000000, 0x00080000), ("DTCM", 0x20000000, 0x20080000)]),
+        ("RAM2", [("OCRAM", 0x20200000, 0x20280000)]),
+        ("EXTMEM", [("PSRAM", 0x70000000, 0x71000000)]),
+    ],
+}
+ITCM_BANK = 32768
+
+# The linker scripts' heap sections are whatever RAM is left over, not use
+UNUSED_SECTIONS = re.compile(r"heap", re.IGNORECASE)
+
+
+def subsystem(name):
+    for group, pattern in SUBSYSTEMS:
+        if re.search(pattern, name):
+            return group
+    return OTHER
+
+
+def is_code(flags):
+    # RP2040's .data is executable too: .time_critical code is copied in with it
+    return flags & elfsyms.SHF_EXECINSTR and not flags & elfsyms.SHF_WRITE
+
+
+def chip(elf, sections):
+    if elf.machine == elfsyms.EM_XTENSA:
+        s3 = any(0x3FC88000 <= elf.sections[i][3] < 0x3FD00000 for i in sections)
+        return "esp32s3" if s3 else "esp32"
+    # Teensy 4 links code into ITCM at address 0; RP2040/RP2350 have ROM there
+    if any(elf.sections[i][3] < 0x00080000 and elf.sections[i][1] != elfsyms.SHT_NOBITS for i in sections):
+        return "teensy4"
+    return "rp2"
+
+
+def parse_budgets(specs, regions):
+    """['RAM1:256000', '120000', 'RAM2:1 RAM1:2'] -> {region: bytes}"""
+    budgets = {}
+    for spec in specs or []:
+        for item in str(spec).split():
+            name, _, value = item.rpartition(":")
+            name = name or regions[0]
+            if name not in regions:
+                raise ValueError("no RAM region %s on this chip (%s)" % (name, ", ".join(regions)))
+            budgets[name] = int(value, 0)
+    return budgets
+
+
+def report(path, budgets=None, top=0, out=print):
+    """`budgets`: list of --budget specs"""
+    elf = elfsyms.Elf(path)
+    sections = [i for i in elf.alloc_sections() if not UNUSED_SECTIONS.search(elf.sections[i][0])]
+    board = chip(elf, sections)
+    regions = MEMORY_MAPS[board]
+    budgets = parse_budgets(budgets, [name for name, _ in regions])
+
+    def part_of(addr):
+        for region, parts in regions:
+            for part, start, end in parts:
+                if start <= addr < end:
+                    return region, part
+        return None
+
+    # Section index -> (region, part), for the sections that are in RAM
+    ram = {}
+    for i in sections:
+        where = part_of(elf.sections[i][3])
+        if where:
+            ram[i] = where
+
+    used = collections.Counter()
+    part_sizes = collections.Counter()
+    for i, (region, part) in ram.items():
+        part_sizes[region, part] += elf.sections[i][4]
+    for (region, part), size in part_sizes.items():
+        if board == "teensy4" and part == "ITCM":
+            size = (size + ITCM_BANK - 1) // ITCM_BANK * ITCM_BANK
+        used[region] += size
+
+    out("%s: static RAM, %s memory map" % (path, board))
+    ok = True
+    for region, parts in regions:
+        if not used[region] and region not in budgets:
+            continue
+        line = "  %-8s %8d" % (region, used[region])
+        if region in budgets:
+            budget = budgets[region]
+            if used[region] > budget:
+                line += "  %d over the budget of %d" % (used[region] - budget, budget)
+                ok = False
+            else:
+                line += "  %d left of the budget of %d" % (budget - used[region], budget)
+        out(line)
+        for part, _, _ in parts:
+            if len(parts) > 1 and part_sizes[region, part]:
+                note = ", 32 KB banks" if board == "teensy4" and part == "ITCM" else ""
+                out("    %-22s %8d%s" % (part, part_sizes[region, part], note))
+        for i in sorted(ram, key=lambda i: elf.sections[i][3]):
+            if ram[i][0] != region:
+                continue
+            name, sh_type, flags, addr, size = elf.sections[i]
+            kind = "code" if is_code(flags) else "" if sh_type == elfsyms.SHT_NOBITS else "initialised"
+            out("      %-20s %8d  0x%08x%s" % (name, size, addr, "  (%s)" % kind if kind else ""))
+
+    total = sum(elf.sections[i][4] for i in ram)
+    groups = collections.Counter()
+    symbols = []
+    seen = set()
+    for name, value, size, sym_type, shndx in elf.symbols:
+        if sym_type != elfsyms.STT_OBJECT or shndx not in ram or not size or (value, size) in seen:
+            continue
+        seen.add((value, size))  # aliases
+        group = subsystem(name)
+        if group != OTHER:
+            groups[group] += size
+            symbols.append((size, name, group, ram[shndx][0]))
+    groups[CODE] = sum(elf.sections[i][4] for i in ram if is_code(elf.sections[i][2]))
+    groups[OTHER] = total - sum(groups.values())
+
+    out("")
+    out("  %-24s %8s %6s  (all regions)" % ("subsystem", "bytes", "%"))
+    for group, size in groups.most_common():
+        out("  %-24s %8d %5.1f%%" % (group, size, 100.0 * size / total if total else 0))
+    if top:
+        out("")
+        for size, name, group, region in sorted(symbols, reverse=True)[:top]:
+            out("  %8d  %-6s %-16s %s" % (size, region, group, name))
+    return ok
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("elf", help="firmware.elf of the build")
+    parser.add_argument("--budget", action="append",
+                        help="[REGION:]bytes, fail when the region uses more; repeatable")
+    parser.add_argument("--top", type=int, default=0, help="also list the largest firmware globals")
+    args = parser.parse_args()
+    try:
+        ok = report(args.elf, args.budget, args.top)
+    except ValueError as e:
+        parser.error(str(e))
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,242 @@
+#!/usr/bin/env python3
+"""Configure and query one or more readers over the serial RPC.
+
+All actions for a reader go out in a single write, and every reader is
+handled in parallel, so a whole rack configures in about one round trip.
+
+    readerctl.py -p /dev/ttyACM0 -p /dev/ttyACM1 version status
+    readerctl.py -p /dev/ttyACM0 set xbox_sda_pin=4 xbox_scl_pin=5 save --now
+    readerctl.py -p /dev/ttyACM0 get disp_mirrored counters
+
+Actions: version, status, counters, schema, get [field...],
+         set field=value..., save [--now], stats [count]
+"""
+
+import argparse
+import os
+import selectors
+import sys
+import time
+
+import durango_rpc as rpc
+
+
+class Reader:
+    def __init__(self, path):
+        self.path = path
+        self.fd = rpc.open_port(path)
+        self.splitter = rpc.StreamSplitter()
+        self.pending = {}  # req_id -> (action, decoder)
+        self.next_id = 0
+        self.schema = None
+        self.schema_page = None  # names the last schema page added
+        self.stats_capacity = 0
+        self.stats = []
+        self.stats_count = None  # set when stats were requested
+        self.results = []
+
+    def request(self, op, payload=b"", action=None, decode=None):
+        req_id = self.next_id
+        self.next_id = (self.next_id + 1) & 0xFF
+        self.pending[req_id] = (action, decode)
+        return rpc.encode_request(req_id, op, payload)
+
+    def on_frame(self, req_id, status, payload):
+        action, decode = self.pending.pop(req_id, (None, None))
+        if action is None:
+            return
+        if status != 0:
+            detail = " (tag %d)" % payload[0] if payload else ""
+            self.results.append("%s: error: %s%s" % (action, rpc.STATUS_NAMES.get(status, status), detail))
+        elif decode is not None:
+            text = decode(payload)
+            if text is not None:
+                self.results.append("%s: %s" % (action, text))
+
+
+def roundtrip(readers, batches, timeout):
+    """Sends each reader its batch in one write, waits for every response."""
+    sel = selectors.DefaultSelector()
+    for reader in readers:
+        os.write(reader.fd, batches[reader])
+        sel.register(reader.fd, selectors.EVENT_READ, reader)
+
+    deadline = time.monotonic() + timeout
+    while any(r.pending for r in readers) and time.monotonic() < deadline:
+        for key, _ in sel.select(max(0.0, deadline - time.monotonic())):
+            reader = key.data
+            try:
+                data = os.read(reader.fd, 4096)
+            except BlockingIOError:
+                continue
+            for kind, item in reader.splitter.feed(data):
+                if kind == "frame":
+                    reader.on_frame(*item)
+    sel.close()
+
+    for reader in readers:
+        for action, _ in reader.pending.values():
+            reader.results.append("%s: timed out" % action)
+        reader.pending.clear()
+
+
+def decode_version(p):
+    return "fw %s (built %d), protocol %d, config v%d" % (
+        p[6:].decode("ascii", "replace"), rpc.u32(p, 2), p[0], p[1])
+
+
+def decode_status(p):
+    return "state=%d queue=%d save_pending=%d journal_free=%d uptime_ms=%d bus_idle_ms=%d" % (
+        p[0], rpc.u16(p, 1), p[3], p[4], rpc.u32(p, 5), rpc.u32(p, 9))
+
+
+def decode_counters(p):
+    text = "callbacks=%d dropped=%d worst_receive_us=%d" % (rpc.u32(p, 0), rpc.u32(p, 4), rpc.u32(p, 8))
+    if len(p) >= 16:
+        text += " filtered=%d" % rpc.u32(p, 12)
+    if len(p) >= 32:
+        text += " dropped_cpu=%d dropped_sp=%d dropped_smc=%d dropped_os=%d" % tuple(rpc.u32(p, 16 + 4 * i) for i in range(4))
+    if len(p) >= 36:
+        text += " captured=%d" % rpc.u32(p, 32)
+    return text
+
+
+def format_stats(reader, count):
+    lines = ["stats: %-4s %-18s %10s %10s %10s %12s %12s" % ("", "code", "hits", "first_ms", "last_ms", "min_gap_us", "max_gap_us")]
+    for e in sorted(reader.stats, key=lambda e: -e["hits"])[:count]:
+        lines.append("stats: %-4s 0x%-16x %10d %10d %10d %12s %12s" % (
+            e["flavor"], e["code"], e["hits"], e["first_ms"], e["last_ms"],
+            e["min_gap_us"] if e["hits"] > 1 else "-", e["max_gap_us"] if e["hits"] > 1 else "-"))
+    return lines
+
+
+def config_field(reader, name):
+    """-> (tag, size), or a usage error naming the fields this reader has"""
+    if name not in reader.schema:
+        raise SystemExit("unknown config field: %s\nvalid fields: %s" % (name, " ".join(sorted(reader.schema))))
+    return reader.schema[name]
+
+
+def build_batch(reader, actions):
+    names = {tag: name for name, (tag, _) in reader.schema.items()}
+    out = bytearray()
+    i = 0
+    while i < len(actions):
+        action = actions[i]
+        args = []
+        i += 1
+        while i < len(actions) and ("=" in actions[i] or actions[i] in reader.schema
+                                    or actions[i].startswith("--") or actions[i].isdigit()):
+            args.append(actions[i])
+            i += 1
+
+        if action == "version":
+            out += reader.request(rpc.OP_VERSION, action=action, decode=decode_version)
+        elif action == "status":
+            out += reader.request(rpc.OP_STATUS, action=action, decode=decode_status)
+        elif action == "counters":
+            out += reader.request(rpc.OP_COUNTERS, action=action, decode=decode_counters)
+        elif action == "schema":
+            # Already fetched, page by page, before any action ran
+            reader.results.append("schema: " + " ".join("%s(tag %d, %dB)" % (n, t, s)
+                                                         for n, (t, s) in reader.schema.items()))
+        elif action == "get":
+            # One request per reply-sized group of fields; a reply is tag, size, value each
+            fields = [config_field(reader, name) for name in args] or list(reader.schema.values())
+            groups = [[]]
+            used = 0
+            for tag, size in fields:
+                if used + 2 + size > rpc.MAX_PAYLOAD:
+                    groups.append([])
+                    used = 0
+                groups[-1].append(tag)
+                used += 2 + size
+            for tags in groups:
+                out += reader.request(rpc.OP_CONFIG_GET, bytes(tags), action=action,
+                                      decode=lambda p: " ".join("%s=%d" % (names.get(t, t), v)
+                                                                for t, v in rpc.parse_tlv(p).items()))
+        elif action == "set":
+            entries = []
+            for arg in args:
+                if "=" not in arg:
+                    raise SystemExit("set takes field=value, got: %s" % arg)
+                name, value = arg.split("=", 1)
+                tag, size = config_field(reader, name)
+                entries.append((tag, size, int(value, 0)))
+            out += reader.request(rpc.OP_CONFIG_SET, rpc.encode_tlv(entries), action=action, decode=lambda p: "ok")
+        elif action == "save":
+            flags = 1 if "--now" in args else 0
+            out += reader.request(rpc.OP_CONFIG_SAVE, bytes([flags]), action=action, decode=lambda p: "ok")
+        elif action == "stats":
+            # The whole table, page by page; printed once everything is in
+            def keep_page(p):
+                reader.stats.extend(rpc.parse_code_stats(p)[3])
+                return None
+            for start in range(0, reader.stats_capacity, rpc.CODE_STATS_MAX_SLOTS):
+                payload = bytes([start & 0xFF, start >> 8, rpc.CODE_STATS_MAX_SLOTS])
+                out += reader.request(rpc.OP_CODE_STATS, payload, action=action, decode=keep_page)
+            reader.stats_count = int(args[0]) if args else 20
+        else:
+            raise SystemExit("unknown action: %s" % action)
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("-p", "--port", action="append", required=True, help="serial device, repeatable")
+    parser.add_argument("-t", "--timeout", type=float, default=2.0, help="seconds to wait for responses")
+    parser.add_argument("actions", nargs=argparse.REMAINDER)
+    args = parser.parse_args()
+
+    readers = [Reader(path) for path in args.port]
+
+    # Field names -> tags come from the reader itself, so this works
+    # against any firmware version. The schema is longer than a frame, so it
+    # comes a page at a time until a page is empty.
+    schema_batches = {}
+    for reader in readers:
+        def keep_stats_capacity(p, reader=reader):
+            reader.stats_capacity = rpc.parse_code_stats(p)[0]
+            return "ok"
+        schema_batches[reader] = b""
+        if "stats" in args.actions:
+            schema_batches[reader] += reader.request(rpc.OP_CODE_STATS, bytes([0, 0, 0]), action="stats",
+                                                     decode=keep_stats_capacity)
+    paging = readers
+    while paging:
+        for reader in paging:
+            def keep_schema(p, reader=reader):
+                schema = reader.schema or {}
+                # Firmware that doesn't page sends the first page again
+                reader.schema_page = [name for name in rpc.parse_schema(p) if name not in schema]
+                reader.schema = dict(schema, **rpc.parse_schema(p))
+                return "ok"
+            reader.schema_page = None
+            first = len(reader.schema or {})
+            schema_batches[reader] += reader.request(rpc.OP_CONFIG_SCHEMA, bytes([first]), action="schema",
+                                                     decode=keep_schema)
+        roundtrip(paging, schema_batches, args.timeout)
+        paging = [r for r in paging if r.schema_page]
+        schema_batches = {r: b"" for r in paging}
+
+    ready = [r for r in readers if r.schema is not None]
+    for reader in readers:
+        reader.results.clear()
+    roundtrip(ready, {r: build_batch(r, args.actions) for r in ready}, args.timeout)
+
+    failed = False
+    for reader in readers:
+        if reader.schema is None:
+            print("%s: no response" % reader.path)
+            failed = True
+            continue
+        if reader.stats_count is not None:
+            reader.results += format_stats(reader, reader.stats_count)
+        for line in reader.results:
+            print("%s: %s" % (reader.path, line))
+            failed |= ": error:" in line or line.endswith("timed out")
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
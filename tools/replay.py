@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+"""Replay a capture through a reader, and check what arrives.
+
+The generator reader plays the capture back as MAX6958 writes: onto its
+Xbox bus as I2C master, to load-test the reader wired to it (-r), or in
+loopback through its own decoder. Afterwards sent and received code counts
+are compared.
+
+    replay.py -g /dev/ttyACM0 -r /dev/ttyACM1 --clock 400 --speedup 10 boot.dcap
+    replay.py -g /dev/ttyACM0 --loopback --speedup 0 --passes 100 console07.log
+
+The capture can be a capture file, the reader's text output or a
+capture_daemon.py log; only its first REPLAY_MAX_CODES codes fit on the
+reader. While replaying onto the bus the generator doesn't capture anything
+itself. Ctrl+C stops the replay early.
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+import capfile
+import durango_rpc as rpc
+from readerctl import Reader, roundtrip
+
+REPLAY_MAX_CODES = 1024
+TARGET_BUS = 0
+TARGET_LOOPBACK = 1
+ENTRIES_PER_FRAME = 19  # 13 bytes each, plus the flags byte
+
+
+def request_all(reader, requests, timeout=2.0):
+    """Sends (op, payload) requests in one write -> their response payloads,
+    None for any that failed or timed out"""
+    results = [None] * len(requests)
+    batch = b""
+    for i, (op, payload) in enumerate(requests):
+        def keep(p, i=i):
+            results[i] = bytes(p)
+        batch += reader.request(op, payload, action="op 0x%02x" % op, decode=keep)
+    reader.results.clear()
+    roundtrip([reader], {reader: batch}, timeout)
+    for line in reader.results:
+        print("%s: %s" % (reader.path, line), file=sys.stderr)
+    return results
+
+
+def counters(reader):
+    (result,) = request_all(reader, [(rpc.OP_COUNTERS, b"")])
+    if result is None:
+        sys.exit("%s: no response" % reader.path)
+    p = result
+    return {"callbacks": rpc.u32(p, 0), "dropped": rpc.u32(p, 4), "filtered": rpc.u32(p, 12),
+            "captured": rpc.u32(p, 32) if len(p) >= 36 else None}
+
+
+def status(reader):
+    (result,) = request_all(reader, [(rpc.OP_REPLAY_STATUS, b"")])
+    if result is None:
+        return None
+    p = result
+    return {"running": p[0], "loaded": rpc.u16(p, 1), "passes": rpc.u16(p, 3), "codes": rpc.u32(p, 5),
+            "packets": rpc.u32(p, 9), "nacks": rpc.u32(p, 13), "received": rpc.u32(p, 17),
+            "dropped": rpc.u32(p, 21)}
+
+
+def load(reader, inputs):
+    entries = []
+    prev_t = None
+    for flavor, code, t_us, _, _ in capfile.read_codes(inputs):
+        if len(entries) == REPLAY_MAX_CODES:
+            print("capture truncated to its first %d codes" % REPLAY_MAX_CODES, file=sys.stderr)
+            break
+        gap = 0 if prev_t is None else min(max(t_us - prev_t, 0), 0xFFFFFFFF)
+        entries.append(struct.pack("<BQI", flavor, code, gap))
+        prev_t = t_us
+    if not entries:
+        sys.exit("no codes in the capture")
+
+    requests = []
+    for i in range(0, len(entries), ENTRIES_PER_FRAME):
+        flags = 0x01 if i == 0 else 0x00
+        requests.append((rpc.OP_REPLAY_LOAD, bytes([flags]) + b"".join(entries[i:i + ENTRIES_PER_FRAME])))
+    results = request_all(reader, requests, timeout=5.0)
+    if any(r is None for r in results):
+        sys.exit("%s: loading the capture failed" % reader.path)
+    return rpc.u16(results[-1], 0)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("-g", "--generator", required=True, help="serial device of the reader that replays")
+    parser.add_argument("-r", "--receiver", help="serial device of the reader on the other end of the bus")
+    parser.add_argument("--loopback", action="store_true", help="replay through the generator's own decoder")
+    parser.add_argument("--clock", type=int, default=400, help="bus clock in kHz")
+    parser.add_argument("--gap", type=int, default=0, help="us of idle bus after every packet")
+    parser.add_argument("--burst", type=int, default=1, help="send every code this many times in a row")
+    parser.add_argument("--speedup", type=int, default=1, help="divide the capture's gaps by this, 0 = no gaps")
+    parser.add_argument("--passes", type=int, default=1, help="times through the capture")
+    parser.add_argument("inputs", nargs="+", help="capture file, text output or daemon log")
+    args = parser.parse_args()
+    if args.passes == 0:
+        parser.error("--passes must be at least 1 here; use the 'replay' command for endless runs")
+
+    generator = Reader(args.generator)
+    receiver = Reader(args.receiver) if args.receiver else None
+
+    loaded = load(generator, args.inputs)
+    print("loaded %d codes" % loaded)
+
+    before = counters(receiver) if receiver else None
+    target = TARGET_LOOPBACK if args.loopback else TARGET_BUS
+    start = struct.pack("<BHHHBB", target, args.passes, args.clock, args.gap, args.burst, args.speedup)
+    (result,) = request_all(generator, [(rpc.OP_REPLAY_START, start)])
+    if result is None:
+        sys.exit("%s: replay didn't start (still running, or nothing loaded?)" % generator.path)
+
+    started = time.monotonic()
+    try:
+        while True:
+            time.sleep(0.5)
+            state = status(generator)
+            if state is None:
+                continue
+            print("\r%.1f s: %d codes sent, %d passes" % (time.monotonic() - started, state["codes"], state["passes"]),
+                  end="", flush=True)
+            if not state["running"]:
+                break
+    except KeyboardInterrupt:
+        request_all(generator, [(rpc.OP_REPLAY_STOP, b"")])
+        time.sleep(0.5)
+        state = status(generator)
+    print()
+
+    print("sent:     %d codes in %d packets, %d not acknowledged, %d passes" % (
+        state["codes"], state["packets"], state["nacks"], state["passes"]))
+    ok = state["nacks"] == 0
+    if args.loopback:
+        print("received: %d codes, %d dropped" % (state["received"], state["dropped"]))
+        ok &= state["received"] == state["codes"] and state["dropped"] == 0
+    elif receiver:
+        time.sleep(0.2)  # let the last codes land
+        after = counters(receiver)
+        delta = {k: after[k] - before[k] for k in after if after[k] is not None}
+        print("received: %s codes in %d writes, %d dropped, %d filtered" % (
+            delta.get("captured", "?"), delta["callbacks"], delta["dropped"], delta["filtered"]))
+        ok &= delta.get("captured") == state["codes"] and delta["callbacks"] == state["packets"] \
+            and delta["dropped"] == 0
+    print("ok" if ok else "MISMATCH")
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,174 @@
+#!/usr/bin/env python3
+"""Runs the reader's sampling profiler and symbolises what it finds.
+
+    sampleprof.py -p /dev/ttyACM0 --elf .pio/build/pico/firmware.elf --duration 30
+    sampleprof.py --elf .pio/build/pico/firmware.elf --log console.txt --folded prof.folded
+
+With -p it starts the profiler over RPC, drains the samples as they come
+for --duration seconds and stops it again. With --log it reads the
+"PROF <core> <pc> <lr>" lines of `prof dump` out of a saved console log
+instead.
+
+The output is a flat profile per core (samples per function, where the
+core was interrupted) and, with --folded, stacks in the folded format of
+flamegraph.pl/speedscope: core;caller;function count. The caller comes
+from LR, which is only reliable for leaf functions - once a function has
+called something else, LR points back into itself, and the stack stops at
+the function. Samples with an exception return value in LR were taken in a
+handler's top level and get "[exception]" as the caller.
+
+Symbols are read from the ELF's symbol table directly (elfsyms.py); if a
+c++filt is on PATH (a toolchain's arm-none-eabi-c++filt, or the host's),
+names are demangled with it.
+"""
+
+import argparse
+import bisect
+import collections
+import re
+import shutil
+import struct
+import subprocess
+import sys
+import time
+
+import durango_rpc as rpc
+import elfsyms
+from readerctl import Reader, roundtrip
+
+OP_PROF = 0x07
+PROF_DRAIN, PROF_START, PROF_STOP = 0, 1, 2
+PROF_MAX_SAMPLES = 27  # per response, see RPC_PROF_MAX_SAMPLES
+DRAINS_PER_POLL = 8    # requests per write
+POLL_INTERVAL = 0.05
+
+PROF_LINE = re.compile(rb"PROF (\d+) ([0-9a-f]{8}) ([0-9a-f]{8})")
+
+
+class Symbols:
+    """Function symbols of the firmware, by address"""
+
+    def __init__(self, path):
+        funcs = {}
+        for name, value, size, sym_type, _ in elfsyms.Elf(path).symbols:
+            if sym_type == elfsyms.STT_FUNC and value:
+                funcs[value & ~1] = (size, name)  # without the Thumb bit
+
+        self.starts = sorted(funcs)
+        self.sizes = [funcs[a][0] for a in self.starts]
+        self.names = demangle([funcs[a][1] for a in self.starts])
+
+    def lookup(self, addr):
+        i = bisect.bisect_right(self.starts, addr) - 1
+        if i < 0 or (self.sizes[i] and addr >= self.starts[i] + self.sizes[i]):
+            return "0x%08x" % addr
+        return self.names[i]
+
+
+def demangle(names):
+    tool = shutil.which("arm-none-eabi-c++filt") or shutil.which("c++filt")
+    if tool is None:
+        return names
+    out = subprocess.run([tool], input="\n".join(names), capture_output=True, text=True).stdout.splitlines()
+    return out if len(out) == len(names) else names
+
+
+def drain(reader, action=PROF_DRAIN, payload=b"", count=DRAINS_PER_POLL):
+    """-> ([(core, pc, lr)], rate, dropped) from `count` requests in one write"""
+    samples, state = [], {}
+
+    def keep(p):
+        state["rate"], state["dropped"] = rpc.u16(p, 0), rpc.u32(p, 2)
+        for pos in range(6, len(p) - 8, 9):
+            samples.append((p[pos], rpc.u32(p, pos + 1), rpc.u32(p, pos + 5)))
+    batch = reader.request(OP_PROF, bytes([action]) + payload, action="prof", decode=keep)
+    for _ in range(count - 1):
+        batch += reader.request(OP_PROF, b"", action="prof", decode=keep)
+    reader.results.clear()
+    roundtrip([reader], {reader: batch}, 2.0)
+    for line in reader.results:
+        print("%s: %s" % (reader.path, line), file=sys.stderr)
+    return samples, state.get("rate"), state.get("dropped", 0)
+
+
+def collect_live(args):
+    reader = Reader(args.port)
+    samples, rate, _ = drain(reader, PROF_START, struct.pack("<H", args.rate), count=1)
+    if not rate:
+        sys.exit("%s: the profiler didn't start" % args.port)
+    end = time.monotonic() + args.duration
+    dropped = 0
+    try:
+        while time.monotonic() < end:
+            got, _, dropped = drain(reader)
+            samples += got
+            if len(got) < DRAINS_PER_POLL * PROF_MAX_SAMPLES:
+                time.sleep(POLL_INTERVAL)  # caught up
+    except KeyboardInterrupt:
+        pass
+    got, _, dropped = drain(reader, PROF_STOP)
+    samples += got
+    while got:
+        got, _, dropped = drain(reader)
+        samples += got
+    return samples, dropped
+
+
+def collect_log(path):
+    samples = []
+    with open(path, "rb") as f:
+        for line in f:
+            m = PROF_LINE.search(line)
+            if m:
+                samples.append((int(m.group(1)), int(m.group(2), 16), int(m.group(3), 16)))
+    return samples
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--elf", required=True, help="firmware.elf of the build running on the reader")
+    source = parser.add_mutually_exclusive_group(required=True)
+    source.add_argument("-p", "--port", help="serial device of the reader to profile")
+    source.add_argument("--log", help="console log with the output of 'prof dump'")
+    parser.add_argument("--rate", type=int, default=1000, help="samples per second and core")
+    parser.add_argument("--duration", type=float, default=10.0, help="seconds to profile for")
+    parser.add_argument("--top", type=int, default=25, help="functions per core in the flat profile")
+    parser.add_argument("--folded", help="also write folded stacks to this file")
+    args = parser.parse_args()
+
+    symbols = Symbols(args.elf)
+    if args.port:
+        samples, dropped = collect_live(args)
+    else:
+        samples, dropped = collect_log(args.log), 0
+    if not samples:
+        sys.exit("no samples")
+
+    flat = collections.defaultdict(collections.Counter)
+    folded = collections.Counter()
+    for core, pc, lr in samples:
+        func = symbols.lookup(pc)
+        flat[core][func] += 1
+        if lr >= 0xFFFFFF00:
+            caller = "[exception]"
+        else:
+            caller = symbols.lookup((lr & ~1) - 2)  # the call instruction, not the one after it
+        stack = ["core%d" % core] + ([caller] if caller != func else []) + [func]
+        folded[";".join(stack)] += 1
+
+    print("%d samples%s" % (len(samples), ", %d dropped on the reader" % dropped if dropped else ""))
+    for core in sorted(flat):
+        total = sum(flat[core].values())
+        print("\ncore%d: %d samples" % (core, total))
+        print("%8s %6s  %s" % ("samples", "%", "function"))
+        for func, n in flat[core].most_common(args.top):
+            print("%8d %5.1f%%  %s" % (n, 100.0 * n / total, func))
+
+    if args.folded:
+        with open(args.folded, "w") as f:
+            for stack, n in sorted(folded.items()):
+                f.write("%s %d\n" % (stack, n))
+
+
+if __name__ == "__main__":
+    main()